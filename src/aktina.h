@@ -0,0 +1,30 @@
+/*
+ * aktina.h - Public interface of the Aktina library
+ *
+ * Copyright (c) 2023, Dimitrios Alexopoulos All rights reserved.
+ */
+
+#ifndef AKTINA_H
+#define AKTINA_H
+
+#include "bvh.h"
+#include "canvas.h"
+#include "grid.h"
+#include "mesh.h"
+#include "rays.h"
+#include "scene.h"
+#include "tasks.h"
+#include "vectors.h"
+
+// Info: Must match the project version in "meson.build", which the public interface tests check, the shared library's
+// soname follows the major version
+#define AKTINA_VERSION_MAJOR 0
+#define AKTINA_VERSION_MINOR 1
+#define AKTINA_VERSION_PATCH 0
+#define AKTINA_VERSION "0.1.0"
+
+// Encodes a version as one comparable number, e.g. `AKTINA_VERSION_NUMBER >= AKTINA_VERSION_ENCODE(0, 2, 0)`
+#define AKTINA_VERSION_ENCODE(major, minor, patch) ((major) * 10000 + (minor) * 100 + (patch))
+#define AKTINA_VERSION_NUMBER AKTINA_VERSION_ENCODE(AKTINA_VERSION_MAJOR, AKTINA_VERSION_MINOR, AKTINA_VERSION_PATCH)
+
+#endif
@@ -0,0 +1,1491 @@
+/*
+ * bvh.c - Bounding volume hierarchy
+ *
+ * Copyright (c) 2023, Dimitrios Alexopoulos All rights reserved.
+ */
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <tgmath.h>
+#include <time.h>
+
+#include "bvh.h"
+#include "packed.h"
+#include "tasks.h"
+#include "vectors.h"
+
+#define BVH_TASK_SIZE 8192                    // fewest primitives of a subtree built as a task of its own
+#define BVH_MEDIAN_DEPTH (BVH_STACK_SIZE / 2) // deeper nodes are split at the median, so traversal stacks cannot overflow
+#define BVH_MORTON_BITS 21                    // per axis of the Morton codes of linear hierarchies
+#define BVH_RADIX_BITS 8                      // of the digits sorted by each pass of the radix sort
+#define BVH_RADIX_SIZE (1 << BVH_RADIX_BITS)
+#define BVH_WIDE_STACK_SIZE (3 * BVH_STACK_SIZE + 1) // every node visited pushes at most `BVH_WIDTH - 1` more entries
+
+_Static_assert(BVH_WIDTH == PACKED_WIDTH, "wide nodes are tested with one packed operation per plane");
+
+typedef struct
+{
+    BvhNode *nodes; // of the subtree being built, its root first
+    size_t nodeCount;
+    size_t *primitives;
+    const Bounds *bounds;
+    const Vec3 *centroids;
+    const uint64_t *codes; // Morton codes of the primitives in sorted order, for linear hierarchies
+    BvhBuildOptions options;
+} BvhBuilder;
+
+// Bounds of some primitives and of their centroids
+typedef struct
+{
+    Bounds bounds;
+    Bounds centroids;
+} BvhExtent;
+
+// Bounds and number of the primitives whose centroids fall in a bin
+typedef struct
+{
+    Bounds bounds;
+    size_t count;
+} BvhBin;
+
+// Node at the top of a hierarchy built in parallel, either split in two or the root of a subtree built as a task
+typedef struct
+{
+    size_t left;
+    size_t right;
+    size_t subtree; // SIZE_MAX if the node is split
+} BvhTopNode;
+
+// Subtree over the primitives [start, end) built as a task into its own nodes
+typedef struct
+{
+    size_t start;
+    size_t end;
+    size_t depth;
+    BvhExtent extent;
+    BvhNode *nodes; // right children are relative to the subtree's root
+    size_t nodeCount;
+} BvhSubtree;
+
+typedef struct
+{
+    BvhBuilder *builder;
+    size_t taskSize;
+    BvhNode *scratch; // two nodes per primitive, every subtree builds into the slice of its primitives
+    BvhTopNode *topNodes;
+    size_t topCount;
+    size_t topCapacity;
+    BvhSubtree *subtrees;
+    size_t subtreeCount;
+    size_t subtreeCapacity;
+} BvhParallelBuild;
+
+// Parallel least significant digit radix sort of the primitives by their Morton codes, the tasks taking one chunk
+// of the primitives each
+typedef struct
+{
+    uint64_t *codes[2]; // the primitives' codes, then the sorted ones
+    size_t *primitives[2];
+    size_t count;
+    size_t chunkCount;
+    size_t shift;                      // of the digit sorted by the current pass
+    size_t (*offsets)[BVH_RADIX_SIZE]; // per chunk, the number of each digit, then where they are stored
+    const Vec3 *centroids;
+    Bounds centroidBounds;
+} BvhMortonSort;
+
+typedef struct
+{
+    size_t node;
+    Scalar tEntry;
+} BvhStackEntry;
+
+// Child of a wide node, either a node or a leaf
+typedef struct
+{
+    uint32_t start;
+    uint32_t count; // zero for nodes
+    Scalar tEntry;
+} BvhWideStackEntry;
+
+typedef struct
+{
+    size_t node;
+    unsigned active;
+    Scalar tEntry[BVH_PACKET_SIZE];
+} BvhPacketStackEntry;
+
+// Returns bounds containing nothing, the identity of `boundsUnion`
+Bounds boundsEmpty(void)
+{
+    return (Bounds){{{INFINITY, INFINITY, INFINITY}}, {{-INFINITY, -INFINITY, -INFINITY}}};
+}
+
+// Returns the bounds enclosing both bounds
+Bounds boundsUnion(const Bounds a, const Bounds b)
+{
+    Bounds result;
+    for (size_t i = 0; i < 3; i++)
+    {
+        result.min.elem[i] = fmin(a.min.elem[i], b.min.elem[i]);
+        result.max.elem[i] = fmax(a.max.elem[i], b.max.elem[i]);
+    }
+    return result;
+}
+
+// Returns the bounds enclosing both the bounds and the point
+Bounds boundsExtend(const Bounds a, const Vec3 point)
+{
+    return boundsUnion(a, (Bounds){point, point});
+}
+
+// Returns the center of the bounds
+Vec3 boundsCentroid(const Bounds a)
+{
+    return vec3Mul(vec3Add(a.min, a.max), 0.5);
+}
+
+// Checks if the bounds are finite (and not empty)
+bool boundsFinite(const Bounds a)
+{
+    for (size_t i = 0; i < 3; i++)
+    {
+        if (!isfinite(a.min.elem[i]) || !isfinite(a.max.elem[i]) || a.min.elem[i] > a.max.elem[i])
+        {
+            return false;
+        }
+    }
+    return true;
+}
+
+// Checks if the ray hits the bounds between `tMin` and `tMax` (slab test), storing the entry distance.
+// `inverse` holds the reciprocal of the ray direction.
+// Info: Axes the ray is parallel to and starts on the boundary of produce NaN, which `fmin`/`fmax` ignore
+bool boundsHit(const Bounds a, const Vec4 origin, const Vec4 inverse, Scalar tMin, Scalar tMax, Scalar *tEntry)
+{
+    for (size_t i = 0; i < 3; i++)
+    {
+        Scalar t0 = (a.min.elem[i] - origin.elem[i]) * inverse.elem[i];
+        Scalar t1 = (a.max.elem[i] - origin.elem[i]) * inverse.elem[i];
+        if (t0 > t1)
+        {
+            const Scalar swap = t0;
+            t0 = t1;
+            t1 = swap;
+        }
+        tMin = fmax(t0, tMin);
+        tMax = fmin(t1, tMax);
+    }
+    *tEntry = tMin;
+    return tMin <= tMax;
+}
+
+// Partially sorts the primitives so that the one with the `nth` centroid along the axis is in place,
+// with smaller ones before it and larger ones after it
+static void bvhSelect(BvhBuilder *builder, size_t start, size_t end, const size_t nth, const size_t axis)
+{
+    size_t *primitives = builder->primitives;
+    while (end - start > 1)
+    {
+        const Scalar pivot = builder->centroids[primitives[start + (end - start) / 2]].elem[axis];
+        size_t i = start;
+        size_t j = end - 1;
+        while (i <= j)
+        {
+            while (builder->centroids[primitives[i]].elem[axis] < pivot)
+            {
+                i++;
+            }
+            while (builder->centroids[primitives[j]].elem[axis] > pivot)
+            {
+                j--;
+            }
+            if (i <= j)
+            {
+                const size_t swap = primitives[i];
+                primitives[i] = primitives[j];
+                primitives[j] = swap;
+                i++;
+                if (j == 0)
+                {
+                    break;
+                }
+                j--;
+            }
+        }
+        if (nth <= j)
+        {
+            end = j + 1;
+        }
+        else if (nth >= i)
+        {
+            start = i;
+        }
+        else
+        {
+            return;
+        }
+    }
+}
+
+// Returns half the surface area of non-empty bounds, proportional to the chance of a random ray hitting them
+static Scalar boundsHalfArea(const Bounds a)
+{
+    const Vec3 extent = vec3Sub(a.max, a.min);
+    return extent.x * extent.y + extent.y * extent.z + extent.z * extent.x;
+}
+
+// Returns the bounds of the primitives [start, end) and of their centroids
+static BvhExtent bvhExtent(const BvhBuilder *builder, const size_t start, const size_t end)
+{
+    BvhExtent extent = {boundsEmpty(), boundsEmpty()};
+    for (size_t i = start; i < end; i++)
+    {
+        extent.bounds = boundsUnion(extent.bounds, builder->bounds[builder->primitives[i]]);
+        extent.centroids = boundsExtend(extent.centroids, builder->centroids[builder->primitives[i]]);
+    }
+    return extent;
+}
+
+// Returns the bin of a centroid along the axis, the bins dividing the centroid bounds starting at `min` evenly
+static inline size_t bvhBinIndex(const Vec3 centroid, const size_t axis, const Scalar min, const Scalar scale, const size_t binCount)
+{
+    const size_t bin = (size_t)((centroid.elem[axis] - min) * scale);
+    return bin < binCount ? bin : binCount - 1;
+}
+
+// Splits the primitives [start, end) between the bins of their centroids where the surface area heuristic cost is
+// the lowest, unless keeping them in a leaf is cheaper. Returns the first primitive of the right child, or `end`
+// for a leaf.
+// Important: The centroids must not all be at the same place
+static size_t bvhSahSplit(const BvhBuilder *builder, const size_t start, const size_t end, const BvhExtent extent, BvhExtent children[2])
+{
+    // Small nodes have fewer bins, most of them would be empty
+    const size_t binLimit = end - start < BVH_MAX_BINS ? end - start : BVH_MAX_BINS;
+    const size_t binCount = builder->options.binCount < 2 ? 2
+                            : builder->options.binCount > binLimit ? binLimit
+                                                                   : builder->options.binCount;
+    BvhBin bins[3][BVH_MAX_BINS];
+    Scalar scale[3];
+    for (size_t axis = 0; axis < 3; axis++)
+    {
+        const Scalar length = extent.centroids.max.elem[axis] - extent.centroids.min.elem[axis];
+        scale[axis] = length > 0 ? binCount / length : 0;
+        for (size_t bin = 0; bin < binCount; bin++)
+        {
+            bins[axis][bin] = (BvhBin){boundsEmpty(), 0};
+        }
+    }
+    for (size_t i = start; i < end; i++)
+    {
+        const size_t primitive = builder->primitives[i];
+        for (size_t axis = 0; axis < 3; axis++)
+        {
+            BvhBin *bin = &bins[axis][bvhBinIndex(builder->centroids[primitive], axis, extent.centroids.min.elem[axis], scale[axis], binCount)];
+            bin->bounds = boundsUnion(bin->bounds, builder->bounds[primitive]);
+            bin->count++;
+        }
+    }
+    // Sweeps the bins from the right to get the bounds and count of every right side, then from the left to
+    // evaluate every split
+    Scalar best = INFINITY;
+    size_t splitAxis = 0;
+    size_t splitBin = 0;
+    for (size_t axis = 0; axis < 3; axis++)
+    {
+        if (scale[axis] == 0)
+        {
+            continue;
+        }
+        Bounds right[BVH_MAX_BINS];
+        size_t rightCount[BVH_MAX_BINS];
+        Bounds side = boundsEmpty();
+        size_t count = 0;
+        for (size_t bin = binCount - 1; bin > 0; bin--)
+        {
+            side = right[bin] = boundsUnion(side, bins[axis][bin].bounds);
+            count = rightCount[bin] = count + bins[axis][bin].count;
+        }
+        side = boundsEmpty();
+        count = 0;
+        for (size_t bin = 1; bin < binCount; bin++)
+        {
+            side = boundsUnion(side, bins[axis][bin - 1].bounds);
+            count += bins[axis][bin - 1].count;
+            if (count == 0 || rightCount[bin] == 0)
+            {
+                continue;
+            }
+            const Scalar cost = boundsHalfArea(side) * (Scalar)count + boundsHalfArea(right[bin]) * (Scalar)rightCount[bin];
+            if (cost < best)
+            {
+                best = cost;
+                splitAxis = axis;
+                splitBin = bin;
+                children[0].bounds = side;
+                children[1].bounds = right[bin];
+            }
+        }
+    }
+    // Relative to the cost of testing a primitive, the primitives in a leaf cost their count
+    const Scalar area = boundsHalfArea(extent.bounds);
+    const size_t count = end - start;
+    if (count <= builder->options.leafSize && (area <= 0 || BVH_TRAVERSAL_COST + best / area >= (Scalar)count))
+    {
+        return end;
+    }
+    const Scalar min = extent.centroids.min.elem[splitAxis];
+    size_t *primitives = builder->primitives;
+    children[0].centroids = boundsEmpty();
+    children[1].centroids = boundsEmpty();
+    size_t mid = start;
+    for (size_t i = start; i < end; i++)
+    {
+        const Vec3 centroid = builder->centroids[primitives[i]];
+        const bool left = bvhBinIndex(centroid, splitAxis, min, scale[splitAxis], binCount) < splitBin;
+        children[!left].centroids = boundsExtend(children[!left].centroids, centroid);
+        if (left)
+        {
+            const size_t swap = primitives[i];
+            primitives[i] = primitives[mid];
+            primitives[mid++] = swap;
+        }
+    }
+    return mid;
+}
+
+// Partitions the primitives [start, end) between the children of their node, storing the extents of the children.
+// Returns the first primitive of the right child, or `end` if the primitives are kept together in a leaf.
+static size_t bvhSplit(BvhBuilder *builder, const size_t start, const size_t end, const size_t depth, const BvhExtent extent, BvhExtent children[2])
+{
+    const size_t count = end - start;
+    const Vec3 length = vec3Sub(extent.centroids.max, extent.centroids.min);
+    size_t axis = 0;
+    if (length.y > length.elem[axis])
+    {
+        axis = 1;
+    }
+    if (length.z > length.elem[axis])
+    {
+        axis = 2;
+    }
+    if (builder->options.method == BVH_SAH && depth < BVH_MEDIAN_DEPTH && count > 1 && length.elem[axis] > 0)
+    {
+        return bvhSahSplit(builder, start, end, extent, children);
+    }
+    if (count <= builder->options.leafSize || count <= 1)
+    {
+        return end;
+    }
+    const size_t mid = start + count / 2;
+    bvhSelect(builder, start, end, mid, axis);
+    children[0] = bvhExtent(builder, start, mid);
+    children[1] = bvhExtent(builder, mid, end);
+    return mid;
+}
+
+// Builds the subtree for primitives [start, end) at the given node, at `depth` in the whole hierarchy
+static void bvhBuildNode(BvhBuilder *builder, const size_t node, const size_t start, const size_t end, const size_t depth,
+                         const BvhExtent extent)
+{
+    builder->nodes[node].bounds = extent.bounds;
+    BvhExtent children[2];
+    const size_t mid = bvhSplit(builder, start, end, depth, extent, children);
+    if (mid == end)
+    {
+        builder->nodes[node].start = start;
+        builder->nodes[node].count = end - start;
+        return;
+    }
+    const size_t left = builder->nodeCount++;
+    bvhBuildNode(builder, left, start, mid, depth + 1, children[0]);
+    const size_t right = builder->nodeCount++;
+    bvhBuildNode(builder, right, mid, end, depth + 1, children[1]);
+    builder->nodes[node].start = right;
+    builder->nodes[node].count = 0;
+}
+
+// Returns the first primitive of the right child of the primitives [start, end), sorted by their Morton codes, where
+// their codes first differ, or `end` if the primitives are kept together in a leaf
+static size_t bvhMortonSplit(const BvhBuilder *builder, const size_t start, const size_t end, const size_t depth)
+{
+    const size_t count = end - start;
+    if (count <= builder->options.leafSize || count <= 1)
+    {
+        return end;
+    }
+    const uint64_t difference = builder->codes[start] ^ builder->codes[end - 1];
+    if (difference == 0 || depth >= BVH_MEDIAN_DEPTH)
+    {
+        return start + count / 2;
+    }
+    uint64_t bit = UINT64_C(1) << (3 * BVH_MORTON_BITS - 1);
+    while ((difference & bit) == 0)
+    {
+        bit >>= 1;
+    }
+    // The codes share the bits above the highest differing one, so the ones with it set come last
+    size_t low = start + 1;
+    size_t high = end - 1;
+    while (low < high)
+    {
+        const size_t mid = low + (high - low) / 2;
+        if (builder->codes[mid] & bit)
+        {
+            high = mid;
+        }
+        else
+        {
+            low = mid + 1;
+        }
+    }
+    return low;
+}
+
+// Builds the linear subtree for primitives [start, end), sorted by their Morton codes, at the given node, at `depth`
+// in the whole hierarchy. The bounds are gathered from the leaves up.
+static void bvhBuildLinearNode(BvhBuilder *builder, const size_t node, const size_t start, const size_t end, const size_t depth)
+{
+    const size_t mid = bvhMortonSplit(builder, start, end, depth);
+    if (mid == end)
+    {
+        Bounds bounds = boundsEmpty();
+        for (size_t i = start; i < end; i++)
+        {
+            bounds = boundsUnion(bounds, builder->bounds[builder->primitives[i]]);
+        }
+        builder->nodes[node] = (BvhNode){bounds, start, end - start};
+        return;
+    }
+    const size_t left = builder->nodeCount++;
+    bvhBuildLinearNode(builder, left, start, mid, depth + 1);
+    const size_t right = builder->nodeCount++;
+    bvhBuildLinearNode(builder, right, mid, end, depth + 1);
+    builder->nodes[node] = (BvhNode){boundsUnion(builder->nodes[left].bounds, builder->nodes[right].bounds), right, 0};
+}
+
+// Spreads the low `BVH_MORTON_BITS` bits of the coordinate two bits apart, to be interleaved with the others
+static uint64_t bvhSpreadBits(uint64_t x)
+{
+    x &= (UINT64_C(1) << BVH_MORTON_BITS) - 1;
+    x = (x | x << 32) & UINT64_C(0x1f00000000ffff);
+    x = (x | x << 16) & UINT64_C(0x1f0000ff0000ff);
+    x = (x | x << 8) & UINT64_C(0x100f00f00f00f00f);
+    x = (x | x << 4) & UINT64_C(0x10c30c30c30c30c3);
+    x = (x | x << 2) & UINT64_C(0x1249249249249249);
+    return x;
+}
+
+// Returns the range of primitives of a chunk of the sort
+static inline void bvhChunk(const BvhMortonSort *sort, const size_t chunk, size_t *start, size_t *end)
+{
+    *start = sort->count * chunk / sort->chunkCount;
+    *end = sort->count * (chunk + 1) / sort->chunkCount;
+}
+
+// Computes the Morton codes of a chunk, quantizing the centroids within their bounds
+static void bvhMortonCodes(void *context, const size_t chunk, const size_t worker)
+{
+    (void)worker;
+    BvhMortonSort *sort = context;
+    const Scalar cells = (Scalar)((UINT64_C(1) << BVH_MORTON_BITS) - 1);
+    const Vec3 extent = vec3Sub(sort->centroidBounds.max, sort->centroidBounds.min);
+    const Vec3 scale = color(extent.x > 0 ? cells / extent.x : 0, extent.y > 0 ? cells / extent.y : 0, extent.z > 0 ? cells / extent.z : 0);
+    size_t start;
+    size_t end;
+    bvhChunk(sort, chunk, &start, &end);
+    for (size_t i = start; i < end; i++)
+    {
+        const Vec3 cell = vec3Prod(vec3Sub(sort->centroids[sort->primitives[0][i]], sort->centroidBounds.min), scale);
+        uint64_t code = 0;
+        for (size_t axis = 0; axis < 3; axis++)
+        {
+            const uint64_t quantized = (uint64_t)cell.elem[axis];
+            code |= bvhSpreadBits(quantized < (uint64_t)cells ? quantized : (uint64_t)cells) << (2 - axis);
+        }
+        sort->codes[0][i] = code;
+    }
+}
+
+// Counts the digits of a chunk for the current pass
+static void bvhRadixCount(void *context, const size_t chunk, const size_t worker)
+{
+    (void)worker;
+    BvhMortonSort *sort = context;
+    size_t *counts = sort->offsets[chunk];
+    for (size_t digit = 0; digit < BVH_RADIX_SIZE; digit++)
+    {
+        counts[digit] = 0;
+    }
+    size_t start;
+    size_t end;
+    bvhChunk(sort, chunk, &start, &end);
+    for (size_t i = start; i < end; i++)
+    {
+        counts[sort->codes[0][i] >> sort->shift & (BVH_RADIX_SIZE - 1)]++;
+    }
+}
+
+// Moves the codes and primitives of a chunk to where their digits are stored, keeping their order
+static void bvhRadixScatter(void *context, const size_t chunk, const size_t worker)
+{
+    (void)worker;
+    BvhMortonSort *sort = context;
+    size_t *offsets = sort->offsets[chunk];
+    size_t start;
+    size_t end;
+    bvhChunk(sort, chunk, &start, &end);
+    for (size_t i = start; i < end; i++)
+    {
+        const size_t target = offsets[sort->codes[0][i] >> sort->shift & (BVH_RADIX_SIZE - 1)]++;
+        sort->codes[1][target] = sort->codes[0][i];
+        sort->primitives[1][target] = sort->primitives[0][i];
+    }
+}
+
+// Sorts the primitives of the hierarchy along the Morton curve through the centroid bounds, returning their codes.
+// Passes over digits that all the codes share are skipped.
+// If the allocation fails, `abort()` is called
+static uint64_t *bvhMortonSort(Bvh *dest, const Vec3 *centroids, const Bounds centroidBounds, const size_t chunkCount,
+                               const size_t threadCount)
+{
+    const size_t count = dest->primitiveCount;
+    BvhMortonSort sort = {{malloc(sizeof(uint64_t[count])), malloc(sizeof(uint64_t[count]))},
+                          {dest->primitives, malloc(sizeof(size_t[count]))},
+                          count,
+                          chunkCount,
+                          0,
+                          malloc(sizeof(size_t[chunkCount][BVH_RADIX_SIZE])),
+                          centroids,
+                          centroidBounds};
+    if (sort.codes[0] == NULL || sort.codes[1] == NULL || sort.primitives[1] == NULL || sort.offsets == NULL)
+    {
+        abort();
+    }
+    tasksRun(chunkCount, threadCount, bvhMortonCodes, &sort);
+    for (sort.shift = 0; sort.shift < 3 * BVH_MORTON_BITS; sort.shift += BVH_RADIX_BITS)
+    {
+        tasksRun(chunkCount, threadCount, bvhRadixCount, &sort);
+        const size_t first = sort.codes[0][0] >> sort.shift & (BVH_RADIX_SIZE - 1);
+        size_t shared = 0;
+        for (size_t chunk = 0; chunk < chunkCount; chunk++)
+        {
+            shared += sort.offsets[chunk][first];
+        }
+        if (shared == count)
+        {
+            continue;
+        }
+        size_t offset = 0;
+        for (size_t digit = 0; digit < BVH_RADIX_SIZE; digit++)
+        {
+            for (size_t chunk = 0; chunk < chunkCount; chunk++)
+            {
+                const size_t digitCount = sort.offsets[chunk][digit];
+                sort.offsets[chunk][digit] = offset;
+                offset += digitCount;
+            }
+        }
+        tasksRun(chunkCount, threadCount, bvhRadixScatter, &sort);
+        uint64_t *codes = sort.codes[0];
+        sort.codes[0] = sort.codes[1];
+        sort.codes[1] = codes;
+        size_t *primitives = sort.primitives[0];
+        sort.primitives[0] = sort.primitives[1];
+        sort.primitives[1] = primitives;
+    }
+    dest->primitives = sort.primitives[0];
+    free(sort.primitives[1]);
+    free(sort.codes[1]);
+    free(sort.offsets);
+    return sort.codes[0];
+}
+
+// Grows an array to fit one more element, doubling its capacity.
+// If the allocation fails, `abort()` is called
+static void *bvhGrow(void *array, const size_t count, size_t *capacity, const size_t size)
+{
+    if (count < *capacity)
+    {
+        return array;
+    }
+    *capacity = *capacity == 0 ? 16 : *capacity * 2;
+    array = realloc(array, *capacity * size);
+    if (array == NULL)
+    {
+        abort();
+    }
+    return array;
+}
+
+// Splits the top of the hierarchy over the primitives [start, end) as `bvhBuildNode` does, down to subtrees of at
+// most `taskSize` primitives left to be built as tasks. Returns the index of the top node.
+// If the allocation fails, `abort()` is called
+static size_t bvhSplitTop(BvhParallelBuild *build, const size_t start, const size_t end, const size_t depth, const BvhExtent extent)
+{
+    const size_t index = build->topCount;
+    build->topNodes = bvhGrow(build->topNodes, build->topCount++, &build->topCapacity, sizeof(BvhTopNode));
+    BvhExtent children[2] = {0};
+    size_t mid = end;
+    if (end - start > build->taskSize)
+    {
+        mid = build->builder->options.method == BVH_LBVH ? bvhMortonSplit(build->builder, start, end, depth)
+                                                         : bvhSplit(build->builder, start, end, depth, extent, children);
+    }
+    if (mid == end)
+    {
+        build->subtrees = bvhGrow(build->subtrees, build->subtreeCount, &build->subtreeCapacity, sizeof(BvhSubtree));
+        build->subtrees[build->subtreeCount] = (BvhSubtree){start, end, depth, extent, build->scratch + 2 * start, 0};
+        build->topNodes[index].subtree = build->subtreeCount++;
+        return index;
+    }
+    const size_t left = bvhSplitTop(build, start, mid, depth + 1, children[0]);
+    const size_t right = bvhSplitTop(build, mid, end, depth + 1, children[1]);
+    build->topNodes[index] = (BvhTopNode){left, right, SIZE_MAX};
+    return index;
+}
+
+// Builds one subtree of a parallel build
+static void bvhBuildSubtree(void *context, const size_t task, const size_t worker)
+{
+    (void)worker;
+    BvhParallelBuild *build = context;
+    BvhSubtree *subtree = &build->subtrees[task];
+    BvhBuilder builder = *build->builder;
+    builder.nodes = subtree->nodes;
+    builder.nodeCount = 1;
+    if (builder.options.method == BVH_LBVH)
+    {
+        bvhBuildLinearNode(&builder, 0, subtree->start, subtree->end, subtree->depth);
+    }
+    else
+    {
+        bvhBuildNode(&builder, 0, subtree->start, subtree->end, subtree->depth, subtree->extent);
+    }
+    subtree->nodeCount = builder.nodeCount;
+}
+
+// Stores the top node and the nodes below it at `*count` in depth-first order, as `bvhBuildNode` lays them out,
+// advancing `*count` past them
+static void bvhEmit(const BvhParallelBuild *build, const size_t index, BvhNode *nodes, size_t *count)
+{
+    const size_t node = *count;
+    const BvhTopNode top = build->topNodes[index];
+    if (top.subtree != SIZE_MAX)
+    {
+        const BvhSubtree *subtree = &build->subtrees[top.subtree];
+        for (size_t i = 0; i < subtree->nodeCount; i++)
+        {
+            nodes[node + i] = subtree->nodes[i];
+            if (nodes[node + i].count == 0)
+            {
+                nodes[node + i].start += node;
+            }
+        }
+        *count += subtree->nodeCount;
+        return;
+    }
+    (*count)++;
+    bvhEmit(build, top.left, nodes, count);
+    const size_t right = *count;
+    bvhEmit(build, top.right, nodes, count);
+    nodes[node] = (BvhNode){boundsUnion(nodes[node + 1].bounds, nodes[right].bounds), right, 0};
+}
+
+// Returns the surface area heuristic cost of the tree: the cost of visiting its nodes and testing the primitives of
+// its leaves, each weighted by the chance of a ray hitting the root hitting them
+static Scalar bvhCost(const Bvh *bvh)
+{
+    if (bvh->nodeCount == 0)
+    {
+        return 0;
+    }
+    Scalar cost = 0;
+    const Scalar rootArea = boundsHalfArea(bvh->nodes[0].bounds);
+    for (size_t i = 0; i < bvh->nodeCount; i++)
+    {
+        const BvhNode node = bvh->nodes[i];
+        const Scalar probability = rootArea > 0 ? boundsHalfArea(node.bounds) / rootArea : 1;
+        cost += (node.count == 0 ? BVH_TRAVERSAL_COST : (Scalar)node.count) * probability;
+    }
+    return cost;
+}
+
+// Returns the float nearest to the scalar which is not larger than it
+static float bvhFloatDown(const Scalar a)
+{
+    const float result = (float)a;
+    return (Scalar)result > a ? nextafterf(result, -INFINITY) : result;
+}
+
+// Returns the float nearest to the scalar which is not smaller than it
+static float bvhFloatUp(const Scalar a)
+{
+    const float result = (float)a;
+    return (Scalar)result < a ? nextafterf(result, INFINITY) : result;
+}
+
+// Returns 2^exponent, for exponents from -126 to 127
+static inline float bvhExp2(const int exponent)
+{
+    const uint32_t bits = (uint32_t)(exponent + 127) << 23;
+    float result;
+    memcpy(&result, &bits, sizeof(result));
+    return result;
+}
+
+// Returns the position of plane `q` of a quantized node along an axis, as traversal decodes it
+static inline float bvhDequantize(const float origin, const unsigned q, const int exponent)
+{
+    return origin + (float)q * bvhExp2(exponent);
+}
+
+// Decodes the quantized node into a wide node, with the bounds traversal tests
+static void bvhDecode(const BvhQuantizedNode *node, BvhWideNode *dest)
+{
+    for (size_t i = 0; i < BVH_WIDTH; i++)
+    {
+        for (size_t axis = 0; axis < 3; axis++)
+        {
+            dest->min[axis][i] = i < node->childCount ? bvhDequantize(node->origin[axis], node->min[axis][i], node->exponent[axis]) : INFINITY;
+            dest->max[axis][i] = i < node->childCount ? bvhDequantize(node->origin[axis], node->max[axis][i], node->exponent[axis]) : -INFINITY;
+        }
+        dest->start[i] = node->start[i];
+        dest->count[i] = node->count[i];
+    }
+}
+
+// Gathers the descendants of the binary node becoming the children of a wide node, repeatedly opening the inner
+// child with the largest surface area, which rays are the most likely to hit. Returns the number of children.
+// Info: A leaf becomes the only child of its wide node, for trees with a leaf as their root
+static size_t bvhGatherChildren(const Bvh *bvh, const size_t node, size_t children[BVH_WIDTH])
+{
+    if (bvh->nodes[node].count != 0)
+    {
+        children[0] = node;
+        return 1;
+    }
+    children[0] = node + 1;
+    children[1] = bvh->nodes[node].start;
+    size_t count = 2;
+    while (count < BVH_WIDTH)
+    {
+        size_t largest = count;
+        Scalar largestArea = -INFINITY;
+        for (size_t i = 0; i < count; i++)
+        {
+            const BvhNode child = bvh->nodes[children[i]];
+            if (child.count == 0 && boundsHalfArea(child.bounds) > largestArea)
+            {
+                largest = i;
+                largestArea = boundsHalfArea(child.bounds);
+            }
+        }
+        if (largest == count)
+        {
+            break;
+        }
+        const size_t open = children[largest];
+        children[largest] = open + 1;
+        children[count++] = bvh->nodes[open].start;
+    }
+    return count;
+}
+
+// Returns the number of wide nodes the binary node collapses into
+static size_t bvhCountWide(const Bvh *bvh, const size_t node)
+{
+    size_t children[BVH_WIDTH];
+    const size_t childCount = bvhGatherChildren(bvh, node, children);
+    size_t count = 1;
+    for (size_t i = 0; i < childCount; i++)
+    {
+        if (bvh->nodes[children[i]].count == 0)
+        {
+            count += bvhCountWide(bvh, children[i]);
+        }
+    }
+    return count;
+}
+
+// Stores the child bounds in a wide node, rounded outwards to floats
+static void bvhStoreWide(BvhWideNode *dest, const Bounds bounds[BVH_WIDTH], const size_t childCount)
+{
+    for (size_t axis = 0; axis < 3; axis++)
+    {
+        for (size_t i = 0; i < BVH_WIDTH; i++)
+        {
+            dest->min[axis][i] = i < childCount ? bvhFloatDown(bounds[i].min.elem[axis]) : INFINITY;
+            dest->max[axis][i] = i < childCount ? bvhFloatUp(bounds[i].max.elem[axis]) : -INFINITY;
+        }
+    }
+}
+
+// Stores the child bounds in a quantized node, on the finest grid over their union whose planes fit in 8 bits.
+// Planes are moved outwards until their decoded positions enclose the bounds.
+// Important: The union of the bounds must be finite as floats
+static void bvhStoreQuantized(BvhQuantizedNode *dest, const Bounds bounds[BVH_WIDTH], const size_t childCount)
+{
+    Bounds all = boundsEmpty();
+    for (size_t i = 0; i < childCount; i++)
+    {
+        all = boundsUnion(all, bounds[i]);
+    }
+    dest->childCount = (uint8_t)childCount;
+    for (size_t axis = 0; axis < 3; axis++)
+    {
+        const float origin = bvhFloatDown(all.min.elem[axis]);
+        int exponent;
+        frexp((all.max.elem[axis] - origin) / UINT8_MAX, &exponent);
+        exponent = exponent < -126 ? -126 : exponent > 127 ? 127 : exponent;
+        while (exponent < 127 && bvhDequantize(origin, UINT8_MAX, exponent) < all.max.elem[axis])
+        {
+            exponent++;
+        }
+        dest->origin[axis] = origin;
+        dest->exponent[axis] = (int8_t)exponent;
+        const Scalar scale = bvhExp2(exponent);
+        for (size_t i = 0; i < BVH_WIDTH; i++)
+        {
+            if (i >= childCount)
+            {
+                dest->min[axis][i] = dest->max[axis][i] = 0;
+                continue;
+            }
+            Scalar q = floor((bounds[i].min.elem[axis] - origin) / scale);
+            unsigned min = q < 0 ? 0 : q > UINT8_MAX ? UINT8_MAX : (unsigned)q;
+            while (min > 0 && bvhDequantize(origin, min, exponent) > bounds[i].min.elem[axis])
+            {
+                min--;
+            }
+            q = ceil((bounds[i].max.elem[axis] - origin) / scale);
+            unsigned max = q < 0 ? 0 : q > UINT8_MAX ? UINT8_MAX : (unsigned)q;
+            while (max < UINT8_MAX && bvhDequantize(origin, max, exponent) < bounds[i].max.elem[axis])
+            {
+                max++;
+            }
+            dest->min[axis][i] = (uint8_t)min;
+            dest->max[axis][i] = (uint8_t)max;
+        }
+    }
+}
+
+// Collapses the binary node into a wide node and its descendants, depth-first, returning its index
+static uint32_t bvhCollapseNode(Bvh *bvh, const size_t node)
+{
+    const uint32_t index = (uint32_t)bvh->wideNodeCount++;
+    size_t children[BVH_WIDTH];
+    const size_t childCount = bvhGatherChildren(bvh, node, children);
+    Bounds bounds[BVH_WIDTH];
+    uint32_t start[BVH_WIDTH] = {0};
+    uint32_t count[BVH_WIDTH] = {0};
+    for (size_t i = 0; i < childCount; i++)
+    {
+        const BvhNode child = bvh->nodes[children[i]];
+        bounds[i] = child.bounds;
+        start[i] = child.count != 0 ? (uint32_t)child.start : bvhCollapseNode(bvh, children[i]);
+        count[i] = (uint32_t)child.count;
+    }
+    if (bvh->layout == BVH_WIDE)
+    {
+        BvhWideNode *dest = &bvh->wideNodes[index];
+        bvhStoreWide(dest, bounds, childCount);
+        memcpy(dest->start, start, sizeof(start));
+        memcpy(dest->count, count, sizeof(count));
+    }
+    else
+    {
+        BvhQuantizedNode *dest = &bvh->quantizedNodes[index];
+        bvhStoreQuantized(dest, bounds, childCount);
+        for (size_t i = 0; i < BVH_WIDTH; i++)
+        {
+            dest->start[i] = start[i];
+            dest->count[i] = (uint8_t)count[i];
+        }
+    }
+    return index;
+}
+
+// Collapses the binary tree into the wide layout of the hierarchy, replacing the previous one.
+// Trees too large for the 32-bit indices stay binary, quantized trees with leaves too large for 8-bit counts or
+// bounds beyond the range of floats fall back to wide nodes.
+// If the allocation fails, `abort()` is called
+static void bvhCollapse(Bvh *bvh)
+{
+    free(bvh->wideNodes);
+    free(bvh->quantizedNodes);
+    bvh->wideNodes = NULL;
+    bvh->quantizedNodes = NULL;
+    bvh->wideNodeCount = 0;
+    if (bvh->nodeCount == 0 || bvh->primitiveCount > UINT32_MAX)
+    {
+        bvh->layout = BVH_BINARY;
+    }
+    if (bvh->layout == BVH_QUANTIZED)
+    {
+        for (size_t i = 0; i < 3; i++)
+        {
+            const Bounds root = bvh->nodes[0].bounds;
+            if (!isfinite(bvhFloatDown(root.min.elem[i])) || !isfinite(bvhFloatUp(root.max.elem[i])))
+            {
+                bvh->layout = BVH_WIDE;
+            }
+        }
+        for (size_t i = 0; i < bvh->nodeCount; i++)
+        {
+            if (bvh->nodes[i].count > UINT8_MAX)
+            {
+                bvh->layout = BVH_WIDE;
+            }
+        }
+    }
+    if (bvh->layout == BVH_BINARY)
+    {
+        return;
+    }
+    // Counted first, so the nodes take no more memory than they need
+    const size_t count = bvhCountWide(bvh, 0);
+    if (bvh->layout == BVH_WIDE)
+    {
+        bvh->wideNodes = aligned_alloc(BVH_NODE_ALIGN, sizeof(BvhWideNode[count]));
+    }
+    else
+    {
+        bvh->quantizedNodes = aligned_alloc(BVH_NODE_ALIGN, sizeof(BvhQuantizedNode[count]));
+    }
+    if (bvh->wideNodes == NULL && bvh->quantizedNodes == NULL)
+    {
+        abort();
+    }
+    bvhCollapseNode(bvh, 0);
+}
+
+// Returns the wide node, decoding quantized ones into `decoded`
+static inline const BvhWideNode *bvhWideNode(const Bvh *bvh, const size_t index, BvhWideNode *decoded)
+{
+    if (bvh->layout == BVH_WIDE)
+    {
+        return &bvh->wideNodes[index];
+    }
+    bvhDecode(&bvh->quantizedNodes[index], decoded);
+    return decoded;
+}
+
+// Updates the child bounds of the wide nodes bottom-up to the new bounds of the leaves, keeping their structure.
+// `leafBounds` holds the bounds of every leaf at the index of its first primitive.
+static void bvhRefitWide(Bvh *bvh, const Bounds *leafBounds)
+{
+    // Nodes come after their parent, so one pass in reverse sees every node before its parent
+    for (size_t i = bvh->wideNodeCount; i-- > 0;)
+    {
+        BvhWideNode decoded;
+        const BvhWideNode *node = bvhWideNode(bvh, i, &decoded);
+        Bounds children[BVH_WIDTH];
+        size_t childCount = 0;
+        // Children fill the first slots, empty slots have empty bounds
+        for (; childCount < BVH_WIDTH && node->min[0][childCount] <= node->max[0][childCount]; childCount++)
+        {
+            const size_t start = node->start[childCount];
+            Bounds *child = &children[childCount];
+            if (node->count[childCount] != 0)
+            {
+                *child = leafBounds[start];
+                continue;
+            }
+            BvhWideNode grandchildDecoded;
+            const BvhWideNode *grandchild = bvhWideNode(bvh, start, &grandchildDecoded);
+            *child = boundsEmpty();
+            for (size_t axis = 0; axis < 3; axis++)
+            {
+                for (size_t j = 0; j < BVH_WIDTH; j++)
+                {
+                    // Bounds are never NaN, so plain comparisons are enough
+                    child->min.elem[axis] = grandchild->min[axis][j] < child->min.elem[axis] ? grandchild->min[axis][j] : child->min.elem[axis];
+                    child->max.elem[axis] = grandchild->max[axis][j] > child->max.elem[axis] ? grandchild->max[axis][j] : child->max.elem[axis];
+                }
+            }
+        }
+        if (bvh->layout == BVH_WIDE)
+        {
+            bvhStoreWide(&bvh->wideNodes[i], children, childCount);
+        }
+        else
+        {
+            bvhStoreQuantized(&bvh->quantizedNodes[i], children, childCount);
+        }
+    }
+}
+
+// Builds a hierarchy over the primitive bounds with the default options (see `bvhBuildWith`).
+// If the allocation fails, `abort()` is called
+void bvhBuild(Bvh *dest, const Bounds *bounds, const size_t count)
+{
+    bvhBuildWith(dest, bounds, count, BVH_BUILD_DEFAULT, NULL);
+}
+
+// Builds a hierarchy over the primitive bounds, storing its build time and quality in `stats` unless it is NULL.
+// Primitives with infinite (or empty) bounds are kept out of the tree and always tested.
+// Large hierarchies are split at the top, then their subtrees are built in parallel; the tree does not depend on
+// the number of threads. Linear hierarchies first sort the primitives by their Morton codes in parallel.
+// Wide and quantized layouts collapse the binary tree, which is kept for refitting and packet traversal.
+// If the allocation fails, `abort()` is called
+void bvhBuildWith(Bvh *dest, const Bounds *bounds, const size_t count, const BvhBuildOptions options, BvhStats *stats)
+{
+    struct timespec startTime;
+    timespec_get(&startTime, TIME_UTC);
+    *dest = (Bvh){0};
+    if (count != 0)
+    {
+        dest->primitives = malloc(sizeof(size_t[count]));
+        dest->unbounded = malloc(sizeof(size_t[count]));
+        Vec3 *centroids = malloc(sizeof(Vec3[count]));
+        if (dest->primitives == NULL || dest->unbounded == NULL || centroids == NULL)
+        {
+            abort();
+        }
+        for (size_t i = 0; i < count; i++)
+        {
+            if (boundsFinite(bounds[i]))
+            {
+                centroids[i] = boundsCentroid(bounds[i]);
+                dest->primitives[dest->primitiveCount++] = i;
+            }
+            else
+            {
+                dest->unbounded[dest->unboundedCount++] = i;
+            }
+        }
+        if (dest->primitiveCount != 0)
+        {
+            dest->nodes = malloc(sizeof(BvhNode[2 * dest->primitiveCount - 1]));
+            if (dest->nodes == NULL)
+            {
+                abort();
+            }
+            BvhBuilder builder = {dest->nodes, 1, dest->primitives, bounds, centroids, NULL, options};
+            const BvhExtent extent = bvhExtent(&builder, 0, dest->primitiveCount);
+            const size_t workerCount = tasksThreadCount(options.threadCount);
+            const bool parallel = workerCount > 1 && dest->primitiveCount >= 2 * BVH_TASK_SIZE;
+            uint64_t *codes = NULL;
+            if (options.method == BVH_LBVH)
+            {
+                codes = bvhMortonSort(dest, centroids, extent.centroids, parallel ? workerCount : 1, options.threadCount);
+                builder.primitives = dest->primitives;
+                builder.codes = codes;
+            }
+            if (!parallel)
+            {
+                if (options.method == BVH_LBVH)
+                {
+                    bvhBuildLinearNode(&builder, 0, 0, dest->primitiveCount, 0);
+                }
+                else
+                {
+                    bvhBuildNode(&builder, 0, 0, dest->primitiveCount, 0, extent);
+                }
+                dest->nodeCount = builder.nodeCount;
+            }
+            else
+            {
+                // Several subtrees per worker, so the workers finishing early can steal the remaining ones
+                const size_t taskSize = dest->primitiveCount / (4 * workerCount);
+                BvhParallelBuild build = {.builder = &builder,
+                                          .taskSize = taskSize > BVH_TASK_SIZE ? taskSize : BVH_TASK_SIZE,
+                                          .scratch = malloc(sizeof(BvhNode[2 * dest->primitiveCount]))};
+                if (build.scratch == NULL)
+                {
+                    abort();
+                }
+                bvhSplitTop(&build, 0, dest->primitiveCount, 0, extent);
+                tasksRun(build.subtreeCount, options.threadCount, bvhBuildSubtree, &build);
+                bvhEmit(&build, 0, dest->nodes, &dest->nodeCount);
+                free(build.scratch);
+                free(build.topNodes);
+                free(build.subtrees);
+            }
+            free(codes);
+        }
+        free(centroids);
+    }
+    dest->sahCost = bvhCost(dest);
+    dest->layout = options.layout;
+    bvhCollapse(dest);
+    if (stats != NULL)
+    {
+        struct timespec endTime;
+        timespec_get(&endTime, TIME_UTC);
+        *stats = bvhStats(dest);
+        stats->buildTime = (double)(endTime.tv_sec - startTime.tv_sec) + (double)(endTime.tv_nsec - startTime.tv_nsec) / 1e9;
+    }
+}
+
+// Collapses the binary tree of a built hierarchy into another layout, which may fall back as when building it.
+// If the allocation fails, `abort()` is called
+// Info: Only the wide or quantized nodes are allocated, so it can be used on a binary tree stored elsewhere
+void bvhSetLayout(Bvh *bvh, const BvhLayout layout)
+{
+    bvh->layout = layout;
+    bvhCollapse(bvh);
+}
+
+// Hierarchy destructor
+void bvhDestroy(Bvh *dest)
+{
+    free(dest->nodes);
+    free(dest->primitives);
+    free(dest->unbounded);
+    free(dest->wideNodes);
+    free(dest->quantizedNodes);
+    *dest = (Bvh){0};
+}
+
+// Returns the quality of the hierarchy: its surface area heuristic cost, depth and leaf sizes.
+// If the allocation fails, `abort()` is called
+BvhStats bvhStats(const Bvh *bvh)
+{
+    BvhStats stats = {0};
+    if (bvh->nodeCount == 0)
+    {
+        return stats;
+    }
+    // Children come after their parent, so one pass in order sees the depth of a parent before its children
+    size_t *depths = malloc(sizeof(size_t[bvh->nodeCount]));
+    if (depths == NULL)
+    {
+        abort();
+    }
+    depths[0] = 0;
+    stats.sahCost = bvhCost(bvh);
+    stats.minLeafSize = SIZE_MAX;
+    for (size_t i = 0; i < bvh->nodeCount; i++)
+    {
+        const BvhNode node = bvh->nodes[i];
+        if (node.count == 0)
+        {
+            depths[i + 1] = depths[node.start] = depths[i] + 1;
+            continue;
+        }
+        stats.depth = depths[i] > stats.depth ? depths[i] : stats.depth;
+        stats.leafCount++;
+        stats.minLeafSize = node.count < stats.minLeafSize ? node.count : stats.minLeafSize;
+        stats.maxLeafSize = node.count > stats.maxLeafSize ? node.count : stats.maxLeafSize;
+    }
+    stats.averageLeafSize = (Scalar)bvh->primitiveCount / (Scalar)stats.leafCount;
+    stats.nodeSize = bvh->layout == BVH_WIDE        ? sizeof(BvhWideNode[bvh->wideNodeCount])
+                     : bvh->layout == BVH_QUANTIZED ? sizeof(BvhQuantizedNode[bvh->wideNodeCount])
+                                                    : sizeof(BvhNode[bvh->nodeCount]);
+    free(depths);
+    return stats;
+}
+
+// Updates the bounds of the nodes bottom-up to the new bounds of the primitives, keeping the tree as it is.
+// Takes time linear in the size of the tree, but the tree gets costlier to trace as the primitives move from where
+// they were when it was built. Returns the surface area heuristic cost of the refitted tree, to compare against
+// `bvh->sahCost` when deciding to rebuild it. Wide layouts are refitted the same way.
+// Important: Primitives must stay bounded (or unbounded) as when the tree was built, the tree must not be mapped
+// from a scene cache
+// If the allocation fails, `abort()` is called
+Scalar bvhRefit(Bvh *bvh, const Bounds *bounds)
+{
+    // The leaves of wide layouts are those of the binary tree, so they reuse its bounds
+    Bounds *leafBounds = NULL;
+    if (bvh->layout != BVH_BINARY)
+    {
+        leafBounds = calloc(bvh->primitiveCount, sizeof(Bounds));
+        if (leafBounds == NULL)
+        {
+            abort();
+        }
+    }
+    // Children come after their parent, so one pass in reverse sees both children before their parent
+    for (size_t i = bvh->nodeCount; i-- > 0;)
+    {
+        BvhNode *node = &bvh->nodes[i];
+        if (node->count == 0)
+        {
+            node->bounds = boundsUnion(bvh->nodes[i + 1].bounds, bvh->nodes[node->start].bounds);
+            continue;
+        }
+        node->bounds = boundsEmpty();
+        for (size_t j = node->start; j < node->start + node->count; j++)
+        {
+            node->bounds = boundsUnion(node->bounds, bounds[bvh->primitives[j]]);
+        }
+        if (leafBounds != NULL)
+        {
+            leafBounds[node->start] = node->bounds;
+        }
+    }
+    if (leafBounds != NULL)
+    {
+        bvhRefitWide(bvh, leafBounds);
+        free(leafBounds);
+    }
+    return bvhCost(bvh);
+}
+
+// Direction signs, origin and reciprocal direction of a ray, packed per axis for testing the children of wide nodes
+typedef struct
+{
+    bool negative[3];
+    Packed4 origin[3];
+    Packed4 inverse[3];
+} BvhWideRay;
+
+// Tests the ray against the child bounds of a wide node at once (slab test), storing their entry distances.
+// Returns a mask of the children hit between `tMin` and `tMax`, bit `i` for child `i`.
+// Info: As with `boundsHit`, NaN from axes the ray is parallel to and starts on the boundary of is ignored
+static inline unsigned bvhHitChildren(const BvhWideNode *node, const BvhWideRay *ray, const Scalar tMin, const Scalar tMax,
+                                      Scalar tEntry[BVH_WIDTH])
+{
+    Packed4 tNear = packedSet(tMin);
+    Packed4 tFar = packedSet(tMax);
+    for (size_t i = 0; i < 3; i++)
+    {
+        const Packed4 near = packedLoadFloat(ray->negative[i] ? node->max[i] : node->min[i]);
+        const Packed4 far = packedLoadFloat(ray->negative[i] ? node->min[i] : node->max[i]);
+        tNear = packedMax(packedMul(packedSub(near, ray->origin[i]), ray->inverse[i]), tNear);
+        tFar = packedMin(packedMul(packedSub(far, ray->origin[i]), ray->inverse[i]), tFar);
+    }
+    packedStore(tEntry, tNear);
+    return packedLessEqual(tNear, tFar);
+}
+
+// Traverses the wide layout of the hierarchy (see `bvhTraverse`), pushing the children hit from the farthest to
+// the nearest so the nearest one is visited next
+static bool bvhTraverseWide(const Bvh *bvh, const Vec4 origin, const Vec4 direction, const Scalar tMin, Scalar tMax,
+                            const BvhLeafFunction leaf, void *context)
+{
+    BvhWideRay ray;
+    for (size_t i = 0; i < 3; i++)
+    {
+        const Scalar inverse = 1 / direction.elem[i];
+        ray.negative[i] = signbit(inverse);
+        ray.origin[i] = packedSet(origin.elem[i]);
+        ray.inverse[i] = packedSet(inverse);
+    }
+    BvhWideStackEntry stack[BVH_WIDE_STACK_SIZE];
+    stack[0] = (BvhWideStackEntry){0, 0, tMin};
+    size_t stackSize = 1;
+    while (stackSize != 0)
+    {
+        const BvhWideStackEntry entry = stack[--stackSize];
+        if (entry.tEntry > tMax)
+        {
+            continue; // `tMax` shrunk since the node was pushed
+        }
+        if (entry.count != 0)
+        {
+            for (size_t i = entry.start; i < (size_t)entry.start + entry.count; i++)
+            {
+                if (leaf(context, bvh->primitives[i], &tMax))
+                {
+                    return true;
+                }
+            }
+            continue;
+        }
+        BvhWideNode decoded;
+        const BvhWideNode *node = bvhWideNode(bvh, entry.start, &decoded);
+        Scalar tEntry[BVH_WIDTH];
+        const unsigned hits = bvhHitChildren(node, &ray, tMin, tMax, tEntry);
+        // Insertion sort of the children hit by decreasing entry distance
+        BvhWideStackEntry children[BVH_WIDTH];
+        size_t childCount = 0;
+        for (size_t i = 0; i < BVH_WIDTH; i++)
+        {
+            if (!(hits & 1u << i))
+            {
+                continue;
+            }
+            size_t j = childCount++;
+            for (; j > 0 && children[j - 1].tEntry < tEntry[i]; j--)
+            {
+                children[j] = children[j - 1];
+            }
+            children[j] = (BvhWideStackEntry){node->start[i], node->count[i], tEntry[i]};
+        }
+        for (size_t i = 0; i < childCount; i++)
+        {
+            stack[stackSize++] = children[i];
+        }
+    }
+    return false;
+}
+
+// Calls `leaf` for every primitive whose bounds the ray hits between `tMin` and `tMax`, visiting nearer nodes first.
+// Returns true if `leaf` stopped the traversal.
+bool bvhTraverse(const Bvh *bvh, const Vec4 origin, const Vec4 direction, const Scalar tMin, Scalar tMax, const BvhLeafFunction leaf, void *context)
+{
+    for (size_t i = 0; i < bvh->unboundedCount; i++)
+    {
+        if (leaf(context, bvh->unbounded[i], &tMax))
+        {
+            return true;
+        }
+    }
+    if (bvh->nodeCount == 0)
+    {
+        return false;
+    }
+    if (bvh->layout != BVH_BINARY)
+    {
+        return bvhTraverseWide(bvh, origin, direction, tMin, tMax, leaf, context);
+    }
+    const Vec4 inverse = vector(1 / direction.x, 1 / direction.y, 1 / direction.z);
+    BvhStackEntry stack[BVH_STACK_SIZE];
+    size_t stackSize = 0;
+    Scalar tEntry;
+    if (!boundsHit(bvh->nodes[0].bounds, origin, inverse, tMin, tMax, &tEntry))
+    {
+        return false;
+    }
+    stack[stackSize++] = (BvhStackEntry){0, tEntry};
+    while (stackSize != 0)
+    {
+        const BvhStackEntry entry = stack[--stackSize];
+        if (entry.tEntry > tMax)
+        {
+            continue; // `tMax` shrunk since the node was pushed
+        }
+        const BvhNode *node = &bvh->nodes[entry.node];
+        if (node->count != 0)
+        {
+            for (size_t i = node->start; i < node->start + node->count; i++)
+            {
+                if (leaf(context, bvh->primitives[i], &tMax))
+                {
+                    return true;
+                }
+            }
+            continue;
+        }
+        Scalar tLeft;
+        Scalar tRight;
+        const bool hitLeft = boundsHit(bvh->nodes[entry.node + 1].bounds, origin, inverse, tMin, tMax, &tLeft);
+        const bool hitRight = boundsHit(bvh->nodes[node->start].bounds, origin, inverse, tMin, tMax, &tRight);
+        if (hitLeft && hitRight)
+        {
+            // Push the far child first so the near one is visited next
+            if (tLeft <= tRight)
+            {
+                stack[stackSize++] = (BvhStackEntry){node->start, tRight};
+                stack[stackSize++] = (BvhStackEntry){entry.node + 1, tLeft};
+            }
+            else
+            {
+                stack[stackSize++] = (BvhStackEntry){entry.node + 1, tLeft};
+                stack[stackSize++] = (BvhStackEntry){node->start, tRight};
+            }
+        }
+        else if (hitLeft)
+        {
+            stack[stackSize++] = (BvhStackEntry){entry.node + 1, tLeft};
+        }
+        else if (hitRight)
+        {
+            stack[stackSize++] = (BvhStackEntry){node->start, tRight};
+        }
+    }
+    return false;
+}
+
+// Tests the bounds against the active rays of a packet, storing their entry distances.
+// Returns a mask of the rays that hit the bounds.
+static unsigned boundsHitPacket(const Bounds a, const Vec4 origin[BVH_PACKET_SIZE], const Vec4 inverse[BVH_PACKET_SIZE], const unsigned active,
+                                const Scalar tMin, const Scalar tMax[BVH_PACKET_SIZE], Scalar tEntry[BVH_PACKET_SIZE])
+{
+    unsigned hits = 0;
+    for (size_t i = 0; i < BVH_PACKET_SIZE; i++)
+    {
+        if ((active & 1u << i) && boundsHit(a, origin[i], inverse[i], tMin, tMax[i], &tEntry[i]))
+        {
+            hits |= 1u << i;
+        }
+    }
+    return hits;
+}
+
+// Returns the smallest entry distance of the rays in the mask
+static Scalar packetEntry(const Scalar tEntry[BVH_PACKET_SIZE], const unsigned active)
+{
+    Scalar nearest = INFINITY;
+    for (size_t i = 0; i < BVH_PACKET_SIZE; i++)
+    {
+        if (active & 1u << i)
+        {
+            nearest = fmin(nearest, tEntry[i]);
+        }
+    }
+    return nearest;
+}
+
+// Calls `leaf` for every primitive whose bounds one of the `active` rays of the packet hits between `tMin` and its `tMax`.
+// Nodes are visited once for the whole packet, nearer ones first, with the rays that missed them masked out.
+// Info: Pays off for coherent rays, such as the primary rays of neighbouring pixels
+void bvhTraversePacket(const Bvh *bvh, const Vec4 origin[BVH_PACKET_SIZE], const Vec4 direction[BVH_PACKET_SIZE], const unsigned active,
+                       const Scalar tMin, Scalar tMax[BVH_PACKET_SIZE], const BvhPacketLeafFunction leaf, void *context)
+{
+    if (active == 0)
+    {
+        return;
+    }
+    for (size_t i = 0; i < bvh->unboundedCount; i++)
+    {
+        leaf(context, bvh->unbounded[i], active, tMax);
+    }
+    if (bvh->nodeCount == 0)
+    {
+        return;
+    }
+    Vec4 inverse[BVH_PACKET_SIZE];
+    for (size_t i = 0; i < BVH_PACKET_SIZE; i++)
+    {
+        inverse[i] = vector(1 / direction[i].x, 1 / direction[i].y, 1 / direction[i].z);
+    }
+    BvhPacketStackEntry stack[BVH_STACK_SIZE];
+    stack[0].node = 0;
+    stack[0].active = boundsHitPacket(bvh->nodes[0].bounds, origin, inverse, active, tMin, tMax, stack[0].tEntry);
+    size_t stackSize = stack[0].active != 0 ? 1 : 0;
+    while (stackSize != 0)
+    {
+        BvhPacketStackEntry entry = stack[--stackSize];
+        for (size_t i = 0; i < BVH_PACKET_SIZE; i++)
+        {
+            if ((entry.active & 1u << i) && entry.tEntry[i] > tMax[i])
+            {
+                entry.active &= ~(1u << i); // `tMax` shrunk since the node was pushed
+            }
+        }
+        if (entry.active == 0)
+        {
+            continue;
+        }
+        const BvhNode *node = &bvh->nodes[entry.node];
+        if (node->count != 0)
+        {
+            for (size_t i = node->start; i < node->start + node->count; i++)
+            {
+                leaf(context, bvh->primitives[i], entry.active, tMax);
+            }
+            continue;
+        }
+        BvhPacketStackEntry left = {entry.node + 1, 0, {0}};
+        BvhPacketStackEntry right = {node->start, 0, {0}};
+        left.active = boundsHitPacket(bvh->nodes[left.node].bounds, origin, inverse, entry.active, tMin, tMax, left.tEntry);
+        right.active = boundsHitPacket(bvh->nodes[right.node].bounds, origin, inverse, entry.active, tMin, tMax, right.tEntry);
+        // Push the far child first so the near one is visited next
+        const bool leftFirst = packetEntry(left.tEntry, left.active) <= packetEntry(right.tEntry, right.active);
+        const BvhPacketStackEntry *children[2] = {leftFirst ? &right : &left, leftFirst ? &left : &right};
+        for (size_t i = 0; i < 2; i++)
+        {
+            if (children[i]->active != 0)
+            {
+                stack[stackSize++] = *children[i];
+            }
+        }
+    }
+}
@@ -0,0 +1,148 @@
+/*
+ * bvh.h - Bounding volume hierarchy
+ *
+ * Copyright (c) 2023, Dimitrios Alexopoulos All rights reserved.
+ */
+
+#ifndef BVH_H
+#define BVH_H
+
+#include <stdalign.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "vectors.h"
+
+#define BVH_LEAF_SIZE 4
+#define BVH_STACK_SIZE 64
+#define BVH_PACKET_SIZE 4
+#define BVH_MAX_BINS 64
+#define BVH_TRAVERSAL_COST 1 // of visiting a node, relative to testing a primitive
+#define BVH_WIDTH 4          // children of the nodes of wide hierarchies
+#define BVH_NODE_ALIGN 64    // of wide nodes, the size of a cache line
+
+// Surface area heuristic with 16 bins and leaves of up to `BVH_LEAF_SIZE` primitives, on one thread per processor,
+// collapsed into a wide hierarchy
+#define BVH_BUILD_DEFAULT (BvhBuildOptions){BVH_SAH, 16, BVH_LEAF_SIZE, 0, BVH_WIDE}
+// Linear hierarchy with leaves of up to `BVH_LEAF_SIZE` primitives, on one thread per processor, collapsed into a
+// wide hierarchy, for scenes rebuilt every frame
+#define BVH_BUILD_LINEAR (BvhBuildOptions){BVH_LBVH, 0, BVH_LEAF_SIZE, 0, BVH_WIDE}
+
+typedef struct
+{
+    Vec3 min;
+    Vec3 max;
+} Bounds;
+
+// Inner nodes store their left child directly after themselves and the right child at `start`.
+// Leaf nodes store `count` primitives starting at `start` in the primitive index array.
+typedef struct
+{
+    Bounds bounds;
+    size_t start;
+    size_t count; // zero for inner nodes
+} BvhNode;
+
+// Node of a wide hierarchy, the bounds of its `BVH_WIDTH` children stored axis by axis so they are tested at once.
+// Inner children store the index of their node in `start`, leaf children store `count` primitives starting at `start`
+// in the primitive index array. Bounds are rounded outwards, empty slots have empty bounds.
+typedef struct
+{
+    alignas(BVH_NODE_ALIGN) float min[3][BVH_WIDTH];
+    float max[3][BVH_WIDTH];
+    uint32_t start[BVH_WIDTH];
+    uint32_t count[BVH_WIDTH]; // zero for inner children
+} BvhWideNode;
+
+// Wide node fitting a cache line, its child bounds quantized to 8 bits per plane on a grid over the node's bounds.
+// Plane `q` along axis `i` is at `origin[i] + q * 2^exponent[i]`, the grid is rounded outwards.
+typedef struct
+{
+    alignas(BVH_NODE_ALIGN) float origin[3];
+    int8_t exponent[3];
+    uint8_t childCount; // the first children are used
+    uint8_t min[3][BVH_WIDTH];
+    uint8_t max[3][BVH_WIDTH];
+    uint32_t start[BVH_WIDTH];
+    uint8_t count[BVH_WIDTH]; // zero for inner children
+} BvhQuantizedNode;
+
+typedef enum
+{
+    BVH_BINARY,   // traverses the binary tree, 64 bytes per child bounds in double precision
+    BVH_WIDE,     // traverses a copy collapsed into nodes of `BVH_WIDTH` children, 32 bytes per child bounds
+    BVH_QUANTIZED // traverses a wide copy with quantized bounds, 16 bytes per child bounds but more nodes visited
+} BvhLayout;
+
+typedef struct
+{
+    size_t nodeCount;
+    size_t primitiveCount;
+    size_t unboundedCount;
+    BvhNode *nodes;
+    size_t *primitives;
+    size_t *unbounded; // primitives with infinite bounds, always tested
+    Scalar sahCost;    // when built, refits measure how much the tree degraded against it
+    BvhLayout layout;  // used for traversing the tree, packets traverse the binary tree
+    size_t wideNodeCount;
+    BvhWideNode *wideNodes;           // root first, unless binary or quantized
+    BvhQuantizedNode *quantizedNodes; // root first, unless binary or wide
+} Bvh;
+
+typedef enum
+{
+    BVH_MEDIAN, // splits at the median centroid along the widest axis
+    BVH_SAH,    // binned surface area heuristic, slower to build but faster to trace
+    BVH_LBVH    // splits the primitives sorted along a Morton curve where their codes differ, fastest to build
+} BvhMethod;
+
+// Trade-off between the build and trace speed of `bvhBuildWith`
+typedef struct
+{
+    BvhMethod method;
+    size_t binCount;    // candidate splits per axis of the surface area heuristic, from 2 to `BVH_MAX_BINS`
+    size_t leafSize;    // most primitives in a leaf, the surface area heuristic may make smaller ones
+    size_t threadCount; // building subtrees in parallel, zero for one per processor
+    BvhLayout layout;   // the binary tree is built and kept either way
+} BvhBuildOptions;
+
+// Build time and quality of a hierarchy
+typedef struct
+{
+    double buildTime; // in seconds, zero unless reported by `bvhBuildWith`
+    Scalar sahCost;   // expected cost of a ray hitting the root, in primitive tests (see `BVH_TRAVERSAL_COST`)
+    size_t depth;     // of the deepest leaf, the root is at depth zero
+    size_t leafCount;
+    size_t minLeafSize;
+    size_t maxLeafSize;
+    Scalar averageLeafSize;
+    size_t nodeSize; // bytes of the nodes traversal reads
+} BvhStats;
+
+// Called for every primitive a ray may hit, may shrink `tMax`.
+// Returning true stops the traversal.
+typedef bool (*BvhLeafFunction)(void *context, size_t primitive, Scalar *tMax);
+
+// Called for every primitive one of the `active` rays (bit `i` for ray `i`) of a packet may hit,
+// may shrink their `tMax`.
+typedef void (*BvhPacketLeafFunction)(void *context, size_t primitive, unsigned active, Scalar tMax[BVH_PACKET_SIZE]);
+
+Bounds boundsEmpty(void);
+Bounds boundsUnion(Bounds a, Bounds b);
+Bounds boundsExtend(Bounds a, Vec3 point);
+Vec3 boundsCentroid(Bounds a);
+bool boundsFinite(Bounds a);
+bool boundsHit(Bounds a, Vec4 origin, Vec4 inverse, Scalar tMin, Scalar tMax, Scalar *tEntry);
+
+void bvhBuild(Bvh *dest, const Bounds *bounds, size_t count);
+void bvhBuildWith(Bvh *dest, const Bounds *bounds, size_t count, BvhBuildOptions options, BvhStats *stats);
+void bvhSetLayout(Bvh *bvh, BvhLayout layout);
+void bvhDestroy(Bvh *dest);
+BvhStats bvhStats(const Bvh *bvh);
+Scalar bvhRefit(Bvh *bvh, const Bounds *bounds);
+bool bvhTraverse(const Bvh *bvh, Vec4 origin, Vec4 direction, Scalar tMin, Scalar tMax, BvhLeafFunction leaf, void *context);
+void bvhTraversePacket(const Bvh *bvh, const Vec4 origin[BVH_PACKET_SIZE], const Vec4 direction[BVH_PACKET_SIZE], unsigned active,
+                       Scalar tMin, Scalar tMax[BVH_PACKET_SIZE], BvhPacketLeafFunction leaf, void *context);
+
+#endif
@@ -4,13 +4,18 @@
  * Copyright (c) 2023, Dimitrios Alexopoulos All rights reserved.
  */
 
+#include <stdbool.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <tgmath.h>
 
 #include "canvas.h"
 #include "vectors.h"
 
+#define PPM_BUFFER_SIZE 4096
+#define PPM_LINE_VALUES 17 // Keeps plain PPM lines within 70 characters
+
 struct Canvas_s
 {
     size_t width;
@@ -127,6 +132,66 @@ char *canvasPPM(const Canvas *canvas)
     return buffer;
 }
 
+// Writes the buffered bytes to the stream, returning false if not all of them were written
+static bool canvasFlush(FILE *stream, const char *buffer, size_t *size)
+{
+    const bool written = fwrite(buffer, 1, *size, stream) == *size;
+    *size = 0;
+    return written;
+}
+
+// Writes the canvas to the stream in PPM format, converting it pixel by pixel through a small fixed buffer.
+// Plain (P3) values are padded to 3 characters as in `canvasPPM`, with lines wrapped to fit 70 characters.
+// Returns false if writing to the stream fails
+// Info: Channels are rounded to the nearest integer (ties to even), matching `canvasPPM`
+bool canvasWritePPM(const Canvas *canvas, FILE *stream, const PPMFormat format)
+{
+    if (fprintf(stream, "%s\n%zu %zu\n%d\n", format == PPM_P6 ? "P6" : "P3", canvas->width, canvas->height, PPM_DEPTH) < 0)
+    {
+        return false;
+    }
+    char buffer[PPM_BUFFER_SIZE];
+    size_t size = 0;
+    for (size_t j = 0; j < canvas->height; j++)
+    {
+        size_t lineValues = 0;
+        for (size_t i = 0; i < canvas->width; i++)
+        {
+            const Vec3 pixel = vec3PPM(canvas->pixelCanvas[i + j * canvas->width]);
+            for (size_t k = 0; k < 3; k++)
+            {
+                const unsigned int value = (unsigned int)nearbyint(pixel.elem[k]);
+                if (format == PPM_P6)
+                {
+                    buffer[size++] = (char)value;
+                }
+                else
+                {
+                    buffer[size] = value >= 100 ? (char)('0' + value / 100) : ' ';
+                    buffer[size + 1] = value >= 10 ? (char)('0' + value / 10 % 10) : ' ';
+                    buffer[size + 2] = (char)('0' + value % 10);
+                    lineValues++;
+                    if (lineValues == PPM_LINE_VALUES || (i == canvas->width - 1 && k == 2))
+                    {
+                        buffer[size + 3] = '\n';
+                        lineValues = 0;
+                    }
+                    else
+                    {
+                        buffer[size + 3] = ' ';
+                    }
+                    size += 4;
+                }
+                if (size > PPM_BUFFER_SIZE - 4 && !canvasFlush(stream, buffer, &size))
+                {
+                    return false;
+                }
+            }
+        }
+    }
+    return canvasFlush(stream, buffer, &size);
+}
+
 // 000 000 000 ... 000 000 000 |000n000 |000
 //                            ^       ^
 //                           65      67
@@ -7,12 +7,20 @@
 #ifndef CANVAS_H
 #define CANVAS_H
 
+#include <stdbool.h>
 #include <stddef.h>
+#include <stdio.h>
 
 #include "vectors.h"
 
 typedef struct Canvas_s Canvas;
 
+typedef enum
+{
+    PPM_P3, // plain, one decimal value per channel
+    PPM_P6  // binary, one byte per channel
+} PPMFormat;
+
 Canvas *canvasCreate(size_t width, size_t height);
 Canvas *canvasCopy(const Canvas *canvas);
 
@@ -23,5 +31,6 @@ size_t canvasWidth(const Canvas *canvas);
 size_t canvasHeight(const Canvas *canvas);
 
 char *canvasPPM(const Canvas *canvas);
+bool canvasWritePPM(const Canvas *canvas, FILE *stream, PPMFormat format);
 
 #endif
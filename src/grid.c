@@ -0,0 +1,260 @@
+/*
+ * grid.c - Uniform grid
+ *
+ * Copyright (c) 2023, Dimitrios Alexopoulos All rights reserved.
+ */
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <tgmath.h>
+
+#include "bvh.h"
+#include "grid.h"
+#include "vectors.h"
+
+// Sizes the cells so there are about `GRID_DENSITY` of them per primitive, as close to cubes as the bounds allow.
+// Axes the bounds are flat in get a single cell.
+static void gridResolve(Grid *grid, const size_t count)
+{
+    Scalar volume = 1;
+    size_t dimensions = 0;
+    for (size_t i = 0; i < 3; i++)
+    {
+        const Scalar extent = grid->bounds.max.elem[i] - grid->bounds.min.elem[i];
+        if (extent > 0)
+        {
+            volume *= extent;
+            dimensions++;
+        }
+    }
+    // Cells along an axis per unit of length
+    const Scalar scale = dimensions == 0 ? 0 : pow(GRID_DENSITY * (Scalar)count / volume, 1 / (Scalar)dimensions);
+    grid->cellCount = 1;
+    for (size_t i = 0; i < 3; i++)
+    {
+        const Scalar extent = grid->bounds.max.elem[i] - grid->bounds.min.elem[i];
+        const Scalar cells = extent * scale;
+        grid->resolution[i] = !(cells > 1) ? 1 : cells > GRID_MAX_RESOLUTION ? GRID_MAX_RESOLUTION : (size_t)cells;
+        grid->cellSize.elem[i] = extent / (Scalar)grid->resolution[i];
+        grid->inverseCellSize.elem[i] = extent > 0 ? (Scalar)grid->resolution[i] / extent : 0;
+        grid->cellCount *= grid->resolution[i];
+    }
+}
+
+// Returns the coordinate along the axis of the cell containing the position, clamped to the grid
+static inline size_t gridCoordinate(const Grid *grid, const Scalar position, const size_t axis)
+{
+    const Scalar cell = (position - grid->bounds.min.elem[axis]) * grid->inverseCellSize.elem[axis];
+    if (!(cell > 0))
+    {
+        return 0;
+    }
+    return cell >= (Scalar)(grid->resolution[axis] - 1) ? grid->resolution[axis] - 1 : (size_t)cell;
+}
+
+// Stores the coordinates of the first and last cells the bounds overlap along every axis
+static void gridBlock(const Grid *grid, const Bounds bounds, size_t first[3], size_t last[3])
+{
+    for (size_t i = 0; i < 3; i++)
+    {
+        first[i] = gridCoordinate(grid, bounds.min.elem[i], i);
+        last[i] = gridCoordinate(grid, bounds.max.elem[i], i);
+    }
+}
+
+// Builds a grid over the primitive bounds, sized automatically (see `GRID_DENSITY`).
+// Primitives with infinite (or empty) bounds are kept out of the cells and always tested.
+// If the allocation fails, `abort()` is called
+void gridBuild(Grid *dest, const Bounds *bounds, const size_t count)
+{
+    *dest = (Grid){.bounds = boundsEmpty()};
+    if (count == 0)
+    {
+        return;
+    }
+    dest->unbounded = malloc(sizeof(size_t[count]));
+    if (dest->unbounded == NULL)
+    {
+        abort();
+    }
+    for (size_t i = 0; i < count; i++)
+    {
+        if (boundsFinite(bounds[i]))
+        {
+            dest->bounds = boundsUnion(dest->bounds, bounds[i]);
+        }
+        else
+        {
+            dest->unbounded[dest->unboundedCount++] = i;
+        }
+    }
+    if (dest->unboundedCount == count)
+    {
+        return;
+    }
+    gridResolve(dest, count - dest->unboundedCount);
+    dest->cellStart = calloc(dest->cellCount + 1, sizeof(size_t));
+    if (dest->cellStart == NULL)
+    {
+        abort();
+    }
+    // Counts the primitives of every cell, then turns the counts into where the lists start and fills them in
+    for (int pass = 0; pass < 2; pass++)
+    {
+        for (size_t i = 0; i < count; i++)
+        {
+            if (!boundsFinite(bounds[i]))
+            {
+                continue;
+            }
+            size_t first[3];
+            size_t last[3];
+            gridBlock(dest, bounds[i], first, last);
+            for (size_t z = first[2]; z <= last[2]; z++)
+            {
+                for (size_t y = first[1]; y <= last[1]; y++)
+                {
+                    const size_t row = (z * dest->resolution[1] + y) * dest->resolution[0];
+                    for (size_t x = first[0]; x <= last[0]; x++)
+                    {
+                        if (pass == 0)
+                        {
+                            dest->cellStart[row + x + 1]++;
+                        }
+                        else
+                        {
+                            dest->primitives[dest->cellStart[row + x]++] = i;
+                        }
+                    }
+                }
+            }
+        }
+        if (pass == 0)
+        {
+            for (size_t cell = 0; cell < dest->cellCount; cell++)
+            {
+                dest->cellStart[cell + 1] += dest->cellStart[cell];
+            }
+            dest->referenceCount = dest->cellStart[dest->cellCount];
+            dest->primitives = malloc(sizeof(size_t[dest->referenceCount]));
+            if (dest->primitives == NULL)
+            {
+                abort();
+            }
+        }
+    }
+    // Filling moved the start of every list to the start of the next one
+    memmove(dest->cellStart + 1, dest->cellStart, sizeof(size_t[dest->cellCount]));
+    dest->cellStart[0] = 0;
+}
+
+// Grid destructor
+void gridDestroy(Grid *grid)
+{
+    free(grid->cellStart);
+    free(grid->primitives);
+    free(grid->unbounded);
+    *grid = (Grid){0};
+}
+
+// Calls `leaf` for the primitives of every cell the ray passes through between `tMin` and `tMax`, visiting the cells
+// in order along the ray (3D-DDA) and stopping once `tMax` is before the next one. Returns true if `leaf` stopped the
+// traversal.
+// Info: Primitives overlapping several cells may be passed to `leaf` once for each of them
+bool gridTraverse(const Grid *grid, const Vec4 origin, const Vec4 direction, const Scalar tMin, Scalar tMax, const BvhLeafFunction leaf,
+                  void *context)
+{
+    for (size_t i = 0; i < grid->unboundedCount; i++)
+    {
+        if (leaf(context, grid->unbounded[i], &tMax))
+        {
+            return true;
+        }
+    }
+    if (grid->cellCount == 0)
+    {
+        return false;
+    }
+    // Where the ray enters and leaves the grid (slab test)
+    const Vec4 inverse = vector(1 / direction.x, 1 / direction.y, 1 / direction.z);
+    Scalar tEnter = tMin;
+    Scalar tExit = tMax;
+    for (size_t i = 0; i < 3; i++)
+    {
+        const Scalar t0 = (grid->bounds.min.elem[i] - origin.elem[i]) * inverse.elem[i];
+        const Scalar t1 = (grid->bounds.max.elem[i] - origin.elem[i]) * inverse.elem[i];
+        tEnter = fmax(fmin(t0, t1), tEnter);
+        tExit = fmin(fmax(t0, t1), tExit);
+    }
+    if (tEnter > tExit)
+    {
+        return false;
+    }
+    // Distances to the next cell boundary along every axis, and between boundaries
+    size_t cell[3];
+    Scalar tNext[3];
+    Scalar tDelta[3];
+    for (size_t i = 0; i < 3; i++)
+    {
+        cell[i] = gridCoordinate(grid, origin.elem[i] + direction.elem[i] * tEnter, i);
+        const Scalar cellMin = grid->bounds.min.elem[i] + (Scalar)cell[i] * grid->cellSize.elem[i];
+        if (grid->resolution[i] == 1 || direction.elem[i] == 0)
+        {
+            tNext[i] = INFINITY; // never leaves the cells of this axis
+            tDelta[i] = 0;
+        }
+        else if (direction.elem[i] > 0)
+        {
+            tNext[i] = (cellMin + grid->cellSize.elem[i] - origin.elem[i]) * inverse.elem[i];
+            tDelta[i] = grid->cellSize.elem[i] * inverse.elem[i];
+        }
+        else
+        {
+            tNext[i] = (cellMin - origin.elem[i]) * inverse.elem[i];
+            tDelta[i] = -grid->cellSize.elem[i] * inverse.elem[i];
+        }
+    }
+    // Primitives recently passed to `leaf`, so those overlapping the cells just left are not tested again
+    size_t mailbox[GRID_MAILBOX_SIZE];
+    for (size_t i = 0; i < GRID_MAILBOX_SIZE; i++)
+    {
+        mailbox[i] = SIZE_MAX;
+    }
+    size_t mailboxNext = 0;
+    while (true)
+    {
+        const size_t index = (cell[2] * grid->resolution[1] + cell[1]) * grid->resolution[0] + cell[0];
+        for (size_t i = grid->cellStart[index]; i < grid->cellStart[index + 1]; i++)
+        {
+            const size_t primitive = grid->primitives[i];
+            bool tested = false;
+            for (size_t j = 0; j < GRID_MAILBOX_SIZE; j++)
+            {
+                tested = tested || mailbox[j] == primitive;
+            }
+            if (tested)
+            {
+                continue;
+            }
+            mailbox[mailboxNext] = primitive;
+            mailboxNext = (mailboxNext + 1) % GRID_MAILBOX_SIZE;
+            if (leaf(context, primitive, &tMax))
+            {
+                return true;
+            }
+        }
+        const size_t axis = tNext[0] < tNext[1] ? (tNext[0] < tNext[2] ? 0 : 2) : (tNext[1] < tNext[2] ? 1 : 2);
+        if (tNext[axis] > tMax || tNext[axis] > tExit)
+        {
+            return false; // primitives hit in the cell are nearer than the next one, or the ray left the grid
+        }
+        if (direction.elem[axis] > 0 ? ++cell[axis] == grid->resolution[axis] : cell[axis]-- == 0)
+        {
+            return false;
+        }
+        tNext[axis] += tDelta[axis];
+    }
+}
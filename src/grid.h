@@ -0,0 +1,41 @@
+/*
+ * grid.h - Uniform grid
+ *
+ * Copyright (c) 2023, Dimitrios Alexopoulos All rights reserved.
+ */
+
+#ifndef GRID_H
+#define GRID_H
+
+#include <stdbool.h>
+#include <stddef.h>
+
+#include "bvh.h"
+#include "vectors.h"
+
+#define GRID_DENSITY 2           // cells per primitive of automatically sized grids
+#define GRID_MAX_RESOLUTION 1024 // cells along each axis
+#define GRID_MAILBOX_SIZE 8      // primitives remembered by traversals to skip testing them again
+
+// Cells of equal size over the bounds of the primitives, each listing the primitives whose bounds overlap it.
+// The lists are stored back to back, cell `i` listing `primitives[cellStart[i]]` up to `primitives[cellStart[i + 1]]`
+// (exclusive). Cells are numbered along x first, then y, then z.
+typedef struct
+{
+    Bounds bounds;
+    size_t resolution[3];
+    Vec3 cellSize;
+    Vec3 inverseCellSize; // zero along axes the grid is flat in
+    size_t cellCount;
+    size_t referenceCount; // of primitives by cells, primitives overlapping several cells are listed by each
+    size_t unboundedCount;
+    size_t *cellStart;
+    size_t *primitives;
+    size_t *unbounded; // primitives with infinite bounds, always tested
+} Grid;
+
+void gridBuild(Grid *dest, const Bounds *bounds, size_t count);
+void gridDestroy(Grid *grid);
+bool gridTraverse(const Grid *grid, Vec4 origin, Vec4 direction, Scalar tMin, Scalar tMax, BvhLeafFunction leaf, void *context);
+
+#endif
@@ -0,0 +1,198 @@
+/*
+ * mesh.c - Indexed triangle meshes
+ *
+ * Copyright (c) 2023, Dimitrios Alexopoulos All rights reserved.
+ */
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdlib.h>
+#include <tgmath.h>
+
+#include "bvh.h"
+#include "mesh.h"
+#include "vectors.h"
+
+// Grows an array to fit one more element, doubling its capacity.
+// If the allocation fails, `abort()` is called
+static void *meshGrow(void *array, const size_t count, size_t *capacity, const size_t size)
+{
+    if (count < *capacity)
+    {
+        return array;
+    }
+    *capacity = *capacity == 0 ? 16 : *capacity * 2;
+    array = realloc(array, *capacity * size);
+    if (array == NULL)
+    {
+        abort();
+    }
+    return array;
+}
+
+// Mesh constructor, creates a mesh without any triangles
+void meshCreate(Mesh *dest)
+{
+    *dest = (Mesh){.bounds = boundsEmpty()};
+}
+
+// Mesh destructor
+void meshDestroy(Mesh *mesh)
+{
+    free(mesh->vertices);
+    free(mesh->normals);
+    free(mesh->triangles);
+    free(mesh->faces);
+    bvhDestroy(&mesh->bvh);
+    meshCreate(mesh);
+}
+
+// Appends a vertex to the mesh, returning its index.
+// If the allocation fails, `abort()` is called
+size_t meshAddVertex(Mesh *mesh, const Vec3 vertex)
+{
+    mesh->vertices = meshGrow(mesh->vertices, mesh->vertexCount, &mesh->vertexCapacity, sizeof(Vec3));
+    mesh->vertices[mesh->vertexCount] = vertex;
+    return mesh->vertexCount++;
+}
+
+// Appends a normal to the mesh, returning its index.
+// If the allocation fails, `abort()` is called
+size_t meshAddNormal(Mesh *mesh, const Vec3 normal)
+{
+    mesh->normals = meshGrow(mesh->normals, mesh->normalCount, &mesh->normalCapacity, sizeof(Vec3));
+    mesh->normals[mesh->normalCount] = normal;
+    return mesh->normalCount++;
+}
+
+// Appends a triangle to the mesh.
+// Important: The indices must refer to vertices (and normals) of the mesh, a mesh holds at most `UINT32_MAX` triangles
+// If the allocation fails, `abort()` is called
+void meshAddTriangle(Mesh *mesh, const MeshTriangle triangle)
+{
+    mesh->triangles = meshGrow(mesh->triangles, mesh->triangleCount, &mesh->triangleCapacity, sizeof(MeshTriangle));
+    mesh->triangles[mesh->triangleCount++] = triangle;
+}
+
+// Gives the triangles without normals smooth normals, the area weighted average of the faces around each vertex
+static void meshSmoothNormals(Mesh *mesh)
+{
+    size_t missing = 0;
+    for (size_t i = 0; i < mesh->triangleCount; i++)
+    {
+        missing += mesh->triangles[i].normals[0] == MESH_NO_NORMAL;
+    }
+    if (missing == 0)
+    {
+        return;
+    }
+    const size_t base = mesh->normalCount;
+    for (size_t i = 0; i < mesh->vertexCount; i++)
+    {
+        meshAddNormal(mesh, color(0, 0, 0));
+    }
+    for (size_t i = 0; i < mesh->triangleCount; i++)
+    {
+        MeshTriangle *triangle = &mesh->triangles[i];
+        if (triangle->normals[0] != MESH_NO_NORMAL)
+        {
+            continue;
+        }
+        // The cross product's length is twice the area of the triangle, weighting larger faces more
+        const MeshFace face = mesh->faces[i];
+        const Vec3 normal = vec3Cross(face.ab, face.ac);
+        for (size_t corner = 0; corner < 3; corner++)
+        {
+            triangle->normals[corner] = base + triangle->vertices[corner];
+            mesh->normals[triangle->normals[corner]] = vec3Add(mesh->normals[triangle->normals[corner]], normal);
+        }
+    }
+}
+
+// Precomputes the faces and bounds of the triangles, gives smooth normals to the triangles without any and
+// builds the bounding volume hierarchy used to intersect the mesh.
+// Important: Rebuild after adding triangles or moving vertices
+// If the allocation fails, `abort()` is called
+void meshBuild(Mesh *mesh)
+{
+    free(mesh->faces);
+    bvhDestroy(&mesh->bvh);
+    mesh->faces = malloc(sizeof(MeshFace[mesh->triangleCount + 1]));
+    Bounds *bounds = malloc(sizeof(Bounds[mesh->triangleCount + 1]));
+    if (mesh->faces == NULL || bounds == NULL)
+    {
+        abort();
+    }
+    mesh->bounds = boundsEmpty();
+    for (size_t i = 0; i < mesh->triangleCount; i++)
+    {
+        const MeshTriangle triangle = mesh->triangles[i];
+        const Vec3 a = mesh->vertices[triangle.vertices[0]];
+        const Vec3 b = mesh->vertices[triangle.vertices[1]];
+        const Vec3 c = mesh->vertices[triangle.vertices[2]];
+        mesh->faces[i] = (MeshFace){a, vec3Sub(b, a), vec3Sub(c, a)};
+        bounds[i] = boundsExtend(boundsExtend((Bounds){a, a}, b), c);
+        mesh->bounds = boundsUnion(mesh->bounds, bounds[i]);
+    }
+    meshSmoothNormals(mesh);
+    bvhBuild(&mesh->bvh, bounds, mesh->triangleCount);
+    free(bounds);
+}
+
+// Checks if the ray (in object space) intersects the triangle of the mesh, storing the distance (Möller-Trumbore).
+// Info: The triangle is hit from both sides, rays in its plane miss it
+bool meshTriangleHit(const Mesh *mesh, const size_t triangle, const Vec4 origin, const Vec4 direction, Scalar *t)
+{
+    const MeshFace face = mesh->faces[triangle];
+    const Vec3 p = vec3Cross(direction.xyz, face.ac);
+    const Scalar determinant = vec3Dot(face.ab, p);
+    if (determinant == 0)
+    {
+        return false;
+    }
+    const Scalar inverse = 1 / determinant;
+    const Vec3 s = vec3Sub(origin.xyz, face.a);
+    const Scalar u = vec3Dot(s, p) * inverse;
+    if (u < 0 || u > 1)
+    {
+        return false;
+    }
+    const Vec3 q = vec3Cross(s, face.ab);
+    const Scalar v = vec3Dot(direction.xyz, q) * inverse;
+    if (v < 0 || u + v > 1)
+    {
+        return false;
+    }
+    *t = vec3Dot(face.ac, q) * inverse;
+    return true;
+}
+
+// Returns the object space normal of the triangle at the point, interpolated between the normals of its corners.
+// The normal is not normalized.
+// Important: The point must be on the triangle and the mesh must be built
+Vec3 meshNormal(const Mesh *mesh, const size_t triangle, const Vec4 point)
+{
+    const MeshFace face = mesh->faces[triangle];
+    const MeshTriangle corners = mesh->triangles[triangle];
+    // Barycentric coordinates of the point, from the projections of its offset onto the edges
+    const Vec3 offset = vec3Sub(point.xyz, face.a);
+    const Scalar abab = vec3Dot(face.ab, face.ab);
+    const Scalar abac = vec3Dot(face.ab, face.ac);
+    const Scalar acac = vec3Dot(face.ac, face.ac);
+    const Scalar offsetAb = vec3Dot(offset, face.ab);
+    const Scalar offsetAc = vec3Dot(offset, face.ac);
+    const Scalar denominator = abab * acac - abac * abac;
+    if (denominator != 0)
+    {
+        const Scalar u = (acac * offsetAb - abac * offsetAc) / denominator;
+        const Scalar v = (abab * offsetAc - abac * offsetAb) / denominator;
+        const Vec3 normal = vec3Add(vec3Mul(mesh->normals[corners.normals[0]], 1 - u - v),
+                                    vec3Add(vec3Mul(mesh->normals[corners.normals[1]], u),
+                                            vec3Mul(mesh->normals[corners.normals[2]], v)));
+        if (vec3Dot(normal, normal) != 0)
+        {
+            return normal;
+        }
+    }
+    return vec3Cross(face.ab, face.ac); // Flat normal of degenerate triangles or opposing corner normals
+}
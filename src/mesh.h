@@ -0,0 +1,61 @@
+/*
+ * mesh.h - Indexed triangle meshes
+ *
+ * Copyright (c) 2023, Dimitrios Alexopoulos All rights reserved.
+ */
+
+#ifndef MESH_H
+#define MESH_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "bvh.h"
+#include "vectors.h"
+
+#define MESH_NO_NORMAL SIZE_MAX
+
+// Indices of the corners of a triangle in the vertex and normal buffers of its mesh
+typedef struct
+{
+    size_t vertices[3];
+    size_t normals[3]; // `MESH_NO_NORMAL` if the normals are computed when the mesh is built
+} MeshTriangle;
+
+// First corner and edges of a triangle, as used by the intersection kernel
+typedef struct
+{
+    Vec3 a;
+    Vec3 ab;
+    Vec3 ac;
+} MeshFace;
+
+// Triangles sharing vertex and normal buffers, in object space
+typedef struct
+{
+    size_t vertexCount;
+    size_t normalCount;
+    size_t triangleCount;
+    size_t vertexCapacity;
+    size_t normalCapacity;
+    size_t triangleCapacity;
+    Vec3 *vertices;
+    Vec3 *normals;
+    MeshTriangle *triangles;
+    MeshFace *faces; // NULL until built
+    Bounds bounds;
+    Bvh bvh; // over the triangles, built by `meshBuild`
+} Mesh;
+
+void meshCreate(Mesh *dest);
+void meshDestroy(Mesh *mesh);
+size_t meshAddVertex(Mesh *mesh, Vec3 vertex);
+size_t meshAddNormal(Mesh *mesh, Vec3 normal);
+void meshAddTriangle(Mesh *mesh, MeshTriangle triangle);
+void meshBuild(Mesh *mesh);
+
+bool meshTriangleHit(const Mesh *mesh, size_t triangle, Vec4 origin, Vec4 direction, Scalar *t);
+Vec3 meshNormal(const Mesh *mesh, size_t triangle, Vec4 point);
+
+#endif
@@ -0,0 +1,361 @@
+/*
+ * packed.h - Four-wide vector operations shared by the kernels
+ *
+ * Copyright (c) 2023, Dimitrios Alexopoulos All rights reserved.
+ */
+
+#ifndef PACKED_H
+#define PACKED_H
+
+#include <stddef.h>
+#include <tgmath.h>
+
+#include "vectors.h"
+
+#ifdef VECTORS_SIMD
+#include <immintrin.h>
+#endif
+
+#define PACKED_WIDTH 4
+
+// Four packed scalars: one SSE register of floats, one AVX register of doubles, a pair of SSE2 registers of doubles,
+// or a plain array when SIMD is disabled.
+// Info: Operations are element-wise, so kernels built on them keep the results of the equivalent scalar code.
+// `packedMin` and `packedMax` return `b` where `a` is NaN, as `fmin` and `fmax` do, `packedLessEqual` returns the mask
+// of the elements where `a <= b` and `packedLoadFloat` widens four floats
+
+#if defined(VECTORS_SIMD) && defined(AKTINA_SINGLE_PRECISION)
+typedef __m128 Packed4;
+
+static inline Packed4 packedLoad(const float *a)
+{
+    return _mm_loadu_ps(a);
+}
+
+static inline void packedStore(float *dest, const Packed4 a)
+{
+    _mm_storeu_ps(dest, a);
+}
+
+static inline Packed4 packedSet(const float a)
+{
+    return _mm_set1_ps(a);
+}
+
+static inline Packed4 packedAdd(const Packed4 a, const Packed4 b)
+{
+    return _mm_add_ps(a, b);
+}
+
+static inline Packed4 packedSub(const Packed4 a, const Packed4 b)
+{
+    return _mm_sub_ps(a, b);
+}
+
+static inline Packed4 packedMul(const Packed4 a, const Packed4 b)
+{
+    return _mm_mul_ps(a, b);
+}
+
+static inline Packed4 packedDiv(const Packed4 a, const Packed4 b)
+{
+    return _mm_div_ps(a, b);
+}
+
+static inline Packed4 packedNeg(const Packed4 a)
+{
+    return _mm_xor_ps(a, _mm_set1_ps(-0.0f));
+}
+
+static inline Packed4 packedSqrt(const Packed4 a)
+{
+    return _mm_sqrt_ps(a);
+}
+
+static inline Packed4 packedLoadFloat(const float *a)
+{
+    return _mm_loadu_ps(a);
+}
+
+static inline Packed4 packedMin(const Packed4 a, const Packed4 b)
+{
+    return _mm_min_ps(a, b);
+}
+
+static inline Packed4 packedMax(const Packed4 a, const Packed4 b)
+{
+    return _mm_max_ps(a, b);
+}
+
+static inline unsigned packedLessEqual(const Packed4 a, const Packed4 b)
+{
+    return (unsigned)_mm_movemask_ps(_mm_cmple_ps(a, b));
+}
+
+// Transposes four rows into four columns
+static inline void packedTranspose(Packed4 rows[4])
+{
+    _MM_TRANSPOSE4_PS(rows[0], rows[1], rows[2], rows[3]);
+}
+#elif defined(VECTORS_SIMD) && defined(__AVX__)
+typedef __m256d Packed4;
+
+static inline Packed4 packedLoad(const Scalar *a)
+{
+    return _mm256_loadu_pd(a);
+}
+
+static inline void packedStore(Scalar *dest, const Packed4 a)
+{
+    _mm256_storeu_pd(dest, a);
+}
+
+static inline Packed4 packedSet(const Scalar a)
+{
+    return _mm256_set1_pd(a);
+}
+
+static inline Packed4 packedAdd(const Packed4 a, const Packed4 b)
+{
+    return _mm256_add_pd(a, b);
+}
+
+static inline Packed4 packedSub(const Packed4 a, const Packed4 b)
+{
+    return _mm256_sub_pd(a, b);
+}
+
+static inline Packed4 packedMul(const Packed4 a, const Packed4 b)
+{
+    return _mm256_mul_pd(a, b);
+}
+
+static inline Packed4 packedDiv(const Packed4 a, const Packed4 b)
+{
+    return _mm256_div_pd(a, b);
+}
+
+static inline Packed4 packedNeg(const Packed4 a)
+{
+    return _mm256_xor_pd(a, _mm256_set1_pd(-0.0));
+}
+
+static inline Packed4 packedSqrt(const Packed4 a)
+{
+    return _mm256_sqrt_pd(a);
+}
+
+static inline Packed4 packedLoadFloat(const float *a)
+{
+    return _mm256_cvtps_pd(_mm_loadu_ps(a));
+}
+
+static inline Packed4 packedMin(const Packed4 a, const Packed4 b)
+{
+    return _mm256_min_pd(a, b);
+}
+
+static inline Packed4 packedMax(const Packed4 a, const Packed4 b)
+{
+    return _mm256_max_pd(a, b);
+}
+
+static inline unsigned packedLessEqual(const Packed4 a, const Packed4 b)
+{
+    return (unsigned)_mm256_movemask_pd(_mm256_cmp_pd(a, b, _CMP_LE_OQ));
+}
+
+// Transposes four rows into four columns
+static inline void packedTranspose(Packed4 rows[4])
+{
+    const __m256d t0 = _mm256_unpacklo_pd(rows[0], rows[1]);
+    const __m256d t1 = _mm256_unpackhi_pd(rows[0], rows[1]);
+    const __m256d t2 = _mm256_unpacklo_pd(rows[2], rows[3]);
+    const __m256d t3 = _mm256_unpackhi_pd(rows[2], rows[3]);
+    rows[0] = _mm256_permute2f128_pd(t0, t2, 0x20);
+    rows[1] = _mm256_permute2f128_pd(t1, t3, 0x20);
+    rows[2] = _mm256_permute2f128_pd(t0, t2, 0x31);
+    rows[3] = _mm256_permute2f128_pd(t1, t3, 0x31);
+}
+#elif defined(VECTORS_SIMD)
+typedef struct
+{
+    __m128d lo;
+    __m128d hi;
+} Packed4;
+
+static inline Packed4 packedLoad(const Scalar *a)
+{
+    return (Packed4){_mm_loadu_pd(a), _mm_loadu_pd(a + 2)};
+}
+
+static inline void packedStore(Scalar *dest, const Packed4 a)
+{
+    _mm_storeu_pd(dest, a.lo);
+    _mm_storeu_pd(dest + 2, a.hi);
+}
+
+static inline Packed4 packedSet(const Scalar a)
+{
+    return (Packed4){_mm_set1_pd(a), _mm_set1_pd(a)};
+}
+
+static inline Packed4 packedAdd(const Packed4 a, const Packed4 b)
+{
+    return (Packed4){_mm_add_pd(a.lo, b.lo), _mm_add_pd(a.hi, b.hi)};
+}
+
+static inline Packed4 packedSub(const Packed4 a, const Packed4 b)
+{
+    return (Packed4){_mm_sub_pd(a.lo, b.lo), _mm_sub_pd(a.hi, b.hi)};
+}
+
+static inline Packed4 packedMul(const Packed4 a, const Packed4 b)
+{
+    return (Packed4){_mm_mul_pd(a.lo, b.lo), _mm_mul_pd(a.hi, b.hi)};
+}
+
+static inline Packed4 packedDiv(const Packed4 a, const Packed4 b)
+{
+    return (Packed4){_mm_div_pd(a.lo, b.lo), _mm_div_pd(a.hi, b.hi)};
+}
+
+static inline Packed4 packedNeg(const Packed4 a)
+{
+    const __m128d sign = _mm_set1_pd(-0.0);
+    return (Packed4){_mm_xor_pd(a.lo, sign), _mm_xor_pd(a.hi, sign)};
+}
+
+static inline Packed4 packedSqrt(const Packed4 a)
+{
+    return (Packed4){_mm_sqrt_pd(a.lo), _mm_sqrt_pd(a.hi)};
+}
+
+static inline Packed4 packedLoadFloat(const float *a)
+{
+    const __m128 floats = _mm_loadu_ps(a);
+    return (Packed4){_mm_cvtps_pd(floats), _mm_cvtps_pd(_mm_movehl_ps(floats, floats))};
+}
+
+static inline Packed4 packedMin(const Packed4 a, const Packed4 b)
+{
+    return (Packed4){_mm_min_pd(a.lo, b.lo), _mm_min_pd(a.hi, b.hi)};
+}
+
+static inline Packed4 packedMax(const Packed4 a, const Packed4 b)
+{
+    return (Packed4){_mm_max_pd(a.lo, b.lo), _mm_max_pd(a.hi, b.hi)};
+}
+
+static inline unsigned packedLessEqual(const Packed4 a, const Packed4 b)
+{
+    return (unsigned)(_mm_movemask_pd(_mm_cmple_pd(a.lo, b.lo)) | _mm_movemask_pd(_mm_cmple_pd(a.hi, b.hi)) << 2);
+}
+
+// Transposes four rows into four columns
+static inline void packedTranspose(Packed4 rows[4])
+{
+    const Packed4 r0 = rows[0];
+    const Packed4 r1 = rows[1];
+    const Packed4 r2 = rows[2];
+    const Packed4 r3 = rows[3];
+    rows[0] = (Packed4){_mm_unpacklo_pd(r0.lo, r1.lo), _mm_unpacklo_pd(r2.lo, r3.lo)};
+    rows[1] = (Packed4){_mm_unpackhi_pd(r0.lo, r1.lo), _mm_unpackhi_pd(r2.lo, r3.lo)};
+    rows[2] = (Packed4){_mm_unpacklo_pd(r0.hi, r1.hi), _mm_unpacklo_pd(r2.hi, r3.hi)};
+    rows[3] = (Packed4){_mm_unpackhi_pd(r0.hi, r1.hi), _mm_unpackhi_pd(r2.hi, r3.hi)};
+}
+#else
+typedef struct
+{
+    Scalar elem[PACKED_WIDTH];
+} Packed4;
+
+static inline Packed4 packedLoad(const Scalar *a)
+{
+    return (Packed4){{a[0], a[1], a[2], a[3]}};
+}
+
+static inline void packedStore(Scalar *dest, const Packed4 a)
+{
+    for (size_t i = 0; i < PACKED_WIDTH; i++)
+    {
+        dest[i] = a.elem[i];
+    }
+}
+
+static inline Packed4 packedSet(const Scalar a)
+{
+    return (Packed4){{a, a, a, a}};
+}
+
+static inline Packed4 packedAdd(const Packed4 a, const Packed4 b)
+{
+    return (Packed4){{a.elem[0] + b.elem[0], a.elem[1] + b.elem[1], a.elem[2] + b.elem[2], a.elem[3] + b.elem[3]}};
+}
+
+static inline Packed4 packedSub(const Packed4 a, const Packed4 b)
+{
+    return (Packed4){{a.elem[0] - b.elem[0], a.elem[1] - b.elem[1], a.elem[2] - b.elem[2], a.elem[3] - b.elem[3]}};
+}
+
+static inline Packed4 packedMul(const Packed4 a, const Packed4 b)
+{
+    return (Packed4){{a.elem[0] * b.elem[0], a.elem[1] * b.elem[1], a.elem[2] * b.elem[2], a.elem[3] * b.elem[3]}};
+}
+
+static inline Packed4 packedDiv(const Packed4 a, const Packed4 b)
+{
+    return (Packed4){{a.elem[0] / b.elem[0], a.elem[1] / b.elem[1], a.elem[2] / b.elem[2], a.elem[3] / b.elem[3]}};
+}
+
+static inline Packed4 packedNeg(const Packed4 a)
+{
+    return (Packed4){{-a.elem[0], -a.elem[1], -a.elem[2], -a.elem[3]}};
+}
+
+static inline Packed4 packedSqrt(const Packed4 a)
+{
+    return (Packed4){{sqrt(a.elem[0]), sqrt(a.elem[1]), sqrt(a.elem[2]), sqrt(a.elem[3])}};
+}
+
+static inline Packed4 packedLoadFloat(const float *a)
+{
+    return (Packed4){{a[0], a[1], a[2], a[3]}};
+}
+
+static inline Packed4 packedMin(const Packed4 a, const Packed4 b)
+{
+    return (Packed4){{fmin(a.elem[0], b.elem[0]), fmin(a.elem[1], b.elem[1]), fmin(a.elem[2], b.elem[2]), fmin(a.elem[3], b.elem[3])}};
+}
+
+static inline Packed4 packedMax(const Packed4 a, const Packed4 b)
+{
+    return (Packed4){{fmax(a.elem[0], b.elem[0]), fmax(a.elem[1], b.elem[1]), fmax(a.elem[2], b.elem[2]), fmax(a.elem[3], b.elem[3])}};
+}
+
+static inline unsigned packedLessEqual(const Packed4 a, const Packed4 b)
+{
+    unsigned mask = 0;
+    for (size_t i = 0; i < PACKED_WIDTH; i++)
+    {
+        mask |= (unsigned)(a.elem[i] <= b.elem[i]) << i;
+    }
+    return mask;
+}
+
+// Transposes four rows into four columns
+static inline void packedTranspose(Packed4 rows[4])
+{
+    for (size_t i = 0; i < PACKED_WIDTH; i++)
+    {
+        for (size_t j = i + 1; j < PACKED_WIDTH; j++)
+        {
+            const Scalar swap = rows[i].elem[j];
+            rows[i].elem[j] = rows[j].elem[i];
+            rows[j].elem[i] = swap;
+        }
+    }
+}
+#endif
+
+#endif
@@ -4,15 +4,35 @@
  * Copyright (c) 2023, Dimitrios Alexopoulos All rights reserved.
  */
 
-#include <math.h>
+#include <float.h>
+#include <stdatomic.h>
 #include <stdint.h>
 #include <stdlib.h>
 #include <string.h>
+#include <tgmath.h>
 
+#include "bvh.h"
 #include "canvas.h"
+#include "grid.h"
+#include "packed.h"
 #include "rays.h"
+#include "tasks.h"
 #include "vectors.h"
 
+#define RENDER_TILE_SIZE 16
+
+_Static_assert(RAY_PACKET_SIZE == PACKED_WIDTH && RAY_PACKET_SIZE == BVH_PACKET_SIZE, "packets must fill the packed lanes");
+
+// Number of heap allocations made while tracing, see `traceAllocations()`
+static atomic_size_t allocationCount;
+
+// Counted `realloc`, used by every allocation of the intersection collections, trace contexts, batches and renderers
+static void *traceRealloc(void *ptr, const size_t size)
+{
+    atomic_fetch_add_explicit(&allocationCount, 1, memory_order_relaxed);
+    return realloc(ptr, size);
+}
+
 // TODO: Test if using `vec3Mag` and `vec3Norm` is faster than the `Vec4` variants
 
 // Intersection collection constructor.
@@ -21,7 +41,7 @@ void intersectionsCreate(Intersections *dest, const size_t size)
 {
     if (size != 0)
     {
-        dest->elem = malloc(sizeof(Intersection[size]));
+        dest->elem = traceRealloc(NULL, sizeof(Intersection[size]));
         if (dest->elem == NULL)
         {
             abort();
@@ -48,7 +68,7 @@ void intersectionsCopy(Intersections *dest, const Intersections *src)
         dest->elem = NULL;
         return;
     }
-    dest->elem = malloc(sizeof(Intersection[src->size]));
+    dest->elem = traceRealloc(NULL, sizeof(Intersection[src->size]));
     if (dest->elem == NULL)
     {
         abort();
@@ -113,7 +133,7 @@ void intersectionsResize(Intersections *dest, const size_t size)
         {
             dest->capacity = size;
         }
-        dest->elem = realloc(dest->elem, sizeof(Intersection[dest->capacity]));
+        dest->elem = traceRealloc(dest->elem, sizeof(Intersection[dest->capacity]));
         if (dest->elem == NULL)
         {
             abort();
@@ -135,8 +155,34 @@ Intersection intersectionPop(Intersections *dest)
     return dest->elem[dest->size];
 }
 
+// Returns the number of heap allocations made while tracing since the program started, by intersection collections,
+// trace contexts (including their occluder storage), batches and renderers.
+// Info: Used to check that tracing with a warmed up `TraceContext` does not allocate, building worlds is not counted
+size_t traceAllocations(void)
+{
+    return atomic_load_explicit(&allocationCount, memory_order_relaxed);
+}
+
+// Trace context constructor
+void traceContextCreate(TraceContext *dest)
+{
+    intersectionsCreate(&dest->intersections, 0);
+    dest->occluderCount = 0;
+    dest->occluders = NULL;
+    dest->shadows = (ShadowStats){0, 0, 0};
+}
+
+// Trace context destructor
+void traceContextDestroy(TraceContext *dest)
+{
+    intersectionsDestroy(&dest->intersections);
+    free(dest->occluders);
+    dest->occluders = NULL;
+    dest->occluderCount = 0;
+}
+
 // Returns a point on the ray
-Vec4 rayPos(const Ray ray, const double t)
+Vec4 rayPos(const Ray ray, const Scalar t)
 {
     return vec4Add(ray.origin, vec4Mul(ray.direction, t));
 }
@@ -149,61 +195,162 @@ Ray rayTransform(Ray ray, const Mat4 mat)
     return ray;
 }
 
+// Returns a ray that has been transformed by an affine transformation
+Ray rayTransformAffine(Ray ray, const Affine transform)
+{
+    ray.origin = affinePointMul(transform, ray.origin);
+    ray.direction = affineVecMul(transform, ray.direction);
+    return ray;
+}
+
 // Returns a ray from the camera passing through the chosen pixel on the canvas
 Ray rayPixel(const Camera camera, const size_t x, const size_t y)
 {
-    const double xOffset = (x + 0.5) * camera.pixelSize;
-    const double yOffset = (y + 0.5) * camera.pixelSize;
-    const double worldX = camera.halfWidth - xOffset;
-    const double worldY = camera.halfHeight - yOffset;
-    const Vec4 pixel = mat4VecMul(camera.transformInv, point(worldX, worldY, -1));
-    const Vec4 origin = mat4VecMul(camera.transformInv, point(0, 0, 0));
+    const Scalar xOffset = ((Scalar)x + (Scalar)0.5) * camera.pixelSize;
+    const Scalar yOffset = ((Scalar)y + (Scalar)0.5) * camera.pixelSize;
+    const Scalar worldX = camera.halfWidth - xOffset;
+    const Scalar worldY = camera.halfHeight - yOffset;
+    const Vec4 pixel = affinePointMul(camera.transformInv, point(worldX, worldY, -1));
+    const Vec4 origin = affinePointMul(camera.transformInv, point(0, 0, 0));
     return (Ray){origin, vec4Norm(vec4Sub(pixel, origin))};
 }
 
+typedef struct
+{
+    const Shape *shape;
+    Ray ray;                      // in object space
+    Intersections *intersections; // collects every intersection if not NULL
+    bool any;
+    Scalar t;
+    size_t triangle; // of the closest intersection, SIZE_MAX if there is none
+} MeshTraversal;
+
+// Keeps the closest intersection between zero and the search distance of a triangle reached in the mesh's hierarchy,
+// shrinking the search distance, or collects every intersection
+static bool meshLeaf(void *context, const size_t triangle, Scalar *tMax)
+{
+    MeshTraversal *traversal = context;
+    Scalar t;
+    if (!meshTriangleHit(traversal->shape->mesh, triangle, traversal->ray.origin, traversal->ray.direction, &t))
+    {
+        return false;
+    }
+    if (traversal->intersections != NULL)
+    {
+        intersectionsPush(traversal->intersections, (Intersection){traversal->shape, t, (uint32_t)triangle, NULL});
+        return false;
+    }
+    if (t >= 0 && t < *tMax)
+    {
+        traversal->t = t;
+        traversal->triangle = triangle;
+        *tMax = t;
+        return traversal->any;
+    }
+    return false;
+}
+
+// Finds the closest intersection between the object space ray and a mesh shape between zero and `tMax`,
+// shrinking `tMax` and storing the triangle. Returns false if there is none.
+// If `any` is set, stops at the first intersection found instead.
+static bool meshClosest(const Shape *shape, const Ray ray, Scalar *tMax, size_t *triangle, const bool any)
+{
+    MeshTraversal traversal = {shape, ray, NULL, any, *tMax, SIZE_MAX};
+    bvhTraverse(&shape->mesh->bvh, ray.origin, ray.direction, 0, *tMax, meshLeaf, &traversal);
+    if (traversal.triangle == SIZE_MAX)
+    {
+        return false;
+    }
+    *tMax = traversal.t;
+    *triangle = traversal.triangle;
+    return true;
+}
+
 // Returns the intersection between a shape and a ray
-Intersections intersect(const Shape shape, Ray ray)
+Intersections intersect(const Shape *shape, const Ray ray)
+{
+    Intersections shapeIntersections;
+    intersectionsCreate(&shapeIntersections, 0);
+    intersectInto(&shapeIntersections, shape, ray);
+    if (shape->type == MESH && shapeIntersections.size > 0)
+    {
+        intersectionsSort(&shapeIntersections);
+    }
+    return shapeIntersections;
+}
+
+// Appends the intersections between a shape and a ray to the collection.
+// Info: Only allocates if the collection has to grow, the intersections of a mesh are appended in no particular order
+void intersectInto(Intersections *dest, const Shape *shape, const Ray ray)
+{
+    if (shape->type == MESH)
+    {
+        MeshTraversal traversal = {shape, rayTransformAffine(ray, shape->transformInv), dest, false, INFINITY, SIZE_MAX};
+        bvhTraverse(&shape->mesh->bvh, traversal.ray.origin, traversal.ray.direction, -INFINITY, INFINITY, meshLeaf, &traversal);
+        return;
+    }
+    Scalar t[SHAPE_MAX_INTERSECTIONS];
+    const size_t count = intersectShape(shape, ray, t);
+    for (size_t i = 0; i < count; i++)
+    {
+        intersectionsPush(dest, (Intersection){shape, t[i], 0, NULL});
+    }
+}
+
+// Stores the distances at which the ray intersects the shape in ascending order and returns how many there are.
+// Info: Meshes only store their closest intersection in front of the ray, see `intersect` for all of them
+size_t intersectShape(const Shape *shape, Ray ray, Scalar t[SHAPE_MAX_INTERSECTIONS])
 {
-    ray = rayTransform(ray, shape.transformInv);
-    switch (shape.type)
+    ray = rayTransformAffine(ray, shape->transformInv);
+    switch (shape->type)
     {
     case SPHERE:
     {
         // NOTE: It may be faster to do these operations using Vec3 functions
         const Vec4 sphereToRay = vec4Sub(ray.origin, point(0, 0, 0));
-        const double a = vec4Dot(ray.direction, ray.direction);
-        const double b = 2 * vec4Dot(ray.direction, sphereToRay);
-        const double c = vec4Dot(sphereToRay, sphereToRay) - 1;
-        const double discriminant = (b * b) - (4 * a * c);
-        Intersections sphereIntersections;
+        const Scalar a = vec4Dot(ray.direction, ray.direction);
+        const Scalar b = 2 * vec4Dot(ray.direction, sphereToRay);
+        const Scalar c = vec4Dot(sphereToRay, sphereToRay) - 1;
+        // b^2 - 4ac rewritten as 4a(1 - l.l), where l is the offset from the center to the closest point on the ray,
+        // avoiding catastrophic cancellation for distant or strongly scaled spheres
+        const Vec4 closest = vec4Sub(sphereToRay, vec4Mul(ray.direction, b / (2 * a)));
+        const Scalar discriminant = 4 * a * (1 - vec4Dot(closest, closest));
         if (discriminant < 0)
         {
-            intersectionsCreate(&sphereIntersections, 0);
-            return sphereIntersections;
+            return 0;
+        }
+        // Both roots from q, so -b and the root of the discriminant are never subtracted
+        const Scalar q = -(b + copysign(sqrt(discriminant), b)) / 2;
+        if (q == 0)
+        {
+            t[0] = t[1] = 0; // Grazing ray starting on the sphere
+            return 2;
         }
-        double point1 = (-b - sqrt(discriminant)) / (2 * a);
-        double point2 = (-b + sqrt(discriminant)) / (2 * a);
-        intersectionsCreate(&sphereIntersections, 2);
-        sphereIntersections.elem[0].shape = shape;
-        sphereIntersections.elem[1].shape = shape;
-        sphereIntersections.elem[0].t = point1;
-        sphereIntersections.elem[1].t = point2;
-        return sphereIntersections;
+        const Scalar t0 = c / q;
+        const Scalar t1 = q / a;
+        t[0] = fmin(t0, t1);
+        t[1] = fmax(t0, t1);
+        return 2;
     }
     case PLANE:
     {
-        Intersections planeIntersections;
         if (fabs(ray.direction.y) < MAT_EPSILON)
         {
-            intersectionsCreate(&planeIntersections, 0);
+            return 0;
         }
-        else
+        t[0] = -ray.origin.y / ray.direction.y;
+        return 1;
+    }
+    case MESH:
+    {
+        Scalar tMax = INFINITY;
+        size_t triangle;
+        if (!meshClosest(shape, ray, &tMax, &triangle, false))
         {
-            intersectionsCreate(&planeIntersections, 1);
-            planeIntersections.elem[0].shape = shape;
-            planeIntersections.elem[0].t = -ray.origin.y / ray.direction.y;
+            return 0;
         }
-        return planeIntersections;
+        t[0] = tMax;
+        return 1;
     }
     default:
         abort(); // TODO: Remove
@@ -211,7 +358,7 @@ Intersections intersect(const Shape shape, Ray ray)
 }
 
 // Returns the "hit" (first non-negative) intersection.
-// If a "hit" does exist, an intersection with a `NO_HIT` shape type is returned.
+// If a "hit" does not exist, an intersection with a NULL shape is returned.
 // Important: The intersection collection needs to be sorted.
 Intersection hit(const Intersections intersections)
 {
@@ -222,38 +369,57 @@ Intersection hit(const Intersections intersections)
             return intersections.elem[i];
         }
     }
-    return (Intersection){{NO_HIT, {{0}}, {{0}}, {0}}, -1};
+    return (Intersection){NULL, -1, 0, NULL};
 }
 
 // Returns the vector normal to the shape at point on the surfaces point.
-// Important: The point must be on the shape's surface.
-Vec4 normal(const Shape shape, Vec4 point)
+// Important: The point must be on the shape's surface, meshes need the intersected triangle (see `normalAtHit`).
+Vec4 normal(const Shape *shape, Vec4 point)
 {
-    switch (shape.type)
+    switch (shape->type)
     {
     case SPHERE:
     {
-        point = mat4VecMul(shape.transformInv, point); // move outside of switch for other shapes
-        point = vec4Sub(point, point(0, 0, 0));
-        point = mat4VecMul(mat4Trans(shape.transformInv), point);
+        point = affinePointMul(shape->transformInv, point); // move outside of switch for other shapes
+        point.xyz = mat3VecMul(shape->normalMatrix, point.xyz);
         point.w = 0;
         return vec4Norm(point);
     }
     case PLANE:
     {
-        point = mat4VecMul(mat4Trans(shape.transformInv), vector(0, 1, 0));
-        point.w = 0;
-        return point;
+        return vector(shape->normalMatrix.elem[0][1], shape->normalMatrix.elem[1][1], shape->normalMatrix.elem[2][1]);
     }
     default:
         abort();
     }
 }
 
+// Returns the vector normal to the surface at the point of an intersection, interpolating the normals of a mesh's triangle.
+// Important: The point must be the position of the intersection
+Vec4 normalAtHit(const Intersection intersection, const Vec4 point)
+{
+    const Shape *shape = intersection.shape;
+    if (intersection.instance != NULL)
+    {
+        // Normal in the space of the group, carried to world space by the inverse transpose of the instance
+        const Affine inverse = intersection.instance->transformInv;
+        const Intersection groupHit = {shape, intersection.t, intersection.triangle, NULL};
+        return vec4Norm(affineNormalMul(inverse, normalAtHit(groupHit, affinePointMul(inverse, point))));
+    }
+    if (shape->type != MESH)
+    {
+        return normal(shape, point);
+    }
+    const Vec3 objectNormal = meshNormal(shape->mesh, intersection.triangle, affinePointMul(shape->transformInv, point));
+    Vec4 worldNormal = vector(0, 0, 0);
+    worldNormal.xyz = mat3VecMul(shape->normalMatrix, objectNormal);
+    return vec4Norm(worldNormal);
+}
+
 // Returns the value of light received by the camera on the point on a shape.
 // Important: Ensure vectors are normalized.
 // TODO: Remove material parameter
-Vec3 lighting(const Material material, const Shape object, const Light light, const Vec4 point, const Vec4 camera, const Vec4 normal, const bool inShadow)
+Vec3 lighting(const Material material, const Shape *object, const Light light, const Vec4 point, const Vec4 camera, const Vec4 normal, const bool inShadow)
 {
     Vec3 color;
     if (material.hasPattern)
@@ -269,7 +435,7 @@ Vec3 lighting(const Material material, const Shape object, const Light light, co
     const Vec3 ambient = vec3Mul(effectiveColor, material.ambient);
     Vec3 diffuse;
     Vec3 specular;
-    const double lightDotNormal = vec4Dot(vecLight, normal);
+    const Scalar lightDotNormal = vec4Dot(vecLight, normal);
     if (inShadow || signbit(lightDotNormal)) // NOTE: Test if < 0 is better for branch prediction
     {
         diffuse = color(0, 0, 0); // NOTE: Test if the use of compound literals affects performance
@@ -279,7 +445,7 @@ Vec3 lighting(const Material material, const Shape object, const Light light, co
     {
         diffuse = vec3Mul(effectiveColor, material.diffuse * lightDotNormal);
         const Vec4 vecReflect = vec4Reflect(vec4Neg(vecLight), normal);
-        const double reflectDotCamera = vec4Dot(vecReflect, camera);
+        const Scalar reflectDotCamera = vec4Dot(vecReflect, camera);
         if (reflectDotCamera <= 0)
         {
             specular = color(0, 0, 0);
@@ -295,12 +461,48 @@ Vec3 lighting(const Material material, const Shape object, const Light light, co
 // World destructor
 void worldDestroy(World *world)
 {
+    worldDestroyBvh(world);
+    worldDestroyGrid(world);
+    worldDestroyArrays(world);
     free(world->lights);
     free(world->shapes);
+    free(world->instances);
     world->lightCount = 0;
     world->shapeCount = 0;
+    world->instanceCount = 0;
     world->lights = NULL;
     world->shapes = NULL;
+    world->instances = NULL;
+}
+
+// Computes the bounds of the shapes of the group and builds the bounding volume hierarchy shared by its instances.
+// Important: Rebuild after adding, removing or transforming shapes, then rebuild the hierarchies of the worlds using it
+// If the allocation fails, `abort()` is called
+void groupBuild(Group *group)
+{
+    World shapes = {.shapeCount = group->shapeCount, .shapes = group->shapes, .bvh = group->bvh};
+    worldBuildBvh(&shapes);
+    group->bvh = shapes.bvh;
+    group->bounds = boundsEmpty();
+    for (size_t i = 0; i < group->shapeCount; i++)
+    {
+        group->bounds = boundsUnion(group->bounds, shapeBounds(&group->shapes[i]));
+    }
+}
+
+// Group destructor
+void groupDestroy(Group *group)
+{
+    if (group->bvh != NULL)
+    {
+        bvhDestroy(group->bvh);
+        free(group->bvh);
+        group->bvh = NULL;
+    }
+    free(group->shapes);
+    group->shapeCount = 0;
+    group->shapes = NULL;
+    group->bounds = boundsEmpty();
 }
 
 // Returns the default world
@@ -317,6 +519,11 @@ World defaultWorld(void)
     world.shapes[0].material.diffuse = 0.7;
     world.shapes[0].material.specular = 0.2;
     world.shapes[1] = sphere(scaling(0.5, 0.5, 0.5), MATERIAL);
+    world.bvh = NULL;
+    world.arrays = NULL;
+    world.instanceCount = 0;
+    world.instances = NULL;
+    world.grid = NULL;
     if (world.lights == NULL || world.shapes == NULL)
     {
         abort();
@@ -324,148 +531,1340 @@ World defaultWorld(void)
     return world;
 }
 
-// Calculates the intersections between the ray and the shapes in the world,
-// returning them as a sorted intersection collection.
-Intersections intersectWorld(World world, Ray ray)
+// Returns the bounds of finite bounds after an affine transformation, padded against rounding
+static Bounds boundsTransform(const Affine transform, const Bounds objectBounds)
 {
-    Intersections worldIntersections;
-    intersectionsCreate(&worldIntersections, 0);
-    for (size_t i = 0; i < world.shapeCount; i++)
+    const Vec3 center = boundsCentroid(objectBounds);
+    const Vec3 half = vec3Mul(vec3Sub(objectBounds.max, objectBounds.min), 0.5);
+    Bounds bounds;
+    for (size_t i = 0; i < 3; i++)
+    {
+        Scalar middle = transform.elem[i][3];
+        Scalar extent = 0;
+        for (size_t j = 0; j < 3; j++)
+        {
+            middle += transform.elem[i][j] * center.elem[j];
+            extent += fabs(transform.elem[i][j]) * half.elem[j];
+        }
+        extent = extent * (1 + 4 * SCALAR_EPSILON) + fabs(middle) * 4 * SCALAR_EPSILON;
+        bounds.min.elem[i] = middle - extent;
+        bounds.max.elem[i] = middle + extent;
+    }
+    return bounds;
+}
+
+// Returns the world space bounds of a shape, planes are unbounded
+Bounds shapeBounds(const Shape *shape)
+{
+    switch (shape->type)
     {
-        Intersections shapeIntersections = intersect(world.shapes[i], ray);
-        for (size_t j = 0; j < shapeIntersections.size; j++)
+    case SPHERE:
+    {
+        // Bounds of the transformed unit cube enclosing the sphere, padded against rounding
+        Bounds bounds;
+        for (size_t i = 0; i < 3; i++)
         {
-            intersectionsPush(&worldIntersections, shapeIntersections.elem[j]);
+            const Scalar extent = (fabs(shape->transform.elem[i][0]) + fabs(shape->transform.elem[i][1]) +
+                                   fabs(shape->transform.elem[i][2])) *
+                                  (1 + 4 * SCALAR_EPSILON);
+            bounds.min.elem[i] = shape->transform.elem[i][3] - extent;
+            bounds.max.elem[i] = shape->transform.elem[i][3] + extent;
         }
-        intersectionsDestroy(&shapeIntersections);
+        return bounds;
     }
-    if (worldIntersections.size > 0)
+    case PLANE:
+        return (Bounds){{{-INFINITY, -INFINITY, -INFINITY}}, {{INFINITY, INFINITY, INFINITY}}};
+    case MESH:
     {
-        intersectionsSort(&worldIntersections);
+        if (!boundsFinite(shape->mesh->bounds))
+        {
+            return boundsEmpty();
+        }
+        return boundsTransform(shape->transform, shape->mesh->bounds);
+    }
+    default:
+        abort();
     }
-    return worldIntersections;
 }
 
-// Returns weather a certain point is shadowed by the light at the given index in the world
-// Important: `lightIndex` begins at zero
-bool isShadowed(const World world, const size_t lightIndex, const Vec4 point)
+// Returns the world space bounds of an instance, unbounded if its group is empty or has unbounded shapes
+static Bounds instanceBounds(const Instance *instance)
 {
-    Vec4 vec = vec4Sub(world.lights[lightIndex].position, point);
-    Ray ray = {point, vec4Norm(vec)};
-    Intersections lightIntersections = intersectWorld(world, ray);
-    Intersection lightHit = hit(lightIntersections);
-    intersectionsDestroy(&lightIntersections);
-    if (lightHit.shape.type != NO_HIT && lightHit.t < vec4Mag(vec))
+    const Bounds groupBounds = instance->group->bounds;
+    if (!boundsFinite(groupBounds))
     {
-        return true;
+        return groupBounds;
     }
-    else
+    return boundsTransform(affineInv(instance->transformInv), groupBounds);
+}
+
+// Returns the bounds of the shapes of the world followed by those of its instances, the primitives of its hierarchy.
+// If the allocation fails, `abort()` is called
+static Bounds *worldBounds(const World *world)
+{
+    Bounds *bounds = malloc(sizeof(Bounds[world->shapeCount + world->instanceCount + 1]));
+    if (bounds == NULL)
     {
-        return false;
+        abort();
+    }
+    for (size_t i = 0; i < world->shapeCount; i++)
+    {
+        bounds[i] = shapeBounds(&world->shapes[i]);
     }
+    for (size_t i = 0; i < world->instanceCount; i++)
+    {
+        bounds[world->shapeCount + i] = instanceBounds(&world->instances[i]);
+    }
+    return bounds;
 }
 
-// Pre-computes certain vectors and returns a Computations object
-Computations prepareComputations(const Intersection intersection, const Ray ray)
+// Builds a bounding volume hierarchy over the shapes and instances of the world, used by `intersectWorld`.
+// The instances are the leaves of this top level, the hierarchies of their groups are the bottom level.
+// Important: Rebuild after adding, removing or transforming shapes or instances, or refit (see `worldRefitBvh`)
+// after only transforming them
+// If the allocation fails, `abort()` is called
+void worldBuildBvh(World *world)
 {
-    Computations computations;
-    computations.shape = intersection.shape;
-    computations.t = intersection.t;
-    computations.point = rayPos(ray, intersection.t);
-    computations.camera = vec4Neg(ray.direction);
-    computations.normal = normal(intersection.shape, computations.point);
-    if (vec4Dot(computations.normal, computations.camera) < 0)
+    worldBuildBvhWith(world, BVH_BUILD_DEFAULT, NULL);
+}
+
+// Builds the bounding volume hierarchy of the world as `worldBuildBvh` does with the given options, storing its
+// build time and quality in `stats` unless it is NULL.
+// If the allocation fails, `abort()` is called
+void worldBuildBvhWith(World *world, const BvhBuildOptions options, BvhStats *stats)
+{
+    worldDestroyBvh(world);
+    world->bvh = malloc(sizeof(Bvh));
+    if (world->bvh == NULL)
     {
-        computations.normal = vec4Neg(computations.normal);
-        computations.inside = true;
+        abort();
     }
-    else
+    Bounds *bounds = worldBounds(world);
+    bvhBuildWith(world->bvh, bounds, world->shapeCount + world->instanceCount, options, stats);
+    free(bounds);
+}
+
+// Refits the bounding volume hierarchy of the world to its moved shapes and instances in time linear in their number,
+// unless refitting makes the tree more than `rebuildRatio` times as costly to trace as when it was built, in which
+// case it is rebuilt with the options. Returns true if the hierarchy was rebuilt.
+// Important: The hierarchy must be built and shapes or instances must not have been added, removed or made unbounded
+// since
+// If the allocation fails, `abort()` is called
+bool worldRefitBvh(World *world, const BvhBuildOptions options, const Scalar rebuildRatio)
+{
+    Bounds *bounds = worldBounds(world);
+    const bool rebuild = bvhRefit(world->bvh, bounds) > world->bvh->sahCost * rebuildRatio;
+    if (rebuild)
     {
-        computations.inside = false;
+        bvhDestroy(world->bvh);
+        bvhBuildWith(world->bvh, bounds, world->shapeCount + world->instanceCount, options, NULL);
     }
-    computations.overPoint = vec4Add(computations.point, vec4Mul(computations.normal, MAT_EPSILON));
-    return computations;
+    free(bounds);
+    return rebuild;
 }
 
-// Calculates the color of a certain point
-Vec3 shadeHit(const World world, const Computations computations)
+// World bounding volume hierarchy destructor
+void worldDestroyBvh(World *world)
 {
-    Vec3 hitColor = color(0, 0, 0);
-    for (size_t i = 0; i < world.lightCount; i++)
+    if (world->bvh != NULL)
     {
-        hitColor = vec3Add(hitColor,
-                           lighting(computations.shape.material, computations.shape,
-                                    world.lights[i],
-                                    computations.point,
-                                    computations.camera,
-                                    computations.normal,
-                                    isShadowed(world, i, computations.overPoint)));
+        bvhDestroy(world->bvh);
+        free(world->bvh);
+        world->bvh = NULL;
     }
-    return hitColor;
 }
 
-// Returns the color that the ray receives in the world
-Vec3 colorAt(const World world, const Ray ray)
+// Builds a uniform grid over the shapes and instances of the world, used by `intersectClosest` and `intersectAny`
+// when there is no bounding volume hierarchy. Much faster to build than a hierarchy for many shapes of about the same
+// size spread evenly, such as particles.
+// Important: Rebuild after adding, removing or transforming shapes or instances
+// If the allocation fails, `abort()` is called
+void worldBuildGrid(World *world)
 {
-    Intersections worldIntersections = intersectWorld(world, ray);
-    const Intersection rayHit = hit(worldIntersections);
-    intersectionsDestroy(&worldIntersections);
-    if (rayHit.shape.type == NO_HIT)
+    worldDestroyGrid(world);
+    world->grid = malloc(sizeof(Grid));
+    if (world->grid == NULL)
     {
-        return color(0, 0, 0);
+        abort();
     }
-    else
+    Bounds *bounds = worldBounds(world);
+    gridBuild(world->grid, bounds, world->shapeCount + world->instanceCount);
+    free(bounds);
+}
+
+// World grid destructor
+void worldDestroyGrid(World *world)
+{
+    if (world->grid != NULL)
     {
-        Computations computations = prepareComputations(rayHit, ray);
-        return shadeHit(world, computations);
+        gridDestroy(world->grid);
+        free(world->grid);
+        world->grid = NULL;
     }
 }
 
-// Camera constructor
-Camera cameraInit(const size_t hsize, const size_t vsize, const double fov, const Mat4 transform)
+// Builds the structure of arrays copy of the shapes of the world, used by `intersectClosest` and `intersectAny`
+// when there is no bounding volume hierarchy or grid.
+// Important: Rebuild after adding, removing or transforming shapes
+// If the allocation fails, `abort()` is called
+void worldBuildArrays(World *world)
 {
-    Camera camera = {hsize, vsize, fov, .transform = transform,
-                     .transformInv = mat4Inv(transform)};
-    const double halfView = tan(camera.fov / 2);
-    const double aspect = (double)hsize / vsize;
-    if (aspect >= 1)
+    worldDestroyArrays(world);
+    ShapeArrays *arrays = malloc(sizeof(ShapeArrays));
+    if (arrays == NULL)
     {
-        camera.halfWidth = halfView;
-        camera.halfHeight = halfView / aspect;
+        abort();
+    }
+    size_t typeCounts[SHAPE_TYPE_COUNT] = {0};
+    for (size_t i = 0; i < world->shapeCount; i++)
+    {
+        typeCounts[world->shapes[i].type]++;
+    }
+    arrays->count = 0;
+    for (size_t type = 0; type < SHAPE_TYPE_COUNT; type++)
+    {
+        arrays->groupStart[type] = arrays->count;
+        arrays->count += (typeCounts[type] + PACKED_WIDTH - 1) / PACKED_WIDTH * PACKED_WIDTH;
+    }
+    arrays->groupStart[SHAPE_TYPE_COUNT] = arrays->count;
+    Scalar *coefficients = malloc(sizeof(Scalar[12][arrays->count + 1]));
+    arrays->types = malloc(sizeof(ShapeType[arrays->count + 1]));
+    arrays->materials = malloc(sizeof(size_t[arrays->count + 1]));
+    if (coefficients == NULL || arrays->types == NULL || arrays->materials == NULL)
+    {
+        abort();
+    }
+    for (size_t row = 0; row < 3; row++)
+    {
+        for (size_t col = 0; col < 4; col++)
+        {
+            arrays->inverse[row][col] = &coefficients[(row * 4 + col) * arrays->count];
+        }
+    }
+    size_t next[SHAPE_TYPE_COUNT];
+    for (size_t type = 0; type < SHAPE_TYPE_COUNT; type++)
+    {
+        next[type] = arrays->groupStart[type];
+    }
+    for (size_t i = 0; i < world->shapeCount; i++)
+    {
+        const ShapeType type = world->shapes[i].type;
+        arrays->types[next[type]] = type;
+        arrays->materials[next[type]++] = i;
+    }
+    // Padding gets the identity, so the kernels compute finite values for it
+    for (size_t type = 0; type < SHAPE_TYPE_COUNT; type++)
+    {
+        for (; next[type] < arrays->groupStart[type + 1]; next[type]++)
+        {
+            arrays->types[next[type]] = type;
+            arrays->materials[next[type]] = SIZE_MAX;
+        }
+    }
+    for (size_t i = 0; i < arrays->count; i++)
+    {
+        const Affine inverse = arrays->materials[i] != SIZE_MAX ? world->shapes[arrays->materials[i]].transformInv
+                                                                : affineFromMat4(IDENTITY);
+        for (size_t row = 0; row < 3; row++)
+        {
+            for (size_t col = 0; col < 4; col++)
+            {
+                arrays->inverse[row][col][i] = inverse.elem[row][col];
+            }
+        }
+    }
+    world->arrays = arrays;
+}
+
+// World structure of arrays destructor
+void worldDestroyArrays(World *world)
+{
+    if (world->arrays != NULL)
+    {
+        free(world->arrays->inverse[0][0]);
+        free(world->arrays->types);
+        free(world->arrays->materials);
+        free(world->arrays);
+        world->arrays = NULL;
+    }
+}
+
+// Primitives of a world are its shapes followed by its instances
+typedef struct
+{
+    const World *world;
+    Ray ray;
+    Intersections *intersections;
+    Intersection closest;
+    size_t occluder; // primitive that stopped an any-hit traversal, SIZE_MAX if none
+} WorldTraversal;
+
+static void worldAll(WorldTraversal *traversal);
+static void worldClosest(WorldTraversal *traversal, Scalar *tMax);
+static bool worldAny(WorldTraversal *traversal, Scalar tMax);
+
+// Returns the shapes of a group as a world without lights or instances
+static World groupWorld(const Group *group)
+{
+    return (World){0, group->shapeCount, NULL, group->shapes, group->bvh, NULL, 0, NULL, NULL};
+}
+
+// Returns the traversal of the group of an instance with the ray of a world traversal moved into the group's space,
+// collecting into the same intersections. `group` stores the world of the group.
+static WorldTraversal instanceTraversal(const WorldTraversal *traversal, const Instance *instance, World *group)
+{
+    *group = groupWorld(instance->group);
+    return (WorldTraversal){group, rayTransformAffine(traversal->ray, instance->transformInv), traversal->intersections,
+                            {NULL, -1, 0, NULL}, SIZE_MAX};
+}
+
+// Adds the intersections of a shape or instance reached in the hierarchy
+static bool intersectLeaf(void *context, const size_t shape, Scalar *tMax)
+{
+    (void)tMax;
+    WorldTraversal *traversal = context;
+    const World *world = traversal->world;
+    if (shape >= world->shapeCount)
+    {
+        const Instance *instance = &world->instances[shape - world->shapeCount];
+        const size_t start = traversal->intersections->size;
+        World group;
+        WorldTraversal groupTraversal = instanceTraversal(traversal, instance, &group);
+        worldAll(&groupTraversal);
+        for (size_t i = start; i < traversal->intersections->size; i++)
+        {
+            traversal->intersections->elem[i].instance = instance;
+        }
+        return false;
+    }
+    intersectInto(traversal->intersections, &world->shapes[shape], traversal->ray);
+    return false;
+}
+
+// Keeps the closest non-negative intersection of a shape or instance reached in the hierarchy, shrinking the
+// search distance
+static bool closestLeaf(void *context, const size_t shape, Scalar *tMax)
+{
+    WorldTraversal *traversal = context;
+    const World *world = traversal->world;
+    if (shape >= world->shapeCount)
+    {
+        // Distances along the transformed ray are the same as along the world space ray
+        const Instance *instance = &world->instances[shape - world->shapeCount];
+        World group;
+        WorldTraversal groupTraversal = instanceTraversal(traversal, instance, &group);
+        worldClosest(&groupTraversal, tMax);
+        if (groupTraversal.closest.shape != NULL)
+        {
+            traversal->closest = groupTraversal.closest;
+            traversal->closest.instance = instance;
+        }
+        return false;
+    }
+    const Shape *object = &world->shapes[shape];
+    if (object->type == MESH)
+    {
+        size_t triangle;
+        if (meshClosest(object, rayTransformAffine(traversal->ray, object->transformInv), tMax, &triangle, false))
+        {
+            traversal->closest = (Intersection){object, *tMax, (uint32_t)triangle, NULL};
+        }
+        return false;
+    }
+    Scalar t[SHAPE_MAX_INTERSECTIONS];
+    const size_t count = intersectShape(object, traversal->ray, t);
+    for (size_t i = 0; i < count; i++)
+    {
+        if (t[i] >= 0 && t[i] < *tMax)
+        {
+            traversal->closest = (Intersection){object, t[i], 0, NULL};
+            *tMax = t[i];
+        }
+    }
+    return false;
+}
+
+// Stops the traversal at the first shape or instance intersected between zero and the search distance
+static bool anyLeaf(void *context, const size_t shape, Scalar *tMax)
+{
+    WorldTraversal *traversal = context;
+    const World *world = traversal->world;
+    bool blocked = false;
+    if (shape >= world->shapeCount)
+    {
+        World group;
+        WorldTraversal groupTraversal = instanceTraversal(traversal, &world->instances[shape - world->shapeCount], &group);
+        blocked = worldAny(&groupTraversal, *tMax);
+    }
+    else if (world->shapes[shape].type == MESH)
+    {
+        const Shape *object = &world->shapes[shape];
+        Scalar limit = *tMax;
+        size_t triangle;
+        blocked = meshClosest(object, rayTransformAffine(traversal->ray, object->transformInv), &limit, &triangle, true);
     }
     else
     {
-        camera.halfWidth = halfView * aspect;
-        camera.halfHeight = halfView;
+        Scalar t[SHAPE_MAX_INTERSECTIONS];
+        const size_t count = intersectShape(&world->shapes[shape], traversal->ray, t);
+        for (size_t i = 0; i < count && !blocked; i++)
+        {
+            blocked = t[i] >= 0 && t[i] < *tMax;
+        }
     }
-    camera.pixelSize = (camera.halfWidth * 2) / hsize;
-    return camera;
+    if (blocked)
+    {
+        traversal->occluder = shape; // the instance rather than the shape of its group
+    }
+    return blocked;
 }
 
-// Renders the world from a given camera
-Canvas *render(const Camera camera, const World world)
+// Transforms one row of `PACKED_WIDTH` rays by the matching row of transformations, storing the origin and
+// direction coordinates. Either the rays or the transformations may be the same in every lane.
+// Info: Follows the operation order of `affinePointMul` and `affineVecMul`
+static inline void packedTransformRow(const Packed4 m[4], const Packed4 origin[3], const Packed4 direction[3], Packed4 *o, Packed4 *d)
 {
-    Canvas *image = canvasCreate(camera.hsize, camera.vsize);
-    if (image == NULL) // Move canvas error handling code inside the canvas functions
+    const Packed4 linear = packedAdd(packedMul(origin[0], m[0]), packedMul(origin[1], m[1]));
+    *o = packedAdd(packedAdd(linear, packedMul(origin[2], m[2])), m[3]);
+    *d = packedAdd(packedAdd(packedMul(direction[0], m[0]), packedMul(direction[1], m[1])), packedMul(direction[2], m[2]));
+}
+
+// Dot product of `PACKED_WIDTH` pairs of vectors, adding the zero `w` product as `vec4Dot` does
+static inline Packed4 packedDot(const Packed4 a[3], const Packed4 b[3])
+{
+    const Packed4 xyz = packedAdd(packedAdd(packedMul(a[0], b[0]), packedMul(a[1], b[1])), packedMul(a[2], b[2]));
+    return packedAdd(xyz, packedSet(0));
+}
+
+// Intersects `PACKED_WIDTH` object space rays with the unit sphere, storing both distances in ascending order.
+// Returns a mask of the lanes that intersect.
+// Info: Follows the operation order of `intersectShape`, so both produce identical distances
+static unsigned packedSphereHits(const Packed4 o[3], const Packed4 d[3], Scalar near[PACKED_WIDTH], Scalar far[PACKED_WIDTH])
+{
+    const Packed4 a = packedDot(d, d);
+    const Packed4 b = packedMul(packedSet(2), packedDot(d, o));
+    const Packed4 c = packedSub(packedDot(o, o), packedSet(1));
+    const Packed4 scale = packedDiv(b, packedMul(packedSet(2), a));
+    Packed4 closest[3];
+    for (size_t axis = 0; axis < 3; axis++)
     {
-        abort();
+        closest[axis] = packedSub(o[axis], packedMul(d[axis], scale));
+    }
+    const Packed4 discriminant = packedMul(packedMul(packedSet(4), a), packedSub(packedSet(1), packedDot(closest, closest)));
+    Scalar aLanes[PACKED_WIDTH];
+    Scalar bLanes[PACKED_WIDTH];
+    Scalar cLanes[PACKED_WIDTH];
+    Scalar discriminantLanes[PACKED_WIDTH];
+    Scalar rootLanes[PACKED_WIDTH];
+    packedStore(aLanes, a);
+    packedStore(bLanes, b);
+    packedStore(cLanes, c);
+    packedStore(discriminantLanes, discriminant);
+    packedStore(rootLanes, packedSqrt(discriminant));
+    unsigned hits = 0;
+    for (size_t lane = 0; lane < PACKED_WIDTH; lane++)
+    {
+        if (discriminantLanes[lane] < 0)
+        {
+            continue;
+        }
+        const Scalar q = -(bLanes[lane] + copysign(rootLanes[lane], bLanes[lane])) / 2;
+        const Scalar t0 = q == 0 ? 0 : cLanes[lane] / q;
+        const Scalar t1 = q == 0 ? 0 : q / aLanes[lane];
+        near[lane] = fmin(t0, t1);
+        far[lane] = fmax(t0, t1);
+        hits |= 1u << lane;
+    }
+    return hits;
+}
+
+// Intersects `PACKED_WIDTH` object space rays with the xz plane, given their origin height and direction slope.
+// Returns a mask of the lanes that intersect.
+static unsigned packedPlaneHits(const Packed4 height, const Packed4 slope, Scalar t[PACKED_WIDTH])
+{
+    Scalar slopeLanes[PACKED_WIDTH];
+    packedStore(slopeLanes, slope);
+    packedStore(t, packedDiv(packedNeg(height), slope));
+    unsigned hits = 0;
+    for (size_t lane = 0; lane < PACKED_WIDTH; lane++)
+    {
+        if (fabs(slopeLanes[lane]) >= MAT_EPSILON)
+        {
+            hits |= 1u << lane;
+        }
+    }
+    return hits;
+}
+
+// Records an intersection with the shape of the arrays at `index` if it is between zero and `tMax`.
+// Returns true if it is, so `intersectArrays` can stop when any intersection will do.
+// Info: Ties go to the shape stored first in the world, as when the shapes are tested in order
+static bool arraysLeaf(WorldTraversal *traversal, const size_t index, const Scalar t, Scalar *tMax)
+{
+    const size_t shape = traversal->world->arrays->materials[index];
+    const Shape *closest = traversal->closest.shape;
+    if (t >= 0 && (t < *tMax || (t == *tMax && closest != NULL && shape < (size_t)(closest - traversal->world->shapes))))
+    {
+        traversal->closest = (Intersection){&traversal->world->shapes[shape], t, 0, NULL};
+        traversal->occluder = shape;
+        *tMax = t;
+        return true;
+    }
+    return false;
+}
+
+// Returns a mask of the lanes of the arrays starting at `index` that hold shapes rather than padding
+static unsigned arraysLanes(const ShapeArrays *arrays, const size_t index)
+{
+    unsigned lanes = 0;
+    for (size_t lane = 0; lane < PACKED_WIDTH; lane++)
+    {
+        if (arrays->materials[index + lane] != SIZE_MAX)
+        {
+            lanes |= 1u << lane;
+        }
+    }
+    return lanes;
+}
+
+// Intersects the ray with `PACKED_WIDTH` shapes of the arrays at a time, keeping the closest intersection
+// between zero and `tMax`. If `any` is set, returns true on the first intersection found.
+static bool intersectArrays(WorldTraversal *traversal, Scalar tMax, const bool any)
+{
+    const ShapeArrays *arrays = traversal->world->arrays;
+    const Ray ray = traversal->ray;
+    const Packed4 origin[3] = {packedSet(ray.origin.x), packedSet(ray.origin.y), packedSet(ray.origin.z)};
+    const Packed4 direction[3] = {packedSet(ray.direction.x), packedSet(ray.direction.y), packedSet(ray.direction.z)};
+    for (size_t i = arrays->groupStart[SPHERE]; i < arrays->groupStart[SPHERE + 1]; i += PACKED_WIDTH)
+    {
+        Packed4 o[3];
+        Packed4 d[3];
+        for (size_t row = 0; row < 3; row++)
+        {
+            const Packed4 m[4] = {packedLoad(&arrays->inverse[row][0][i]), packedLoad(&arrays->inverse[row][1][i]),
+                                  packedLoad(&arrays->inverse[row][2][i]), packedLoad(&arrays->inverse[row][3][i])};
+            packedTransformRow(m, origin, direction, &o[row], &d[row]);
+        }
+        Scalar near[PACKED_WIDTH];
+        Scalar far[PACKED_WIDTH];
+        const unsigned hits = packedSphereHits(o, d, near, far) & arraysLanes(arrays, i);
+        for (size_t lane = 0; lane < PACKED_WIDTH; lane++)
+        {
+            if ((hits & 1u << lane) &&
+                (arraysLeaf(traversal, i + lane, near[lane], &tMax) | arraysLeaf(traversal, i + lane, far[lane], &tMax)) && any)
+            {
+                return true;
+            }
+        }
+    }
+    for (size_t i = arrays->groupStart[PLANE]; i < arrays->groupStart[PLANE + 1]; i += PACKED_WIDTH)
+    {
+        const Packed4 m[4] = {packedLoad(&arrays->inverse[1][0][i]), packedLoad(&arrays->inverse[1][1][i]),
+                              packedLoad(&arrays->inverse[1][2][i]), packedLoad(&arrays->inverse[1][3][i])};
+        Packed4 height;
+        Packed4 slope;
+        packedTransformRow(m, origin, direction, &height, &slope);
+        Scalar t[PACKED_WIDTH];
+        const unsigned hits = packedPlaneHits(height, slope, t) & arraysLanes(arrays, i);
+        for (size_t lane = 0; lane < PACKED_WIDTH; lane++)
+        {
+            if ((hits & 1u << lane) && arraysLeaf(traversal, i + lane, t[lane], &tMax) && any)
+            {
+                return true;
+            }
+        }
+    }
+    // Meshes traverse their own hierarchy one at a time
+    for (size_t i = arrays->groupStart[MESH]; i < arrays->groupStart[MESH + 1]; i++)
+    {
+        if (arrays->materials[i] == SIZE_MAX)
+        {
+            continue;
+        }
+        if (any && anyLeaf(traversal, arrays->materials[i], &tMax))
+        {
+            return true;
+        }
+        if (!any)
+        {
+            closestLeaf(traversal, arrays->materials[i], &tMax);
+        }
+    }
+    const World *world = traversal->world;
+    for (size_t i = world->shapeCount; i < world->shapeCount + world->instanceCount; i++)
+    {
+        if (any && anyLeaf(traversal, i, &tMax))
+        {
+            return true;
+        }
+        if (!any)
+        {
+            closestLeaf(traversal, i, &tMax);
+        }
+    }
+    return false;
+}
+
+// Adds the intersections between the traversal's ray and the shapes and instances of its world
+static void worldAll(WorldTraversal *traversal)
+{
+    const World *world = traversal->world;
+    if (world->bvh != NULL)
+    {
+        bvhTraverse(world->bvh, traversal->ray.origin, traversal->ray.direction, -INFINITY, INFINITY, intersectLeaf, traversal);
+        return;
+    }
+    for (size_t i = 0; i < world->shapeCount + world->instanceCount; i++)
+    {
+        intersectLeaf(traversal, i, NULL);
+    }
+}
+
+// Keeps the closest intersection between zero and `tMax` of the traversal's ray with the shapes and instances of its
+// world, shrinking `tMax`
+static void worldClosest(WorldTraversal *traversal, Scalar *tMax)
+{
+    const World *world = traversal->world;
+    if (world->bvh != NULL)
+    {
+        bvhTraverse(world->bvh, traversal->ray.origin, traversal->ray.direction, 0, *tMax, closestLeaf, traversal);
+    }
+    else if (world->grid != NULL)
+    {
+        gridTraverse(world->grid, traversal->ray.origin, traversal->ray.direction, 0, *tMax, closestLeaf, traversal);
+    }
+    else if (world->arrays != NULL)
+    {
+        intersectArrays(traversal, *tMax, false);
+    }
+    else
+    {
+        for (size_t i = 0; i < world->shapeCount + world->instanceCount; i++)
+        {
+            closestLeaf(traversal, i, tMax);
+        }
+    }
+    if (traversal->closest.shape != NULL)
+    {
+        *tMax = traversal->closest.t;
+    }
+}
+
+// Checks if the traversal's ray intersects any shape or instance of its world between zero and `tMax`
+static bool worldAny(WorldTraversal *traversal, Scalar tMax)
+{
+    const World *world = traversal->world;
+    if (world->bvh != NULL)
+    {
+        return bvhTraverse(world->bvh, traversal->ray.origin, traversal->ray.direction, 0, tMax, anyLeaf, traversal);
+    }
+    if (world->grid != NULL)
+    {
+        return gridTraverse(world->grid, traversal->ray.origin, traversal->ray.direction, 0, tMax, anyLeaf, traversal);
+    }
+    if (world->arrays != NULL)
+    {
+        return intersectArrays(traversal, tMax, true);
+    }
+    for (size_t i = 0; i < world->shapeCount + world->instanceCount; i++)
+    {
+        if (anyLeaf(traversal, i, &tMax))
+        {
+            return true;
+        }
+    }
+    return false;
+}
+
+// Returns the "hit" (closest non-negative intersection) between the ray and the shapes in the world.
+// If a "hit" does not exist, an intersection with a NULL shape is returned.
+// Info: Keeps a running minimum instead of collecting and sorting every intersection
+Intersection intersectClosest(World world, const Ray ray)
+{
+    WorldTraversal traversal = {&world, ray, NULL, {NULL, -1, 0, NULL}, SIZE_MAX};
+    Scalar tMax = INFINITY;
+    worldClosest(&traversal, &tMax);
+    return traversal.closest;
+}
+
+// Checks if the ray intersects any shape in the world at a distance between zero and `tMax`.
+// Info: Returns on the first intersection found
+bool intersectAny(World world, const Ray ray, const Scalar tMax)
+{
+    WorldTraversal traversal = {&world, ray, NULL, {NULL, -1, 0, NULL}, SIZE_MAX};
+    return worldAny(&traversal, tMax);
+}
+
+typedef struct
+{
+    const World *world;
+    const Ray *rays;
+    Packed4 origin[3];
+    Packed4 direction[3];
+    Intersection *hits;
+} PacketTraversal;
+
+static void worldPacket(const World *world, const Ray rays[RAY_PACKET_SIZE], unsigned active, Scalar tMax[RAY_PACKET_SIZE],
+                        Intersection hits[RAY_PACKET_SIZE]);
+
+// Keeps the closest non-negative intersection of each active ray of the packet with a shape or instance, shrinking
+// its search distance
+static void packetLeaf(void *context, const size_t shape, const unsigned active, Scalar tMax[RAY_PACKET_SIZE])
+{
+    PacketTraversal *traversal = context;
+    const World *world = traversal->world;
+    if (shape >= world->shapeCount)
+    {
+        // The rays move into the group's space together, so its hierarchy is traversed once for the packet as well
+        const Instance *instance = &world->instances[shape - world->shapeCount];
+        const World group = groupWorld(instance->group);
+        Ray rays[RAY_PACKET_SIZE];
+        Intersection hits[RAY_PACKET_SIZE];
+        for (size_t lane = 0; lane < RAY_PACKET_SIZE; lane++)
+        {
+            rays[lane] = rayTransformAffine(traversal->rays[lane], instance->transformInv);
+            hits[lane] = (Intersection){NULL, -1, 0, NULL};
+        }
+        worldPacket(&group, rays, active, tMax, hits);
+        for (size_t lane = 0; lane < RAY_PACKET_SIZE; lane++)
+        {
+            if (hits[lane].shape != NULL)
+            {
+                traversal->hits[lane] = hits[lane];
+                traversal->hits[lane].instance = instance;
+            }
+        }
+        return;
+    }
+    const Shape *object = &world->shapes[shape];
+    Scalar t[SHAPE_MAX_INTERSECTIONS][PACKED_WIDTH];
+    unsigned hits;
+    if (object->type == MESH)
+    {
+        // Meshes are intersected ray by ray, through their own hierarchy
+        for (size_t lane = 0; lane < PACKED_WIDTH; lane++)
+        {
+            size_t triangle;
+            if ((active & 1u << lane) &&
+                meshClosest(object, rayTransformAffine(traversal->rays[lane], object->transformInv), &tMax[lane], &triangle, false))
+            {
+                traversal->hits[lane] = (Intersection){object, tMax[lane], (uint32_t)triangle, NULL};
+            }
+        }
+        return;
+    }
+    switch (object->type)
+    {
+    case SPHERE:
+    {
+        Packed4 o[3];
+        Packed4 d[3];
+        for (size_t row = 0; row < 3; row++)
+        {
+            const Packed4 m[4] = {packedSet(object->transformInv.elem[row][0]), packedSet(object->transformInv.elem[row][1]),
+                                  packedSet(object->transformInv.elem[row][2]), packedSet(object->transformInv.elem[row][3])};
+            packedTransformRow(m, traversal->origin, traversal->direction, &o[row], &d[row]);
+        }
+        hits = packedSphereHits(o, d, t[0], t[1]);
+        break;
+    }
+    case PLANE:
+    {
+        const Packed4 m[4] = {packedSet(object->transformInv.elem[1][0]), packedSet(object->transformInv.elem[1][1]),
+                              packedSet(object->transformInv.elem[1][2]), packedSet(object->transformInv.elem[1][3])};
+        Packed4 height;
+        Packed4 slope;
+        packedTransformRow(m, traversal->origin, traversal->direction, &height, &slope);
+        hits = packedPlaneHits(height, slope, t[0]);
+        for (size_t lane = 0; lane < PACKED_WIDTH; lane++)
+        {
+            t[1][lane] = t[0][lane];
+        }
+        break;
+    }
+    default:
+        abort();
+    }
+    hits &= active;
+    for (size_t lane = 0; lane < PACKED_WIDTH; lane++)
+    {
+        for (size_t i = 0; i < SHAPE_MAX_INTERSECTIONS && (hits & 1u << lane); i++)
+        {
+            if (t[i][lane] >= 0 && t[i][lane] < tMax[lane])
+            {
+                traversal->hits[lane] = (Intersection){object, t[i][lane], 0, NULL};
+                tMax[lane] = t[i][lane];
+            }
+        }
+    }
+}
+
+// One ray of a packet walking a grid on its own
+typedef struct
+{
+    PacketTraversal *traversal;
+    size_t lane;
+    Scalar *tMax; // of the whole packet
+} GridLane;
+
+// Keeps the closest non-negative intersection of the lane's ray with a shape or instance, shrinking `tMax`
+static bool gridLaneLeaf(void *context, const size_t shape, Scalar *tMax)
+{
+    GridLane *lane = context;
+    packetLeaf(lane->traversal, shape, 1u << lane->lane, lane->tMax);
+    *tMax = lane->tMax[lane->lane];
+    return false;
+}
+
+// Keeps the closest intersection between zero and `tMax` of each active ray with the shapes and instances of the world
+// in `hits`, shrinking `tMax`
+static void worldPacket(const World *world, const Ray rays[RAY_PACKET_SIZE], const unsigned active, Scalar tMax[RAY_PACKET_SIZE],
+                        Intersection hits[RAY_PACKET_SIZE])
+{
+    PacketTraversal traversal = {.world = world, .rays = rays, .hits = hits};
+    Vec4 origin[RAY_PACKET_SIZE];
+    Vec4 direction[RAY_PACKET_SIZE];
+    for (size_t lane = 0; lane < RAY_PACKET_SIZE; lane++)
+    {
+        origin[lane] = rays[lane].origin;
+        direction[lane] = rays[lane].direction;
+    }
+    for (size_t axis = 0; axis < 3; axis++)
+    {
+        const Scalar originAxis[PACKED_WIDTH] = {origin[0].elem[axis], origin[1].elem[axis], origin[2].elem[axis], origin[3].elem[axis]};
+        const Scalar directionAxis[PACKED_WIDTH] = {direction[0].elem[axis], direction[1].elem[axis], direction[2].elem[axis], direction[3].elem[axis]};
+        traversal.origin[axis] = packedLoad(originAxis);
+        traversal.direction[axis] = packedLoad(directionAxis);
+    }
+    if (world->bvh != NULL)
+    {
+        bvhTraversePacket(world->bvh, origin, direction, active, 0, tMax, packetLeaf, &traversal);
+    }
+    else if (world->grid != NULL)
+    {
+        // The rays pass through different cells, so each walks the grid on its own
+        for (size_t lane = 0; lane < RAY_PACKET_SIZE; lane++)
+        {
+            if (active & 1u << lane)
+            {
+                GridLane gridLane = {&traversal, lane, tMax};
+                gridTraverse(world->grid, origin[lane], direction[lane], 0, tMax[lane], gridLaneLeaf, &gridLane);
+            }
+        }
+    }
+    else
+    {
+        for (size_t i = 0; i < world->shapeCount + world->instanceCount && active != 0; i++)
+        {
+            packetLeaf(&traversal, i, active, tMax);
+        }
+    }
+}
+
+// Stores the "hit" (closest non-negative intersection) of every active ray of the packet in `hits`,
+// an intersection with a NULL shape for the rays that do not hit anything or are not active.
+// Info: Intersects each shape with all the rays at once, traversing the hierarchy once for the whole packet
+void intersectPacket(const World world, const RayPacket *packet, Intersection hits[RAY_PACKET_SIZE])
+{
+    Scalar tMax[RAY_PACKET_SIZE];
+    for (size_t lane = 0; lane < RAY_PACKET_SIZE; lane++)
+    {
+        hits[lane] = (Intersection){NULL, -1, 0, NULL};
+        tMax[lane] = INFINITY;
+    }
+    worldPacket(&world, packet->rays, packet->active, tMax, hits);
+}
+
+typedef struct
+{
+    uint64_t key;
+    size_t ray;
+} BatchEntry;
+
+typedef struct
+{
+    const World *world;
+    const Ray *rays;
+    HitRecord *hits;
+    const BatchEntry *order;
+    size_t count;
+} BatchJob;
+
+// Spreads the low 10 bits of the value out so that two zero bits follow each one
+static uint64_t batchSpread(uint64_t value)
+{
+    value &= 0x3FF;
+    value = (value | value << 16) & 0x30000FF;
+    value = (value | value << 8) & 0x300F00F;
+    value = (value | value << 4) & 0x30C30C3;
+    value = (value | value << 2) & 0x9249249;
+    return value;
+}
+
+// Quantizes a coordinate in [min, min + extent] to 10 bits
+static uint64_t batchQuantize(const Scalar value, const Scalar min, const Scalar extent)
+{
+    const Scalar unit = extent > 0 ? (value - min) / extent : 0;
+    return unit >= 1 ? 0x3FF : unit > 0 ? (uint64_t)(unit * 0x3FF) : 0;
+}
+
+// Returns a sort key grouping rays by direction octant, then by origin and direction along Morton curves
+static uint64_t batchKey(const Ray ray, const Bounds origins)
+{
+    uint64_t octant = 0;
+    uint64_t originCode = 0;
+    uint64_t directionCode = 0;
+    for (size_t axis = 0; axis < 3; axis++)
+    {
+        octant |= (uint64_t)(ray.direction.elem[axis] < 0) << axis;
+        const Scalar extent = origins.max.elem[axis] - origins.min.elem[axis];
+        originCode |= batchSpread(batchQuantize(ray.origin.elem[axis], origins.min.elem[axis], extent)) << axis;
+        directionCode |= batchSpread(batchQuantize(ray.direction.elem[axis], -1, 2)) << axis;
+    }
+    return octant << 60 | originCode << 30 | directionCode;
+}
+
+// Sorts the entries by key, least significant byte first, using `scratch` (of the same size) as temporary storage.
+// Passes over bytes that every key shares are skipped.
+static void batchSort(BatchEntry *entries, BatchEntry *scratch, const size_t count)
+{
+    for (size_t shift = 0; shift < 64; shift += 8)
+    {
+        size_t offsets[256] = {0};
+        for (size_t i = 0; i < count; i++)
+        {
+            offsets[entries[i].key >> shift & 0xFF]++;
+        }
+        if (offsets[entries[0].key >> shift & 0xFF] == count)
+        {
+            continue;
+        }
+        size_t start = 0;
+        for (size_t digit = 0; digit < 256; digit++)
+        {
+            const size_t digitCount = offsets[digit];
+            offsets[digit] = start;
+            start += digitCount;
+        }
+        for (size_t i = 0; i < count; i++)
+        {
+            scratch[offsets[entries[i].key >> shift & 0xFF]++] = entries[i];
+        }
+        for (size_t i = 0; i < count; i++)
+        {
+            entries[i] = scratch[i];
+        }
+    }
+}
+
+// Traces a chunk of sorted rays in packets, storing their hits in the original order
+static void batchChunk(void *context, const size_t chunk, const size_t worker)
+{
+    (void)worker;
+    const BatchJob *job = context;
+    const size_t start = chunk * RAY_BATCH_CHUNK;
+    const size_t end = start + RAY_BATCH_CHUNK < job->count ? start + RAY_BATCH_CHUNK : job->count;
+    for (size_t i = start; i < end; i += RAY_PACKET_SIZE)
+    {
+        RayPacket packet = {0};
+        for (size_t lane = 0; lane < RAY_PACKET_SIZE; lane++)
+        {
+            const size_t entry = i + lane < end ? i + lane : i; // Inactive lanes repeat the first ray
+            packet.rays[lane] = job->rays[job->order[entry].ray];
+            packet.active |= (unsigned)(i + lane < end) << lane;
+        }
+        Intersection packetHits[RAY_PACKET_SIZE];
+        intersectPacket(*job->world, &packet, packetHits);
+        for (size_t lane = 0; lane < RAY_PACKET_SIZE && i + lane < end; lane++)
+        {
+            HitRecord *record = &job->hits[job->order[i + lane].ray];
+            const Intersection hit = packetHits[lane];
+            if (hit.shape == NULL)
+            {
+                *record = (HitRecord){-1, SIZE_MAX, vector(0, 0, 0), SIZE_MAX};
+            }
+            else if (hit.instance == NULL)
+            {
+                *record = (HitRecord){hit.t, (size_t)(hit.shape - job->world->shapes),
+                                      normalAtHit(hit, rayPos(packet.rays[lane], hit.t)), SIZE_MAX};
+            }
+            else
+            {
+                *record = (HitRecord){hit.t, (size_t)(hit.shape - hit.instance->group->shapes),
+                                      normalAtHit(hit, rayPos(packet.rays[lane], hit.t)),
+                                      (size_t)(hit.instance - job->world->instances)};
+            }
+        }
+    }
+}
+
+// Stores the closest hit of each of the `count` rays in the matching element of `hits`.
+// The rays are sorted for coherence, then traced in packets by `threadCount` threads (one per processor if zero).
+// If the allocation fails, `abort()` is called.
+// Info: Meant for large batches, the sorting does not pay off for a handful of rays
+void intersectBatch(const World world, const Ray *rays, HitRecord *hits, const size_t count, const size_t threadCount)
+{
+    if (count == 0)
+    {
+        return;
+    }
+    BatchEntry *order = traceRealloc(NULL, sizeof(BatchEntry[count]));
+    BatchEntry *scratch = traceRealloc(NULL, sizeof(BatchEntry[count]));
+    if (order == NULL || scratch == NULL)
+    {
+        abort();
+    }
+    Bounds origins = boundsEmpty();
+    for (size_t i = 0; i < count; i++)
+    {
+        origins = boundsExtend(origins, rays[i].origin.xyz);
+    }
+    for (size_t i = 0; i < count; i++)
+    {
+        order[i] = (BatchEntry){batchKey(rays[i], origins), i};
+    }
+    batchSort(order, scratch, count);
+    free(scratch);
+    BatchJob job = {&world, rays, hits, order, count};
+    tasksRun((count + RAY_BATCH_CHUNK - 1) / RAY_BATCH_CHUNK, threadCount, batchChunk, &job);
+    free(order);
+}
+
+// Calculates the intersections between the ray and the shapes in the world,
+// returning them as a sorted intersection collection.
+Intersections intersectWorld(const World world, const Ray ray)
+{
+    Intersections worldIntersections;
+    intersectionsCreate(&worldIntersections, 0);
+    intersectWorldInto(&worldIntersections, world, ray);
+    return worldIntersections;
+}
+
+// Replaces the contents of the collection with the sorted intersections between the ray and the shapes in the world.
+// Info: Only allocates if the collection has to grow
+void intersectWorldInto(Intersections *dest, World world, const Ray ray)
+{
+    dest->size = 0;
+    WorldTraversal traversal = {&world, ray, dest, {NULL, -1, 0, NULL}, SIZE_MAX};
+    worldAll(&traversal);
+    if (dest->size > 0)
+    {
+        intersectionsSort(dest);
+    }
+}
+
+// Returns weather a certain point is shadowed by the light at the given index in the world
+// Important: `lightIndex` begins at zero
+bool isShadowed(const World world, const size_t lightIndex, const Vec4 point)
+{
+    TraceContext context;
+    traceContextCreate(&context);
+    const bool shadowed = traceShadowed(&context, world, lightIndex, point);
+    traceContextDestroy(&context);
+    return shadowed;
+}
+
+// Returns weather a certain point is shadowed by the light at the given index in the world,
+// using the context's storage.
+// If the light was blocked from the previous point, the shape or instance that blocked it is tested first, as it
+// usually blocks it from the neighbouring points as well, and the world is only traversed if it does not.
+// Info: Stops at the first shape found between the point and the light. Contexts may be reused between worlds, as
+// the remembered primitives are only ever used to find shadows sooner
+// If the allocation fails, `abort()` is called
+bool traceShadowed(TraceContext *context, const World world, const size_t lightIndex, const Vec4 point)
+{
+    if (lightIndex >= context->occluderCount)
+    {
+        const size_t count = world.lightCount > lightIndex ? world.lightCount : lightIndex + 1;
+        size_t *occluders = traceRealloc(context->occluders, sizeof(size_t[count]));
+        if (occluders == NULL)
+        {
+            abort();
+        }
+        for (size_t i = context->occluderCount; i < count; i++)
+        {
+            occluders[i] = SIZE_MAX;
+        }
+        context->occluders = occluders;
+        context->occluderCount = count;
+    }
+    Vec4 vec = vec4Sub(world.lights[lightIndex].position, point);
+    Ray ray = {point, vec4Norm(vec)};
+    const Scalar distance = vec4Mag(vec);
+    WorldTraversal traversal = {&world, ray, NULL, {NULL, -1, 0, NULL}, SIZE_MAX};
+    size_t *occluder = &context->occluders[lightIndex];
+    context->shadows.rays++;
+    if (*occluder < world.shapeCount + world.instanceCount)
+    {
+        context->shadows.occluderTests++;
+        Scalar tMax = distance;
+        if (anyLeaf(&traversal, *occluder, &tMax))
+        {
+            context->shadows.occluderHits++;
+            return true;
+        }
+    }
+    // Lit points are usually next to lit points, which would only test the remembered primitive in vain
+    *occluder = worldAny(&traversal, distance) ? traversal.occluder : SIZE_MAX;
+    return *occluder != SIZE_MAX;
+}
+
+// Pre-computes certain vectors and returns a Computations object
+Computations prepareComputations(const Intersection intersection, const Ray ray)
+{
+    Computations computations;
+    computations.shape = intersection.shape;
+    computations.t = intersection.t;
+    computations.point = rayPos(ray, intersection.t);
+    computations.camera = vec4Neg(ray.direction);
+    computations.normal = normalAtHit(intersection, computations.point);
+    computations.instance = intersection.instance;
+    if (vec4Dot(computations.normal, computations.camera) < 0)
+    {
+        computations.normal = vec4Neg(computations.normal);
+        computations.inside = true;
+    }
+    else
+    {
+        computations.inside = false;
+    }
+    computations.overPoint = vec4Add(computations.point, vec4Mul(computations.normal, MAT_EPSILON));
+    return computations;
+}
+
+// Calculates the color of a certain point
+Vec3 shadeHit(const World world, const Computations computations)
+{
+    TraceContext context;
+    traceContextCreate(&context);
+    const Vec3 hitColor = traceShade(&context, world, computations);
+    traceContextDestroy(&context);
+    return hitColor;
+}
+
+// Calculates the color of a certain point using the context's storage
+Vec3 traceShade(TraceContext *context, const World world, const Computations computations)
+{
+    const Shape *object = computations.shape;
+    Shape placed;
+    if (computations.instance != NULL && object->material.hasPattern)
+    {
+        // Patterns are evaluated in object space, reached through the transformation of the instance first
+        placed = *object;
+        placed.transformInv = affineMul(object->transformInv, computations.instance->transformInv);
+        object = &placed;
+    }
+    Vec3 hitColor = color(0, 0, 0);
+    for (size_t i = 0; i < world.lightCount; i++)
+    {
+        hitColor = vec3Add(hitColor,
+                           lighting(object->material, object,
+                                    world.lights[i],
+                                    computations.point,
+                                    computations.camera,
+                                    computations.normal,
+                                    traceShadowed(context, world, i, computations.overPoint)));
+    }
+    return hitColor;
+}
+
+// Returns the color that the ray receives in the world
+Vec3 colorAt(const World world, const Ray ray)
+{
+    TraceContext context;
+    traceContextCreate(&context);
+    const Vec3 rayColor = traceColor(&context, world, ray);
+    traceContextDestroy(&context);
+    return rayColor;
+}
+
+// Returns the color that the ray receives in the world using the context's storage.
+// Info: Does not allocate once the context's storage has grown to fit the scene
+Vec3 traceColor(TraceContext *context, const World world, const Ray ray)
+{
+    const Intersection rayHit = intersectClosest(world, ray);
+    if (rayHit.shape == NULL)
+    {
+        return color(0, 0, 0);
+    }
+    else
+    {
+        Computations computations = prepareComputations(rayHit, ray);
+        return traceShade(context, world, computations);
+    }
+}
+
+// Stores the color that every active ray of the packet receives in the world in `colors`.
+// Info: Finds the closest hits of the packet together, then shades the rays (and traces their shadows) one by one
+void tracePacket(TraceContext *context, const World world, const RayPacket *packet, Vec3 colors[RAY_PACKET_SIZE])
+{
+    Intersection hits[RAY_PACKET_SIZE];
+    intersectPacket(world, packet, hits);
+    for (size_t lane = 0; lane < RAY_PACKET_SIZE; lane++)
+    {
+        if (!(packet->active & 1u << lane))
+        {
+            continue;
+        }
+        if (hits[lane].shape == NULL)
+        {
+            colors[lane] = color(0, 0, 0);
+        }
+        else
+        {
+            Computations computations = prepareComputations(hits[lane], packet->rays[lane]);
+            colors[lane] = traceShade(context, world, computations);
+        }
+    }
+}
+
+// Camera constructor
+// Important: The transformation must be affine (see `affineFromMat4`)
+Camera cameraInit(const size_t hsize, const size_t vsize, const Scalar fov, const Mat4 transform)
+{
+    Camera camera = {hsize, vsize, fov, .transform = affineFromMat4(transform),
+                     .transformInv = affineInv(affineFromMat4(transform))};
+    const Scalar halfView = tan(camera.fov / 2);
+    const Scalar aspect = (Scalar)hsize / vsize;
+    if (aspect >= 1)
+    {
+        camera.halfWidth = halfView;
+        camera.halfHeight = halfView / aspect;
+    }
+    else
+    {
+        camera.halfWidth = halfView * aspect;
+        camera.halfHeight = halfView;
+    }
+    camera.pixelSize = (camera.halfWidth * 2) / hsize;
+    return camera;
+}
+
+// Renders the pixels [startX, endX) * [startY, endY) of the canvas, tracing the primary rays of every 2*2 block of
+// pixels as a packet
+static void renderBlock(Canvas *image, const Camera *camera, const World world, TraceContext *context,
+                        const size_t startX, const size_t startY, const size_t endX, const size_t endY)
+{
+    for (size_t y = startY; y < endY; y += 2)
+    {
+        for (size_t x = startX; x < endX; x += 2)
+        {
+            RayPacket packet = {0};
+            for (size_t lane = 0; lane < RAY_PACKET_SIZE; lane++)
+            {
+                const size_t pixelX = x + lane % 2;
+                const size_t pixelY = y + lane / 2;
+                if (pixelX < endX && pixelY < endY)
+                {
+                    packet.rays[lane] = rayPixel(*camera, pixelX, pixelY);
+                    packet.active |= 1u << lane;
+                }
+                else
+                {
+                    packet.rays[lane] = packet.rays[0]; // Keeps the inactive lanes finite
+                }
+            }
+            Vec3 colors[RAY_PACKET_SIZE];
+            tracePacket(context, world, &packet, colors);
+            for (size_t lane = 0; lane < RAY_PACKET_SIZE; lane++)
+            {
+                if (packet.active & 1u << lane)
+                {
+                    canvasPixelWrite(image, x + lane % 2, y + lane / 2, colors[lane]);
+                }
+            }
+        }
+    }
+}
+
+// Renders the world from a given camera
+Canvas *render(const Camera camera, const World world)
+{
+    Canvas *image = canvasCreate(camera.hsize, camera.vsize);
+    if (image == NULL) // Move canvas error handling code inside the canvas functions
+    {
+        abort();
+    }
+    TraceContext context;
+    traceContextCreate(&context);
+    renderBlock(image, &camera, world, &context, 0, 0, camera.hsize, camera.vsize);
+    traceContextDestroy(&context);
+    return image;
+}
+
+typedef struct
+{
+    const Camera *camera;
+    const World *world;
+    Canvas *image;
+    TraceContext *contexts; // one per worker
+    size_t tilesX;
+} RenderJob;
+
+// Renders a single tile of the canvas
+static void renderTile(void *context, const size_t tile, const size_t worker)
+{
+    const RenderJob *job = context;
+    const size_t startX = (tile % job->tilesX) * RENDER_TILE_SIZE;
+    const size_t startY = (tile / job->tilesX) * RENDER_TILE_SIZE;
+    const size_t endX = startX + RENDER_TILE_SIZE < job->camera->hsize ? startX + RENDER_TILE_SIZE : job->camera->hsize;
+    const size_t endY = startY + RENDER_TILE_SIZE < job->camera->vsize ? startY + RENDER_TILE_SIZE : job->camera->vsize;
+    renderBlock(job->image, job->camera, *job->world, &job->contexts[worker], startX, startY, endX, endY);
+}
+
+// Renders the world from a given camera, splitting the canvas in tiles which are shared between `threadCount` threads.
+// If `threadCount` is zero, one thread per processor is used.
+// Info: Every pixel is written by exactly one thread, so the result is identical to `render()`
+Canvas *renderParallel(const Camera camera, const World world, const size_t threadCount)
+{
+    return renderParallelWith(camera, world, threadCount, NULL);
+}
+
+// Renders the world as `renderParallel` does, adding up the shadow rays traced by every thread in `stats` unless it is
+// NULL
+Canvas *renderParallelWith(const Camera camera, const World world, const size_t threadCount, ShadowStats *stats)
+{
+    Canvas *image = canvasCreate(camera.hsize, camera.vsize);
+    if (image == NULL)
+    {
+        abort();
+    }
+    const size_t tilesX = (camera.hsize + RENDER_TILE_SIZE - 1) / RENDER_TILE_SIZE;
+    const size_t tilesY = (camera.vsize + RENDER_TILE_SIZE - 1) / RENDER_TILE_SIZE;
+    const size_t workerCount = tasksThreadCount(threadCount);
+    TraceContext *contexts = traceRealloc(NULL, sizeof(TraceContext[workerCount]));
+    if (contexts == NULL)
+    {
+        abort();
+    }
+    for (size_t i = 0; i < workerCount; i++)
+    {
+        traceContextCreate(&contexts[i]);
+    }
+    RenderJob job = {&camera, &world, image, contexts, tilesX};
+    tasksRun(tilesX * tilesY, workerCount, renderTile, &job);
+    if (stats != NULL)
+    {
+        *stats = (ShadowStats){0, 0, 0};
     }
-    for (size_t y = 0; y < camera.vsize; y++)
+    for (size_t i = 0; i < workerCount; i++)
     {
-        for (size_t x = 0; x < camera.hsize; x++)
+        if (stats != NULL)
         {
-            const Ray ray = rayPixel(camera, x, y);
-            const Vec3 color = colorAt(world, ray);
-            canvasPixelWrite(image, x, y, color);
+            stats->rays += contexts[i].shadows.rays;
+            stats->occluderTests += contexts[i].shadows.occluderTests;
+            stats->occluderHits += contexts[i].shadows.occluderHits;
         }
+        traceContextDestroy(&contexts[i]);
     }
+    free(contexts);
     return image;
 }
 
 // Creates a stripped pattern
 StripePattern stripePattern(const Vec3 colorA, const Vec3 colorB, const Mat4 transform)
 {
-    return (StripePattern){colorA, colorB, transform, mat4Inv(transform)};
+    return (StripePattern){colorA, colorB, affineFromMat4(transform), affineInv(affineFromMat4(transform))};
 }
 
 Vec3 stripeAt(const StripePattern pattern, const Vec4 point)
@@ -473,10 +1872,10 @@ Vec3 stripeAt(const StripePattern pattern, const Vec4 point)
     return (int64_t)floor(point.x) % 2 == 0 ? pattern.a : pattern.b;
 }
 
-Vec3 stripeAtObject(const Shape object, Vec4 point)
+Vec3 stripeAtObject(const Shape *object, Vec4 point)
 {
     // TODO: See if this can be done only on the x to avoid extra math
-    point = mat4VecMul(object.transformInv, point);
-    point = mat4VecMul(object.material.pattern.transformInv, point);
-    return stripeAt(object.material.pattern, point);
+    point = affinePointMul(object->transformInv, point);
+    point = affinePointMul(object->material.pattern.transformInv, point);
+    return stripeAt(object->material.pattern, point);
 }
@@ -4,12 +4,24 @@
  * Copyright (c) 2023, Dimitrios Alexopoulos All rights reserved.
  */
 
+#ifndef RAYS_H
+#define RAYS_H
+
 #include <stdbool.h>
 #include <stddef.h>
+#include <stdint.h>
 
+#include "bvh.h"
 #include "canvas.h"
+#include "grid.h"
+#include "mesh.h"
 #include "vectors.h"
 
+#define SHAPE_MAX_INTERSECTIONS 2
+#define SHAPE_TYPE_COUNT 3
+#define RAY_PACKET_SIZE 4
+#define RAY_BATCH_CHUNK 256
+
 // clang-format off
 #define ray(x, y, z, xdir, ydir, zdir) (Ray){point(x, y, z), vector(xdir, ydir, zdir)}
 
@@ -19,9 +31,13 @@
 
 #define light(x, y, z, r, g, b) (Light){point(x, y, z), {{r, g, b}}}
 
-#define sphere(transform, material) (Shape){SPHERE, transform, mat4Inv(transform), material}
+#define sphere(transform, material) (Shape){SPHERE, affineFromMat4(transform), affineInv(affineFromMat4(transform)), affineNormalMatrix(affineFromMat4(transform)), material, NULL}
+
+#define plane(transform, material) (Shape){PLANE, affineFromMat4(transform), affineInv(affineFromMat4(transform)), affineNormalMatrix(affineFromMat4(transform)), material, NULL}
+
+#define mesh(transform, material, triangles) (Shape){MESH, affineFromMat4(transform), affineInv(affineFromMat4(transform)), affineNormalMatrix(affineFromMat4(transform)), material, triangles}
 
-#define plane(transform, material) (Shape){PLANE, transform, mat4Inv(transform), material}
+#define instance(transform, shapes) (Instance){affineInv(affineFromMat4(transform)), shapes}
 
 // clang-format on
 
@@ -35,25 +51,25 @@ typedef enum
 {
     SPHERE,
     PLANE,
-    NO_HIT
+    MESH
 } ShapeType;
 
 typedef struct
 {
     Vec3 a;
     Vec3 b;
-    Mat4 transform;
-    Mat4 transformInv;
+    Affine transform;
+    Affine transformInv;
 } StripePattern;
 
 // TODO: Check best way to pack struct
 typedef struct
 {
     Vec3 color;
-    double ambient;
-    double diffuse;
-    double specular;
-    double shininess;
+    Scalar ambient;
+    Scalar diffuse;
+    Scalar specular;
+    Scalar shininess;
     bool hasPattern;
     StripePattern pattern;
 } Material;
@@ -61,29 +77,82 @@ typedef struct
 typedef struct
 {
     ShapeType type;
-    Mat4 transform;
-    Mat4 transformInv;
+    Affine transform;
+    Affine transformInv;
+    Mat3 normalMatrix; // inverse transpose of the transformation, a plane's normal is its second column
     Material material;
+    const Mesh *mesh; // NULL unless the shape is a mesh, which must be built and outlive the shape
 } Shape;
 
+// Shapes sharing one hierarchy, placed in worlds by instances
+typedef struct
+{
+    size_t shapeCount;
+    Shape *shapes;
+    Bvh *bvh;      // NULL until built by `groupBuild`
+    Bounds bounds; // of the shapes, in the space of the group
+} Group;
+
+// Placement of a group in a world, only the transformation is stored per instance
+typedef struct
+{
+    Affine transformInv;
+    const Group *group; // must be built and outlive the instance
+} Instance;
+
 typedef struct
 {
     Vec4 position;
     Vec3 intensity;
 } Light;
 
+// Structure of arrays copy of the shapes for intersecting one ray with several shapes at once.
+// Shapes are grouped by type, every group padded to a multiple of `PACKED_WIDTH`.
+typedef struct
+{
+    size_t count;                            // including the padding
+    size_t groupStart[SHAPE_TYPE_COUNT + 1]; // shapes of type `i` are in [groupStart[i], groupStart[i + 1])
+    Scalar *inverse[3][4];                   // one array per coefficient of the inverse transformations
+    ShapeType *types;
+    size_t *materials; // index of the shape (and its material) in the world, SIZE_MAX for padding
+} ShapeArrays;
+
 typedef struct
 {
     size_t lightCount;
     size_t shapeCount;
     Light *lights;
     Shape *shapes;
+    Bvh *bvh;            // NULL if the shapes are tested one by one
+    ShapeArrays *arrays; // NULL if not built, unused if `bvh` or `grid` is built
+    size_t instanceCount;
+    Instance *instances; // of groups, the hierarchy of the world is built over the shapes and the instances
+    Grid *grid;          // NULL if not built, unused if `bvh` is built
 } World;
 
+// Rays traced together, such as the primary rays of a 2*2 block of pixels
 typedef struct
 {
-    Shape shape;
-    double t;
+    unsigned active; // bit `i` is set if `rays[i]` is traced
+    Ray rays[RAY_PACKET_SIZE];
+} RayPacket;
+
+// Closest hit of a ray traced by `intersectBatch`
+typedef struct
+{
+    Scalar t;        // -1 if there is no hit
+    size_t shape;    // index in the shapes of the world, or of the group of the instance, SIZE_MAX if there is no hit
+    Vec4 normal;     // world space normal at the hit, facing away from the shape
+    size_t instance; // index in the instances of the world, SIZE_MAX if the shape is not in a group
+} HitRecord;
+
+// Info: Refers to the shape instead of copying it, the shape must outlive the intersection
+typedef struct
+{
+    const Shape *shape; // NULL if there is no hit
+    Scalar t;
+    uint32_t triangle;        // of a mesh, zero for other shapes
+    const Instance *instance; // NULL unless the shape is in the group placed by the instance
 } Intersection;
 
 typedef struct
@@ -93,27 +162,45 @@ typedef struct
     Intersection *elem;
 } Intersections;
 
+// Counts of the shadow rays traced with a `TraceContext`
 typedef struct
 {
-    Shape shape;
-    double t;
+    size_t rays;
+    size_t occluderTests; // rays tested first against the last shape or instance that blocked their light
+    size_t occluderHits;  // of those tests, rays blocked again without traversing the world
+} ShadowStats;
+
+// Per-thread storage reused between rays, so tracing does not allocate once it has grown to fit the scene
+typedef struct
+{
+    Intersections intersections;
+    size_t occluderCount;
+    size_t *occluders; // per light, the last primitive of the world that blocked it, SIZE_MAX if none
+    ShadowStats shadows;
+} TraceContext;
+
+typedef struct
+{
+    const Shape *shape;
+    Scalar t;
     Vec4 point;
     Vec4 overPoint;
     Vec4 camera;
     Vec4 normal;
     bool inside;
+    const Instance *instance; // NULL unless the shape is in the group placed by the instance
 } Computations;
 
 typedef struct
 {
     size_t hsize;
     size_t vsize;
-    double fov;
-    double pixelSize;
-    double halfWidth;
-    double halfHeight;
-    Mat4 transform;
-    Mat4 transformInv;
+    Scalar fov;
+    Scalar pixelSize;
+    Scalar halfWidth;
+    Scalar halfHeight;
+    Affine transform;
+    Affine transformInv;
 } Camera;
 
 // typedef struct
@@ -134,28 +221,61 @@ void intersectionsResize(Intersections *dest, size_t size);
 void intersectionsPush(Intersections *dest, Intersection intersection);
 Intersection intersectionPop(Intersections *dest);
 
-Vec4 rayPos(Ray ray, double t);
+size_t traceAllocations(void);
+void traceContextCreate(TraceContext *dest);
+void traceContextDestroy(TraceContext *dest);
+
+Vec4 rayPos(Ray ray, Scalar t);
 Ray rayTransform(Ray ray, Mat4 mat);
+Ray rayTransformAffine(Ray ray, Affine transform);
 Ray rayPixel(Camera camera, size_t x, size_t y);
 
-Intersections intersect(Shape shape, Ray ray);
+Intersections intersect(const Shape *shape, Ray ray);
+void intersectInto(Intersections *dest, const Shape *shape, Ray ray);
+size_t intersectShape(const Shape *shape, Ray ray, Scalar t[SHAPE_MAX_INTERSECTIONS]);
 Intersection hit(Intersections intersections);
-Vec4 normal(Shape shape, Vec4 point);
-Vec3 lighting(Material material, Shape object, Light light, Vec4 point, Vec4 eye, Vec4 normal, bool inShadow);
+Vec4 normal(const Shape *shape, Vec4 point);
+Vec4 normalAtHit(Intersection intersection, Vec4 point);
+Vec3 lighting(Material material, const Shape *object, Light light, Vec4 point, Vec4 eye, Vec4 normal, bool inShadow);
+
+void groupBuild(Group *group);
+void groupDestroy(Group *group);
 
 void worldDestroy(World *world);
 World defaultWorld(void);
+Bounds shapeBounds(const Shape *shape);
+void worldBuildBvh(World *world);
+void worldBuildBvhWith(World *world, BvhBuildOptions options, BvhStats *stats);
+bool worldRefitBvh(World *world, BvhBuildOptions options, Scalar rebuildRatio);
+void worldDestroyBvh(World *world);
+void worldBuildGrid(World *world);
+void worldDestroyGrid(World *world);
+void worldBuildArrays(World *world);
+void worldDestroyArrays(World *world);
 Intersections intersectWorld(World world, Ray ray);
+void intersectWorldInto(Intersections *dest, World world, Ray ray);
+Intersection intersectClosest(World world, Ray ray);
+bool intersectAny(World world, Ray ray, Scalar tMax);
+void intersectPacket(World world, const RayPacket *packet, Intersection hits[RAY_PACKET_SIZE]);
+void intersectBatch(World world, const Ray *rays, HitRecord *hits, size_t count, size_t threadCount);
 
 bool isShadowed(World world, size_t lightIndex, Vec4 point);
 Computations prepareComputations(Intersection intersection, Ray ray);
 Vec3 shadeHit(World world, Computations computations);
 Vec3 colorAt(World world, Ray ray);
+bool traceShadowed(TraceContext *context, World world, size_t lightIndex, Vec4 point);
+Vec3 traceShade(TraceContext *context, World world, Computations computations);
+Vec3 traceColor(TraceContext *context, World world, Ray ray);
+void tracePacket(TraceContext *context, World world, const RayPacket *packet, Vec3 colors[RAY_PACKET_SIZE]);
 
-Camera cameraInit(size_t hsize, size_t vsize, double fov, Mat4 transform);
+Camera cameraInit(size_t hsize, size_t vsize, Scalar fov, Mat4 transform);
 Canvas *render(Camera camera, World world);
+Canvas *renderParallel(Camera camera, World world, size_t threadCount);
+Canvas *renderParallelWith(Camera camera, World world, size_t threadCount, ShadowStats *stats);
 
 // Vec3 defaultPattern(Vec4 point, const void *parameters);
 StripePattern stripePattern(Vec3 colorA, Vec3 colorB, Mat4 transform);
 Vec3 stripeAt(StripePattern pattern, Vec4 point);
-Vec3 stripeAtObject(Shape shape, Vec4 point);
+Vec3 stripeAtObject(const Shape *shape, Vec4 point);
+
+#endif
@@ -0,0 +1,1345 @@
+/*
+ * scene.c - Scene description parsing
+ *
+ * Copyright (c) 2023, Dimitrios Alexopoulos All rights reserved.
+ */
+
+// TODO: Find a better solution than _POSIX_C_SOURCE
+#ifdef __unix__
+#define _POSIX_C_SOURCE 200112L
+#endif
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <tgmath.h>
+
+#if defined(__unix__)
+#include <sys/mman.h>
+#include <sys/stat.h>
+#elif defined(_WIN32)
+#include <io.h>
+#include <windows.h>
+#endif
+
+#include "rays.h"
+#include "scene.h"
+#include "vectors.h"
+
+#define SCENE_READ_SIZE 65536
+#define SCENE_NUMBER_LENGTH 64
+#define SCENE_MANTISSA_LIMIT UINT64_C(1000000000000000000)
+#define SCENE_EXACT_MANTISSA (UINT64_C(1) << 53)
+#define SCENE_EXACT_POWER 22
+#define SCENE_CACHE_VERSION 2
+#define SCENE_CACHE_ALIGN 64 // of every section, enough for any vector type
+#define SCENE_CACHE_BYTE_ORDER UINT64_C(0x0102030405060708)
+
+typedef struct
+{
+    const char *name; // points into the scene text
+    size_t length;
+    Material material;
+} SceneMaterial;
+
+// Header at the start of a binary scene cache, followed by the sections it points to.
+// Sizes and offsets are in bytes, the node count is zero if no bounding volume hierarchy is stored.
+typedef struct
+{
+    char magic[8];
+    uint32_t version;
+    uint32_t scalarSize;
+    uint64_t byteOrder;
+    uint64_t cameraSize; // sizes of the stored types, a cache can only be used by builds with the same layout
+    uint64_t lightSize;
+    uint64_t shapeSize;
+    uint64_t nodeSize;
+    uint64_t size; // of the whole cache
+    uint64_t hasCamera;
+    uint64_t lightCount;
+    uint64_t shapeCount;
+    uint64_t nodeCount;
+    uint64_t primitiveCount;
+    uint64_t unboundedCount;
+    uint64_t layout; // of the hierarchy, only the binary tree is stored and collapsed again when mapped
+    uint64_t camera;
+    uint64_t lights;
+    uint64_t shapes;
+    uint64_t nodes;
+    uint64_t primitives;
+    uint64_t unbounded;
+} SceneCacheHeader;
+
+typedef struct
+{
+    const char *text; // points into the scene text
+    size_t length;
+} SceneName;
+
+typedef struct
+{
+    const char *at;
+    const char *end;
+    size_t line;
+    const char *message; // NULL until parsing fails
+    SceneMaterial *materials;
+    size_t materialCount;
+    size_t materialCapacity;
+    size_t lastMaterial; // shapes tend to reuse the material of the previous one
+    size_t shapeCapacity;
+    size_t lightCapacity;
+    SceneName *meshPaths; // of the meshes of the scene, so every file is loaded once
+    size_t meshCapacity;
+    SceneName *groupNames; // of the groups of the scene
+    size_t groupCapacity;
+    Group *group; // receiving the shapes until its end, NULL outside of a group
+    size_t groupShapeCapacity;
+    size_t instanceCapacity;
+} SceneParser;
+
+// Parses one statement starting at the parser's position, the line must not be empty
+typedef bool (*SceneStatementFunction)(SceneParser *parser, void *context);
+
+// Powers of ten which are exact in double precision
+static const double scenePowers[SCENE_EXACT_POWER + 1] = {1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11,
+                                                          1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22};
+
+// Records the first error and returns false
+static bool sceneFail(SceneParser *parser, const char *message)
+{
+    if (parser->message == NULL)
+    {
+        parser->message = message;
+    }
+    return false;
+}
+
+static bool sceneIsBlank(const char c)
+{
+    return c == ' ' || c == '\t' || c == '\r';
+}
+
+static bool sceneIsDigit(const char c)
+{
+    return c >= '0' && c <= '9';
+}
+
+// Skips blanks and comments, returning true if the end of the line (or text) is reached
+static bool sceneLineEnd(SceneParser *parser)
+{
+    while (parser->at < parser->end && sceneIsBlank(*parser->at))
+    {
+        parser->at++;
+    }
+    if (parser->at < parser->end && *parser->at == '#')
+    {
+        while (parser->at < parser->end && *parser->at != '\n')
+        {
+            parser->at++;
+        }
+    }
+    return parser->at == parser->end || *parser->at == '\n';
+}
+
+// Moves to the end of the line, skipping whatever is left on it
+static void sceneSkipLine(SceneParser *parser)
+{
+    while (parser->at < parser->end && *parser->at != '\n')
+    {
+        parser->at++;
+    }
+}
+
+// Returns the length of the token starting at `at`
+static size_t sceneTokenLength(const SceneParser *parser, const char *at)
+{
+    const char *start = at;
+    while (at < parser->end && !sceneIsBlank(*at) && *at != '\n' && *at != '#')
+    {
+        at++;
+    }
+    return (size_t)(at - start);
+}
+
+// Reads the next word of the line
+static bool sceneWord(SceneParser *parser, const char **word, size_t *length)
+{
+    if (sceneLineEnd(parser))
+    {
+        return sceneFail(parser, "unexpected end of line");
+    }
+    *word = parser->at;
+    *length = sceneTokenLength(parser, parser->at);
+    parser->at += *length;
+    return true;
+}
+
+static bool sceneWordIs(const char *word, const size_t length, const char *keyword)
+{
+    return length == strlen(keyword) && memcmp(word, keyword, length) == 0;
+}
+
+// Reads the next number of the line.
+// Info: Decimal numbers with up to 18 significant digits and small exponents are converted exactly without `strtod`
+static bool sceneNumber(SceneParser *parser, Scalar *dest)
+{
+    if (sceneLineEnd(parser))
+    {
+        return sceneFail(parser, "expected a number");
+    }
+    const char *start = parser->at;
+    const char *at = start;
+    const size_t length = sceneTokenLength(parser, start);
+    const char *end = start + length;
+    const bool negative = *at == '-';
+    if (*at == '-' || *at == '+')
+    {
+        at++;
+    }
+    uint64_t mantissa = 0;
+    int exponent = 0;
+    bool digits = false;
+    bool exact = true;
+    for (; at < end && sceneIsDigit(*at); at++, digits = true)
+    {
+        if (mantissa < SCENE_MANTISSA_LIMIT)
+        {
+            mantissa = mantissa * 10 + (uint64_t)(*at - '0');
+        }
+        else
+        {
+            exact = false;
+        }
+    }
+    if (at < end && *at == '.')
+    {
+        for (at++; at < end && sceneIsDigit(*at); at++, digits = true)
+        {
+            if (mantissa < SCENE_MANTISSA_LIMIT)
+            {
+                mantissa = mantissa * 10 + (uint64_t)(*at - '0');
+                exponent--;
+            }
+            else
+            {
+                exact = false;
+            }
+        }
+    }
+    if (digits && at < end && (*at == 'e' || *at == 'E'))
+    {
+        at++;
+        const bool negativeExponent = at < end && *at == '-';
+        if (at < end && (*at == '-' || *at == '+'))
+        {
+            at++;
+        }
+        int written = 0;
+        bool exponentDigits = false;
+        for (; at < end && sceneIsDigit(*at); at++, exponentDigits = true)
+        {
+            written = written < 10000 ? written * 10 + (*at - '0') : written;
+        }
+        digits = exponentDigits;
+        exponent += negativeExponent ? -written : written;
+    }
+    if (!digits || at != end)
+    {
+        return sceneFail(parser, "invalid number");
+    }
+    parser->at = end;
+    double value;
+    if (exact && mantissa <= SCENE_EXACT_MANTISSA && exponent >= -SCENE_EXACT_POWER && exponent <= SCENE_EXACT_POWER)
+    {
+        // Both operands are exact, so the single rounding of the operation gives the correctly rounded result
+        value = exponent < 0 ? (double)mantissa / scenePowers[-exponent] : (double)mantissa * scenePowers[exponent];
+        value = negative ? -value : value;
+    }
+    else
+    {
+        char buffer[SCENE_NUMBER_LENGTH];
+        if (length >= SCENE_NUMBER_LENGTH)
+        {
+            return sceneFail(parser, "number too long");
+        }
+        memcpy(buffer, start, length);
+        buffer[length] = '\0';
+        value = strtod(buffer, NULL);
+    }
+    *dest = (Scalar)value;
+    return true;
+}
+
+// Reads several numbers of the line
+static bool sceneNumbers(SceneParser *parser, Scalar *dest, const size_t count)
+{
+    for (size_t i = 0; i < count; i++)
+    {
+        if (!sceneNumber(parser, &dest[i]))
+        {
+            return false;
+        }
+    }
+    return true;
+}
+
+// Reads transformations until the end of the line, multiplying them in the order they are written
+static bool sceneTransform(SceneParser *parser, Affine *dest)
+{
+    Affine transform = affineFromMat4(IDENTITY);
+    while (!sceneLineEnd(parser))
+    {
+        const char *word;
+        size_t length;
+        if (!sceneWord(parser, &word, &length))
+        {
+            return false;
+        }
+        Scalar v[6];
+        Mat4 operation;
+        if (sceneWordIs(word, length, "translate") && sceneNumbers(parser, v, 3))
+        {
+            operation = translation(v[0], v[1], v[2]);
+        }
+        else if (sceneWordIs(word, length, "scale") && sceneNumbers(parser, v, 3))
+        {
+            operation = scaling(v[0], v[1], v[2]);
+        }
+        else if (sceneWordIs(word, length, "rotate-x") && sceneNumbers(parser, v, 1))
+        {
+            operation = rotationX(v[0]);
+        }
+        else if (sceneWordIs(word, length, "rotate-y") && sceneNumbers(parser, v, 1))
+        {
+            operation = rotationY(v[0]);
+        }
+        else if (sceneWordIs(word, length, "rotate-z") && sceneNumbers(parser, v, 1))
+        {
+            operation = rotationZ(v[0]);
+        }
+        else if (sceneWordIs(word, length, "shear") && sceneNumbers(parser, v, 6))
+        {
+            operation = shearing(v[0], v[1], v[2], v[3], v[4], v[5]);
+        }
+        else
+        {
+            return sceneFail(parser, "unknown transformation");
+        }
+        transform = affineMul(transform, affineFromMat4(operation));
+    }
+    *dest = transform;
+    return true;
+}
+
+// Returns the index of the material with the given name, or `materialCount` if there is none
+static size_t sceneFindMaterial(SceneParser *parser, const char *name, const size_t length)
+{
+    if (parser->lastMaterial < parser->materialCount &&
+        parser->materials[parser->lastMaterial].length == length &&
+        memcmp(parser->materials[parser->lastMaterial].name, name, length) == 0)
+    {
+        return parser->lastMaterial;
+    }
+    for (size_t i = 0; i < parser->materialCount; i++)
+    {
+        if (parser->materials[i].length == length && memcmp(parser->materials[i].name, name, length) == 0)
+        {
+            parser->lastMaterial = i;
+            return i;
+        }
+    }
+    return parser->materialCount;
+}
+
+// Grows an array to fit one more element, doubling its capacity.
+// If the allocation fails, `abort()` is called
+static void *sceneGrow(void *array, const size_t count, size_t *capacity, const size_t size)
+{
+    if (count < *capacity)
+    {
+        return array;
+    }
+    *capacity = *capacity == 0 ? 16 : *capacity * 2;
+    array = realloc(array, *capacity * size);
+    if (array == NULL)
+    {
+        abort();
+    }
+    return array;
+}
+
+// material <name> <r> <g> <b> <ambient> <diffuse> <specular> <shininess> [stripe <r> <g> <b> <r> <g> <b> <transformations>]
+static bool sceneMaterial(SceneParser *parser)
+{
+    const char *name;
+    size_t length;
+    Scalar v[7];
+    if (!sceneWord(parser, &name, &length) || !sceneNumbers(parser, v, 7))
+    {
+        return false;
+    }
+    if (sceneFindMaterial(parser, name, length) != parser->materialCount)
+    {
+        return sceneFail(parser, "duplicate material");
+    }
+    Material material = {.color = color(v[0], v[1], v[2]), .ambient = v[3], .diffuse = v[4], .specular = v[5], .shininess = v[6]};
+    if (!sceneLineEnd(parser))
+    {
+        const char *word;
+        size_t wordLength;
+        Scalar colors[6];
+        Affine transform;
+        if (!sceneWord(parser, &word, &wordLength))
+        {
+            return false;
+        }
+        if (!sceneWordIs(word, wordLength, "stripe"))
+        {
+            return sceneFail(parser, "unknown pattern");
+        }
+        if (!sceneNumbers(parser, colors, 6) || !sceneTransform(parser, &transform))
+        {
+            return false;
+        }
+        Affine inverse;
+        if (!affineTryInv(&inverse, transform))
+        {
+            return sceneFail(parser, "singular transformation");
+        }
+        material.hasPattern = true;
+        material.pattern = stripePattern(color(colors[0], colors[1], colors[2]), color(colors[3], colors[4], colors[5]), affineToMat4(transform));
+    }
+    parser->materials = sceneGrow(parser->materials, parser->materialCount, &parser->materialCapacity, sizeof(SceneMaterial));
+    parser->materials[parser->materialCount++] = (SceneMaterial){name, length, material};
+    return true;
+}
+
+// Returns the mesh loaded from the file, loading it if it is used for the first time.
+// Returns NULL if the file cannot be loaded.
+// If the allocation fails, `abort()` is called
+static const Mesh *sceneFindMesh(SceneParser *parser, Scene *scene, const char *path, const size_t length)
+{
+    for (size_t i = 0; i < scene->meshCount; i++)
+    {
+        if (parser->meshPaths[i].length == length && memcmp(parser->meshPaths[i].text, path, length) == 0)
+        {
+            return scene->meshes[i];
+        }
+    }
+    char *fileName = malloc(length + 1);
+    Mesh *mesh = malloc(sizeof(Mesh));
+    if (fileName == NULL || mesh == NULL)
+    {
+        abort();
+    }
+    memcpy(fileName, path, length);
+    fileName[length] = '\0';
+    FILE *file = fopen(fileName, "rb");
+    free(fileName);
+    if (file == NULL)
+    {
+        free(mesh);
+        sceneFail(parser, "could not open the mesh file");
+        return NULL;
+    }
+    SceneError error;
+    const bool loaded = sceneLoadObj(mesh, file, &error);
+    fclose(file);
+    if (!loaded)
+    {
+        free(mesh);
+        sceneFail(parser, error.message);
+        return NULL;
+    }
+    const size_t capacity = parser->meshCapacity;
+    scene->meshes = sceneGrow(scene->meshes, scene->meshCount, &parser->meshCapacity, sizeof(Mesh *));
+    if (parser->meshCapacity != capacity)
+    {
+        parser->meshPaths = realloc(parser->meshPaths, parser->meshCapacity * sizeof(SceneName));
+        if (parser->meshPaths == NULL)
+        {
+            abort();
+        }
+    }
+    parser->meshPaths[scene->meshCount] = (SceneName){path, length};
+    scene->meshes[scene->meshCount++] = mesh;
+    return mesh;
+}
+
+// sphere|plane <material> <transformations>
+// mesh <material> <Wavefront OBJ file> <transformations>
+static bool sceneShape(SceneParser *parser, Scene *scene, const ShapeType type)
+{
+    World *world = &scene->world;
+    const char *name;
+    size_t length;
+    Affine transform;
+    if (!sceneWord(parser, &name, &length))
+    {
+        return false;
+    }
+    const size_t material = sceneFindMaterial(parser, name, length);
+    if (material == parser->materialCount)
+    {
+        return sceneFail(parser, "unknown material");
+    }
+    const Mesh *mesh = NULL;
+    if (type == MESH)
+    {
+        const char *path;
+        size_t pathLength;
+        if (!sceneWord(parser, &path, &pathLength) || (mesh = sceneFindMesh(parser, scene, path, pathLength)) == NULL)
+        {
+            return false;
+        }
+    }
+    if (!sceneTransform(parser, &transform))
+    {
+        return false;
+    }
+    Affine inverse;
+    if (!affineTryInv(&inverse, transform))
+    {
+        return sceneFail(parser, "singular transformation");
+    }
+    const Shape shape = {type, transform, inverse, affineNormalMatrix(transform), parser->materials[material].material, mesh};
+    Group *group = parser->group;
+    if (group != NULL)
+    {
+        group->shapes = sceneGrow(group->shapes, group->shapeCount, &parser->groupShapeCapacity, sizeof(Shape));
+        group->shapes[group->shapeCount++] = shape;
+        return true;
+    }
+    world->shapes = sceneGrow(world->shapes, world->shapeCount, &parser->shapeCapacity, sizeof(Shape));
+    world->shapes[world->shapeCount++] = shape;
+    return true;
+}
+
+// Returns the index of the group with the given name, or `groupCount` if there is none
+static size_t sceneFindGroup(const SceneParser *parser, const Scene *scene, const char *name, const size_t length)
+{
+    for (size_t i = 0; i < scene->groupCount; i++)
+    {
+        if (parser->groupNames[i].length == length && memcmp(parser->groupNames[i].text, name, length) == 0)
+        {
+            return i;
+        }
+    }
+    return scene->groupCount;
+}
+
+// group <name>
+// If the allocation fails, `abort()` is called
+static bool sceneGroup(SceneParser *parser, Scene *scene)
+{
+    const char *name;
+    size_t length;
+    if (!sceneWord(parser, &name, &length))
+    {
+        return false;
+    }
+    if (parser->group != NULL)
+    {
+        return sceneFail(parser, "nested group");
+    }
+    if (sceneFindGroup(parser, scene, name, length) != scene->groupCount)
+    {
+        return sceneFail(parser, "duplicate group");
+    }
+    Group *group = malloc(sizeof(Group));
+    if (group == NULL)
+    {
+        abort();
+    }
+    *group = (Group){.bounds = boundsEmpty()};
+    const size_t capacity = parser->groupCapacity;
+    scene->groups = sceneGrow(scene->groups, scene->groupCount, &parser->groupCapacity, sizeof(Group *));
+    if (parser->groupCapacity != capacity)
+    {
+        parser->groupNames = realloc(parser->groupNames, parser->groupCapacity * sizeof(SceneName));
+        if (parser->groupNames == NULL)
+        {
+            abort();
+        }
+    }
+    parser->groupNames[scene->groupCount] = (SceneName){name, length};
+    scene->groups[scene->groupCount++] = group;
+    parser->group = group;
+    parser->groupShapeCapacity = 0;
+    return true;
+}
+
+// end
+static bool sceneGroupEnd(SceneParser *parser)
+{
+    if (parser->group == NULL)
+    {
+        return sceneFail(parser, "end outside of a group");
+    }
+    groupBuild(parser->group);
+    parser->group = NULL;
+    return true;
+}
+
+// instance <group> <transformations>
+static bool sceneInstance(SceneParser *parser, Scene *scene)
+{
+    World *world = &scene->world;
+    const char *name;
+    size_t length;
+    Affine transform;
+    if (!sceneWord(parser, &name, &length))
+    {
+        return false;
+    }
+    if (parser->group != NULL)
+    {
+        return sceneFail(parser, "instance inside a group");
+    }
+    const size_t group = sceneFindGroup(parser, scene, name, length);
+    if (group == scene->groupCount)
+    {
+        return sceneFail(parser, "unknown group");
+    }
+    if (!sceneTransform(parser, &transform))
+    {
+        return false;
+    }
+    Affine inverse;
+    if (!affineTryInv(&inverse, transform))
+    {
+        return sceneFail(parser, "singular transformation");
+    }
+    world->instances = sceneGrow(world->instances, world->instanceCount, &parser->instanceCapacity, sizeof(Instance));
+    world->instances[world->instanceCount++] = (Instance){inverse, scene->groups[group]};
+    return true;
+}
+
+// light <x> <y> <z> <r> <g> <b>
+static bool sceneLight(SceneParser *parser, World *world)
+{
+    Scalar v[6];
+    if (!sceneNumbers(parser, v, 6))
+    {
+        return false;
+    }
+    world->lights = sceneGrow(world->lights, world->lightCount, &parser->lightCapacity, sizeof(Light));
+    world->lights[world->lightCount++] = light(v[0], v[1], v[2], v[3], v[4], v[5]);
+    return true;
+}
+
+// camera <width> <height> <fov> <from x y z> <to x y z> <up x y z>
+static bool sceneCamera(SceneParser *parser, Scene *scene)
+{
+    Scalar v[12];
+    if (!sceneNumbers(parser, v, 12))
+    {
+        return false;
+    }
+    if (scene->hasCamera)
+    {
+        return sceneFail(parser, "duplicate camera");
+    }
+    if (v[0] < 1 || v[1] < 1 || v[0] != floor(v[0]) || v[1] != floor(v[1]) || v[0] > 1e6 || v[1] > 1e6)
+    {
+        return sceneFail(parser, "invalid image size");
+    }
+    scene->camera = cameraInit((size_t)v[0], (size_t)v[1], v[2], viewTransform(point(v[3], v[4], v[5]), point(v[6], v[7], v[8]), vector(v[9], v[10], v[11])));
+    scene->hasCamera = true;
+    return true;
+}
+
+// Parses one statement of a scene description, the line must not be empty
+static bool sceneStatement(SceneParser *parser, void *context)
+{
+    Scene *scene = context;
+    const char *word;
+    size_t length;
+    if (!sceneWord(parser, &word, &length))
+    {
+        return false;
+    }
+    bool parsed;
+    if (sceneWordIs(word, length, "sphere"))
+    {
+        parsed = sceneShape(parser, scene, SPHERE);
+    }
+    else if (sceneWordIs(word, length, "plane"))
+    {
+        parsed = sceneShape(parser, scene, PLANE);
+    }
+    else if (sceneWordIs(word, length, "mesh"))
+    {
+        parsed = sceneShape(parser, scene, MESH);
+    }
+    else if (sceneWordIs(word, length, "instance"))
+    {
+        parsed = sceneInstance(parser, scene);
+    }
+    else if (sceneWordIs(word, length, "group"))
+    {
+        parsed = sceneGroup(parser, scene);
+    }
+    else if (sceneWordIs(word, length, "end"))
+    {
+        parsed = sceneGroupEnd(parser);
+    }
+    else if (sceneWordIs(word, length, "material"))
+    {
+        parsed = sceneMaterial(parser);
+    }
+    else if (sceneWordIs(word, length, "light"))
+    {
+        parsed = sceneLight(parser, &scene->world);
+    }
+    else if (sceneWordIs(word, length, "camera"))
+    {
+        parsed = sceneCamera(parser, scene);
+    }
+    else
+    {
+        return sceneFail(parser, "unknown statement");
+    }
+    if (parsed && !sceneLineEnd(parser))
+    {
+        return sceneFail(parser, "unexpected value");
+    }
+    return parsed;
+}
+
+// Parses the lines from the parser's position to its end, skipping empty lines and stopping at the first error
+static void sceneLines(SceneParser *parser, const SceneStatementFunction statement, void *context)
+{
+    while (parser->at < parser->end)
+    {
+        if (!sceneLineEnd(parser) && !statement(parser, context))
+        {
+            return;
+        }
+        if (parser->at < parser->end)
+        {
+            parser->at++; // newline
+            parser->line++;
+        }
+    }
+}
+
+// Parses a scene description of `length` characters, one statement per line:
+//   camera <width> <height> <fov> <from x y z> <to x y z> <up x y z>
+//   light <x> <y> <z> <r> <g> <b>
+//   material <name> <r> <g> <b> <ambient> <diffuse> <specular> <shininess> [stripe <r> <g> <b> <r> <g> <b> <transformations>]
+//   sphere|plane <material> <transformations>
+//   mesh <material> <Wavefront OBJ file> <transformations>
+//   group <name>
+//   end
+//   instance <group> <transformations>
+// Transformations are a list of `translate x y z`, `scale x y z`, `rotate-x|rotate-y|rotate-z radians` and
+// `shear xy xz yx yz zx zy`, multiplied in the order they are written (so the last one is applied first).
+// Everything after a `#` on a line is ignored and materials must be defined before they are used.
+// Mesh files are opened relative to the working directory (see `sceneLoadObj`), each file is loaded once.
+// The shapes between `group` and `end` form a group instead of being added to the world, instances place the shapes
+// of an ended group in the world without copying them.
+// Returns false and fills `error` if the description is invalid, leaving `dest` empty.
+// If the allocation fails, `abort()` is called
+bool sceneParse(Scene *dest, const char *text, const size_t length, SceneError *error)
+{
+    *dest = (Scene){.hasCamera = false};
+    SceneParser parser = {.at = text, .end = text + length, .line = 1};
+    sceneLines(&parser, sceneStatement, dest);
+    if (parser.message == NULL && parser.group != NULL)
+    {
+        sceneFail(&parser, "group without an end");
+    }
+    free(parser.materials);
+    free(parser.meshPaths);
+    free(parser.groupNames);
+    if (parser.message != NULL)
+    {
+        if (error != NULL)
+        {
+            *error = (SceneError){parser.line, parser.message};
+        }
+        sceneDestroy(dest);
+        return false;
+    }
+    return true;
+}
+
+// Reads and parses a scene description from the file (see `sceneParse`).
+// Returns false and fills `error` if the file cannot be read or the description is invalid.
+// If the allocation fails, `abort()` is called
+bool sceneLoad(Scene *dest, FILE *file, SceneError *error)
+{
+    size_t length = 0;
+    size_t capacity = SCENE_READ_SIZE;
+    char *text = malloc(capacity);
+    if (text == NULL)
+    {
+        abort();
+    }
+    size_t read;
+    while ((read = fread(text + length, 1, capacity - length, file)) != 0)
+    {
+        length += read;
+        if (length == capacity)
+        {
+            capacity *= 2;
+            text = realloc(text, capacity);
+            if (text == NULL)
+            {
+                abort();
+            }
+        }
+    }
+    if (ferror(file))
+    {
+        free(text);
+        *dest = (Scene){.hasCamera = false};
+        if (error != NULL)
+        {
+            *error = (SceneError){0, "could not read the file"};
+        }
+        return false;
+    }
+    const bool parsed = sceneParse(dest, text, length, error);
+    free(text);
+    return parsed;
+}
+
+// Scene destructor, also destroys the groups and meshes of the scene
+void sceneDestroy(Scene *scene)
+{
+    worldDestroy(&scene->world);
+    for (size_t i = 0; i < scene->groupCount; i++)
+    {
+        groupDestroy(scene->groups[i]);
+        free(scene->groups[i]);
+    }
+    free(scene->groups);
+    scene->groups = NULL;
+    scene->groupCount = 0;
+    for (size_t i = 0; i < scene->meshCount; i++)
+    {
+        meshDestroy(scene->meshes[i]);
+        free(scene->meshes[i]);
+    }
+    free(scene->meshes);
+    scene->meshes = NULL;
+    scene->meshCount = 0;
+    scene->hasCamera = false;
+}
+
+// Reads an index of a face's vertex reference, 1-based or negative to count back from the last element.
+// Stores the index, which must be below `count`, 0-based.
+static bool sceneObjIndex(SceneParser *parser, const char **at, const char *end, const size_t count, size_t *dest)
+{
+    const bool negative = *at < end && **at == '-';
+    if (negative)
+    {
+        (*at)++;
+    }
+    size_t value = 0;
+    bool digits = false;
+    for (; *at < end && sceneIsDigit(**at); (*at)++, digits = true)
+    {
+        value = value <= count ? value * 10 + (size_t)(**at - '0') : value; // anything above `count` is invalid
+    }
+    if (!digits || value == 0 || value > count)
+    {
+        return sceneFail(parser, "invalid index");
+    }
+    *dest = negative ? count - value : value - 1;
+    return true;
+}
+
+// Reads a face's vertex reference, `v`, `v/vt`, `v//vn` or `v/vt/vn`, ignoring the texture coordinate.
+// Stores `MESH_NO_NORMAL` as the normal if there is none.
+static bool sceneObjReference(SceneParser *parser, const Mesh *mesh, size_t *vertex, size_t *normal)
+{
+    const char *at;
+    size_t length;
+    if (!sceneWord(parser, &at, &length))
+    {
+        return false;
+    }
+    const char *end = at + length;
+    *normal = MESH_NO_NORMAL;
+    if (!sceneObjIndex(parser, &at, end, mesh->vertexCount, vertex))
+    {
+        return false;
+    }
+    if (at < end && *at == '/')
+    {
+        for (at++; at < end && *at != '/'; at++)
+        {
+            // Skips the texture coordinate
+        }
+        if (at < end)
+        {
+            at++;
+            if (!sceneObjIndex(parser, &at, end, mesh->normalCount, normal))
+            {
+                return false;
+            }
+        }
+    }
+    return at == end || sceneFail(parser, "invalid index");
+}
+
+// f <vertex reference> <vertex reference> <vertex reference> ..., triangulated as a fan around the first vertex
+static bool sceneObjFace(SceneParser *parser, Mesh *mesh)
+{
+    size_t vertices[3];
+    size_t normals[3];
+    size_t count = 0;
+    while (!sceneLineEnd(parser))
+    {
+        const size_t corner = count < 2 ? count : 2;
+        if (!sceneObjReference(parser, mesh, &vertices[corner], &normals[corner]))
+        {
+            return false;
+        }
+        if (++count >= 3)
+        {
+            const bool hasNormals = normals[0] != MESH_NO_NORMAL && normals[1] != MESH_NO_NORMAL && normals[2] != MESH_NO_NORMAL;
+            meshAddTriangle(mesh, (MeshTriangle){{vertices[0], vertices[1], vertices[2]},
+                                                 {hasNormals ? normals[0] : MESH_NO_NORMAL, hasNormals ? normals[1] : MESH_NO_NORMAL,
+                                                  hasNormals ? normals[2] : MESH_NO_NORMAL}});
+            vertices[1] = vertices[2];
+            normals[1] = normals[2];
+        }
+    }
+    return count >= 3 || sceneFail(parser, "a face needs at least three vertices");
+}
+
+// Parses one statement of a Wavefront OBJ file, the line must not be empty
+static bool sceneObjStatement(SceneParser *parser, void *context)
+{
+    Mesh *mesh = context;
+    const char *word;
+    size_t length;
+    Scalar v[3];
+    if (!sceneWord(parser, &word, &length))
+    {
+        return false;
+    }
+    if (sceneWordIs(word, length, "v"))
+    {
+        if (!sceneNumbers(parser, v, 3))
+        {
+            return false;
+        }
+        meshAddVertex(mesh, color(v[0], v[1], v[2]));
+    }
+    else if (sceneWordIs(word, length, "vn"))
+    {
+        if (!sceneNumbers(parser, v, 3))
+        {
+            return false;
+        }
+        meshAddNormal(mesh, color(v[0], v[1], v[2]));
+    }
+    else if (sceneWordIs(word, length, "f") && !sceneObjFace(parser, mesh))
+    {
+        return false;
+    }
+    sceneSkipLine(parser); // vertex weights and colors, texture coordinates, groups, materials, ...
+    return true;
+}
+
+// Reads a Wavefront OBJ file into the mesh and builds it (see `meshBuild`).
+// Vertices, normals and polygonal faces are read, faces without normals get smooth ones, everything else is ignored.
+// The file is parsed in blocks as it is read, without holding all of it in memory.
+// Returns false and fills `error` if the file cannot be read or is invalid, leaving `dest` empty.
+// If the allocation fails, `abort()` is called
+bool sceneLoadObj(Mesh *dest, FILE *file, SceneError *error)
+{
+    meshCreate(dest);
+    size_t capacity = SCENE_READ_SIZE;
+    size_t length = 0; // of the partial line kept at the start of the buffer
+    char *buffer = malloc(capacity);
+    if (buffer == NULL)
+    {
+        abort();
+    }
+    SceneParser parser = {.line = 1};
+    bool end = false;
+    while (!end && parser.message == NULL)
+    {
+        if (length == capacity)
+        {
+            capacity *= 2; // a line longer than the buffer
+            buffer = realloc(buffer, capacity);
+            if (buffer == NULL)
+            {
+                abort();
+            }
+        }
+        const size_t read = fread(buffer + length, 1, capacity - length, file);
+        end = read == 0;
+        length += read;
+        // Parses the complete lines, the partial last one is finished by the next block
+        size_t complete = length;
+        while (!end && complete > 0 && buffer[complete - 1] != '\n')
+        {
+            complete--;
+        }
+        parser.at = buffer;
+        parser.end = buffer + complete;
+        sceneLines(&parser, sceneObjStatement, dest);
+        memmove(buffer, buffer + complete, length - complete);
+        length -= complete;
+    }
+    free(buffer);
+    if (parser.message == NULL && ferror(file))
+    {
+        parser = (SceneParser){.message = "could not read the file"};
+    }
+    if (parser.message != NULL)
+    {
+        if (error != NULL)
+        {
+            *error = (SceneError){parser.line, parser.message};
+        }
+        meshDestroy(dest);
+        return false;
+    }
+    meshBuild(dest);
+    return true;
+}
+
+static const char sceneCacheMagic[8] = {'A', 'K', 'T', 'I', 'N', 'A', 'S', 'C'};
+
+// Returns the offset of a section of `size` bytes placed at or after `offset`, moving `offset` past it
+static uint64_t sceneCacheSection(uint64_t *offset, const uint64_t size)
+{
+    const uint64_t start = (*offset + SCENE_CACHE_ALIGN - 1) / SCENE_CACHE_ALIGN * SCENE_CACHE_ALIGN;
+    *offset = start + size;
+    return start;
+}
+
+// Writes `size` bytes at `offset`, padding the file with zeros up to it
+static bool sceneCacheWriteSection(FILE *file, uint64_t *position, const uint64_t offset, const void *data, const size_t size)
+{
+    static const char padding[SCENE_CACHE_ALIGN] = {0};
+    if (fwrite(padding, 1, (size_t)(offset - *position), file) != offset - *position)
+    {
+        return false;
+    }
+    *position = offset + size;
+    return size == 0 || fwrite(data, 1, size, file) == size;
+}
+
+// Writes the shapes at `offset`, padding the file with zeros up to it, with their mesh pointers cleared
+static bool sceneCacheWriteShapes(FILE *file, uint64_t *position, const uint64_t offset, const Shape *shapes, const size_t count)
+{
+    if (!sceneCacheWriteSection(file, position, offset, NULL, 0))
+    {
+        return false;
+    }
+    for (size_t i = 0; i < count; i++)
+    {
+        Shape stored;
+        memcpy(&stored, &shapes[i], sizeof(Shape));
+        stored.mesh = NULL;
+        if (fwrite(&stored, sizeof(Shape), 1, file) != 1)
+        {
+            return false;
+        }
+    }
+    *position = offset + count * sizeof(Shape);
+    return true;
+}
+
+// Writes the scene, and its bounding volume hierarchy if one is built, as a binary scene cache (see `sceneCacheMap`).
+// Of the hierarchy only the binary tree and its layout are stored, wide and quantized nodes are collapsed again when
+// the cache is mapped.
+// Returns false if the file cannot be written or the scene has meshes or instances, which cannot be cached.
+// Important: The cache stores the types as they are laid out in memory, padding included, it can only be read by builds
+// with the same precision, alignment and byte order. The mesh pointers of the shapes are stored as NULL
+// Info: `file` should be opened in binary mode and positioned at its start
+bool sceneCacheWrite(const Scene *scene, FILE *file)
+{
+    const World *world = &scene->world;
+    if (world->instanceCount != 0)
+    {
+        return false;
+    }
+    for (size_t i = 0; i < world->shapeCount; i++)
+    {
+        if (world->shapes[i].type == MESH)
+        {
+            return false;
+        }
+    }
+    const Bvh *bvh = world->bvh;
+    SceneCacheHeader header = {.version = SCENE_CACHE_VERSION,
+                               .scalarSize = sizeof(Scalar),
+                               .byteOrder = SCENE_CACHE_BYTE_ORDER,
+                               .cameraSize = sizeof(Camera),
+                               .lightSize = sizeof(Light),
+                               .shapeSize = sizeof(Shape),
+                               .nodeSize = sizeof(BvhNode),
+                               .hasCamera = scene->hasCamera,
+                               .lightCount = world->lightCount,
+                               .shapeCount = world->shapeCount,
+                               .nodeCount = bvh != NULL ? bvh->nodeCount : 0,
+                               .primitiveCount = bvh != NULL ? bvh->primitiveCount : 0,
+                               .unboundedCount = bvh != NULL ? bvh->unboundedCount : 0,
+                               .layout = bvh != NULL ? bvh->layout : BVH_BINARY};
+    memcpy(header.magic, sceneCacheMagic, sizeof(header.magic));
+    uint64_t offset = sizeof(SceneCacheHeader);
+    header.camera = sceneCacheSection(&offset, sizeof(Camera));
+    header.lights = sceneCacheSection(&offset, header.lightCount * sizeof(Light));
+    header.shapes = sceneCacheSection(&offset, header.shapeCount * sizeof(Shape));
+    header.nodes = sceneCacheSection(&offset, header.nodeCount * sizeof(BvhNode));
+    header.primitives = sceneCacheSection(&offset, header.primitiveCount * sizeof(size_t));
+    header.unbounded = sceneCacheSection(&offset, header.unboundedCount * sizeof(size_t));
+    header.size = offset;
+    uint64_t position = 0;
+    return sceneCacheWriteSection(file, &position, 0, &header, sizeof(header)) &&
+           sceneCacheWriteSection(file, &position, header.camera, &scene->camera, sizeof(Camera)) &&
+           sceneCacheWriteSection(file, &position, header.lights, world->lights, header.lightCount * sizeof(Light)) &&
+           sceneCacheWriteShapes(file, &position, header.shapes, world->shapes, world->shapeCount) &&
+           (bvh == NULL ||
+            (sceneCacheWriteSection(file, &position, header.nodes, bvh->nodes, header.nodeCount * sizeof(BvhNode)) &&
+             sceneCacheWriteSection(file, &position, header.primitives, bvh->primitives, header.primitiveCount * sizeof(size_t)) &&
+             sceneCacheWriteSection(file, &position, header.unbounded, bvh->unbounded, header.unboundedCount * sizeof(size_t)))) &&
+           fflush(file) == 0;
+}
+
+// Returns true if a section of `count` elements of `size` bytes at `offset` lies within the cache and is aligned
+static bool sceneCacheFits(const SceneCacheHeader *header, const uint64_t offset, const uint64_t count, const uint64_t size)
+{
+    return offset % SCENE_CACHE_ALIGN == 0 && offset <= header->size && count <= (header->size - offset) / size;
+}
+
+// Returns true if the sections of the cache, which must fit in it, only refer to each other within their bounds: the
+// shapes are spheres or planes without a mesh, the hierarchy has a known layout, its children follow their parents
+// and its leaves and unbounded primitives list existing shapes
+static bool sceneCacheConsistent(const SceneCacheHeader *header, const unsigned char *mapping)
+{
+    if (header->layout > BVH_QUANTIZED)
+    {
+        return false;
+    }
+    const Shape *shapes = (const Shape *)(mapping + header->shapes);
+    for (uint64_t i = 0; i < header->shapeCount; i++)
+    {
+        if ((shapes[i].type != SPHERE && shapes[i].type != PLANE) || shapes[i].mesh != NULL)
+        {
+            return false;
+        }
+    }
+    const BvhNode *nodes = (const BvhNode *)(mapping + header->nodes);
+    for (uint64_t i = 0; i < header->nodeCount; i++)
+    {
+        const bool inner = nodes[i].count == 0;
+        if (inner ? i + 1 >= header->nodeCount || nodes[i].start <= i + 1 || nodes[i].start >= header->nodeCount
+                  : nodes[i].start > header->primitiveCount || nodes[i].count > header->primitiveCount - nodes[i].start)
+        {
+            return false;
+        }
+    }
+    const size_t *primitives = (const size_t *)(mapping + header->primitives);
+    for (uint64_t i = 0; i < header->primitiveCount; i++)
+    {
+        if (primitives[i] >= header->shapeCount)
+        {
+            return false;
+        }
+    }
+    const size_t *unbounded = (const size_t *)(mapping + header->unbounded);
+    for (uint64_t i = 0; i < header->unboundedCount; i++)
+    {
+        if (unbounded[i] >= header->shapeCount)
+        {
+            return false;
+        }
+    }
+    return true;
+}
+
+// Maps the whole file into memory read-only, returning NULL if it fails
+static void *sceneCacheMapFile(FILE *file, size_t *size)
+{
+#if defined(__unix__)
+    struct stat status;
+    const int descriptor = fileno(file);
+    if (fstat(descriptor, &status) != 0 || status.st_size <= 0)
+    {
+        return NULL;
+    }
+    *size = (size_t)status.st_size;
+    void *mapping = mmap(NULL, *size, PROT_READ, MAP_PRIVATE, descriptor, 0);
+    return mapping != MAP_FAILED ? mapping : NULL;
+#elif defined(_WIN32)
+    HANDLE handle = (HANDLE)_get_osfhandle(_fileno(file));
+    LARGE_INTEGER fileSize;
+    if (handle == INVALID_HANDLE_VALUE || !GetFileSizeEx(handle, &fileSize) || fileSize.QuadPart <= 0)
+    {
+        return NULL;
+    }
+    *size = (size_t)fileSize.QuadPart;
+    HANDLE mappingHandle = CreateFileMappingA(handle, NULL, PAGE_READONLY, 0, 0, NULL);
+    if (mappingHandle == NULL)
+    {
+        return NULL;
+    }
+    void *mapping = MapViewOfFile(mappingHandle, FILE_MAP_READ, 0, 0, 0);
+    CloseHandle(mappingHandle); // the view keeps the mapping alive
+    return mapping;
+#else
+    // Without memory mapping the file is read into an aligned buffer
+    if (fseek(file, 0, SEEK_END) != 0)
+    {
+        return NULL;
+    }
+    const long length = ftell(file);
+    if (length <= 0 || fseek(file, 0, SEEK_SET) != 0)
+    {
+        return NULL;
+    }
+    *size = (size_t)length;
+    void *mapping = aligned_alloc(SCENE_CACHE_ALIGN, (*size + SCENE_CACHE_ALIGN - 1) / SCENE_CACHE_ALIGN * SCENE_CACHE_ALIGN);
+    if (mapping == NULL)
+    {
+        abort();
+    }
+    if (fread(mapping, 1, *size, file) != *size)
+    {
+        free(mapping);
+        return NULL;
+    }
+    return mapping;
+#endif
+}
+
+static void sceneCacheUnmapFile(void *mapping, const size_t size)
+{
+#if defined(__unix__)
+    munmap(mapping, size);
+#elif defined(_WIN32)
+    (void)size;
+    UnmapViewOfFile(mapping);
+#else
+    (void)size;
+    free(mapping);
+#endif
+}
+
+// Returns true if the file starts like a binary scene cache, whether or not it can be used by this build
+// Info: Reads from the beginning of the file and rewinds it
+bool sceneIsCache(FILE *file)
+{
+    char magic[sizeof(sceneCacheMagic)];
+    rewind(file);
+    const bool isCache = fread(magic, 1, sizeof(magic), file) == sizeof(magic) && memcmp(magic, sceneCacheMagic, sizeof(magic)) == 0;
+    rewind(file);
+    return isCache;
+}
+
+// Maps a binary scene cache written by `sceneCacheWrite` read-only into memory, the scene of `dest` then refers to
+// the cached shapes, lights and bounding volume hierarchy in place, so the cost of loading is paid in page faults
+// as they are first used. The sections are checked to lie within the file and to only refer to each other within
+// their bounds, which reads the shapes and the hierarchy once. A hierarchy written with the wide or quantized layout
+// is collapsed into it again.
+// Returns false and fills `error` if the file cannot be mapped, is not a cache written by a compatible build or is
+// truncated or corrupt.
+// Important: The scene must not be modified or destroyed with `sceneDestroy`, close the cache with `sceneCacheClose`
+// Info: The file can be closed once mapped, the cache must start at the beginning of the file
+// If the allocation fails, `abort()` is called
+bool sceneCacheMap(SceneCache *dest, FILE *file, SceneError *error)
+{
+    *dest = (SceneCache){.scene = {.hasCamera = false}};
+    const char *message = NULL;
+    size_t size = 0;
+    unsigned char *mapping = sceneCacheMapFile(file, &size);
+    const SceneCacheHeader *header = (const SceneCacheHeader *)mapping;
+    if (mapping == NULL)
+    {
+        message = "could not map the file";
+    }
+    else if (size < sizeof(SceneCacheHeader) || memcmp(header->magic, sceneCacheMagic, sizeof(header->magic)) != 0)
+    {
+        message = "not a scene cache";
+    }
+    else if (header->version != SCENE_CACHE_VERSION || header->scalarSize != sizeof(Scalar) ||
+             header->byteOrder != SCENE_CACHE_BYTE_ORDER || header->cameraSize != sizeof(Camera) ||
+             header->lightSize != sizeof(Light) || header->shapeSize != sizeof(Shape) || header->nodeSize != sizeof(BvhNode))
+    {
+        message = "scene cache written by an incompatible build";
+    }
+    else if (header->size > size || !sceneCacheFits(header, header->camera, 1, sizeof(Camera)) ||
+             !sceneCacheFits(header, header->lights, header->lightCount, sizeof(Light)) ||
+             !sceneCacheFits(header, header->shapes, header->shapeCount, sizeof(Shape)) ||
+             !sceneCacheFits(header, header->nodes, header->nodeCount, sizeof(BvhNode)) ||
+             !sceneCacheFits(header, header->primitives, header->primitiveCount, sizeof(size_t)) ||
+             !sceneCacheFits(header, header->unbounded, header->unboundedCount, sizeof(size_t)))
+    {
+        message = "truncated scene cache";
+    }
+    else if (!sceneCacheConsistent(header, mapping))
+    {
+        message = "corrupt scene cache";
+    }
+    if (message != NULL)
+    {
+        if (mapping != NULL)
+        {
+            sceneCacheUnmapFile(mapping, size);
+        }
+        if (error != NULL)
+        {
+            *error = (SceneError){0, message};
+        }
+        return false;
+    }
+    dest->mapping = mapping;
+    dest->size = size;
+    // The types are read-only through the mapping, the casts only satisfy the mutable pointers of `World`
+    World *world = &dest->scene.world;
+    world->lightCount = (size_t)header->lightCount;
+    world->shapeCount = (size_t)header->shapeCount;
+    world->lights = (Light *)(mapping + header->lights);
+    world->shapes = (Shape *)(mapping + header->shapes);
+    if (header->nodeCount != 0)
+    {
+        world->bvh = malloc(sizeof(Bvh));
+        if (world->bvh == NULL)
+        {
+            abort();
+        }
+        *world->bvh = (Bvh){(size_t)header->nodeCount, (size_t)header->primitiveCount, (size_t)header->unboundedCount,
+                            (BvhNode *)(mapping + header->nodes), (size_t *)(mapping + header->primitives),
+                            (size_t *)(mapping + header->unbounded), 0, BVH_BINARY, 0, NULL, NULL};
+        bvhSetLayout(world->bvh, (BvhLayout)header->layout);
+    }
+    dest->scene.hasCamera = header->hasCamera != 0;
+    if (dest->scene.hasCamera)
+    {
+        dest->scene.camera = *(const Camera *)(mapping + header->camera);
+    }
+    return true;
+}
+
+// Unmaps a binary scene cache, also freeing the structure of arrays copy if one was built for its world
+void sceneCacheClose(SceneCache *cache)
+{
+    if (cache->mapping != NULL)
+    {
+        worldDestroyArrays(&cache->scene.world);
+        if (cache->scene.world.bvh != NULL)
+        {
+            // The binary tree is in the mapping, only the collapsed nodes were allocated
+            free(cache->scene.world.bvh->wideNodes);
+            free(cache->scene.world.bvh->quantizedNodes);
+        }
+        free(cache->scene.world.bvh);
+        sceneCacheUnmapFile(cache->mapping, cache->size);
+    }
+    *cache = (SceneCache){.scene = {.hasCamera = false}};
+}
@@ -0,0 +1,53 @@
+/*
+ * scene.h - Scene description parsing
+ *
+ * Copyright (c) 2023, Dimitrios Alexopoulos All rights reserved.
+ */
+
+#ifndef SCENE_H
+#define SCENE_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdio.h>
+
+#include "mesh.h"
+#include "rays.h"
+#include "vectors.h"
+
+typedef struct
+{
+    World world;
+    Camera camera;
+    bool hasCamera;
+    size_t meshCount;
+    Mesh **meshes; // used by the mesh shapes of the world and its groups
+    size_t groupCount;
+    Group **groups; // placed by the instances of the world
+} Scene;
+
+typedef struct
+{
+    size_t line; // starting from 1, 0 if the error is not tied to a line
+    const char *message;
+} SceneError;
+
+// Binary scene cache mapped read-only into memory
+typedef struct
+{
+    Scene scene; // refers to the mapping
+    void *mapping;
+    size_t size;
+} SceneCache;
+
+bool sceneParse(Scene *dest, const char *text, size_t length, SceneError *error);
+bool sceneLoad(Scene *dest, FILE *file, SceneError *error);
+void sceneDestroy(Scene *scene);
+bool sceneLoadObj(Mesh *dest, FILE *file, SceneError *error);
+
+bool sceneCacheWrite(const Scene *scene, FILE *file);
+bool sceneIsCache(FILE *file);
+bool sceneCacheMap(SceneCache *dest, FILE *file, SceneError *error);
+void sceneCacheClose(SceneCache *cache);
+
+#endif
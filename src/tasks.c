@@ -0,0 +1,193 @@
+/*
+ * tasks.c - Work-stealing parallel task scheduler
+ *
+ * Copyright (c) 2023, Dimitrios Alexopoulos All rights reserved.
+ */
+
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <threads.h>
+
+#ifdef __unix__
+#include <unistd.h>
+#endif
+#ifdef _WIN32
+#include <windows.h>
+#endif
+
+#include "tasks.h"
+
+#define CACHE_LINE 64
+
+// Range of task indices [begin, end) owned by a worker.
+// Both ends are packed in one word so the owner (popping from the front) and thieves (stealing from the back)
+// can update it with a single compare-and-swap.
+typedef struct
+{
+    atomic_uint_least64_t range;
+    char padding[CACHE_LINE - sizeof(atomic_uint_least64_t)]; // Avoids false sharing between neighbouring queues
+} TaskQueue;
+
+typedef struct
+{
+    TaskQueue *queues;
+    size_t workerCount;
+    TaskFunction function;
+    void *context;
+} TaskPool;
+
+typedef struct
+{
+    TaskPool *pool;
+    size_t index;
+} TaskWorker;
+
+static uint_least64_t rangePack(const uint_least64_t begin, const uint_least64_t end)
+{
+    return begin << 32 | end;
+}
+
+static uint_least64_t rangeBegin(const uint_least64_t range)
+{
+    return range >> 32;
+}
+
+static uint_least64_t rangeEnd(const uint_least64_t range)
+{
+    return range & 0xFFFFFFFF;
+}
+
+// Takes the next task from the front of the worker's own queue
+static bool taskPop(TaskQueue *queue, size_t *task)
+{
+    uint_least64_t range = atomic_load(&queue->range);
+    while (rangeBegin(range) < rangeEnd(range))
+    {
+        if (atomic_compare_exchange_weak(&queue->range, &range, rangePack(rangeBegin(range) + 1, rangeEnd(range))))
+        {
+            *task = rangeBegin(range);
+            return true;
+        }
+    }
+    return false;
+}
+
+// Moves the back half of the victim's queue into the (empty) queue of the thief
+static bool taskSteal(TaskQueue *victim, TaskQueue *thief)
+{
+    uint_least64_t range = atomic_load(&victim->range);
+    while (rangeBegin(range) < rangeEnd(range))
+    {
+        const uint_least64_t stolen = (rangeEnd(range) - rangeBegin(range) + 1) / 2;
+        const uint_least64_t split = rangeEnd(range) - stolen;
+        if (atomic_compare_exchange_weak(&victim->range, &range, rangePack(rangeBegin(range), split)))
+        {
+            atomic_store(&thief->range, rangePack(split, split + stolen));
+            return true;
+        }
+    }
+    return false;
+}
+
+// Runs tasks from the worker's queue, stealing from the other workers once it runs dry.
+// Info: Returns when a full pass over the other queues finds no work
+static int taskWorker(void *arg)
+{
+    const TaskWorker *worker = arg;
+    TaskPool *pool = worker->pool;
+    TaskQueue *queue = &pool->queues[worker->index];
+    bool stolen = true;
+    while (stolen)
+    {
+        size_t task;
+        while (taskPop(queue, &task))
+        {
+            pool->function(pool->context, task, worker->index);
+        }
+        stolen = false;
+        for (size_t i = 1; i < pool->workerCount && !stolen; i++)
+        {
+            stolen = taskSteal(&pool->queues[(worker->index + i) % pool->workerCount], queue);
+        }
+    }
+    return 0;
+}
+
+// Returns the number of worker threads used for the requested thread count.
+// If `threadCount` is zero, the number of online processors is returned.
+size_t tasksThreadCount(const size_t threadCount)
+{
+    if (threadCount != 0)
+    {
+        return threadCount;
+    }
+#if defined(__unix__)
+    const long processors = sysconf(_SC_NPROCESSORS_ONLN);
+    return processors > 0 ? (size_t)processors : 1;
+#elif defined(_WIN32)
+    SYSTEM_INFO info;
+    GetSystemInfo(&info);
+    return info.dwNumberOfProcessors > 0 ? info.dwNumberOfProcessors : 1;
+#else
+    return 1;
+#endif
+}
+
+// Calls `function` once for every task in [0, taskCount) using up to `threadCount` threads (see `tasksThreadCount`),
+// returning the number of workers used. The calling thread takes part as worker zero.
+// Tasks are split evenly between the workers up front and idle workers steal from busy ones.
+// If the allocation fails, `abort()` is called
+// Info: If a thread cannot be started its tasks are stolen by the remaining workers
+size_t tasksRun(const size_t taskCount, const size_t threadCount, const TaskFunction function, void *context)
+{
+    size_t workerCount = tasksThreadCount(threadCount);
+    if (workerCount > taskCount)
+    {
+        workerCount = taskCount;
+    }
+    if (workerCount <= 1)
+    {
+        for (size_t i = 0; i < taskCount; i++)
+        {
+            function(context, i, 0);
+        }
+        return 1;
+    }
+    if (taskCount > 0xFFFFFFFF)
+    {
+        abort(); // Task indices must fit in half of the packed range
+    }
+    TaskQueue *queues = malloc(sizeof(TaskQueue[workerCount]));
+    TaskWorker *workers = malloc(sizeof(TaskWorker[workerCount]));
+    thrd_t *threads = malloc(sizeof(thrd_t[workerCount]));
+    bool *started = malloc(sizeof(bool[workerCount]));
+    if (queues == NULL || workers == NULL || threads == NULL || started == NULL)
+    {
+        abort();
+    }
+    TaskPool pool = {queues, workerCount, function, context};
+    for (size_t i = 0; i < workerCount; i++)
+    {
+        atomic_init(&queues[i].range, rangePack(taskCount * i / workerCount, taskCount * (i + 1) / workerCount));
+        workers[i] = (TaskWorker){&pool, i};
+    }
+    for (size_t i = 1; i < workerCount; i++)
+    {
+        started[i] = thrd_create(&threads[i], taskWorker, &workers[i]) == thrd_success;
+    }
+    taskWorker(&workers[0]);
+    for (size_t i = 1; i < workerCount; i++)
+    {
+        if (started[i])
+        {
+            thrd_join(threads[i], NULL);
+        }
+    }
+    free(queues);
+    free(workers);
+    free(threads);
+    free(started);
+    return workerCount;
+}
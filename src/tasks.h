@@ -0,0 +1,18 @@
+/*
+ * tasks.h - Work-stealing parallel task scheduler
+ *
+ * Copyright (c) 2023, Dimitrios Alexopoulos All rights reserved.
+ */
+
+#ifndef TASKS_H
+#define TASKS_H
+
+#include <stddef.h>
+
+// Called once for every task index, `worker` identifies the executing thread (0 to thread count - 1)
+typedef void (*TaskFunction)(void *context, size_t task, size_t worker);
+
+size_t tasksThreadCount(size_t threadCount);
+size_t tasksRun(size_t taskCount, size_t threadCount, TaskFunction function, void *context);
+
+#endif
@@ -4,10 +4,11 @@
  * Copyright (c) 2023, Dimitrios Alexopoulos All rights reserved.
  */
 
-#include <math.h>
 #include <stdbool.h>
 #include <stddef.h>
+#include <tgmath.h>
 
+#include "packed.h"
 #include "vectors.h"
 
 // TODO: Consider using compound literals as in "tuples.c"
@@ -30,7 +31,7 @@ Vec2 vec2Sub(const Vec2 a, const Vec2 b)
 }
 
 // Scalar-vector multiplication
-Vec2 vec2Mul(const Vec2 a, const double b)
+Vec2 vec2Mul(const Vec2 a, const Scalar b)
 {
     Vec2 result;
     result.x = a.x * b;
@@ -39,7 +40,7 @@ Vec2 vec2Mul(const Vec2 a, const double b)
 }
 
 // Scalar-vector division
-Vec2 vec2Div(const Vec2 a, const double b)
+Vec2 vec2Div(const Vec2 a, const Scalar b)
 {
     Vec2 result;
     result.x = a.x / b;
@@ -57,7 +58,7 @@ Vec2 vec2Neg(const Vec2 a)
 }
 
 // Returns the magnitude of a vector
-double vec2Mag(const Vec2 a)
+Scalar vec2Mag(const Vec2 a)
 {
     return sqrt(a.x * a.x + a.y * a.y);
 }
@@ -70,7 +71,7 @@ Vec2 vec2Norm(const Vec2 a)
 }
 
 // Returns the dot product of two vectors
-double vec2Dot(const Vec2 a, const Vec2 b)
+Scalar vec2Dot(const Vec2 a, const Vec2 b)
 {
     return a.x * b.x + a.y * b.y;
 }
@@ -105,7 +106,7 @@ Vec3 vec3Sub(const Vec3 a, const Vec3 b)
 }
 
 // Scalar-vector multiplication
-Vec3 vec3Mul(const Vec3 a, const double b)
+Vec3 vec3Mul(const Vec3 a, const Scalar b)
 {
     Vec3 result;
     result.x = a.x * b;
@@ -115,7 +116,7 @@ Vec3 vec3Mul(const Vec3 a, const double b)
 }
 
 // Scalar-vector division
-Vec3 vec3Div(const Vec3 a, const double b)
+Vec3 vec3Div(const Vec3 a, const Scalar b)
 {
     Vec3 result;
     result.x = a.x / b;
@@ -135,7 +136,7 @@ Vec3 vec3Neg(Vec3 a)
 }
 
 // Returns the magnitude of a vector
-double vec3Mag(const Vec3 a)
+Scalar vec3Mag(const Vec3 a)
 {
     return sqrt(a.x * a.x + a.y * a.y + a.z * a.z);
 }
@@ -147,7 +148,7 @@ Vec3 vec3Norm(const Vec3 a)
 }
 
 // Returns the dot product of two vectors
-double vec3Dot(const Vec3 a, const Vec3 b)
+Scalar vec3Dot(const Vec3 a, const Vec3 b)
 {
     return a.x * b.x + a.y * b.y + a.z * b.z;
 }
@@ -205,7 +206,7 @@ Vec4 vec4Sub(const Vec4 a, const Vec4 b)
 }
 
 // Scalar-vector multiplication
-Vec4 vec4Mul(const Vec4 a, const double b)
+Vec4 vec4Mul(const Vec4 a, const Scalar b)
 {
     Vec4 result;
     result.x = a.x * b;
@@ -216,7 +217,7 @@ Vec4 vec4Mul(const Vec4 a, const double b)
 }
 
 // Scalar-vector division
-Vec4 vec4Div(const Vec4 a, const double b)
+Vec4 vec4Div(const Vec4 a, const Scalar b)
 {
     Vec4 result;
     result.x = a.x / b;
@@ -238,7 +239,7 @@ Vec4 vec4Neg(const Vec4 a)
 }
 
 // Returns the magnitude of a vector
-double vec4Mag(const Vec4 a)
+Scalar vec4Mag(const Vec4 a)
 {
     return sqrt(a.x * a.x + a.y * a.y + a.z * a.z + a.w * a.w);
 }
@@ -250,7 +251,7 @@ Vec4 vec4Norm(const Vec4 a)
 }
 
 // Returns the dot product of two vectors
-double vec4Dot(const Vec4 a, const Vec4 b)
+Scalar vec4Dot(const Vec4 a, const Vec4 b)
 {
     return a.x * b.x + a.y * b.y + a.z * b.z + a.w * b.w;
 }
@@ -354,6 +355,19 @@ Mat3 mat3Mul(const Mat3 a, const Mat3 b)
 Mat4 mat4Mul(const Mat4 a, const Mat4 b)
 {
     Mat4 result = {0};
+#ifdef VECTORS_SIMD
+    // Each result row is a linear combination of the rows of `b`
+    const Packed4 rows[4] = {packedLoad(b.elem[0]), packedLoad(b.elem[1]), packedLoad(b.elem[2]), packedLoad(b.elem[3])};
+    for (size_t row = 0; row < 4; row++)
+    {
+        Packed4 sum = packedLoad(result.elem[row]);
+        for (size_t i = 0; i < 4; i++)
+        {
+            sum = packedAdd(sum, packedMul(packedSet(a.elem[row][i]), rows[i]));
+        }
+        packedStore(result.elem[row], sum);
+    }
+#else
     for (size_t row = 0; row < 4; row++)
     {
         for (size_t col = 0; col < 4; col++)
@@ -364,6 +378,7 @@ Mat4 mat4Mul(const Mat4 a, const Mat4 b)
             }
         }
     }
+#endif
     return result;
 }
 
@@ -386,7 +401,6 @@ Vec3 mat3VecMul(const Mat3 mat, const Vec3 vec)
     return result;
 }
 
-// TODO: Check if the matrix can be accessed via its columns and thus vectorized
 // Matrix-vector product
 Vec4 mat4VecMul(const Mat4 mat, const Vec4 vec)
 {
@@ -432,6 +446,14 @@ Mat3 mat3Trans(const Mat3 a)
 Mat4 mat4Trans(const Mat4 a)
 {
     Mat4 result;
+#ifdef VECTORS_SIMD
+    Packed4 rows[4] = {packedLoad(a.elem[0]), packedLoad(a.elem[1]), packedLoad(a.elem[2]), packedLoad(a.elem[3])};
+    packedTranspose(rows);
+    for (size_t i = 0; i < 4; i++)
+    {
+        packedStore(result.elem[i], rows[i]);
+    }
+#else
     for (size_t i = 0; i < 4; i++) // NOTE: Consider skipping [0][0] and [3][3] and doing out of loop
     {
         for (size_t j = 0; j < 4; j++)
@@ -440,11 +462,12 @@ Mat4 mat4Trans(const Mat4 a)
             result.elem[j][i] = a.elem[i][j];
         }
     }
+#endif
     return result;
 }
 
 // Determinant of a 2*2 matrix
-double mat2Det(const Mat2 a)
+Scalar mat2Det(const Mat2 a)
 {
     return a.elem[0][0] * a.elem[1][1] - a.elem[1][0] * a.elem[0][1];
 }
@@ -516,13 +539,13 @@ Mat3 mat4SubM(const size_t row, const size_t col, const Mat4 a)
 }
 
 // Calculates the minor of a 3*3 matrix
-double mat3Min(const size_t row, const size_t col, const Mat3 a)
+Scalar mat3Min(const size_t row, const size_t col, const Mat3 a)
 {
     return mat2Det(mat3SubM(row, col, a));
 }
 
 // Calculates the cofactor of a 3*3 matrix
-double mat3Cof(const size_t row, const size_t col, const Mat3 a)
+Scalar mat3Cof(const size_t row, const size_t col, const Mat3 a)
 {
     if (row % 2 != col % 2)
     {
@@ -536,9 +559,9 @@ double mat3Cof(const size_t row, const size_t col, const Mat3 a)
 
 // TODO: Try doing non-recursively
 // Calculates the determinant of a 3*3 matrix
-double mat3Det(const Mat3 a)
+Scalar mat3Det(const Mat3 a)
 {
-    double determinant = 0;
+    Scalar determinant = 0;
     for (size_t col = 0; col < 3; col++)
     {
         determinant += a.elem[0][col] * mat3Cof(0, col, a);
@@ -547,13 +570,13 @@ double mat3Det(const Mat3 a)
 }
 
 // Calculates the minor of a 4*4 matrix
-double mat4Min(const size_t row, const size_t col, const Mat4 a)
+Scalar mat4Min(const size_t row, const size_t col, const Mat4 a)
 {
     return mat3Det(mat4SubM(row, col, a));
 }
 
 // Calculates the cofactor of a 3*3 matrix
-double mat4Cof(const size_t row, const size_t col, const Mat4 a)
+Scalar mat4Cof(const size_t row, const size_t col, const Mat4 a)
 {
     if (row % 2 != col % 2)
     {
@@ -565,31 +588,88 @@ double mat4Cof(const size_t row, const size_t col, const Mat4 a)
     }
 }
 
+// 2*2 subdeterminants of a 4*4 matrix, shared by the determinant and the inverse.
+// `top` come from the top two rows and `bottom` from the bottom two, paired so that `top[i] * bottom[5 - i]`
+// are the terms of the Laplace expansion
+typedef struct
+{
+    Scalar top[6];
+    Scalar bottom[6];
+} Mat4SubDets;
+
+static Mat4SubDets mat4SubDets(const Mat4 a)
+{
+    const Scalar(*m)[4] = a.elem;
+    Mat4SubDets result;
+    result.top[0] = m[0][0] * m[1][1] - m[1][0] * m[0][1];
+    result.top[1] = m[0][0] * m[1][2] - m[1][0] * m[0][2];
+    result.top[2] = m[0][0] * m[1][3] - m[1][0] * m[0][3];
+    result.top[3] = m[0][1] * m[1][2] - m[1][1] * m[0][2];
+    result.top[4] = m[0][1] * m[1][3] - m[1][1] * m[0][3];
+    result.top[5] = m[0][2] * m[1][3] - m[1][2] * m[0][3];
+    result.bottom[0] = m[2][0] * m[3][1] - m[3][0] * m[2][1];
+    result.bottom[1] = m[2][0] * m[3][2] - m[3][0] * m[2][2];
+    result.bottom[2] = m[2][0] * m[3][3] - m[3][0] * m[2][3];
+    result.bottom[3] = m[2][1] * m[3][2] - m[3][1] * m[2][2];
+    result.bottom[4] = m[2][1] * m[3][3] - m[3][1] * m[2][3];
+    result.bottom[5] = m[2][2] * m[3][3] - m[3][2] * m[2][3];
+    return result;
+}
+
+static Scalar mat4SubDetsDet(const Mat4SubDets *sub)
+{
+    return sub->top[0] * sub->bottom[5] - sub->top[1] * sub->bottom[4] + sub->top[2] * sub->bottom[3] +
+           sub->top[3] * sub->bottom[2] - sub->top[4] * sub->bottom[1] + sub->top[5] * sub->bottom[0];
+}
+
 // Calculates the determinant of a 4*4 matrix
-double mat4Det(const Mat4 a)
+Scalar mat4Det(const Mat4 a)
+{
+    const Mat4SubDets sub = mat4SubDets(a);
+    return mat4SubDetsDet(&sub);
+}
+
+// Inverts a 4*4 matrix, storing the result in `dest`.
+// Returns false, leaving `dest` untouched, if the matrix is singular (or its inverse overflows).
+bool mat4TryInv(Mat4 *dest, const Mat4 a)
 {
-    double determinant = 0;
-    for (size_t col = 0; col < 4; col++)
+    const Scalar(*m)[4] = a.elem;
+    const Mat4SubDets sub = mat4SubDets(a);
+    const Scalar *s = sub.top;
+    const Scalar *c = sub.bottom;
+    const Scalar determinant = mat4SubDetsDet(&sub);
+    const Scalar inverse = 1 / determinant;
+    if (determinant == 0 || !isfinite(inverse))
     {
-        determinant += a.elem[0][col] * mat4Cof(0, col, a);
+        return false;
     }
-    return determinant;
+    Mat4 inverted;
+    inverted.elem[0][0] = (m[1][1] * c[5] - m[1][2] * c[4] + m[1][3] * c[3]) * inverse;
+    inverted.elem[0][1] = (-m[0][1] * c[5] + m[0][2] * c[4] - m[0][3] * c[3]) * inverse;
+    inverted.elem[0][2] = (m[3][1] * s[5] - m[3][2] * s[4] + m[3][3] * s[3]) * inverse;
+    inverted.elem[0][3] = (-m[2][1] * s[5] + m[2][2] * s[4] - m[2][3] * s[3]) * inverse;
+    inverted.elem[1][0] = (-m[1][0] * c[5] + m[1][2] * c[2] - m[1][3] * c[1]) * inverse;
+    inverted.elem[1][1] = (m[0][0] * c[5] - m[0][2] * c[2] + m[0][3] * c[1]) * inverse;
+    inverted.elem[1][2] = (-m[3][0] * s[5] + m[3][2] * s[2] - m[3][3] * s[1]) * inverse;
+    inverted.elem[1][3] = (m[2][0] * s[5] - m[2][2] * s[2] + m[2][3] * s[1]) * inverse;
+    inverted.elem[2][0] = (m[1][0] * c[4] - m[1][1] * c[2] + m[1][3] * c[0]) * inverse;
+    inverted.elem[2][1] = (-m[0][0] * c[4] + m[0][1] * c[2] - m[0][3] * c[0]) * inverse;
+    inverted.elem[2][2] = (m[3][0] * s[4] - m[3][1] * s[2] + m[3][3] * s[0]) * inverse;
+    inverted.elem[2][3] = (-m[2][0] * s[4] + m[2][1] * s[2] - m[2][3] * s[0]) * inverse;
+    inverted.elem[3][0] = (-m[1][0] * c[3] + m[1][1] * c[1] - m[1][2] * c[0]) * inverse;
+    inverted.elem[3][1] = (m[0][0] * c[3] - m[0][1] * c[1] + m[0][2] * c[0]) * inverse;
+    inverted.elem[3][2] = (-m[3][0] * s[3] + m[3][1] * s[1] - m[3][2] * s[0]) * inverse;
+    inverted.elem[3][3] = (m[2][0] * s[3] - m[2][1] * s[1] + m[2][2] * s[0]) * inverse;
+    *dest = inverted;
+    return true;
 }
 
-// TODO: Optimize
 // Inverts a 4*4 matrix
-// Important: Only pass invertible matrices
+// Important: Only pass invertible matrices, the result of inverting a singular matrix is undefined (see `mat4TryInv`)
 Mat4 mat4Inv(const Mat4 a)
 {
-    double determinant = mat4Det(a);
-    Mat4 inverted;
-    for (size_t col = 0; col < 4; col++)
-    {
-        for (size_t row = 0; row < 4; row++)
-        {
-            inverted.elem[col][row] = mat4Cof(row, col, a) / determinant;
-        }
-    }
+    Mat4 inverted = {0};
+    mat4TryInv(&inverted, a);
     return inverted;
 }
 
@@ -606,3 +686,142 @@ Mat4 viewTransform(const Vec4 origin, const Vec4 destination, Vec4 up)
                            {0, 0, 0, 1}}};
     return mat4Mul(viewTransform, translation(-origin.x, -origin.y, -origin.z));
 }
+
+// Converts a 4*4 matrix to an affine transformation by dropping its bottom row
+// Important: The bottom row must be (0, 0, 0, 1), as it is for all the transformation macros and `viewTransform`
+Affine affineFromMat4(const Mat4 a)
+{
+    Affine result;
+    for (size_t i = 0; i < 3; i++)
+    {
+        result.rows[i] = a.rows[i];
+    }
+    return result;
+}
+
+// Converts an affine transformation to a 4*4 matrix
+Mat4 affineToMat4(const Affine a)
+{
+    Mat4 result;
+    for (size_t i = 0; i < 3; i++)
+    {
+        result.rows[i] = a.rows[i];
+    }
+    result.rows[3] = point(0, 0, 0);
+    return result;
+}
+
+// Composes two affine transformations, `b` is applied first
+Affine affineMul(const Affine a, const Affine b)
+{
+    Affine result;
+    for (size_t row = 0; row < 3; row++)
+    {
+        for (size_t col = 0; col < 4; col++)
+        {
+            result.elem[row][col] = a.elem[row][0] * b.elem[0][col] + a.elem[row][1] * b.elem[1][col] +
+                                    a.elem[row][2] * b.elem[2][col];
+        }
+        result.elem[row][3] += a.elem[row][3];
+    }
+    return result;
+}
+
+// Inverts an affine transformation, storing the result in `dest`.
+// Returns false, leaving `dest` untouched, if the transformation is singular (or its inverse overflows).
+// Info: Inverts the 3*3 linear part and applies it to the negated translation
+bool affineTryInv(Affine *dest, const Affine a)
+{
+    const Scalar(*m)[4] = a.elem;
+    const Scalar cofactor0 = m[1][1] * m[2][2] - m[1][2] * m[2][1];
+    const Scalar cofactor1 = m[1][2] * m[2][0] - m[1][0] * m[2][2];
+    const Scalar cofactor2 = m[1][0] * m[2][1] - m[1][1] * m[2][0];
+    const Scalar determinant = m[0][0] * cofactor0 + m[0][1] * cofactor1 + m[0][2] * cofactor2;
+    const Scalar inverse = 1 / determinant;
+    if (determinant == 0 || !isfinite(inverse))
+    {
+        return false;
+    }
+    Affine inverted;
+    inverted.elem[0][0] = cofactor0 * inverse;
+    inverted.elem[0][1] = (m[0][2] * m[2][1] - m[0][1] * m[2][2]) * inverse;
+    inverted.elem[0][2] = (m[0][1] * m[1][2] - m[0][2] * m[1][1]) * inverse;
+    inverted.elem[1][0] = cofactor1 * inverse;
+    inverted.elem[1][1] = (m[0][0] * m[2][2] - m[0][2] * m[2][0]) * inverse;
+    inverted.elem[1][2] = (m[0][2] * m[1][0] - m[0][0] * m[1][2]) * inverse;
+    inverted.elem[2][0] = cofactor2 * inverse;
+    inverted.elem[2][1] = (m[0][1] * m[2][0] - m[0][0] * m[2][1]) * inverse;
+    inverted.elem[2][2] = (m[0][0] * m[1][1] - m[0][1] * m[1][0]) * inverse;
+    for (size_t i = 0; i < 3; i++)
+    {
+        inverted.elem[i][3] = -(inverted.elem[i][0] * m[0][3] + inverted.elem[i][1] * m[1][3] + inverted.elem[i][2] * m[2][3]);
+    }
+    *dest = inverted;
+    return true;
+}
+
+// Inverts an affine transformation
+// Important: Only pass invertible transformations (see `affineTryInv`)
+Affine affineInv(const Affine a)
+{
+    Affine inverted = {0};
+    affineTryInv(&inverted, a);
+    return inverted;
+}
+
+// Transforms a point, its `w` is assumed to be 1
+Vec4 affinePointMul(const Affine a, const Vec4 point)
+{
+    Vec4 result;
+    result.x = point.x * a.elem[0][0] + point.y * a.elem[0][1] + point.z * a.elem[0][2] + a.elem[0][3];
+    result.y = point.x * a.elem[1][0] + point.y * a.elem[1][1] + point.z * a.elem[1][2] + a.elem[1][3];
+    result.z = point.x * a.elem[2][0] + point.y * a.elem[2][1] + point.z * a.elem[2][2] + a.elem[2][3];
+    result.w = 1;
+    return result;
+}
+
+// Transforms a vector, ignoring the translation; its `w` is assumed to be 0
+Vec4 affineVecMul(const Affine a, const Vec4 vec)
+{
+    Vec4 result;
+    result.x = vec.x * a.elem[0][0] + vec.y * a.elem[0][1] + vec.z * a.elem[0][2];
+    result.y = vec.x * a.elem[1][0] + vec.y * a.elem[1][1] + vec.z * a.elem[1][2];
+    result.z = vec.x * a.elem[2][0] + vec.y * a.elem[2][1] + vec.z * a.elem[2][2];
+    result.w = 0;
+    return result;
+}
+
+// Transforms a normal vector by the transpose of the inverse transformation, without building the transpose.
+// Info: The result is not normalized
+Vec4 affineNormalMul(const Affine inverse, const Vec4 normal)
+{
+    Vec4 result;
+    result.x = normal.x * inverse.elem[0][0] + normal.y * inverse.elem[1][0] + normal.z * inverse.elem[2][0];
+    result.y = normal.x * inverse.elem[0][1] + normal.y * inverse.elem[1][1] + normal.z * inverse.elem[2][1];
+    result.z = normal.x * inverse.elem[0][2] + normal.y * inverse.elem[1][2] + normal.z * inverse.elem[2][2];
+    result.w = 0;
+    return result;
+}
+
+// Returns the matrix transforming normal vectors, the inverse transpose of the linear part of the transformation.
+// Info: Computed as the cofactor matrix over the determinant, a singular transformation produces infinities
+Mat3 affineNormalMatrix(const Affine a)
+{
+    const Scalar(*m)[4] = a.elem;
+    Mat3 result;
+    result.elem[0][0] = m[1][1] * m[2][2] - m[1][2] * m[2][1];
+    result.elem[0][1] = m[1][2] * m[2][0] - m[1][0] * m[2][2];
+    result.elem[0][2] = m[1][0] * m[2][1] - m[1][1] * m[2][0];
+    result.elem[1][0] = m[0][2] * m[2][1] - m[0][1] * m[2][2];
+    result.elem[1][1] = m[0][0] * m[2][2] - m[0][2] * m[2][0];
+    result.elem[1][2] = m[0][1] * m[2][0] - m[0][0] * m[2][1];
+    result.elem[2][0] = m[0][1] * m[1][2] - m[0][2] * m[1][1];
+    result.elem[2][1] = m[0][2] * m[1][0] - m[0][0] * m[1][2];
+    result.elem[2][2] = m[0][0] * m[1][1] - m[0][1] * m[1][0];
+    const Scalar inverse = 1 / (m[0][0] * result.elem[0][0] + m[0][1] * result.elem[0][1] + m[0][2] * result.elem[0][2]);
+    for (size_t i = 0; i < 3; i++)
+    {
+        result.rows[i] = vec3Mul(result.rows[i], inverse);
+    }
+    return result;
+}
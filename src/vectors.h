@@ -7,11 +7,41 @@
 #ifndef VECTORS_H
 #define VECTORS_H
 
+#include <float.h>
 #include <math.h>
+#include <stdalign.h>
 #include <stdbool.h>
 #include <stddef.h>
 
+// Floating point type of the vectors, matrices, colors and distances.
+// Info: Define `AKTINA_SINGLE_PRECISION` to use `float` instead of `double`
+#ifdef AKTINA_SINGLE_PRECISION
+typedef float Scalar;
+#define SCALAR_EPSILON FLT_EPSILON
+#define MAT_EPSILON 0.0001f
+#else
+typedef double Scalar;
+#define SCALAR_EPSILON DBL_EPSILON
 #define MAT_EPSILON 0.00001
+#endif
+
+// Vector instruction set used by the `Mat4` product and transpose kernels, undefined for the scalar fallback.
+// Info: Define `AKTINA_NO_SIMD` to force the scalar fallback, the `Vec4` kernels are always scalar as the compiler
+// inlines them into faster code than the intrinsics
+#if !defined(AKTINA_NO_SIMD) && defined(AKTINA_SINGLE_PRECISION) && (defined(__SSE__) || defined(_M_X64))
+#define VECTORS_SIMD "SSE"
+#elif !defined(AKTINA_NO_SIMD) && !defined(AKTINA_SINGLE_PRECISION) && defined(__AVX__)
+#define VECTORS_SIMD "AVX"
+#elif !defined(AKTINA_NO_SIMD) && !defined(AKTINA_SINGLE_PRECISION) && (defined(__SSE2__) || defined(_M_X64))
+#define VECTORS_SIMD "SSE2"
+#endif
+
+#ifdef VECTORS_SIMD
+#define VECTORS_ALIGN alignas(16)
+#else
+#define VECTORS_ALIGN
+#endif
+
 #define PPM_DEPTH 255
 // clang-format off
 #define point(x, y, z) (Vec4){{x, y, z, 1}}
@@ -60,89 +90,96 @@ typedef union Vec2
 {
     struct
     {
-        double x, y;
+        Scalar x, y;
     };
     struct
     {
-        double u, v;
+        Scalar u, v;
     };
-    double elem[2];
+    Scalar elem[2];
 } Vec2;
 
 typedef union Vec3
 {
     struct
     {
-        double x, y, z;
+        Scalar x, y, z;
     };
     struct
     {
-        double u, v, w;
+        Scalar u, v, w;
     };
     struct
     {
-        double r, g, b;
+        Scalar r, g, b;
     };
     struct
     {
         Vec2 xy;
-        double _ignored;
+        Scalar _ignored;
     };
-    double elem[3];
+    Scalar elem[3];
 } Vec3;
 
 typedef union Vec4
 {
     struct
     {
-        double x, y, z, w;
+        Scalar x, y, z, w;
     };
     struct
     {
         Vec3 xyz;
-        double _ignored;
+        Scalar _ignored;
     };
-    double elem[4];
+    VECTORS_ALIGN Scalar elem[4];
 } Vec4;
 
 typedef union Mat2
 {
-    double elem[2][2];
+    Scalar elem[2][2];
     Vec2 rows[2];
 } Mat2;
 
 typedef union Mat3
 {
-    double elem[3][3];
+    Scalar elem[3][3];
     Vec3 rows[3];
 } Mat3;
 
 typedef union Mat4
 {
-    double elem[4][4];
+    Scalar elem[4][4];
     Vec4 rows[4];
 } Mat4;
 
+// Affine transformation, a 4*4 matrix without its constant bottom row (0, 0, 0, 1)
+typedef union Affine
+{
+    Scalar elem[3][4];
+    Vec4 rows[3];
+} Affine;
+
 Vec2 vec2Add(Vec2 a, Vec2 b);
 Vec2 vec2Sub(Vec2 a, Vec2 b);
-Vec2 vec2Mul(Vec2 a, double b);
-Vec2 vec2Div(Vec2 a, double b);
+Vec2 vec2Mul(Vec2 a, Scalar b);
+Vec2 vec2Div(Vec2 a, Scalar b);
 Vec2 vec2Neg(Vec2 a);
 
-double vec2Mag(Vec2 a);
+Scalar vec2Mag(Vec2 a);
 Vec2 vec2Norm(Vec2 a);
-double vec2Dot(Vec2 a, Vec2 b);
+Scalar vec2Dot(Vec2 a, Vec2 b);
 Vec2 vec2Prod(Vec2 a, Vec2 b);
 
 Vec3 vec3Add(Vec3 a, Vec3 b);
 Vec3 vec3Sub(Vec3 a, Vec3 b);
-Vec3 vec3Mul(Vec3 a, double b);
-Vec3 vec3Div(Vec3 a, double b);
+Vec3 vec3Mul(Vec3 a, Scalar b);
+Vec3 vec3Div(Vec3 a, Scalar b);
 Vec3 vec3Neg(Vec3 a);
 
-double vec3Mag(Vec3 a);
+Scalar vec3Mag(Vec3 a);
 Vec3 vec3Norm(Vec3 a);
-double vec3Dot(Vec3 a, Vec3 b);
+Scalar vec3Dot(Vec3 a, Vec3 b);
 Vec3 vec3Cross(Vec3 a, Vec3 b);
 Vec3 vec3Prod(Vec3 a, Vec3 b);
 
@@ -150,13 +187,13 @@ Vec3 vec3PPM(const Vec3 a);
 
 Vec4 vec4Add(Vec4 a, Vec4 b);
 Vec4 vec4Sub(Vec4 a, Vec4 b);
-Vec4 vec4Mul(Vec4 a, double b);
-Vec4 vec4Div(Vec4 a, double b);
+Vec4 vec4Mul(Vec4 a, Scalar b);
+Vec4 vec4Div(Vec4 a, Scalar b);
 Vec4 vec4Neg(Vec4 a);
 
-double vec4Mag(Vec4 a);
+Scalar vec4Mag(Vec4 a);
 Vec4 vec4Norm(Vec4 a);
-double vec4Dot(Vec4 a, Vec4 b);
+Scalar vec4Dot(Vec4 a, Vec4 b);
 Vec4 vec4Prod(Vec4 a, Vec4 b);
 
 Vec4 vec4Reflect(Vec4 vec, Vec4 normal);
@@ -176,20 +213,31 @@ Mat2 mat2Trans(Mat2 a);
 Mat3 mat3Trans(Mat3 a);
 Mat4 mat4Trans(Mat4 a);
 
-double mat2Det(Mat2 a);
-double mat3Det(Mat3 a);
-double mat4Det(Mat4 a);
+Scalar mat2Det(Mat2 a);
+Scalar mat3Det(Mat3 a);
+Scalar mat4Det(Mat4 a);
 
 Mat2 mat3SubM(size_t row, size_t col, Mat3 a);
 Mat3 mat4SubM(size_t row, size_t col, Mat4 a);
 
-double mat3Min(size_t row, size_t col, Mat3 a);
-double mat4Min(size_t row, size_t col, Mat4 a);
+Scalar mat3Min(size_t row, size_t col, Mat3 a);
+Scalar mat4Min(size_t row, size_t col, Mat4 a);
 
-double mat3Cof(size_t row, size_t col, Mat3 a);
-double mat4Cof(size_t row, size_t col, Mat4 a);
+Scalar mat3Cof(size_t row, size_t col, Mat3 a);
+Scalar mat4Cof(size_t row, size_t col, Mat4 a);
 
 Mat4 mat4Inv(Mat4 a);
+bool mat4TryInv(Mat4 *dest, Mat4 a);
 
 Mat4 viewTransform(Vec4 origin, Vec4 destination, Vec4 up);
+
+Affine affineFromMat4(Mat4 a);
+Mat4 affineToMat4(Affine a);
+Affine affineMul(Affine a, Affine b);
+Affine affineInv(Affine a);
+bool affineTryInv(Affine *dest, Affine a);
+Vec4 affinePointMul(Affine a, Vec4 point);
+Vec4 affineVecMul(Affine a, Vec4 vec);
+Vec4 affineNormalMul(Affine inverse, Vec4 normal);
+Mat3 affineNormalMatrix(Affine a);
 #endif
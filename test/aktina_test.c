@@ -0,0 +1,26 @@
+/*
+ * aktina_test.c - Tests on the public interface
+ *
+ * Copyright (c) 2023, Dimitrios Alexopoulos All rights reserved.
+ */
+
+#include <criterion/criterion.h>
+#include <criterion/new/assert.h>
+#include <stdio.h>
+
+#include "src/aktina.h"
+
+// Passed by "meson.build" from the project version
+#ifndef AKTINA_PROJECT_VERSION
+#error "AKTINA_PROJECT_VERSION must be defined as the project version"
+#endif
+
+Test(version, project_version)
+{
+    cr_expect(eq(str, AKTINA_VERSION, AKTINA_PROJECT_VERSION));
+    char version[32];
+    snprintf(version, sizeof(version), "%d.%d.%d", AKTINA_VERSION_MAJOR, AKTINA_VERSION_MINOR, AKTINA_VERSION_PATCH);
+    cr_expect(eq(str, version, AKTINA_PROJECT_VERSION));
+    cr_expect(eq(int, AKTINA_VERSION_NUMBER, AKTINA_VERSION_ENCODE(AKTINA_VERSION_MAJOR, AKTINA_VERSION_MINOR, AKTINA_VERSION_PATCH)));
+    cr_expect(lt(int, AKTINA_VERSION_ENCODE(0, 9, 99), AKTINA_VERSION_ENCODE(1, 0, 0)));
+}
@@ -0,0 +1,195 @@
+/*
+ * bvh_bench.c - Benchmark of bounding volume hierarchy construction and the quality of the trees
+ *
+ * Usage: bvh_bench [most spheres], worlds of 10M spheres take about 7 GiB
+ *
+ * Copyright (c) 2023, Dimitrios Alexopoulos All rights reserved.
+ */
+
+// TODO: Find a better solution than _XOPEN_SOURCE
+#ifdef _WIN32
+#define _USE_MATH_DEFINES
+#endif
+#ifdef __unix__
+#define _XOPEN_SOURCE
+#endif
+
+#include <math.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include "src/bvh.h"
+#include "src/mesh.h"
+#include "src/rays.h"
+#include "src/tasks.h"
+#include "test/random.h"
+
+#define BENCH_RINGS 500
+#define BENCH_SEGMENTS 1000
+#define BENCH_RAYS 1000000
+#define BENCH_WORLD_RAYS 200000
+#define BENCH_MIN_SPHERES 10000
+#define BENCH_MAX_SPHERES 1000000
+#define BENCH_FRAMES 10
+#define BENCH_REBUILD_RATIO 1.5
+
+// Returns the current time in seconds
+static double benchTime(void)
+{
+    struct timespec now;
+    timespec_get(&now, TIME_UTC);
+    return (double)now.tv_sec + (double)now.tv_nsec / 1e9;
+}
+
+// Builds the hierarchy of the world and traces rays through it from the side of the cube around its spheres
+static void benchWorld(World *world, const double side, const char *name, const BvhBuildOptions options)
+{
+    BvhStats stats;
+    worldBuildBvhWith(world, options, &stats);
+    uint64_t state = 3;
+    size_t hits = 0;
+    const double traceStart = benchTime();
+    for (size_t i = 0; i < BENCH_WORLD_RAYS; i++)
+    {
+        const Ray ray = {point(randomUnit(&state) * side, randomUnit(&state) * side, -1),
+                         vec4Norm(vector(randomUnit(&state) - 0.5, randomUnit(&state) - 0.5, 2))};
+        hits += intersectClosest(*world, ray).shape != NULL;
+    }
+    const double traced = benchTime() - traceStart;
+    printf("  %-16s built in %.3f s, SAH cost %.1f, depth %zu, %.1f MiB of nodes, %zu hits at %.2f Mrays/s\n", name,
+           stats.buildTime, (double)stats.sahCost, stats.depth, (double)stats.nodeSize / (1 << 20), hits,
+           BENCH_WORLD_RAYS / traced / 1e6);
+    worldDestroyBvh(world);
+}
+
+int main(int argc, char **argv)
+{
+    const size_t maxSpheres = argc > 1 ? strtoull(argv[1], NULL, 10) : BENCH_MAX_SPHERES;
+
+    // The bumpy unit sphere of about a million triangles of the mesh benchmark
+    Mesh mesh;
+    meshCreate(&mesh);
+    for (size_t ring = 0; ring <= BENCH_RINGS; ring++)
+    {
+        const double polar = M_PI * (double)ring / BENCH_RINGS;
+        for (size_t segment = 0; segment < BENCH_SEGMENTS; segment++)
+        {
+            const double azimuth = 2 * M_PI * (double)segment / BENCH_SEGMENTS;
+            const double radius = 1 + 0.02 * sin(13 * polar) * cos(17 * azimuth);
+            meshAddVertex(&mesh, color(radius * sin(polar) * cos(azimuth), radius * cos(polar), radius * sin(polar) * sin(azimuth)));
+        }
+    }
+    for (size_t ring = 0; ring < BENCH_RINGS; ring++)
+    {
+        for (size_t segment = 0; segment < BENCH_SEGMENTS; segment++)
+        {
+            const size_t a = ring * BENCH_SEGMENTS + segment;
+            const size_t b = ring * BENCH_SEGMENTS + (segment + 1) % BENCH_SEGMENTS;
+            meshAddTriangle(&mesh, (MeshTriangle){{a, b, b + BENCH_SEGMENTS}, {MESH_NO_NORMAL, MESH_NO_NORMAL, MESH_NO_NORMAL}});
+            meshAddTriangle(&mesh, (MeshTriangle){{a, b + BENCH_SEGMENTS, a + BENCH_SEGMENTS}, {MESH_NO_NORMAL, MESH_NO_NORMAL, MESH_NO_NORMAL}});
+        }
+    }
+    meshBuild(&mesh);
+    Bounds *bounds = malloc(sizeof(Bounds[mesh.triangleCount]));
+    if (bounds == NULL)
+    {
+        return 1;
+    }
+    for (size_t i = 0; i < mesh.triangleCount; i++)
+    {
+        const MeshFace face = mesh.faces[i];
+        bounds[i] = boundsExtend(boundsExtend((Bounds){face.a, face.a}, vec3Add(face.a, face.ab)), vec3Add(face.a, face.ac));
+    }
+    printf("Building over %zu triangles on up to %zu threads\n", mesh.triangleCount, tasksThreadCount(0));
+
+    const BvhBuildOptions options[] = {
+        {BVH_MEDIAN, 0, BVH_LEAF_SIZE, 1, BVH_BINARY},   {BVH_MEDIAN, 0, BVH_LEAF_SIZE, 0, BVH_BINARY},
+        {BVH_SAH, 4, BVH_LEAF_SIZE, 1, BVH_BINARY},      {BVH_SAH, 4, BVH_LEAF_SIZE, 0, BVH_BINARY},
+        {BVH_SAH, 8, BVH_LEAF_SIZE, 0, BVH_BINARY},      {BVH_SAH, 16, BVH_LEAF_SIZE, 1, BVH_BINARY},
+        {BVH_SAH, 16, BVH_LEAF_SIZE, 0, BVH_BINARY},     {BVH_SAH, 32, BVH_LEAF_SIZE, 0, BVH_BINARY},
+        {BVH_SAH, 16, 8, 0, BVH_BINARY},                 {BVH_SAH, 16, BVH_LEAF_SIZE, 0, BVH_WIDE},
+        {BVH_SAH, 16, BVH_LEAF_SIZE, 0, BVH_QUANTIZED},  {BVH_LBVH, 0, BVH_LEAF_SIZE, 1, BVH_BINARY},
+        {BVH_LBVH, 0, BVH_LEAF_SIZE, 0, BVH_BINARY},     {BVH_LBVH, 0, BVH_LEAF_SIZE, 0, BVH_WIDE},
+    };
+    const char *layouts[] = {"binary", "wide", "quantized"};
+    Shape shape = mesh(mat4Mul(translation(0, 1, 0), rotationY(0.3)), MATERIAL, &mesh);
+    World world = {.shapeCount = 1, .shapes = &shape};
+    for (size_t i = 0; i < sizeof(options) / sizeof(options[0]); i++)
+    {
+        bvhDestroy(&mesh.bvh);
+        BvhStats stats;
+        bvhBuildWith(&mesh.bvh, bounds, mesh.triangleCount, options[i], &stats);
+        uint64_t state = 1;
+        size_t hits = 0;
+        const double traceStart = benchTime();
+        for (size_t ray = 0; ray < BENCH_RAYS; ray++)
+        {
+            const Ray r = {point(randomUnit(&state) * 2.4 - 1.2, randomUnit(&state) * 2.4 - 0.2, -5), vector(0, 0, 1)};
+            hits += intersectClosest(world, r).shape != NULL;
+        }
+        const double traced = benchTime() - traceStart;
+        printf("%-6s %-9s %2zu bins, leaves of %zu, %2zu threads: built in %.3f s, SAH cost %.1f, depth %zu, %zu leaves of "
+               "%zu-%zu (%.2f on average), %.1f MiB of nodes, %zu hits at %.2f Mrays/s\n",
+               options[i].method == BVH_SAH ? "SAH" : options[i].method == BVH_LBVH ? "LBVH" : "median", layouts[options[i].layout],
+               options[i].binCount, options[i].leafSize, tasksThreadCount(options[i].threadCount), stats.buildTime, (double)stats.sahCost,
+               stats.depth, stats.leafCount, stats.minLeafSize, stats.maxLeafSize, (double)stats.averageLeafSize,
+               (double)stats.nodeSize / (1 << 20), hits, BENCH_RAYS / traced / 1e6);
+    }
+    free(bounds);
+    meshDestroy(&mesh);
+
+    // Worlds of randomly placed spheres, as dense whatever their number
+    for (size_t count = BENCH_MIN_SPHERES; count <= maxSpheres; count *= 10)
+    {
+        World spheres = {.shapeCount = count, .shapes = malloc(sizeof(Shape[count]))};
+        Vec4 *places = malloc(sizeof(Vec4[count])); // centers and radii
+        if (spheres.shapes == NULL || places == NULL)
+        {
+            return 1;
+        }
+        const double side = cbrt((double)count) * 4;
+        uint64_t state = 2;
+        for (size_t i = 0; i < count; i++)
+        {
+            const double radius = 0.2 + randomUnit(&state) * 0.8;
+            const double x = randomUnit(&state) * side;
+            const double y = randomUnit(&state) * side;
+            const double z = randomUnit(&state) * side;
+            const Mat4 transform = mat4Mul(translation(x, y, z), scaling(radius, radius, radius));
+            spheres.shapes[i] = sphere(transform, MATERIAL);
+            places[i] = (Vec4){{x, y, z, radius}};
+        }
+        printf("World of %zu spheres\n", count);
+        benchWorld(&spheres, side, "median", (BvhBuildOptions){BVH_MEDIAN, 0, BVH_LEAF_SIZE, 0, BVH_BINARY});
+        benchWorld(&spheres, side, "SAH", (BvhBuildOptions){BVH_SAH, 16, BVH_LEAF_SIZE, 0, BVH_BINARY});
+        benchWorld(&spheres, side, "SAH wide", BVH_BUILD_DEFAULT);
+        benchWorld(&spheres, side, "SAH quantized", (BvhBuildOptions){BVH_SAH, 16, BVH_LEAF_SIZE, 0, BVH_QUANTIZED});
+        benchWorld(&spheres, side, "LBVH", (BvhBuildOptions){BVH_LBVH, 0, BVH_LEAF_SIZE, 0, BVH_BINARY});
+        benchWorld(&spheres, side, "LBVH wide", BVH_BUILD_LINEAR);
+
+        // Bouncing spheres, refitting the hierarchy every frame instead of rebuilding it
+        worldBuildBvh(&spheres);
+        double refitTime = 0;
+        size_t rebuilds = 0;
+        for (size_t frame = 1; frame <= BENCH_FRAMES; frame++)
+        {
+            for (size_t i = 0; i < count; i++)
+            {
+                const double bounce = fabs(sin((double)frame * 0.3 + (double)i)) * 2;
+                const Vec4 place = places[i];
+                const Mat4 transform = mat4Mul(translation(place.x, place.y + bounce, place.z), scaling(place.w, place.w, place.w));
+                spheres.shapes[i] = sphere(transform, MATERIAL);
+            }
+            const double refitStart = benchTime();
+            rebuilds += worldRefitBvh(&spheres, BVH_BUILD_DEFAULT, BENCH_REBUILD_RATIO);
+            refitTime += benchTime() - refitStart;
+        }
+        printf("  refit            %.4f s per frame over %d frames, %zu rebuilds, the tree costs %.2f times as much as when built\n",
+               refitTime / BENCH_FRAMES, BENCH_FRAMES, rebuilds, (double)(bvhStats(spheres.bvh).sahCost / spheres.bvh->sahCost));
+        free(places);
+        worldDestroy(&spheres);
+    }
+    return 0;
+}
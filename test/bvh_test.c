@@ -0,0 +1,480 @@
+/*
+ * bvh_test.c - Tests on the bounding volume hierarchy
+ *
+ * Copyright (c) 2023, Dimitrios Alexopoulos All rights reserved.
+ */
+
+#include <criterion/criterion.h>
+#include <criterion/new/assert.h>
+#include <math.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "src/bvh.h"
+#include "src/vectors.h"
+#include "test/random.h"
+
+#define EPSILON MAT_EPSILON
+
+#define cr_expect_dbl(actual, expected) cr_expect(epsilon_eq(dbl, actual, expected, EPSILON))
+
+#define cr_expect_vec3_eq(actual, expected) cr_expect(all(epsilon_eq(dbl, actual.x, expected.x, EPSILON), \
+                                                          epsilon_eq(dbl, actual.y, expected.y, EPSILON), \
+                                                          epsilon_eq(dbl, actual.z, expected.z, EPSILON)))
+
+#define PRIMITIVE_COUNT 1000
+
+typedef struct
+{
+    const Bounds *bounds;
+    size_t *visits;
+} VisitCounter;
+
+bool boundsContains(const Bounds outer, const Bounds inner)
+{
+    return outer.min.x <= inner.min.x && outer.min.y <= inner.min.y && outer.min.z <= inner.min.z &&
+           outer.max.x >= inner.max.x && outer.max.y >= inner.max.y && outer.max.z >= inner.max.z;
+}
+
+bool countVisit(void *context, const size_t primitive, Scalar *tMax)
+{
+    (void)tMax;
+    VisitCounter *counter = context;
+    counter->visits[primitive]++;
+    return false;
+}
+
+// Checks that the child bounds of the wide node (and its descendants) contain the primitives under them, counting
+// the primitives of its leaves
+void expectValidWideNode(const Bvh *bvh, const Bounds *bounds, const size_t index, size_t *seen)
+{
+    for (size_t i = 0; i < BVH_WIDTH; i++)
+    {
+        size_t start;
+        size_t count;
+        Bounds child;
+        if (bvh->layout == BVH_WIDE)
+        {
+            const BvhWideNode *node = &bvh->wideNodes[index];
+            if (node->min[0][i] > node->max[0][i])
+            {
+                continue; // empty slot
+            }
+            start = node->start[i];
+            count = node->count[i];
+            child = (Bounds){color(node->min[0][i], node->min[1][i], node->min[2][i]), color(node->max[0][i], node->max[1][i], node->max[2][i])};
+        }
+        else
+        {
+            const BvhQuantizedNode *node = &bvh->quantizedNodes[index];
+            if (i >= node->childCount)
+            {
+                continue;
+            }
+            start = node->start[i];
+            count = node->count[i];
+            for (size_t axis = 0; axis < 3; axis++)
+            {
+                child.min.elem[axis] = node->origin[axis] + (float)node->min[axis][i] * ldexpf(1, node->exponent[axis]);
+                child.max.elem[axis] = node->origin[axis] + (float)node->max[axis][i] * ldexpf(1, node->exponent[axis]);
+            }
+        }
+        if (count == 0)
+        {
+            cr_assert(lt(sz, start, bvh->wideNodeCount));
+            cr_assert(gt(sz, start, index)); // depth-first, so traversal cannot loop
+            size_t *below = calloc(bvh->primitiveCount, sizeof(size_t));
+            cr_assert(not(eq(ptr, below, NULL)));
+            expectValidWideNode(bvh, bounds, start, below);
+            for (size_t j = 0; j < bvh->primitiveCount; j++)
+            {
+                if (below[j] != 0)
+                {
+                    cr_expect(boundsContains(child, bounds[bvh->primitives[j]]));
+                    seen[j] += below[j];
+                }
+            }
+            free(below);
+            continue;
+        }
+        for (size_t j = start; j < start + count; j++)
+        {
+            cr_expect(boundsContains(child, bounds[bvh->primitives[j]]));
+            seen[j]++;
+        }
+    }
+}
+
+// Checks that every bounded primitive is in exactly one leaf of at most `leafSize` primitives, and that the nodes
+// contain their children, in both the binary tree and its wide layout
+void expectValidBvh(const Bvh *bvh, const Bounds *bounds, const size_t count, const size_t leafSize)
+{
+    size_t *seen = calloc(count, sizeof(size_t));
+    cr_assert(not(eq(ptr, seen, NULL)));
+    for (size_t i = 0; i < bvh->nodeCount; i++)
+    {
+        const BvhNode node = bvh->nodes[i];
+        if (node.count != 0)
+        {
+            cr_expect(le(sz, node.count, leafSize));
+            for (size_t j = node.start; j < node.start + node.count; j++)
+            {
+                seen[bvh->primitives[j]]++;
+                cr_expect(boundsContains(node.bounds, bounds[bvh->primitives[j]]));
+            }
+        }
+        else
+        {
+            cr_expect(boundsContains(node.bounds, bvh->nodes[i + 1].bounds));
+            cr_expect(boundsContains(node.bounds, bvh->nodes[node.start].bounds));
+        }
+    }
+    for (size_t i = 0; i < count; i++)
+    {
+        cr_expect(eq(sz, seen[i], boundsFinite(bounds[i]) ? 1 : 0));
+    }
+    free(seen);
+    if (bvh->layout != BVH_BINARY)
+    {
+        // Every slot of the primitive index array is under exactly one leaf child
+        size_t *slots = calloc(bvh->primitiveCount, sizeof(size_t));
+        cr_assert(not(eq(ptr, slots, NULL)));
+        expectValidWideNode(bvh, bounds, 0, slots);
+        for (size_t i = 0; i < bvh->primitiveCount; i++)
+        {
+            cr_expect(eq(sz, slots[i], 1));
+        }
+        free(slots);
+    }
+}
+
+void countPacketVisit(void *context, const size_t primitive, const unsigned active, Scalar tMax[BVH_PACKET_SIZE])
+{
+    (void)tMax;
+    VisitCounter *counter = context;
+    for (size_t i = 0; i < BVH_PACKET_SIZE; i++)
+    {
+        if (active & 1u << i)
+        {
+            counter->visits[primitive * BVH_PACKET_SIZE + i]++;
+        }
+    }
+}
+
+Test(bounds_operations, union_extend)
+{
+    const Bounds a = {color(-1, -1, -1), color(1, 1, 1)};
+    const Bounds b = {color(0, 2, -3), color(4, 3, 0)};
+    const Bounds c = boundsUnion(a, b);
+    cr_expect_vec3_eq(c.min, (color(-1, -1, -3)));
+    cr_expect_vec3_eq(c.max, (color(4, 3, 1)));
+    const Bounds d = boundsExtend(boundsEmpty(), color(1, 2, 3));
+    cr_expect_vec3_eq(d.min, (color(1, 2, 3)));
+    cr_expect_vec3_eq(d.max, (color(1, 2, 3)));
+    cr_expect_vec3_eq(boundsCentroid(b), (color(2, 2.5, -1.5)));
+    cr_expect(boundsFinite(a));
+    cr_expect(not(boundsFinite(boundsEmpty())));
+    cr_expect(not(boundsFinite((Bounds){color(-INFINITY, 0, 0), color(0, 0, 0)})));
+}
+
+Test(bounds_operations, hit)
+{
+    const Bounds a = {color(-1, -1, -1), color(1, 1, 1)};
+    Scalar tEntry;
+    cr_expect(boundsHit(a, point(0, 0, -5), vector(INFINITY, INFINITY, 1), -INFINITY, INFINITY, &tEntry));
+    cr_expect_dbl(tEntry, 4);
+    cr_expect(not(boundsHit(a, point(0, 2, -5), vector(INFINITY, INFINITY, 1), -INFINITY, INFINITY, &tEntry)));
+    cr_expect(not(boundsHit(a, point(0, 0, -5), vector(INFINITY, INFINITY, 1), -INFINITY, 3, &tEntry)));
+    cr_expect(boundsHit(a, point(1, 0, -5), vector(INFINITY, INFINITY, 1), 0, INFINITY, &tEntry));
+    cr_expect(boundsHit(a, point(0, 0, 0), vector(1, 1, 1), 0, INFINITY, &tEntry));
+    cr_expect_dbl(tEntry, 0);
+}
+
+Test(bvh_operations, build)
+{
+    Bounds *bounds = randomBounds(PRIMITIVE_COUNT);
+    bounds[7] = (Bounds){color(-INFINITY, -INFINITY, -INFINITY), color(INFINITY, INFINITY, INFINITY)};
+    Bvh bvh;
+    bvhBuild(&bvh, bounds, PRIMITIVE_COUNT);
+    cr_assert(eq(sz, bvh.primitiveCount, PRIMITIVE_COUNT - 1));
+    cr_assert(eq(sz, bvh.unboundedCount, 1));
+    cr_expect(eq(sz, bvh.unbounded[0], 7));
+    expectValidBvh(&bvh, bounds, PRIMITIVE_COUNT, BVH_LEAF_SIZE);
+    free(bounds);
+    bvhDestroy(&bvh);
+    cr_expect(eq(sz, bvh.nodeCount, 0));
+}
+
+Test(bvh_operations, build_options)
+{
+    Bounds *bounds = randomBounds(PRIMITIVE_COUNT);
+    bounds[3] = boundsEmpty();
+    const BvhBuildOptions options[] = {{BVH_MEDIAN, 0, BVH_LEAF_SIZE, 1, BVH_BINARY}, {BVH_MEDIAN, 0, 1, 1, BVH_WIDE},
+                                       {BVH_SAH, 2, 8, 1, BVH_QUANTIZED}, {BVH_SAH, 16, BVH_LEAF_SIZE, 1, BVH_BINARY},
+                                       {BVH_SAH, 1000, 1, 1, BVH_WIDE}, {BVH_LBVH, 0, BVH_LEAF_SIZE, 1, BVH_QUANTIZED},
+                                       {BVH_LBVH, 0, 1, 1, BVH_BINARY}};
+    BvhStats median;
+    for (size_t i = 0; i < sizeof(options) / sizeof(options[0]); i++)
+    {
+        Bvh bvh;
+        BvhStats stats;
+        bvhBuildWith(&bvh, bounds, PRIMITIVE_COUNT, options[i], &stats);
+        cr_expect(eq(sz, bvh.primitiveCount, PRIMITIVE_COUNT - 1));
+        expectValidBvh(&bvh, bounds, PRIMITIVE_COUNT, options[i].leafSize);
+        cr_expect(eq(sz, stats.leafCount, (bvh.nodeCount + 1) / 2));
+        cr_expect(le(sz, stats.maxLeafSize, options[i].leafSize));
+        cr_expect(le(sz, stats.minLeafSize, stats.maxLeafSize));
+        cr_expect(le(sz, stats.depth, BVH_STACK_SIZE - 1));
+        cr_expect(ge(dbl, stats.buildTime, 0));
+        if (i == 0)
+        {
+            median = stats;
+        }
+        if (i == 3)
+        {
+            // The surface area heuristic finds a cheaper tree than splitting at the median
+            cr_expect(lt(dbl, stats.sahCost, median.sahCost));
+        }
+        bvhDestroy(&bvh);
+    }
+    free(bounds);
+}
+
+Test(bvh_operations, parallel_build)
+{
+    const size_t count = 100000;
+    Bounds *bounds = randomBounds(count);
+    const BvhMethod methods[] = {BVH_SAH, BVH_LBVH};
+    for (size_t i = 0; i < sizeof(methods) / sizeof(methods[0]); i++)
+    {
+        Bvh serial;
+        Bvh parallel;
+        bvhBuildWith(&serial, bounds, count, (BvhBuildOptions){methods[i], 8, BVH_LEAF_SIZE, 1, BVH_WIDE}, NULL);
+        bvhBuildWith(&parallel, bounds, count, (BvhBuildOptions){methods[i], 8, BVH_LEAF_SIZE, 4, BVH_WIDE}, NULL);
+        // The tree does not depend on the number of threads
+        cr_assert(eq(sz, parallel.nodeCount, serial.nodeCount));
+        cr_expect(eq(int, memcmp(parallel.nodes, serial.nodes, sizeof(BvhNode[serial.nodeCount])), 0));
+        cr_expect(eq(int, memcmp(parallel.primitives, serial.primitives, sizeof(size_t[count])), 0));
+        expectValidBvh(&parallel, bounds, count, BVH_LEAF_SIZE);
+        bvhDestroy(&serial);
+        bvhDestroy(&parallel);
+    }
+    free(bounds);
+}
+
+Test(bvh_operations, stats)
+{
+    const Bounds bounds[] = {{color(0, 0, 0), color(1, 1, 1)}, {color(3, 0, 0), color(4, 1, 1)}, {color(0.2, 0, 3), color(1.2, 1, 4)}};
+    Bvh bvh;
+    BvhStats stats;
+    bvhBuildWith(&bvh, bounds, 3, (BvhBuildOptions){BVH_MEDIAN, 0, 1, 1, BVH_BINARY}, &stats);
+    cr_expect(eq(sz, stats.leafCount, 3));
+    cr_expect(eq(sz, stats.depth, 2));
+    cr_expect(eq(sz, stats.minLeafSize, 1));
+    cr_expect(eq(sz, stats.maxLeafSize, 1));
+    cr_expect_dbl(stats.averageLeafSize, 1);
+    // The root (half area 24) splits off the first box, leaving the other two under a node of half area 23,
+    // and every leaf has half area 3
+    cr_expect_dbl(stats.sahCost, 1 + 23.0 / 24 + 3 * 3.0 / 24);
+    cr_expect_dbl(bvhStats(&bvh).sahCost, stats.sahCost);
+    bvhDestroy(&bvh);
+    cr_expect(eq(sz, bvhStats(&bvh).leafCount, 0));
+}
+
+Test(bvh_operations, traverse)
+{
+    Bounds *bounds = randomBounds(PRIMITIVE_COUNT);
+    // Every layout of a tree built with the surface area heuristic and of a linear one
+    const BvhBuildOptions options[] = {{BVH_SAH, 16, BVH_LEAF_SIZE, 1, BVH_BINARY}, BVH_BUILD_DEFAULT,
+                                       {BVH_SAH, 16, BVH_LEAF_SIZE, 1, BVH_QUANTIZED}, {BVH_LBVH, 0, BVH_LEAF_SIZE, 1, BVH_BINARY},
+                                       BVH_BUILD_LINEAR, {BVH_LBVH, 0, BVH_LEAF_SIZE, 1, BVH_QUANTIZED}};
+    const size_t treeCount = sizeof(options) / sizeof(options[0]);
+    Bvh trees[sizeof(options) / sizeof(options[0])];
+    for (size_t i = 0; i < treeCount; i++)
+    {
+        bvhBuildWith(&trees[i], bounds, PRIMITIVE_COUNT, options[i], NULL);
+        cr_expect(eq(int, trees[i].layout, options[i].layout));
+    }
+    size_t *visits = calloc(PRIMITIVE_COUNT, sizeof(size_t));
+    cr_assert(not(eq(ptr, visits, NULL)));
+    VisitCounter counter = {bounds, visits};
+    uint64_t state = 7;
+    for (size_t ray = 0; ray < 100; ray++)
+    {
+        const Vec4 origin = point(randomUnit(&state) * 120 - 60, randomUnit(&state) * 120 - 60, -100);
+        const Vec4 direction = vec4Norm(vector(randomUnit(&state) - 0.5, randomUnit(&state) - 0.5, 1));
+        const Vec4 inverse = vector(1 / direction.x, 1 / direction.y, 1 / direction.z);
+        for (size_t i = 0; i < PRIMITIVE_COUNT; i++)
+        {
+            visits[i] = 0;
+        }
+        for (size_t i = 0; i < treeCount; i++)
+        {
+            cr_expect(not(bvhTraverse(&trees[i], origin, direction, 0, INFINITY, countVisit, &counter)));
+        }
+        for (size_t i = 0; i < PRIMITIVE_COUNT; i++)
+        {
+            Scalar tEntry;
+            const bool expected = boundsHit(bounds[i], origin, inverse, 0, INFINITY, &tEntry);
+            cr_expect(le(sz, visits[i], treeCount));
+            if (expected)
+            {
+                cr_expect(eq(sz, visits[i], treeCount));
+            }
+        }
+    }
+    free(visits);
+    free(bounds);
+    for (size_t i = 0; i < treeCount; i++)
+    {
+        bvhDestroy(&trees[i]);
+    }
+}
+
+typedef struct
+{
+    size_t count;
+    Scalar last;
+    bool ordered;
+} OrderCounter;
+
+// Records whether leaves are visited by increasing distance, every primitive being a point on the ray's path
+bool countOrder(void *context, const size_t primitive, Scalar *tMax)
+{
+    (void)tMax;
+    OrderCounter *counter = context;
+    counter->ordered = counter->ordered && (Scalar)primitive >= counter->last;
+    counter->last = (Scalar)primitive;
+    counter->count++;
+    return false;
+}
+
+Test(bvh_operations, wide_layouts)
+{
+    // Points along the z axis at the distance of their index, so near-to-far traversal visits them in order
+    Bounds bounds[64];
+    for (size_t i = 0; i < 64; i++)
+    {
+        bounds[i] = (Bounds){color(0, 0, (double)i), color(0, 0, (double)i)};
+    }
+    const BvhLayout layouts[] = {BVH_BINARY, BVH_WIDE, BVH_QUANTIZED};
+    size_t nodeSize[3];
+    for (size_t i = 0; i < 3; i++)
+    {
+        Bvh bvh;
+        BvhStats stats;
+        bvhBuildWith(&bvh, bounds, 64, (BvhBuildOptions){BVH_MEDIAN, 0, 1, 1, layouts[i]}, &stats);
+        expectValidBvh(&bvh, bounds, 64, 1);
+        nodeSize[i] = stats.nodeSize;
+        OrderCounter counter = {0, -INFINITY, true};
+        cr_expect(not(bvhTraverse(&bvh, point(0, 0, -1), vector(0, 0, 1), 0, INFINITY, countOrder, &counter)));
+        cr_expect(eq(sz, counter.count, 64));
+        cr_expect(counter.ordered);
+        // Away from the points, the ray misses every child
+        counter = (OrderCounter){0, -INFINITY, true};
+        cr_expect(not(bvhTraverse(&bvh, point(0, 1, -1), vector(0, 0, 1), 0, INFINITY, countOrder, &counter)));
+        cr_expect(eq(sz, counter.count, 0));
+        bvhDestroy(&bvh);
+        cr_expect(eq(ptr, bvh.wideNodes, NULL));
+    }
+    // Wide nodes take less memory than the binary tree, quantized ones at most half of that
+    cr_expect(lt(sz, nodeSize[1], nodeSize[0]));
+    cr_expect(le(sz, nodeSize[2] * 2, nodeSize[1]));
+
+    // A single leaf becomes the only child of the root
+    Bvh bvh;
+    bvhBuildWith(&bvh, bounds, 2, (BvhBuildOptions){BVH_MEDIAN, 0, 2, 1, BVH_QUANTIZED}, NULL);
+    cr_expect(eq(sz, bvh.wideNodeCount, 1));
+    expectValidBvh(&bvh, bounds, 2, 2);
+    OrderCounter counter = {0, -INFINITY, true};
+    cr_expect(not(bvhTraverse(&bvh, point(0, 0, -1), vector(0, 0, 1), 0, INFINITY, countOrder, &counter)));
+    cr_expect(eq(sz, counter.count, 2));
+    bvhDestroy(&bvh);
+}
+
+Test(bvh_operations, traverse_packet)
+{
+    Bounds *bounds = randomBounds(PRIMITIVE_COUNT);
+    Bvh bvh;
+    bvhBuild(&bvh, bounds, PRIMITIVE_COUNT);
+    size_t *visits = calloc(PRIMITIVE_COUNT * BVH_PACKET_SIZE, sizeof(size_t));
+    cr_assert(not(eq(ptr, visits, NULL)));
+    VisitCounter counter = {bounds, visits};
+    uint64_t state = 11;
+    for (size_t packet = 0; packet < 50; packet++)
+    {
+        const unsigned active = (unsigned)packet % 15 + 1;
+        Vec4 origin[BVH_PACKET_SIZE];
+        Vec4 direction[BVH_PACKET_SIZE];
+        Scalar tMax[BVH_PACKET_SIZE];
+        const double x = randomUnit(&state) * 120 - 60;
+        const double y = randomUnit(&state) * 120 - 60;
+        for (size_t i = 0; i < BVH_PACKET_SIZE; i++)
+        {
+            origin[i] = point(x + (double)(i % 2), y + (double)(i / 2), -100);
+            direction[i] = vec4Norm(vector(randomUnit(&state) - 0.5, randomUnit(&state) - 0.5, 1));
+            tMax[i] = INFINITY;
+        }
+        for (size_t i = 0; i < PRIMITIVE_COUNT * BVH_PACKET_SIZE; i++)
+        {
+            visits[i] = 0;
+        }
+        bvhTraversePacket(&bvh, origin, direction, active, 0, tMax, countPacketVisit, &counter);
+        for (size_t i = 0; i < PRIMITIVE_COUNT; i++)
+        {
+            for (size_t ray = 0; ray < BVH_PACKET_SIZE; ray++)
+            {
+                const Vec4 inverse = vector(1 / direction[ray].x, 1 / direction[ray].y, 1 / direction[ray].z);
+                Scalar tEntry;
+                const bool expected = (active & 1u << ray) && boundsHit(bounds[i], origin[ray], inverse, 0, INFINITY, &tEntry);
+                cr_expect(le(sz, visits[i * BVH_PACKET_SIZE + ray], 1));
+                if (expected)
+                {
+                    cr_expect(eq(sz, visits[i * BVH_PACKET_SIZE + ray], 1));
+                }
+                if (!(active & 1u << ray))
+                {
+                    cr_expect(eq(sz, visits[i * BVH_PACKET_SIZE + ray], 0));
+                }
+            }
+        }
+    }
+    free(visits);
+    free(bounds);
+    bvhDestroy(&bvh);
+}
+
+Test(bvh_operations, refit)
+{
+    Bounds *bounds = randomBounds(PRIMITIVE_COUNT);
+    Bvh bvh;
+    BvhStats built;
+    bvhBuildWith(&bvh, bounds, PRIMITIVE_COUNT, BVH_BUILD_DEFAULT, &built);
+    cr_expect_dbl(bvh.sahCost, built.sahCost);
+    cr_expect_dbl(bvhRefit(&bvh, bounds), built.sahCost);
+    // Small moves keep the tree about as good, shuffling the primitives makes it much worse
+    uint64_t state = 5;
+    for (size_t i = 0; i < PRIMITIVE_COUNT; i++)
+    {
+        const Vec3 offset = color(randomUnit(&state) - 0.5, randomUnit(&state) - 0.5, randomUnit(&state) - 0.5);
+        bounds[i] = (Bounds){vec3Add(bounds[i].min, offset), vec3Add(bounds[i].max, offset)};
+    }
+    const Scalar moved = bvhRefit(&bvh, bounds);
+    expectValidBvh(&bvh, bounds, PRIMITIVE_COUNT, BVH_LEAF_SIZE);
+    cr_expect_dbl(moved, bvhStats(&bvh).sahCost);
+    cr_expect(lt(dbl, moved, built.sahCost * 1.2));
+    for (size_t i = 0; i < PRIMITIVE_COUNT; i++)
+    {
+        const Bounds swap = bounds[i];
+        const size_t j = (size_t)(randomUnit(&state) * PRIMITIVE_COUNT);
+        bounds[i] = bounds[j];
+        bounds[j] = swap;
+    }
+    const Scalar shuffled = bvhRefit(&bvh, bounds);
+    expectValidBvh(&bvh, bounds, PRIMITIVE_COUNT, BVH_LEAF_SIZE);
+    cr_expect(gt(dbl, shuffled, built.sahCost * 2));
+    cr_expect_dbl(bvh.sahCost, built.sahCost);
+    free(bounds);
+    bvhDestroy(&bvh);
+}
@@ -42,14 +42,13 @@ int main(void)
     left.material.color = color(1, 0.8, 0.1);
     left.material.diffuse = 0.7;
     left.material.specular = 0.3;
-    World world = {1, 6, &light(-10, 10, -10, 1, 1, 1), (Shape[]){floor, leftWall, rightWall, middle, right, left}};
+    World world = {.lightCount = 1, .shapeCount = 6, .lights = &light(-10, 10, -10, 1, 1, 1), .shapes = (Shape[]){floor, leftWall, rightWall, middle, right, left}};
+    worldBuildArrays(&world);
     Camera camera = cameraInit(2000, 1000, M_PI / 3, viewTransform(point(0, 1.5, -5), point(0, 1, 0), vector(0, 1, 0)));
-    Canvas *image = render(camera, world);
-    char *imagePPM = canvasPPM(image);
+    Canvas *image = renderParallel(camera, world, 0);
+    worldDestroyArrays(&world);
+    canvasWritePPM(image, stdout, PPM_P6);
     free(image);
     image = NULL;
-    fputs(imagePPM, stdout);
-    free(imagePPM);
-    imagePPM = NULL;
     return 0;
 }
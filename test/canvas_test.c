@@ -6,11 +6,14 @@
 
 #include <criterion/criterion.h>
 #include <criterion/new/assert.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
 
 #include "src/canvas.h"
 #include "src/vectors.h"
 
-#define EPSILON 0.00001
+#define EPSILON MAT_EPSILON
 
 #define cr_expect_vec3_eq(actual, expected) cr_expect(all(epsilon_eq(dbl, actual.x, expected.x, EPSILON), \
                                                           epsilon_eq(dbl, actual.y, expected.y, EPSILON), \
@@ -104,3 +107,71 @@ Test(canvas_operations, canvas_ppm)
     canvasPPMBuff = NULL;
     canvas2PPMBuff = NULL;
 }
+
+// Writes the canvas to a temporary file and returns its contents, storing the length in `size`
+char *canvasWriteRead(const Canvas *canvas, const PPMFormat format, size_t *size)
+{
+    FILE *file = tmpfile();
+    checkAlloc(file);
+    cr_assert(canvasWritePPM(canvas, file, format));
+    *size = (size_t)ftell(file);
+    rewind(file);
+    char *contents = calloc(*size + 1, 1);
+    checkAlloc(contents);
+    cr_assert(eq(sz, fread(contents, 1, *size, file), *size));
+    fclose(file);
+    return contents;
+}
+
+Test(canvas_operations, canvas_write_ppm)
+{
+    char PPMStr[] = "P3\n"
+                    "10 2\n"
+                    "255\n"
+                    "255 204 153 255 204 153 255 204 153 255 204 153 255 204 153 255 204\n"
+                    "153 255 204 153 255 204 153 255 204 153 255 204 153\n"
+                    "255 204 153 255 204 153 255 204 153 255 204 153 255 204 153 255 204\n"
+                    "153 255 204 153 255 204 153 255 204 153 255 204 153\n";
+    Canvas *canvas = canvasCreate(10, 2);
+    checkAlloc(canvas);
+    for (int i = 0; i < 2; i++)
+    {
+        for (int j = 0; j < 10; j++)
+        {
+            canvasPixelWrite(canvas, j, i, color(1, 0.8, 0.6));
+        }
+    }
+    size_t size;
+    char *plain = canvasWriteRead(canvas, PPM_P3, &size);
+    cr_expect(eq(str, plain, PPMStr));
+    free(plain);
+    free(canvas);
+
+    canvas = canvasCreate(500, 300);
+    checkAlloc(canvas);
+    canvasPixelWrite(canvas, 0, 0, color(1.5, 0, 0));
+    canvasPixelWrite(canvas, 2, 1, color(0, 0.5, 0));
+    canvasPixelWrite(canvas, 499, 299, color(-0.5, 0, 1));
+    char *binary = canvasWriteRead(canvas, PPM_P6, &size);
+    const size_t header = strlen("P6\n500 300\n255\n");
+    cr_assert(eq(sz, size, header + 500 * 300 * 3));
+    cr_expect(eq(chr, binary[header - 1], '\n'));
+    cr_expect(eq(u8, (uint8_t)binary[header], 255));
+    cr_expect(eq(u8, (uint8_t)binary[header + (2 + 500) * 3 + 1], 128));
+    cr_expect(eq(u8, (uint8_t)binary[size - 1], 255));
+    cr_expect(eq(u8, (uint8_t)binary[size - 3], 0));
+    free(binary);
+    char *reference = canvasPPM(canvas);
+    plain = canvasWriteRead(canvas, PPM_P3, &size);
+    cr_assert(eq(chr, plain[size - 1], '\n'));
+    plain[size - 1] = '\0';
+    for (size_t i = 0; i < size; i++) // Only the line breaks differ from `canvasPPM`
+    {
+        plain[i] = plain[i] == '\n' ? ' ' : plain[i];
+        reference[i] = reference[i] == '\n' ? ' ' : reference[i];
+    }
+    cr_expect(eq(str, plain, reference));
+    free(plain);
+    free(reference);
+    free(canvas);
+}
@@ -0,0 +1,112 @@
+/*
+ * grid_bench.c - Benchmark of the uniform grid against the bounding volume hierarchy and testing every shape
+ *
+ * Usage: grid_bench [most spheres]
+ *
+ * Copyright (c) 2023, Dimitrios Alexopoulos All rights reserved.
+ */
+
+#include <math.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include "src/grid.h"
+#include "src/rays.h"
+#include "test/random.h"
+
+#define BENCH_RAYS 200000
+#define BENCH_BRUTE_RAYS 200 // testing every shape is too slow for more
+#define BENCH_MIN_SPHERES 10000
+#define BENCH_MAX_SPHERES 1000000
+
+typedef enum
+{
+    BENCH_BRUTE,
+    BENCH_BVH,
+    BENCH_LBVH,
+    BENCH_GRID
+} BenchAccelerator;
+
+// Returns the current time in seconds
+static double benchTime(void)
+{
+    struct timespec now;
+    timespec_get(&now, TIME_UTC);
+    return (double)now.tv_sec + (double)now.tv_nsec / 1e9;
+}
+
+// Builds the acceleration structure of the world and traces rays through it from the side of the cube around its spheres
+static void benchWorld(World *world, const double side, const char *name, const BenchAccelerator accelerator)
+{
+    const double buildStart = benchTime();
+    if (accelerator == BENCH_BVH)
+    {
+        worldBuildBvh(world);
+    }
+    else if (accelerator == BENCH_LBVH)
+    {
+        worldBuildBvhWith(world, BVH_BUILD_LINEAR, NULL);
+    }
+    else if (accelerator == BENCH_GRID)
+    {
+        worldBuildGrid(world);
+    }
+    const double built = benchTime() - buildStart;
+    const size_t rays = accelerator == BENCH_BRUTE ? BENCH_BRUTE_RAYS : BENCH_RAYS;
+    uint64_t state = 3;
+    size_t hits = 0;
+    size_t shadowed = 0;
+    const double traceStart = benchTime();
+    for (size_t i = 0; i < rays; i++)
+    {
+        const Ray ray = {point(randomUnit(&state) * side, randomUnit(&state) * side, -1),
+                         vec4Norm(vector(randomUnit(&state) - 0.5, randomUnit(&state) - 0.5, 2))};
+        hits += intersectClosest(*world, ray).shape != NULL;
+        shadowed += intersectAny(*world, ray, side);
+    }
+    const double traced = benchTime() - traceStart;
+    printf("  %-6s built in %.3f s, %zu of %zu rays hit, %zu shadowed, %.3f Mrays/s\n", name, built, hits, rays, shadowed,
+           (double)rays / traced / 1e6);
+    if (accelerator == BENCH_GRID)
+    {
+        printf("         %zux%zux%zu cells, %.2f references per sphere\n", world->grid->resolution[0], world->grid->resolution[1],
+               world->grid->resolution[2], (double)world->grid->referenceCount / (double)world->shapeCount);
+    }
+    worldDestroyBvh(world);
+    worldDestroyGrid(world);
+}
+
+int main(int argc, char **argv)
+{
+    const size_t maxSpheres = argc > 1 ? strtoull(argv[1], NULL, 10) : BENCH_MAX_SPHERES;
+
+    // Worlds of randomly placed spheres of similar sizes, as dense whatever their number
+    for (size_t count = BENCH_MIN_SPHERES; count <= maxSpheres; count *= 10)
+    {
+        World spheres = {.shapeCount = count, .shapes = malloc(sizeof(Shape[count]))};
+        if (spheres.shapes == NULL)
+        {
+            return 1;
+        }
+        const double side = cbrt((double)count) * 2;
+        uint64_t state = 2;
+        for (size_t i = 0; i < count; i++)
+        {
+            const double radius = 0.4 + randomUnit(&state) * 0.2;
+            const double x = randomUnit(&state) * side;
+            const double y = randomUnit(&state) * side;
+            const double z = randomUnit(&state) * side;
+            const Mat4 transform = mat4Mul(translation(x, y, z), scaling(radius, radius, radius));
+            spheres.shapes[i] = sphere(transform, MATERIAL);
+        }
+        printf("World of %zu spheres\n", count);
+        benchWorld(&spheres, side, "brute", BENCH_BRUTE);
+        benchWorld(&spheres, side, "SAH", BENCH_BVH);
+        benchWorld(&spheres, side, "LBVH", BENCH_LBVH);
+        benchWorld(&spheres, side, "grid", BENCH_GRID);
+        worldDestroy(&spheres);
+    }
+    return 0;
+}
@@ -0,0 +1,206 @@
+/*
+ * grid_test.c - Tests on the uniform grid
+ *
+ * Copyright (c) 2023, Dimitrios Alexopoulos All rights reserved.
+ */
+
+#include <criterion/criterion.h>
+#include <criterion/new/assert.h>
+#include <math.h>
+#include <stdint.h>
+#include <stdlib.h>
+
+#include "src/bvh.h"
+#include "src/grid.h"
+#include "src/vectors.h"
+#include "test/random.h"
+
+#define PRIMITIVE_COUNT 1000
+
+typedef struct
+{
+    size_t *visits;
+    size_t stopAfter; // visits before stopping the traversal, zero to never stop
+    size_t count;
+    Scalar last;
+    bool ordered;
+} VisitCounter;
+
+bool boundsOverlap(const Bounds a, const Bounds b)
+{
+    return a.min.x <= b.max.x && a.min.y <= b.max.y && a.min.z <= b.max.z &&
+           b.min.x <= a.max.x && b.min.y <= a.max.y && b.min.z <= a.max.z;
+}
+
+// Counts the visits of every primitive, recording whether they come by increasing index
+bool countVisit(void *context, const size_t primitive, Scalar *tMax)
+{
+    (void)tMax;
+    VisitCounter *counter = context;
+    counter->visits[primitive]++;
+    counter->ordered = counter->ordered && (Scalar)primitive >= counter->last;
+    counter->last = (Scalar)primitive;
+    return ++counter->count == counter->stopAfter;
+}
+
+// Checks that every bounded primitive is listed by exactly the cells its bounds overlap
+void expectValidGrid(const Grid *grid, const Bounds *bounds, const size_t count)
+{
+    cr_assert(eq(sz, grid->cellStart[0], 0));
+    cr_assert(eq(sz, grid->cellStart[grid->cellCount], grid->referenceCount));
+    size_t *listed = calloc(count, sizeof(size_t));
+    cr_assert(not(eq(ptr, listed, NULL)));
+    for (size_t z = 0; z < grid->resolution[2]; z++)
+    {
+        for (size_t y = 0; y < grid->resolution[1]; y++)
+        {
+            for (size_t x = 0; x < grid->resolution[0]; x++)
+            {
+                const size_t cell = (z * grid->resolution[1] + y) * grid->resolution[0] + x;
+                const Vec3 min = vec3Add(grid->bounds.min, color((double)x * grid->cellSize.x, (double)y * grid->cellSize.y, (double)z * grid->cellSize.z));
+                const Bounds cellBounds = {min, vec3Add(min, grid->cellSize)};
+                cr_assert(le(sz, grid->cellStart[cell], grid->cellStart[cell + 1]));
+                for (size_t i = grid->cellStart[cell]; i < grid->cellStart[cell + 1]; i++)
+                {
+                    // Up to rounding at the boundaries of the cells
+                    const Bounds grown = {vec3Sub(cellBounds.min, color(1e-9, 1e-9, 1e-9)), vec3Add(cellBounds.max, color(1e-9, 1e-9, 1e-9))};
+                    cr_expect(boundsOverlap(grown, bounds[grid->primitives[i]]));
+                    listed[grid->primitives[i]]++;
+                }
+            }
+        }
+    }
+    size_t unbounded = 0;
+    for (size_t i = 0; i < count; i++)
+    {
+        if (!boundsFinite(bounds[i]))
+        {
+            cr_expect(eq(sz, listed[i], 0));
+            cr_expect(eq(sz, grid->unbounded[unbounded++], i));
+            continue;
+        }
+        cr_expect(ge(sz, listed[i], 1));
+    }
+    cr_expect(eq(sz, grid->unboundedCount, unbounded));
+    free(listed);
+}
+
+Test(grid_operations, build)
+{
+    Bounds *bounds = randomBounds(PRIMITIVE_COUNT);
+    bounds[5] = boundsEmpty();
+    bounds[9] = (Bounds){color(-INFINITY, 0, -INFINITY), color(INFINITY, 0, INFINITY)};
+    Grid grid;
+    gridBuild(&grid, bounds, PRIMITIVE_COUNT);
+    // About `GRID_DENSITY` cells per primitive, nearly cubes
+    cr_expect(ge(sz, grid.cellCount, PRIMITIVE_COUNT));
+    cr_expect(le(sz, grid.cellCount, GRID_DENSITY * PRIMITIVE_COUNT));
+    cr_expect(eq(sz, grid.resolution[0] * grid.resolution[1] * grid.resolution[2], grid.cellCount));
+    cr_expect(lt(dbl, fabs(grid.cellSize.x - grid.cellSize.y), grid.cellSize.x * 0.2));
+    expectValidGrid(&grid, bounds, PRIMITIVE_COUNT);
+    free(bounds);
+    gridDestroy(&grid);
+    cr_expect(eq(sz, grid.cellCount, 0));
+
+    // Without bounded primitives there are no cells
+    const Bounds unbounded = boundsEmpty();
+    gridBuild(&grid, &unbounded, 1);
+    cr_expect(eq(sz, grid.cellCount, 0));
+    cr_expect(eq(sz, grid.unboundedCount, 1));
+    gridDestroy(&grid);
+    gridBuild(&grid, NULL, 0);
+    cr_expect(eq(sz, grid.cellCount, 0));
+    gridDestroy(&grid);
+}
+
+Test(grid_operations, flat)
+{
+    // Points on a plane get a single layer of cells
+    Bounds bounds[100];
+    for (size_t i = 0; i < 100; i++)
+    {
+        const Vec3 point = color((double)(i % 10), (double)(i / 10), 2);
+        bounds[i] = (Bounds){point, point};
+    }
+    Grid grid;
+    gridBuild(&grid, bounds, 100);
+    cr_expect(eq(sz, grid.resolution[2], 1));
+    cr_expect(gt(sz, grid.resolution[0], 1));
+    expectValidGrid(&grid, bounds, 100);
+    size_t visits[100] = {0};
+    VisitCounter counter = {visits, 0, 0, -INFINITY, true};
+    cr_expect(not(gridTraverse(&grid, point(3, 4, 0), vector(0, 0, 1), 0, INFINITY, countVisit, &counter)));
+    cr_expect(eq(sz, visits[43], 1));
+    // Rays in the plane walk along its cells
+    cr_expect(not(gridTraverse(&grid, point(-1, 7, 2), vector(1, 0, 0), 0, INFINITY, countVisit, &counter)));
+    for (size_t i = 70; i < 80; i++)
+    {
+        cr_expect(ge(sz, visits[i], 1));
+    }
+    gridDestroy(&grid);
+}
+
+Test(grid_operations, traverse)
+{
+    Bounds *bounds = randomBounds(PRIMITIVE_COUNT);
+    Grid grid;
+    gridBuild(&grid, bounds, PRIMITIVE_COUNT);
+    size_t *visits = calloc(PRIMITIVE_COUNT, sizeof(size_t));
+    cr_assert(not(eq(ptr, visits, NULL)));
+    uint64_t state = 7;
+    for (size_t ray = 0; ray < 100; ray++)
+    {
+        // From outside and from inside the grid
+        const double z = ray % 2 == 0 ? -100 : randomUnit(&state) * 100 - 50;
+        const Vec4 origin = point(randomUnit(&state) * 120 - 60, randomUnit(&state) * 120 - 60, z);
+        const Vec4 direction = vec4Norm(vector(randomUnit(&state) - 0.5, randomUnit(&state) - 0.5, ray % 4 < 2 ? 1 : -1));
+        const Vec4 inverse = vector(1 / direction.x, 1 / direction.y, 1 / direction.z);
+        for (size_t i = 0; i < PRIMITIVE_COUNT; i++)
+        {
+            visits[i] = 0;
+        }
+        VisitCounter counter = {visits, 0, 0, -INFINITY, true};
+        cr_expect(not(gridTraverse(&grid, origin, direction, 0, INFINITY, countVisit, &counter)));
+        for (size_t i = 0; i < PRIMITIVE_COUNT; i++)
+        {
+            Scalar tEntry;
+            if (boundsHit(bounds[i], origin, inverse, 0, INFINITY, &tEntry))
+            {
+                cr_expect(ge(sz, visits[i], 1));
+            }
+        }
+    }
+    // Leaves stop the traversal
+    VisitCounter counter = {visits, 1, 0, -INFINITY, true};
+    cr_expect(gridTraverse(&grid, point(0, 0, -100), vector(0, 0, 1), 0, INFINITY, countVisit, &counter));
+    cr_expect(eq(sz, counter.count, 1));
+    free(visits);
+    free(bounds);
+    gridDestroy(&grid);
+}
+
+Test(grid_operations, traverse_order)
+{
+    // Points along the z axis at the distance of their index, so cells visited near to far give them in order
+    Bounds bounds[64];
+    for (size_t i = 0; i < 64; i++)
+    {
+        bounds[i] = (Bounds){color(0, 0, (double)i), color(0.5, 0.5, (double)i + 0.5)};
+    }
+    Grid grid;
+    gridBuild(&grid, bounds, 64);
+    size_t visits[64] = {0};
+    VisitCounter counter = {visits, 0, 0, -INFINITY, true};
+    cr_expect(not(gridTraverse(&grid, point(0.25, 0.25, -1), vector(0, 0, 1), 0, INFINITY, countVisit, &counter)));
+    cr_expect(counter.ordered);
+    for (size_t i = 0; i < 64; i++)
+    {
+        cr_expect(ge(sz, visits[i], 1));
+    }
+    // Beyond `tMax` no cells are visited
+    counter = (VisitCounter){visits, 0, 0, -INFINITY, true};
+    cr_expect(not(gridTraverse(&grid, point(0.25, 0.25, -1), vector(0, 0, -1), 0, INFINITY, countVisit, &counter)));
+    cr_expect(not(gridTraverse(&grid, point(0.25, 0.25, -10), vector(0, 0, 1), 0, 5, countVisit, &counter)));
+    cr_expect(eq(sz, counter.count, 0));
+    gridDestroy(&grid);
+}
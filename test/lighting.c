@@ -31,24 +31,21 @@ int main(void)
             canvasPoint.x = canvasX + ((double)i / canvasWidth(canvas)) * canvasSize;
             canvasPoint.y = canvasY - ((double)j / canvasHeight(canvas)) * canvasSize;
             cameraRay.direction = vec4Sub(canvasPoint, cameraOrigin);
-            Intersections cameraIntersections = intersect(sphere, cameraRay);
+            Intersections cameraIntersections = intersect(&sphere, cameraRay);
             Intersection cameraHit = hit(cameraIntersections);
-            if (cameraHit.shape.type == SPHERE)
+            if (cameraHit.shape != NULL)
             {
                 Vec4 hitPoint = rayPos(cameraRay, cameraHit.t);
-                Vec4 hitNormal = normal(sphere, hitPoint);
-                Vec3 pointColor = lighting(sphere.material, sphere, light, hitPoint,
+                Vec4 hitNormal = normal(&sphere, hitPoint);
+                Vec3 pointColor = lighting(sphere.material, &sphere, light, hitPoint,
                                            vec4Neg(vec4Norm(cameraRay.direction)), hitNormal, false);
                 canvasPixelWrite(canvas, i, j, pointColor);
             }
             intersectionsDestroy(&cameraIntersections);
         }
     }
-    char *ppmOutput = canvasPPM(canvas);
-    fputs(ppmOutput, stdout);
+    canvasWritePPM(canvas, stdout, PPM_P6);
     free(canvas);
     canvas = NULL;
-    free(ppmOutput);
-    ppmOutput = NULL;
     return 0;
 }
@@ -0,0 +1,142 @@
+/*
+ * mesh_bench.c - Benchmark of triangle mesh loading, intersection and instancing
+ *
+ * Copyright (c) 2023, Dimitrios Alexopoulos All rights reserved.
+ */
+
+// TODO: Find a better solution than _XOPEN_SOURCE
+#ifdef _WIN32
+#define _USE_MATH_DEFINES
+#endif
+#ifdef __unix__
+#define _XOPEN_SOURCE
+#endif
+
+#include <math.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include "src/mesh.h"
+#include "src/rays.h"
+#include "src/scene.h"
+#include "test/random.h"
+
+#define BENCH_RINGS 500
+#define BENCH_SEGMENTS 1000
+#define BENCH_RAYS 1000000
+#define BENCH_FOREST_SIZE 316 // trees along each side of the forest, about 100k instances
+
+// Returns the current time in seconds
+static double benchTime(void)
+{
+    struct timespec now;
+    timespec_get(&now, TIME_UTC);
+    return (double)now.tv_sec + (double)now.tv_nsec / 1e9;
+}
+
+int main(void)
+{
+    // A bumpy unit sphere of about a million triangles, with the vertex normals computed while loading
+    FILE *file = tmpfile();
+    if (file == NULL)
+    {
+        return 1;
+    }
+    for (size_t ring = 0; ring <= BENCH_RINGS; ring++)
+    {
+        const double polar = M_PI * (double)ring / BENCH_RINGS;
+        for (size_t segment = 0; segment < BENCH_SEGMENTS; segment++)
+        {
+            const double azimuth = 2 * M_PI * (double)segment / BENCH_SEGMENTS;
+            const double radius = 1 + 0.02 * sin(13 * polar) * cos(17 * azimuth);
+            fprintf(file, "v %.6f %.6f %.6f\n", radius * sin(polar) * cos(azimuth), radius * cos(polar),
+                    radius * sin(polar) * sin(azimuth));
+        }
+    }
+    for (size_t ring = 0; ring < BENCH_RINGS; ring++)
+    {
+        for (size_t segment = 0; segment < BENCH_SEGMENTS; segment++)
+        {
+            const size_t a = ring * BENCH_SEGMENTS + segment + 1;
+            const size_t b = ring * BENCH_SEGMENTS + (segment + 1) % BENCH_SEGMENTS + 1;
+            fprintf(file, "f %zu %zu %zu %zu\n", a, b, b + BENCH_SEGMENTS, a + BENCH_SEGMENTS);
+        }
+    }
+    const long size = ftell(file);
+    rewind(file);
+    const double loadStart = benchTime();
+    Mesh mesh;
+    SceneError error;
+    if (!sceneLoadObj(&mesh, file, &error))
+    {
+        printf("Line %zu: %s\n", error.line, error.message);
+        return 1;
+    }
+    const double loaded = benchTime() - loadStart;
+    fclose(file);
+    printf("Loaded %zu triangles (%.1f MiB) in %.3f s\n", mesh.triangleCount, (double)size / (1 << 20), loaded);
+
+    Shape shape = mesh(mat4Mul(translation(0, 1, 0), rotationY(0.3)), MATERIAL, &mesh);
+    World world = {.shapeCount = 1, .shapes = &shape};
+    uint64_t state = 1;
+    size_t hits = 0;
+    Scalar distance = 0;
+    const double traceStart = benchTime();
+    for (size_t i = 0; i < BENCH_RAYS; i++)
+    {
+        const Ray ray = {point(randomUnit(&state) * 2.4 - 1.2, randomUnit(&state) * 2.4 - 0.2, -5), vector(0, 0, 1)};
+        const Intersection hit = intersectClosest(world, ray);
+        if (hit.shape != NULL)
+        {
+            hits++;
+            distance += normalAtHit(hit, rayPos(ray, hit.t)).z;
+        }
+    }
+    const double traced = benchTime() - traceStart;
+    printf("Traced %d rays (%zu hits, checksum %.3f) in %.3f s, %.2f Mrays/s\n", BENCH_RAYS, hits, (double)distance, traced,
+           BENCH_RAYS / traced / 1e6);
+
+    // A forest of instances of the mesh, which is stored once whatever the number of trees
+    Group tree = {.shapeCount = 1, .shapes = malloc(sizeof(Shape))};
+    Instance *trees = malloc(sizeof(Instance[BENCH_FOREST_SIZE * BENCH_FOREST_SIZE]));
+    if (tree.shapes == NULL || trees == NULL)
+    {
+        return 1;
+    }
+    tree.shapes[0] = mesh(mat4Mul(translation(0, 1, 0), scaling(0.5, 1, 0.5)), MATERIAL, &mesh);
+    groupBuild(&tree);
+    for (size_t i = 0; i < BENCH_FOREST_SIZE * BENCH_FOREST_SIZE; i++)
+    {
+        const double x = (double)(i % BENCH_FOREST_SIZE) * 2 + randomUnit(&state);
+        const double z = (double)(i / BENCH_FOREST_SIZE) * 2 + randomUnit(&state);
+        trees[i] = instance(mat4Mul(translation(x, 0, z), mat4Mul(rotationY(randomUnit(&state) * 6.28), scaling(1, 0.5 + randomUnit(&state), 1))), &tree);
+    }
+    World forest = {.instanceCount = BENCH_FOREST_SIZE * BENCH_FOREST_SIZE, .instances = trees};
+    const double forestStart = benchTime();
+    worldBuildBvh(&forest);
+    const double built = benchTime() - forestStart;
+    const double meshSize = (double)(mesh.vertexCount * sizeof(Vec3) + mesh.normalCount * sizeof(Vec3) +
+                                     mesh.triangleCount * (sizeof(MeshTriangle) + sizeof(MeshFace)) + mesh.bvh.nodeCount * sizeof(BvhNode) +
+                                     mesh.bvh.primitiveCount * sizeof(size_t));
+    const double forestSize = (double)(forest.instanceCount * sizeof(Instance) + forest.bvh->nodeCount * sizeof(BvhNode) +
+                                       forest.bvh->primitiveCount * sizeof(size_t));
+    printf("Placed %zu instances (%.1f MiB, the mesh takes %.1f MiB once) in %.3f s\n", forest.instanceCount,
+           forestSize / (1 << 20), meshSize / (1 << 20), built);
+    hits = 0;
+    const double forestTraceStart = benchTime();
+    for (size_t i = 0; i < BENCH_RAYS; i++)
+    {
+        const Ray ray = {point(randomUnit(&state) * BENCH_FOREST_SIZE * 2, 10, randomUnit(&state) * BENCH_FOREST_SIZE * 2),
+                         vec4Norm(vector(randomUnit(&state) - 0.5, -1, randomUnit(&state) - 0.5))};
+        hits += intersectClosest(forest, ray).shape != NULL;
+    }
+    const double forestTraced = benchTime() - forestTraceStart;
+    printf("Traced %d rays through the forest (%zu hits) in %.3f s, %.2f Mrays/s\n", BENCH_RAYS, hits, forestTraced,
+           BENCH_RAYS / forestTraced / 1e6);
+    worldDestroy(&forest);
+    groupDestroy(&tree);
+    meshDestroy(&mesh);
+    return 0;
+}
@@ -0,0 +1,257 @@
+/*
+ * mesh_test.c - Tests on triangle meshes
+ *
+ * Copyright (c) 2023, Dimitrios Alexopoulos All rights reserved.
+ */
+
+#include <criterion/criterion.h>
+#include <criterion/new/assert.h>
+#include <math.h>
+#include <stdint.h>
+#include <stdlib.h>
+
+#include "src/mesh.h"
+#include "src/rays.h"
+#include "src/vectors.h"
+#include "test/random.h"
+
+#define EPSILON MAT_EPSILON
+
+#define cr_expect_dbl(actual, expected) cr_expect(epsilon_eq(dbl, actual, expected, EPSILON))
+
+#define cr_expect_vec3_eq(actual, expected) cr_expect(all(epsilon_eq(dbl, actual.x, expected.x, EPSILON), \
+                                                          epsilon_eq(dbl, actual.y, expected.y, EPSILON), \
+                                                          epsilon_eq(dbl, actual.z, expected.z, EPSILON)))
+
+#define GRID_SIZE 60
+
+// Builds the triangle (0, 1, 0), (-1, 0, 0), (1, 0, 0), with the given corner normals if `smooth` is set
+void triangleMesh(Mesh *mesh, const bool smooth)
+{
+    meshCreate(mesh);
+    meshAddVertex(mesh, color(0, 1, 0));
+    meshAddVertex(mesh, color(-1, 0, 0));
+    meshAddVertex(mesh, color(1, 0, 0));
+    MeshTriangle triangle = {{0, 1, 2}, {MESH_NO_NORMAL, MESH_NO_NORMAL, MESH_NO_NORMAL}};
+    if (smooth)
+    {
+        triangle.normals[0] = meshAddNormal(mesh, color(0, 1, 0));
+        triangle.normals[1] = meshAddNormal(mesh, color(-1, 0, 0));
+        triangle.normals[2] = meshAddNormal(mesh, color(1, 0, 0));
+    }
+    meshAddTriangle(mesh, triangle);
+    meshBuild(mesh);
+}
+
+// Builds a cube from (-1, -1, -1) to (1, 1, 1) out of 12 triangles, wound counterclockwise seen from outside
+void cubeMesh(Mesh *mesh)
+{
+    meshCreate(mesh);
+    for (size_t i = 0; i < 8; i++)
+    {
+        meshAddVertex(mesh, color(i & 1 ? 1 : -1, i & 2 ? 1 : -1, i & 4 ? 1 : -1));
+    }
+    const size_t faces[6][4] = {{0, 2, 3, 1}, {4, 5, 7, 6}, {0, 1, 5, 4}, {2, 6, 7, 3}, {0, 4, 6, 2}, {1, 3, 7, 5}};
+    for (size_t i = 0; i < 6; i++)
+    {
+        meshAddTriangle(mesh, (MeshTriangle){{faces[i][0], faces[i][1], faces[i][2]}, {MESH_NO_NORMAL, MESH_NO_NORMAL, MESH_NO_NORMAL}});
+        meshAddTriangle(mesh, (MeshTriangle){{faces[i][0], faces[i][2], faces[i][3]}, {MESH_NO_NORMAL, MESH_NO_NORMAL, MESH_NO_NORMAL}});
+    }
+    meshBuild(mesh);
+}
+
+Test(mesh_operations, build)
+{
+    Mesh mesh;
+    triangleMesh(&mesh, false);
+    cr_assert(eq(sz, mesh.triangleCount, 1));
+    cr_expect_vec3_eq(mesh.faces[0].ab, (color(-1, -1, 0)));
+    cr_expect_vec3_eq(mesh.faces[0].ac, (color(1, -1, 0)));
+    cr_expect_vec3_eq(mesh.bounds.min, (color(-1, 0, 0)));
+    cr_expect_vec3_eq(mesh.bounds.max, (color(1, 1, 0)));
+    cr_expect(eq(sz, mesh.bvh.primitiveCount, 1));
+    // Computed normals are shared by the corners
+    cr_expect(eq(sz, mesh.normalCount, 3));
+    cr_expect(eq(sz, mesh.triangles[0].normals[1], 1));
+    meshDestroy(&mesh);
+    cr_expect(eq(sz, mesh.triangleCount, 0));
+    cr_expect(eq(ptr, mesh.faces, NULL));
+}
+
+Test(mesh_operations, triangle_hit)
+{
+    Mesh mesh;
+    triangleMesh(&mesh, false);
+    Scalar t;
+    cr_expect(not(meshTriangleHit(&mesh, 0, point(0, -1, -2), vector(0, 1, 0), &t)));
+    cr_expect(not(meshTriangleHit(&mesh, 0, point(1, 1, -2), vector(0, 0, 1), &t)));
+    cr_expect(not(meshTriangleHit(&mesh, 0, point(-1, 1, -2), vector(0, 0, 1), &t)));
+    cr_expect(not(meshTriangleHit(&mesh, 0, point(0, -1, -2), vector(0, 0, 1), &t)));
+    cr_assert(meshTriangleHit(&mesh, 0, point(0, 0.5, -2), vector(0, 0, 1), &t));
+    cr_expect_dbl(t, 2);
+    // Unnormalized directions give distances along the direction, as for the other shapes
+    cr_assert(meshTriangleHit(&mesh, 0, point(0, 0.5, 2), vector(0, 0, -4), &t));
+    cr_expect_dbl(t, 0.5);
+    meshDestroy(&mesh);
+}
+
+Test(mesh_operations, smooth_normal)
+{
+    Mesh mesh;
+    triangleMesh(&mesh, true);
+    const Vec3 interpolated = vec3Norm(meshNormal(&mesh, 0, point(-0.2, 0.3, 0)));
+    cr_expect_vec3_eq(interpolated, (color(-0.5547, 0.83205, 0)));
+    const Shape shape = mesh(mat4Mul(translation(0, 0, 5), scaling(2, 2, 2)), MATERIAL, &mesh);
+    const Ray ray = ray(-0.4, 0.6, 0, 0, 0, 1);
+    const Intersection hit = intersectClosest((World){.shapeCount = 1, .shapes = (Shape *)&shape}, ray);
+    cr_assert(eq(ptr, (void *)hit.shape, (void *)&shape));
+    cr_expect_dbl(hit.t, 5);
+    const Vec4 normal = normalAtHit(hit, rayPos(ray, hit.t));
+    cr_expect_vec3_eq(normal.xyz, (color(-0.5547, 0.83205, 0)));
+    const Computations computations = prepareComputations(hit, ray);
+    cr_expect_vec3_eq(computations.normal.xyz, (color(-0.5547, 0.83205, 0)));
+    meshDestroy(&mesh);
+}
+
+Test(mesh_operations, shape)
+{
+    Mesh cube;
+    cubeMesh(&cube);
+    cr_assert(eq(sz, cube.triangleCount, 12));
+    const Shape shape = mesh(mat4Mul(translation(0, 0, 3), scaling(0.5, 2, 1)), MATERIAL, &cube);
+    const Bounds bounds = shapeBounds(&shape);
+    cr_expect(le(dbl, bounds.min.x, -0.5));
+    cr_expect(ge(dbl, bounds.min.x, -0.5 - EPSILON));
+    cr_expect(le(dbl, bounds.max.z, 4 + EPSILON));
+    cr_expect(ge(dbl, bounds.max.z, 4));
+    Intersections intersections = intersect(&shape, ray(0.25, 0.5, -5, 0, 0, 1));
+    cr_assert(eq(sz, intersections.size, 2));
+    cr_expect_dbl(intersections.elem[0].t, 7);
+    cr_expect_dbl(intersections.elem[1].t, 9);
+    // The corners share smooth normals averaged over three faces, which tilt the normal away from the face's
+    const Vec4 normal = normalAtHit(intersections.elem[0], point(0.25, 0.5, 2));
+    cr_expect_dbl(vec4Mag(normal), 1);
+    cr_expect(le(dbl, normal.z, -0.5));
+    intersectionsDestroy(&intersections);
+    Scalar t[SHAPE_MAX_INTERSECTIONS];
+    cr_assert(eq(sz, intersectShape(&shape, ray(0.25, 0.5, 3, 0, 0, 1), t), 1));
+    cr_expect_dbl(t[0], 1);
+    cr_expect(eq(sz, intersectShape(&shape, ray(0.75, 0.5, -5, 0, 0, 1), t), 0));
+    meshDestroy(&cube);
+}
+
+Test(mesh_operations, world)
+{
+    Mesh cube;
+    cubeMesh(&cube);
+    Shape shapes[] = {mesh(translation(-2, 0, 0), MATERIAL, &cube), sphere(translation(2, 0, 0), MATERIAL),
+                      mesh(mat4Mul(translation(0, 0, 4), rotationY(0.5)), MATERIAL, &cube), plane(translation(0, -1, 0), MATERIAL)};
+    World world = {.shapeCount = 4, .shapes = shapes};
+    uint64_t state = 3;
+    Ray rays[64];
+    Intersection expected[64];
+    for (size_t i = 0; i < 64; i++)
+    {
+        rays[i] = (Ray){point(randomUnit(&state) * 8 - 4, randomUnit(&state) * 2, -10),
+                        vec4Norm(vector(randomUnit(&state) * 0.3 - 0.15, randomUnit(&state) * 0.2 - 0.15, 1))};
+        expected[i] = intersectClosest(world, rays[i]);
+    }
+    size_t meshHits = 0;
+    for (size_t i = 0; i < 64; i++)
+    {
+        meshHits += expected[i].shape == &shapes[0] || expected[i].shape == &shapes[2];
+    }
+    cr_expect(ge(sz, meshHits, 8));
+    for (size_t pass = 0; pass < 2; pass++)
+    {
+        if (pass == 0)
+        {
+            worldBuildArrays(&world);
+        }
+        else
+        {
+            worldBuildBvh(&world);
+        }
+        for (size_t i = 0; i < 64; i++)
+        {
+            const Intersection actual = intersectClosest(world, rays[i]);
+            cr_expect(eq(ptr, (void *)actual.shape, (void *)expected[i].shape));
+            cr_expect(eq(sz, actual.triangle, expected[i].triangle));
+            cr_expect_dbl(actual.t, expected[i].t);
+            cr_expect(eq(int, intersectAny(world, rays[i], INFINITY), expected[i].shape != NULL));
+        }
+        for (size_t i = 0; i < 64; i += RAY_PACKET_SIZE)
+        {
+            RayPacket packet = {.active = 0xF};
+            Intersection hits[RAY_PACKET_SIZE];
+            for (size_t lane = 0; lane < RAY_PACKET_SIZE; lane++)
+            {
+                packet.rays[lane] = rays[i + lane];
+            }
+            intersectPacket(world, &packet, hits);
+            for (size_t lane = 0; lane < RAY_PACKET_SIZE; lane++)
+            {
+                cr_expect(eq(ptr, (void *)hits[lane].shape, (void *)expected[i + lane].shape));
+                cr_expect(eq(sz, hits[lane].triangle, expected[i + lane].triangle));
+                cr_expect_dbl(hits[lane].t, expected[i + lane].t);
+            }
+        }
+    }
+    worldDestroyBvh(&world);
+    worldDestroyArrays(&world);
+    meshDestroy(&cube);
+}
+
+Test(mesh_operations, hierarchy)
+{
+    Mesh grid;
+    meshCreate(&grid);
+    uint64_t state = 5;
+    for (size_t y = 0; y <= GRID_SIZE; y++)
+    {
+        for (size_t x = 0; x <= GRID_SIZE; x++)
+        {
+            meshAddVertex(&grid, color((double)x, (double)y, randomUnit(&state)));
+        }
+    }
+    for (size_t y = 0; y < GRID_SIZE; y++)
+    {
+        for (size_t x = 0; x < GRID_SIZE; x++)
+        {
+            const size_t corner = y * (GRID_SIZE + 1) + x;
+            meshAddTriangle(&grid, (MeshTriangle){{corner, corner + 1, corner + GRID_SIZE + 2}, {MESH_NO_NORMAL, MESH_NO_NORMAL, MESH_NO_NORMAL}});
+            meshAddTriangle(&grid, (MeshTriangle){{corner, corner + GRID_SIZE + 2, corner + GRID_SIZE + 1}, {MESH_NO_NORMAL, MESH_NO_NORMAL, MESH_NO_NORMAL}});
+        }
+    }
+    meshBuild(&grid);
+    cr_assert(eq(sz, grid.bvh.primitiveCount, 2 * GRID_SIZE * GRID_SIZE));
+    const Shape shape = mesh(IDENTITY, MATERIAL, &grid);
+    const World world = {.shapeCount = 1, .shapes = (Shape *)&shape};
+    for (size_t i = 0; i < 100; i++)
+    {
+        const Ray ray = {point(randomUnit(&state) * GRID_SIZE, randomUnit(&state) * GRID_SIZE, -5),
+                         vec4Norm(vector(randomUnit(&state) - 0.5, randomUnit(&state) - 0.5, 1))};
+        Scalar closest = INFINITY;
+        size_t triangle = SIZE_MAX;
+        for (size_t j = 0; j < grid.triangleCount; j++)
+        {
+            Scalar t;
+            if (meshTriangleHit(&grid, j, ray.origin, ray.direction, &t) && t >= 0 && t < closest)
+            {
+                closest = t;
+                triangle = j;
+            }
+        }
+        const Intersection hit = intersectClosest(world, ray);
+        if (triangle == SIZE_MAX)
+        {
+            cr_expect(eq(ptr, (void *)hit.shape, NULL));
+            continue;
+        }
+        cr_expect(eq(sz, hit.triangle, triangle));
+        cr_expect(eq(dbl, hit.t, closest));
+        const Vec4 normal = normalAtHit(hit, rayPos(ray, hit.t));
+        cr_expect_dbl(vec4Mag(normal), 1);
+    }
+    meshDestroy(&grid);
+}
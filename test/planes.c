@@ -39,14 +39,13 @@ int main(void)
     Light leftLight = light(-10, 10, -10, 1, 0, 0);
     Light middleLight = light(0, 10, -10, 0, 1, 0);
     Light rightLight = light(10, 10, -10, 0, 0, 1);
-    World world = {3, 4, (Light[]){leftLight, middleLight, rightLight}, (Shape[]){floor, middle, right, left}};
+    World world = {.lightCount = 3, .shapeCount = 4, .lights = (Light[]){leftLight, middleLight, rightLight}, .shapes = (Shape[]){floor, middle, right, left}};
+    worldBuildArrays(&world);
     Camera camera = cameraInit(2000, 1000, M_PI / 3, viewTransform(point(0, 1.5, -5), point(0, 1, 0), vector(0, 1, 0)));
-    Canvas *image = render(camera, world);
-    char *imagePPM = canvasPPM(image);
+    Canvas *image = renderParallel(camera, world, 0);
+    worldDestroyArrays(&world);
+    canvasWritePPM(image, stdout, PPM_P6);
     free(image);
     image = NULL;
-    fputs(imagePPM, stdout);
-    free(imagePPM);
-    imagePPM = NULL;
     return 0;
 }
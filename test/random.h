@@ -0,0 +1,44 @@
+/*
+ * random.h - Deterministic pseudo-random numbers shared by the tests and benchmarks
+ *
+ * Copyright (c) 2023, Dimitrios Alexopoulos All rights reserved.
+ */
+
+#ifndef TEST_RANDOM_H
+#define TEST_RANDOM_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+
+#include "src/bvh.h"
+#include "src/vectors.h"
+
+// Deterministic pseudo-random numbers between 0 and 1, the same sequence for the same starting state
+static inline double randomUnit(uint64_t *state)
+{
+    *state = *state * 6364136223846793005u + 1442695040888963407u;
+    return (double)(*state >> 11) / (double)(UINT64_C(1) << 53);
+}
+
+// Returns the bounds of `count` boxes up to 4 wide, centered in the cube of side 100 around the origin, the same on
+// every call
+// If the allocation fails, `abort()` is called
+static inline Bounds *randomBounds(const size_t count)
+{
+    uint64_t state = 42;
+    Bounds *bounds = malloc(sizeof(Bounds[count]));
+    if (bounds == NULL)
+    {
+        abort();
+    }
+    for (size_t i = 0; i < count; i++)
+    {
+        const Vec3 center = color(randomUnit(&state) * 100 - 50, randomUnit(&state) * 100 - 50, randomUnit(&state) * 100 - 50);
+        const double radius = randomUnit(&state) * 2;
+        bounds[i] = (Bounds){vec3Sub(center, color(radius, radius, radius)), vec3Add(center, color(radius, radius, radius))};
+    }
+    return bounds;
+}
+
+#endif
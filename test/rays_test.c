@@ -15,12 +15,13 @@
 #include <criterion/criterion.h>
 #include <criterion/new/assert.h>
 #include <math.h>
+#include <stdint.h>
 
 #include "src/canvas.h"
 #include "src/rays.h"
 #include "src/vectors.h"
 
-#define EPSILON 0.00001
+#define EPSILON MAT_EPSILON
 
 #define cr_expect_dbl(actual, expected) cr_expect(epsilon_eq(dbl, actual, expected, EPSILON))
 
@@ -54,8 +55,7 @@
                                                           epsilon_eq(dbl, actual.y, expected.y, EPSILON), \
                                                           epsilon_eq(dbl, actual.z, expected.z, EPSILON)))
 
-// TODO: Add comparison to the shape parameter
-#define shape_eq(actual, expected) all(eq(int, actual.type, expected.type))
+#define shape_eq(actual, expected) eq(ptr, (void *)actual, (void *)expected)
 
 #define cr_expect_intersection_eq(actual, expected) cr_expect(all(shape_eq(actual.shape, expected.shape), epsilon_eq(dbl, actual.t, expected.t, EPSILON)))
 
@@ -74,37 +74,37 @@ Test(sphere_operations, interesect)
 {
     Ray ray1 = ray(0, 0, -5, 0, 0, 1);
     Shape sphere = sphere(IDENTITY, MATERIAL);
-    Intersections xs1 = intersect(sphere, ray1);
-    Intersection i1 = {sphere, 4};
-    Intersection i2 = {sphere, 6};
+    Intersections xs1 = intersect(&sphere, ray1);
+    Intersection i1 = {&sphere, 4};
+    Intersection i2 = {&sphere, 6};
     cr_assert(eq(sz, xs1.size, 2));
     cr_expect_intersection_eq(xs1.elem[0], i1);
     cr_expect_intersection_eq(xs1.elem[1], i2);
     intersectionsDestroy(&xs1);
     Ray ray2 = ray(0, 1, -5, 0, 0, 1);
-    Intersections xs2 = intersect(sphere, ray2);
-    Intersection i3 = {sphere, 5};
-    Intersection i4 = {sphere, 5};
+    Intersections xs2 = intersect(&sphere, ray2);
+    Intersection i3 = {&sphere, 5};
+    Intersection i4 = {&sphere, 5};
     cr_assert(eq(sz, xs2.size, 2));
     cr_expect_intersection_eq(xs2.elem[0], i3);
     cr_expect_intersection_eq(xs2.elem[1], i4);
     intersectionsDestroy(&xs2);
     Ray ray3 = ray(0, 2, -5, 0, 0, 1);
-    Intersections xs3 = intersect(sphere, ray3);
+    Intersections xs3 = intersect(&sphere, ray3);
     cr_assert(eq(sz, xs3.size, 0));
     intersectionsDestroy(&xs3);
     Ray ray4 = ray(0, 0, 0, 0, 0, 1);
-    Intersections xs4 = intersect(sphere, ray4);
-    Intersection i5 = {sphere, -1};
-    Intersection i6 = {sphere, 1};
+    Intersections xs4 = intersect(&sphere, ray4);
+    Intersection i5 = {&sphere, -1};
+    Intersection i6 = {&sphere, 1};
     cr_assert(eq(sz, xs4.size, 2));
     cr_expect_intersection_eq(xs4.elem[0], i5);
     cr_expect_intersection_eq(xs4.elem[1], i6);
     intersectionsDestroy(&xs4);
     Ray ray5 = ray(0, 0, 5, 0, 0, 1);
-    Intersections xs5 = intersect(sphere, ray5);
-    Intersection i7 = {sphere, -6};
-    Intersection i8 = {sphere, -4};
+    Intersections xs5 = intersect(&sphere, ray5);
+    Intersection i7 = {&sphere, -6};
+    Intersection i8 = {&sphere, -4};
     cr_assert(eq(sz, xs5.size, 2));
     cr_expect_intersection_eq(xs5.elem[0], i7);
     cr_expect_intersection_eq(xs5.elem[1], i8);
@@ -113,32 +113,33 @@ Test(sphere_operations, interesect)
 
 Test(sphere_operations, hit)
 {
+    cr_expect(le(sz, sizeof(Intersection), 2 * sizeof(void *) + 2 * sizeof(Scalar))); // shape, instance, distance and triangle
     Shape sphere = sphere(IDENTITY, MATERIAL);
-    Intersection i1 = {sphere, 1};
-    Intersection i2 = {sphere, 2};
+    Intersection i1 = {&sphere, 1};
+    Intersection i2 = {&sphere, 2};
     Intersections xs;
     intersectionsCopy(&xs, &(Intersections){2, 2, (Intersection[2]){i2, i1}});
     Intersection i = hit(xs);
     cr_expect_intersection_eq(i, i1);
     intersectionsDestroy(&xs);
-    Intersection i3 = {sphere, -1};
-    Intersection i4 = {sphere, 1};
+    Intersection i3 = {&sphere, -1};
+    Intersection i4 = {&sphere, 1};
     Intersections xs2;
     intersectionsCopy(&xs2, &(Intersections){2, 2, (Intersection[2]){i4, i3}});
     i = hit(xs2);
     cr_expect_intersection_eq(i, i4);
     intersectionsDestroy(&xs2);
-    Intersection i5 = {sphere, -2};
-    Intersection i6 = {sphere, -1};
+    Intersection i5 = {&sphere, -2};
+    Intersection i6 = {&sphere, -1};
     Intersections xs3;
     intersectionsCopy(&xs3, &(Intersections){2, 2, (Intersection[2]){i6, i5}});
     i = hit(xs3);
-    cr_expect(eq(int, i.shape.type, NO_HIT));
+    cr_expect(eq(ptr, (void *)i.shape, NULL));
     intersectionsDestroy(&xs3);
-    Intersection i7 = {sphere, 5};
-    Intersection i8 = {sphere, 7};
-    Intersection i9 = {sphere, -3};
-    Intersection i10 = {sphere, 2};
+    Intersection i7 = {&sphere, 5};
+    Intersection i8 = {&sphere, 7};
+    Intersection i9 = {&sphere, -3};
+    Intersection i10 = {&sphere, 2};
     Intersections xs4;
     intersectionsCopy(&xs4, &(Intersections){4, 4, (Intersection[4]){i7, i8, i9, i10}});
     i = hit(xs4);
@@ -158,22 +159,25 @@ Test(ray_operations, transform)
     Ray ray4 = rayTransform(ray3, matB);
     cr_expect_point_eq(ray4.origin, 2, 6, 12);
     cr_expect_vector_eq(ray4.direction, 0, 3, 0);
+    Ray ray5 = rayTransformAffine(ray3, affineFromMat4(mat4Mul(matA, matB)));
+    cr_expect_point_eq(ray5.origin, 5, 10, 17);
+    cr_expect_vector_eq(ray5.direction, 0, 3, 0);
 }
 
 Test(sphere_operations, transform)
 {
     Ray ray = ray(0, 0, -5, 0, 0, 1);
     Shape sphere = sphere(scaling(2, 2, 2), MATERIAL);
-    Intersections xs = intersect(sphere, ray);
-    Intersection i1 = {sphere, 3};
-    Intersection i2 = {sphere, 7};
+    Intersections xs = intersect(&sphere, ray);
+    Intersection i1 = {&sphere, 3};
+    Intersection i2 = {&sphere, 7};
     cr_assert(eq(sz, xs.size, 2));
     cr_expect_intersection_eq(xs.elem[0], i1);
     cr_expect_intersection_eq(xs.elem[1], i2);
     intersectionsDestroy(&xs);
     Ray ray2 = ray(0, 0, -5, 0, 0, 1);
     Shape sphere2 = sphere(translation(5, 0, 0), MATERIAL);
-    Intersections xs2 = intersect(sphere2, ray2);
+    Intersections xs2 = intersect(&sphere2, ray2);
     cr_assert(eq(sz, xs2.size, 0));
     intersectionsDestroy(&xs2);
 }
@@ -181,15 +185,15 @@ Test(sphere_operations, transform)
 Test(sphere_operations, normal)
 {
     Shape sphere = sphere(IDENTITY, MATERIAL);
-    cr_expect_vector_eq(normal(sphere, point(1, 0, 0)), 1, 0, 0);
-    cr_expect_vector_eq(normal(sphere, point(0, 1, 0)), 0, 1, 0);
-    cr_expect_vector_eq(normal(sphere, point(0, 0, 1)), 0, 0, 1);
-    cr_expect_vector_eq(normal(sphere, point(sqrt(3) / 3, sqrt(3) / 3, sqrt(3) / 3)), sqrt(3) / 3, sqrt(3) / 3, sqrt(3) / 3);
-    cr_expect_dbl(vec4Mag(normal(sphere, point(sqrt(3) / 3, sqrt(3) / 3, sqrt(3) / 3))), 1);
+    cr_expect_vector_eq(normal(&sphere, point(1, 0, 0)), 1, 0, 0);
+    cr_expect_vector_eq(normal(&sphere, point(0, 1, 0)), 0, 1, 0);
+    cr_expect_vector_eq(normal(&sphere, point(0, 0, 1)), 0, 0, 1);
+    cr_expect_vector_eq(normal(&sphere, point(sqrt(3) / 3, sqrt(3) / 3, sqrt(3) / 3)), sqrt(3) / 3, sqrt(3) / 3, sqrt(3) / 3);
+    cr_expect_dbl(vec4Mag(normal(&sphere, point(sqrt(3) / 3, sqrt(3) / 3, sqrt(3) / 3))), 1);
     Shape sphere2 = sphere(translation(0, 1, 0), MATERIAL);
-    cr_expect_vector_eq(normal(sphere2, point(0, 1.70711, -0.70711)), 0, 0.70711, -0.70711);
+    cr_expect_vector_eq(normal(&sphere2, point(0, 1.70711, -0.70711)), 0, 0.70711, -0.70711);
     Shape sphere3 = sphere(mat4Mul(scaling(1, 0.5, 1), rotationZ(M_PI / 5)), MATERIAL);
-    cr_expect_vector_eq(normal(sphere3, point(0, M_SQRT1_2, -M_SQRT1_2)), 0, 0.97014, -0.24254);
+    cr_expect_vector_eq(normal(&sphere3, point(0, M_SQRT1_2, -M_SQRT1_2)), 0, 0.97014, -0.24254);
 }
 
 Test(materials, lighting)
@@ -199,15 +203,15 @@ Test(materials, lighting)
     Vec4 vecEye = vector(0, 0, -1);
     Vec4 vecNormal = vector(0, 0, -1);
     Light light = light(0, 0, -10, 1, 1, 1);
-    cr_assert_vec3_eq(lighting(m, sphere(IDENTITY, m), light, position, vecEye, vecNormal, false), (color(1.9, 1.9, 1.9)));
+    cr_assert_vec3_eq(lighting(m, &sphere(IDENTITY, m), light, position, vecEye, vecNormal, false), (color(1.9, 1.9, 1.9)));
     Vec4 vecEye2 = vector(0, -M_SQRT1_2, -M_SQRT1_2);
-    cr_assert_vec3_eq(lighting(m, sphere(IDENTITY, m), light, position, vecEye2, vecNormal, false), (color(1, 1, 1)));
+    cr_assert_vec3_eq(lighting(m, &sphere(IDENTITY, m), light, position, vecEye2, vecNormal, false), (color(1, 1, 1)));
     Light light2 = light(0, 10, -10, 1, 1, 1);
-    cr_assert_vec3_eq(lighting(m, sphere(IDENTITY, m), light2, position, vecEye, vecNormal, false), (color(0.7364, 0.7364, 0.7364)));
-    cr_assert_vec3_eq(lighting(m, sphere(IDENTITY, m), light2, position, vecEye2, vecNormal, false), (color(1.6364, 1.6364, 1.6364)));
+    cr_assert_vec3_eq(lighting(m, &sphere(IDENTITY, m), light2, position, vecEye, vecNormal, false), (color(0.7364, 0.7364, 0.7364)));
+    cr_assert_vec3_eq(lighting(m, &sphere(IDENTITY, m), light2, position, vecEye2, vecNormal, false), (color(1.6364, 1.6364, 1.6364)));
     Light light3 = light(0, 0, 10, 1, 1, 1);
-    cr_assert_vec3_eq(lighting(m, sphere(IDENTITY, m), light3, position, vecEye, vecNormal, false), (color(0.1, 0.1, 0.1)));
-    cr_assert_vec3_eq(lighting(m, sphere(IDENTITY, m), light, position, vecEye, vecNormal, true), (color(0.1, 0.1, 0.1)));
+    cr_assert_vec3_eq(lighting(m, &sphere(IDENTITY, m), light3, position, vecEye, vecNormal, false), (color(0.1, 0.1, 0.1)));
+    cr_assert_vec3_eq(lighting(m, &sphere(IDENTITY, m), light, position, vecEye, vecNormal, true), (color(0.1, 0.1, 0.1)));
 }
 
 Test(world, interesect_world)
@@ -224,11 +228,609 @@ Test(world, interesect_world)
     worldDestroy(&world);
 }
 
+Test(world, bounds)
+{
+    const Bounds sphereBounds = shapeBounds(&sphere(mat4Mul(translation(1, 2, 3), scaling(2, 0.5, 1)), MATERIAL));
+    cr_expect_vec3_eq(sphereBounds.min, (color(-1, 1.5, 2)));
+    cr_expect_vec3_eq(sphereBounds.max, (color(3, 2.5, 4)));
+    cr_expect(not(boundsFinite(shapeBounds(&plane(IDENTITY, MATERIAL)))));
+}
+
+Test(world, interesect_world_bvh)
+{
+    World world = defaultWorld();
+    Shape *shapes = realloc(world.shapes, sizeof(Shape[102]));
+    cr_assert(not(eq(ptr, shapes, NULL)));
+    world.shapes = shapes;
+    for (size_t i = 0; i < 100; i++)
+    {
+        world.shapes[i + 2] = sphere(mat4Mul(translation((double)(i % 10) - 4.5, (double)(i / 10) - 4.5, 3), scaling(0.4, 0.4, 0.4)), MATERIAL);
+    }
+    world.shapes[101] = plane(translation(0, -6, 0), MATERIAL);
+    world.shapeCount = 102;
+    Ray rays[] = {ray(0, 0, -5, 0, 0, 1), ray(0.5, -4.5, -5, 0, 0, 1), ray(-4.5, 4.5, -5, 0, -0.2, 1), ray(0, -10, 0, 0, 1, 0), ray(20, 0, 0, 0, 0, 1)};
+    for (size_t i = 0; i < sizeof(rays) / sizeof(Ray); i++)
+    {
+        Intersections expected = intersectWorld(world, rays[i]);
+        worldBuildBvh(&world);
+        Intersections actual = intersectWorld(world, rays[i]);
+        worldBuildBvhWith(&world, BVH_BUILD_LINEAR, NULL);
+        Intersections linear = intersectWorld(world, rays[i]);
+        worldDestroyBvh(&world);
+        cr_assert(eq(sz, actual.size, expected.size));
+        cr_assert(eq(sz, linear.size, expected.size));
+        for (size_t j = 0; j < actual.size; j++)
+        {
+            cr_expect_dbl(actual.elem[j].t, expected.elem[j].t);
+            cr_expect_dbl(linear.elem[j].t, expected.elem[j].t);
+        }
+        intersectionsDestroy(&expected);
+        intersectionsDestroy(&actual);
+        intersectionsDestroy(&linear);
+    }
+    worldDestroy(&world);
+}
+
+Test(world, refit_bvh)
+{
+    World world = {.shapeCount = 100, .shapes = malloc(sizeof(Shape[100]))};
+    cr_assert(not(eq(ptr, world.shapes, NULL)));
+    for (size_t i = 0; i < 100; i++)
+    {
+        const Mat4 transform = mat4Mul(translation((double)(i % 10) - 4.5, (double)(i / 10) - 4.5, 3), scaling(0.4, 0.4, 0.4));
+        world.shapes[i] = sphere(transform, MATERIAL);
+    }
+    worldBuildBvh(&world);
+    for (size_t frame = 0; frame < 2; frame++)
+    {
+        // The spheres bounce a little, then trade places
+        for (size_t i = 0; i < 100; i++)
+        {
+            const size_t place = frame == 0 ? i : 99 - i;
+            const double bounce = frame == 0 ? 0.1 * (double)(i % 3) : 0;
+            const Mat4 transform = mat4Mul(translation((double)(place % 10) - 4.5, (double)(place / 10) - 4.5 + bounce, 3 + (double)(i % 2)),
+                                           scaling(0.4, 0.4, 0.4));
+            world.shapes[i] = sphere(transform, MATERIAL);
+        }
+        cr_expect(eq(int, worldRefitBvh(&world, BVH_BUILD_DEFAULT, frame == 0 ? 2 : 1), frame == 1));
+        World flat = world;
+        flat.bvh = NULL;
+        for (size_t i = 0; i < 100; i++)
+        {
+            const Ray ray = ray((double)(i % 10) - 4.5, (double)(i / 10) - 4.5, -5, 0.01 * (double)(i % 7), 0, 1);
+            const Intersection expected = intersectClosest(flat, ray);
+            const Intersection actual = intersectClosest(world, ray);
+            cr_expect(eq(ptr, (void *)actual.shape, (void *)expected.shape));
+            cr_expect_dbl(actual.t, expected.t);
+        }
+    }
+    worldDestroy(&world);
+}
+
+Test(world, intersect_grid)
+{
+    World world = defaultWorld();
+    Shape *shapes = realloc(world.shapes, sizeof(Shape[203]));
+    cr_assert(not(eq(ptr, shapes, NULL)));
+    world.shapes = shapes;
+    for (size_t i = 0; i < 200; i++)
+    {
+        const Mat4 transform = mat4Mul(translation((double)(i % 10) - 4.5, (double)(i / 10 % 10) - 4.5, 3 + (double)(i / 100) * 2),
+                                       scaling(0.4, 0.6, 0.4));
+        world.shapes[i + 2] = sphere(transform, MATERIAL);
+    }
+    world.shapes[202] = plane(translation(0, -6, 0), MATERIAL);
+    world.shapeCount = 203;
+    World flat = world;
+    worldBuildGrid(&world);
+    cr_assert(not(eq(ptr, world.grid, NULL)));
+    cr_expect(eq(sz, world.grid->unboundedCount, 1));
+    for (size_t i = 0; i < 200; i++)
+    {
+        // Rays from in front of and among the spheres, some reaching the plane
+        const double angle = (double)i * 0.37;
+        const Vec4 origin = point(cos(angle) * 6, sin(angle * 1.3) * 6, i % 2 == 0 ? -5 : 4);
+        const Ray ray = {origin, vec4Norm(vector(sin(angle * 0.7) * 0.5, cos(angle * 1.1) * 0.5 - 0.2, i % 3 == 0 ? -0.3 : 1))};
+        const Intersection expected = intersectClosest(flat, ray);
+        const Intersection actual = intersectClosest(world, ray);
+        cr_expect(shape_eq(actual.shape, expected.shape));
+        cr_expect(eq(dbl, actual.t, expected.t));
+        cr_expect(eq(int, intersectAny(world, ray, 2), intersectAny(flat, ray, 2)));
+    }
+    worldDestroyGrid(&world);
+    cr_expect(eq(ptr, world.grid, NULL));
+    worldDestroy(&world);
+}
+
+Test(world, intersect_into)
+{
+    Shape sphere = sphere(IDENTITY, MATERIAL);
+    Intersections xs;
+    intersectionsCreate(&xs, 0);
+    intersectInto(&xs, &sphere, ray(0, 0, -5, 0, 0, 1));
+    intersectInto(&xs, &sphere, ray(0, 2, -5, 0, 0, 1));
+    intersectInto(&xs, &sphere, ray(0, 0, 0, 0, 0, 1));
+    cr_assert(eq(sz, xs.size, 4));
+    cr_expect_dbl(xs.elem[0].t, 4);
+    cr_expect_dbl(xs.elem[1].t, 6);
+    cr_expect_dbl(xs.elem[2].t, -1);
+    cr_expect_dbl(xs.elem[3].t, 1);
+    World world = defaultWorld();
+    intersectWorldInto(&xs, world, ray(0, 0, -5, 0, 0, 1));
+    cr_assert(eq(sz, xs.size, 4));
+    cr_expect_dbl(xs.elem[0].t, 4);
+    cr_expect_dbl(xs.elem[3].t, 6);
+    intersectionsDestroy(&xs);
+    worldDestroy(&world);
+}
+
+// Returns the color that the ray receives in the world, from the sorted intersections of the primary and shadow rays
+// rather than the closest and any hit traversals and the trace context of `traceColor`
+static Vec3 referenceColor(const World world, const Ray ray)
+{
+    Intersections xs = intersectWorld(world, ray);
+    const Intersection rayHit = hit(xs);
+    intersectionsDestroy(&xs);
+    Vec3 result = color(0, 0, 0);
+    if (rayHit.shape == NULL)
+    {
+        return result;
+    }
+    const Computations comps = prepareComputations(rayHit, ray);
+    for (size_t i = 0; i < world.lightCount; i++)
+    {
+        const Vec4 toLight = vec4Sub(world.lights[i].position, comps.overPoint);
+        Intersections blockers = intersectWorld(world, (Ray){comps.overPoint, vec4Norm(toLight)});
+        const Intersection blocker = hit(blockers);
+        intersectionsDestroy(&blockers);
+        const bool shadowed = blocker.shape != NULL && blocker.t < vec4Mag(toLight);
+        result = vec3Add(result, lighting(comps.shape->material, comps.shape, world.lights[i], comps.point, comps.camera, comps.normal, shadowed));
+    }
+    return result;
+}
+
+Test(world, allocation_free)
+{
+    World world = defaultWorld();
+    Camera camera = cameraInit(21, 21, M_PI_2, viewTransform(point(0, 0, -5), point(0, 0, 0), vector(0, 1, 0)));
+    const size_t created = traceAllocations();
+    TraceContext context;
+    traceContextCreate(&context);
+    for (size_t pass = 0; pass < 2; pass++)
+    {
+        if (pass == 1)
+        {
+            worldBuildBvh(&world);
+        }
+        for (size_t y = 0; y < camera.vsize; y++) // Warm up the context's storage
+        {
+            for (size_t x = 0; x < camera.hsize; x++)
+            {
+                traceColor(&context, world, rayPixel(camera, x, y));
+            }
+        }
+        if (pass == 0)
+        {
+            cr_expect(gt(sz, traceAllocations(), created)); // The occluder storage is counted
+        }
+        size_t allocations = 0;
+        for (size_t y = 0; y < camera.vsize; y++)
+        {
+            for (size_t x = 0; x < camera.hsize; x++)
+            {
+                const Vec3 expected = referenceColor(world, rayPixel(camera, x, y));
+                const size_t pixelAllocations = traceAllocations();
+                const Vec3 actual = traceColor(&context, world, rayPixel(camera, x, y));
+                allocations += traceAllocations() - pixelAllocations;
+                cr_expect_vec3_eq(actual, expected);
+            }
+        }
+        cr_expect(eq(sz, allocations, 0));
+    }
+    traceContextDestroy(&context);
+    worldDestroy(&world);
+}
+
+Test(world, occluder_cache)
+{
+    // Spheres over a plane lit by two lights, the shadows traced with one context checked against fresh ones
+    World world = defaultWorld();
+    Light *lights = realloc(world.lights, sizeof(Light[2]));
+    Shape *shapes = realloc(world.shapes, sizeof(Shape[3]));
+    cr_assert(not(eq(ptr, lights, NULL)));
+    cr_assert(not(eq(ptr, shapes, NULL)));
+    world.lights = lights;
+    world.shapes = shapes;
+    world.lights[1] = light(10, 10, -10, 0.5, 0.5, 0.5);
+    world.lightCount = 2;
+    world.shapes[2] = plane(translation(0, -1, 0), MATERIAL);
+    world.shapeCount = 3;
+    TraceContext context;
+    traceContextCreate(&context);
+    size_t rays = 0;
+    for (size_t pass = 0; pass < 4; pass++)
+    {
+        if (pass == 1)
+        {
+            worldBuildArrays(&world);
+        }
+        else if (pass == 2)
+        {
+            worldBuildBvh(&world);
+        }
+        else if (pass == 3)
+        {
+            worldDestroyBvh(&world);
+            worldBuildGrid(&world);
+        }
+        for (size_t z = 0; z < 40; z++)
+        {
+            for (size_t x = 0; x < 40; x++)
+            {
+                const Vec4 point = point((double)x * 0.2 - 2, -1 + MAT_EPSILON, (double)z * 0.2 - 2);
+                for (size_t light = 0; light < world.lightCount; light++)
+                {
+                    cr_expect(eq(int, traceShadowed(&context, world, light, point), isShadowed(world, light, point)));
+                    rays++;
+                }
+            }
+        }
+    }
+    cr_expect(eq(sz, context.shadows.rays, rays));
+    cr_expect(gt(sz, context.shadows.occluderHits, 0));
+    cr_expect(le(sz, context.shadows.occluderHits, context.shadows.occluderTests));
+    cr_expect(lt(sz, context.shadows.occluderTests, rays));
+
+    // Primitives remembered from another world are only tested if they exist
+    context.occluders[0] = 2;
+    World single = {.lightCount = 1, .shapeCount = 1, .lights = world.lights, .shapes = world.shapes};
+    cr_expect(traceShadowed(&context, single, 0, point(10, -10, 10)));
+    cr_expect(not(traceShadowed(&context, single, 0, point(-3, 0, 0))));
+
+    // Instances are remembered rather than the shapes of their groups
+    Group group = {.shapeCount = 1, .shapes = malloc(sizeof(Shape[1]))};
+    cr_assert(not(eq(ptr, group.shapes, NULL)));
+    group.shapes[0] = sphere(IDENTITY, MATERIAL);
+    groupBuild(&group);
+    Instance instances[] = {instance(translation(0, 2, 0), &group)};
+    World instanced = {.lightCount = 1, .shapeCount = 1, .lights = world.lights, .shapes = &world.shapes[2], .instanceCount = 1, .instances = instances};
+    const ShadowStats before = context.shadows;
+    cr_expect(traceShadowed(&context, instanced, 0, point(3.625, -0.9, 3.625)));
+    cr_expect(eq(sz, context.occluders[0], 1));
+    cr_expect(traceShadowed(&context, instanced, 0, point(3.7, -0.9, 3.6)));
+    cr_expect(eq(sz, context.shadows.occluderHits, before.occluderHits + 1));
+    groupDestroy(&group);
+    traceContextDestroy(&context);
+    worldDestroy(&world);
+}
+
+Test(world, intersect_closest_any)
+{
+    World world = defaultWorld();
+    Shape *shapes = realloc(world.shapes, sizeof(Shape[27]));
+    cr_assert(not(eq(ptr, shapes, NULL)));
+    world.shapes = shapes;
+    for (size_t i = 0; i < 24; i++)
+    {
+        world.shapes[i + 2] = sphere(mat4Mul(translation((double)(i % 6) - 2.5, (double)(i / 6) - 1.5, 2), scaling(0.3, 0.3, 0.3)), MATERIAL);
+    }
+    world.shapes[26] = plane(translation(0, -3, 0), MATERIAL);
+    world.shapeCount = 27;
+    for (size_t pass = 0; pass < 2; pass++)
+    {
+        if (pass == 1)
+        {
+            worldBuildBvh(&world);
+        }
+        for (int i = -5; i <= 5; i++)
+        {
+            for (int j = -5; j <= 5; j++)
+            {
+                const Ray ray = ray(0, 0.1, -5, i * 0.1, j * 0.1, 1);
+                Intersections xs = intersectWorld(world, ray);
+                const Intersection expected = hit(xs);
+                const Intersection actual = intersectClosest(world, ray);
+                cr_expect_dbl(actual.t, expected.t);
+                cr_expect(eq(int, actual.shape == NULL, expected.shape == NULL));
+                if (expected.shape != NULL)
+                {
+                    cr_expect(intersectAny(world, ray, expected.t + EPSILON));
+                    cr_expect(not(intersectAny(world, ray, expected.t - EPSILON)));
+                }
+                else
+                {
+                    cr_expect(not(intersectAny(world, ray, INFINITY)));
+                }
+                intersectionsDestroy(&xs);
+            }
+        }
+    }
+    const Intersection inside = intersectClosest(world, ray(0, 0, 0, 0, 0, 1));
+    cr_expect_dbl(inside.t, 0.5);
+    cr_expect(eq(ptr, (void *)inside.shape, &world.shapes[1]));
+    worldDestroy(&world);
+}
+
+Test(world, intersect_arrays)
+{
+    World world = defaultWorld();
+    Shape *shapes = realloc(world.shapes, sizeof(Shape[40]));
+    cr_assert(not(eq(ptr, shapes, NULL)));
+    world.shapes = shapes;
+    for (size_t i = 2; i < 40; i++)
+    {
+        const double angle = (double)i * 0.7;
+        if (i % 13 == 0)
+        {
+            world.shapes[i] = plane(mat4Mul(translation(0, (double)i / 13 - 4, 0), rotationZ(angle / 10)), MATERIAL);
+        }
+        else
+        {
+            world.shapes[i] = sphere(mat4Mul(translation(cos(angle) * 3, sin(angle) * 2, (double)(i % 5)), mat4Mul(rotationY(angle), scaling(0.3, 0.5, 0.2 + (double)(i % 3) * 0.2))), MATERIAL);
+        }
+    }
+    world.shapes[39] = world.shapes[20]; // coincident shapes, the first one in the world is the hit
+    world.shapeCount = 40;
+    worldBuildArrays(&world);
+    cr_assert(not(eq(ptr, world.arrays, NULL)));
+    cr_expect(eq(sz, world.arrays->count % 4, 0));
+    cr_expect(eq(sz, world.arrays->groupStart[PLANE] - world.arrays->groupStart[SPHERE], 40));
+    cr_expect(eq(sz, world.arrays->groupStart[SHAPE_TYPE_COUNT] - world.arrays->groupStart[PLANE], 4));
+    for (int i = -8; i <= 8; i++)
+    {
+        for (int j = -8; j <= 8; j++)
+        {
+            const Ray ray = ray(0, 0.1, -5, i * 0.1, j * 0.1, 1);
+            World bruteForce = world;
+            bruteForce.arrays = NULL;
+            const Intersection expected = intersectClosest(bruteForce, ray);
+            const Intersection actual = intersectClosest(world, ray);
+            cr_expect(shape_eq(actual.shape, expected.shape));
+            cr_expect(eq(dbl, actual.t, expected.t));
+            cr_expect(eq(int, intersectAny(world, ray, 3), intersectAny(bruteForce, ray, 3)));
+            cr_expect(eq(int, intersectAny(world, ray, INFINITY), expected.shape != NULL));
+        }
+    }
+    worldDestroyArrays(&world);
+    cr_expect(eq(ptr, world.arrays, NULL));
+    worldDestroy(&world);
+}
+
+Test(world, intersect_packet)
+{
+    World world = defaultWorld();
+    Shape *shapes = realloc(world.shapes, sizeof(Shape[30]));
+    cr_assert(not(eq(ptr, shapes, NULL)));
+    world.shapes = shapes;
+    for (size_t i = 2; i < 30; i++)
+    {
+        const double angle = (double)i * 0.9;
+        world.shapes[i] = i % 10 == 0 ? plane(mat4Mul(translation(0, -(double)i / 5, 0), rotationX(angle / 20)), MATERIAL)
+                                      : sphere(mat4Mul(translation(cos(angle) * 3, sin(angle) * 2, (double)(i % 4)), scaling(0.4, 0.3, 0.5)), MATERIAL);
+    }
+    world.shapeCount = 30;
+    Camera camera = cameraInit(24, 18, M_PI_2, viewTransform(point(0, 0.5, -5), point(0, 0, 0), vector(0, 1, 0)));
+    TraceContext context;
+    traceContextCreate(&context);
+    for (size_t pass = 0; pass < 4; pass++)
+    {
+        if (pass == 1)
+        {
+            worldBuildArrays(&world);
+        }
+        else if (pass == 2)
+        {
+            worldBuildBvh(&world);
+        }
+        else if (pass == 3)
+        {
+            worldDestroyBvh(&world);
+            worldBuildGrid(&world);
+        }
+        for (size_t y = 0; y < camera.vsize; y += 2)
+        {
+            for (size_t x = 0; x < camera.hsize; x += 2)
+            {
+                RayPacket packet = {.active = (unsigned)(x + y) % 16 | 1};
+                for (size_t lane = 0; lane < RAY_PACKET_SIZE; lane++)
+                {
+                    packet.rays[lane] = rayPixel(camera, x + lane % 2, y + lane / 2);
+                }
+                Intersection hits[RAY_PACKET_SIZE];
+                Vec3 colors[RAY_PACKET_SIZE];
+                intersectPacket(world, &packet, hits);
+                tracePacket(&context, world, &packet, colors);
+                for (size_t lane = 0; lane < RAY_PACKET_SIZE; lane++)
+                {
+                    if (packet.active & 1u << lane)
+                    {
+                        const Intersection expected = intersectClosest(world, packet.rays[lane]);
+                        cr_expect(shape_eq(hits[lane].shape, expected.shape));
+                        cr_expect(eq(dbl, hits[lane].t, expected.t));
+                        cr_expect_vec3_eq(colors[lane], traceColor(&context, world, packet.rays[lane]));
+                    }
+                    else
+                    {
+                        cr_expect(shape_eq(hits[lane].shape, NULL));
+                    }
+                }
+            }
+        }
+    }
+    traceContextDestroy(&context);
+    worldDestroy(&world);
+}
+
+Test(world, intersect_batch)
+{
+    World world = defaultWorld();
+    Shape *shapes = realloc(world.shapes, sizeof(Shape[20]));
+    cr_assert(not(eq(ptr, shapes, NULL)));
+    world.shapes = shapes;
+    for (size_t i = 2; i < 20; i++)
+    {
+        const double angle = (double)i * 1.3;
+        world.shapes[i] = i == 19 ? plane(translation(0, -4, 0), MATERIAL)
+                                  : sphere(mat4Mul(translation(cos(angle) * 4, sin(angle) * 3, (double)(i % 3) - 1), scaling(0.5, 0.7, 0.6)), MATERIAL);
+    }
+    world.shapeCount = 20;
+    worldBuildBvh(&world);
+    const size_t count = 3001;
+    Ray *rays = malloc(sizeof(Ray[count]));
+    HitRecord *hits = malloc(sizeof(HitRecord[count]));
+    cr_assert(not(eq(ptr, rays, NULL)));
+    cr_assert(not(eq(ptr, hits, NULL)));
+    for (size_t i = 0; i < count; i++)
+    {
+        const double angle = (double)i * 0.61803;
+        rays[i] = (Ray){point(cos(angle) * 8, sin(angle * 3) * 6, -8 + (double)(i % 7)),
+                        vec4Norm(vector(-cos(angle) + sin((double)i), -sin(angle * 3) * 0.5, 1))};
+    }
+    for (size_t threads = 0; threads < 3; threads++)
+    {
+        intersectBatch(world, rays, hits, count, threads);
+        for (size_t i = 0; i < count; i++)
+        {
+            const Intersection expected = intersectClosest(world, rays[i]);
+            if (expected.shape == NULL)
+            {
+                cr_expect(eq(sz, hits[i].shape, SIZE_MAX));
+                cr_expect(eq(dbl, hits[i].t, -1));
+            }
+            else
+            {
+                cr_expect(eq(sz, hits[i].shape, (size_t)(expected.shape - world.shapes)));
+                cr_expect(eq(dbl, hits[i].t, expected.t));
+                const Vec4 normalVector = normal(expected.shape, rayPos(rays[i], expected.t));
+                cr_expect_vector_eq(hits[i].normal, normalVector.x, normalVector.y, normalVector.z);
+            }
+        }
+    }
+    intersectBatch(world, rays, hits, 0, 0);
+    free(rays);
+    free(hits);
+    worldDestroy(&world);
+}
+
+Test(world, instances)
+{
+    // The same shapes, once placed by instances of a group and once copied into a flat world
+    Material striped = MATERIAL;
+    striped.hasPattern = true;
+    striped.pattern = stripePattern(color(1, 0, 0), color(0, 0, 1), scaling(0.2, 1, 1));
+    const Mat4 members[] = {IDENTITY, mat4Mul(translation(0, 1.5, 0), scaling(0.5, 0.5, 0.5)), mat4Mul(translation(1, 0, 0), scaling(0.3, 2, 0.3))};
+    const Mat4 placements[] = {translation(-3, 0, 0), mat4Mul(translation(3, 0, 1), mat4Mul(rotationY(0.5), scaling(2, 1, 1))),
+                               mat4Mul(translation(0, 1, 6), rotationZ(0.3))};
+    Group group = {.shapeCount = 3, .shapes = malloc(sizeof(Shape[3]))};
+    Instance instances[3];
+    Shape flat[10];
+    cr_assert(not(eq(ptr, group.shapes, NULL)));
+    for (size_t i = 0; i < 3; i++)
+    {
+        group.shapes[i] = sphere(members[i], i == 1 ? striped : MATERIAL);
+        instances[i] = instance(placements[i], &group);
+        for (size_t j = 0; j < 3; j++)
+        {
+            flat[i * 3 + j] = sphere(mat4Mul(placements[i], members[j]), j == 1 ? striped : MATERIAL);
+        }
+    }
+    groupBuild(&group);
+    flat[9] = plane(translation(0, -2, 0), MATERIAL);
+    Light light = light(-10, 10, -10, 1, 1, 1);
+    World instanced = {.lightCount = 1, .shapeCount = 1, .lights = &light, .shapes = &flat[9], .instanceCount = 3, .instances = instances};
+    World copied = {.lightCount = 1, .shapeCount = 10, .lights = &light, .shapes = flat};
+    Ray rays[64];
+    for (size_t i = 0; i < 64; i++)
+    {
+        const double angle = (double)i * 0.61803;
+        rays[i] = (Ray){point(cos(angle) * 2, sin(angle * 3) * 2 + 1, -10), vec4Norm(vector(sin((double)i) * 0.3, cos(angle) * 0.1, 1))};
+    }
+    for (size_t pass = 0; pass < 3; pass++)
+    {
+        if (pass == 1)
+        {
+            worldBuildArrays(&instanced);
+        }
+        else if (pass == 2)
+        {
+            worldBuildBvh(&instanced);
+        }
+        size_t instanceHits = 0;
+        for (size_t i = 0; i < 64; i++)
+        {
+            const Intersection expected = intersectClosest(copied, rays[i]);
+            const Intersection actual = intersectClosest(instanced, rays[i]);
+            cr_expect(eq(int, intersectAny(instanced, rays[i], INFINITY), expected.shape != NULL));
+            const Vec3 expectedColor = colorAt(copied, rays[i]);
+            const Vec3 actualColor = colorAt(instanced, rays[i]);
+            cr_expect_vec3_eq(actualColor, expectedColor);
+            if (expected.shape == &flat[9] || expected.shape == NULL)
+            {
+                cr_expect(shape_eq(actual.shape, expected.shape));
+                cr_expect(eq(ptr, (void *)actual.instance, NULL));
+                continue;
+            }
+            instanceHits++;
+            const size_t index = (size_t)(expected.shape - flat);
+            cr_expect(shape_eq(actual.shape, &group.shapes[index % 3]));
+            cr_expect(eq(ptr, (void *)actual.instance, &instances[index / 3]));
+            cr_expect_dbl(actual.t, expected.t);
+            const Vec4 expectedNormal = normalAtHit(expected, rayPos(rays[i], expected.t));
+            const Vec4 actualNormal = normalAtHit(actual, rayPos(rays[i], actual.t));
+            cr_expect_vector_eq(actualNormal, expectedNormal.x, expectedNormal.y, expectedNormal.z);
+            Intersections all = intersectWorld(instanced, rays[i]);
+            Intersections allExpected = intersectWorld(copied, rays[i]);
+            cr_expect(eq(sz, all.size, allExpected.size));
+            for (size_t j = 0; j < all.size && j < allExpected.size; j++)
+            {
+                cr_expect_dbl(all.elem[j].t, allExpected.elem[j].t);
+            }
+            intersectionsDestroy(&all);
+            intersectionsDestroy(&allExpected);
+        }
+        cr_expect(ge(sz, instanceHits, 16));
+        for (size_t i = 0; i < 64; i += RAY_PACKET_SIZE)
+        {
+            RayPacket packet = {.active = 0xB};
+            Intersection hits[RAY_PACKET_SIZE];
+            for (size_t lane = 0; lane < RAY_PACKET_SIZE; lane++)
+            {
+                packet.rays[lane] = rays[i + lane];
+            }
+            intersectPacket(instanced, &packet, hits);
+            for (size_t lane = 0; lane < RAY_PACKET_SIZE; lane++)
+            {
+                const Intersection expected = lane == 2 ? (Intersection){NULL, -1, 0, NULL} : intersectClosest(instanced, rays[i + lane]);
+                cr_expect(shape_eq(hits[lane].shape, expected.shape));
+                cr_expect(eq(ptr, (void *)hits[lane].instance, (void *)expected.instance));
+                cr_expect_dbl(hits[lane].t, expected.t);
+            }
+        }
+        HitRecord records[64];
+        intersectBatch(instanced, rays, records, 64, 2);
+        for (size_t i = 0; i < 64; i++)
+        {
+            const Intersection expected = intersectClosest(instanced, rays[i]);
+            cr_expect(eq(sz, records[i].instance, expected.instance != NULL ? (size_t)(expected.instance - instances) : SIZE_MAX));
+            if (expected.instance != NULL)
+            {
+                cr_expect(eq(sz, records[i].shape, (size_t)(expected.shape - group.shapes)));
+                cr_expect_dbl(records[i].t, expected.t);
+            }
+        }
+    }
+    cr_expect(eq(int, boundsFinite(group.bounds), 1));
+    worldDestroyBvh(&instanced);
+    worldDestroyArrays(&instanced);
+    groupDestroy(&group);
+    cr_expect(eq(ptr, group.bvh, NULL));
+}
+
 Test(sphere_operations, prepare_computations)
 {
     Ray ray1 = ray(0, 0, -5, 0, 0, 1);
     Shape sphere1 = sphere(IDENTITY, MATERIAL);
-    Intersection i1 = {sphere1, 4};
+    Intersection i1 = {&sphere1, 4};
     Computations comps = prepareComputations(i1, ray1);
     Intersection compsIntersection = {comps.shape, comps.t};
     cr_expect_intersection_eq(compsIntersection, i1);
@@ -237,14 +839,14 @@ Test(sphere_operations, prepare_computations)
     cr_expect_vector_eq(comps.normal, 0, 0, -1);
     cr_expect(not(comps.inside));
     Ray ray2 = ray(0, 0, 0, 0, 0, 1);
-    Intersection i2 = {sphere1, 1};
+    Intersection i2 = {&sphere1, 1};
     Computations comps2 = prepareComputations(i2, ray2);
     cr_expect_point_eq(comps2.point, 0, 0, 1);
     cr_expect_vector_eq(comps2.camera, 0, 0, -1);
     cr_expect_vector_eq(comps2.normal, 0, 0, -1);
     cr_expect(comps2.inside);
     Shape sphere2 = sphere(translation(0, 0, 1), MATERIAL);
-    Intersection i3 = {sphere2, 5};
+    Intersection i3 = {&sphere2, 5};
     Computations comps3 = prepareComputations(i3, ray1);
     cr_expect(lt(dbl, comps3.overPoint.z, -MAT_EPSILON / 2));
     cr_expect(gt(dbl, comps3.point.z, comps.overPoint.z));
@@ -254,14 +856,14 @@ Test(world, shade_hit)
 {
     World world1 = defaultWorld();
     Ray ray1 = ray(0, 0, -5, 0, 0, 1);
-    Intersection i1 = {world1.shapes[0], 4};
+    Intersection i1 = {&world1.shapes[0], 4};
     Computations comps1 = prepareComputations(i1, ray1);
     cr_expect_vec3_eq(shadeHit(world1, comps1), (color(0.38066, 0.47583, 0.2855)));
     worldDestroy(&world1);
     World world2 = defaultWorld();
     world2.lights[0] = light(0, 0.25, 0, 1, 1, 1);
     Ray ray2 = ray(0, 0, 0, 0, 0, 1);
-    Intersection i2 = {world2.shapes[1], 0.5};
+    Intersection i2 = {&world2.shapes[1], 0.5};
     Computations comps2 = prepareComputations(i2, ray2);
     cr_expect_vec3_eq(shadeHit(world2, comps2), (color(0.90498, 0.90498, 0.90498)));
     worldDestroy(&world2);
@@ -270,7 +872,7 @@ Test(world, shade_hit)
     World world3 = {1, 2, &(Light){point(0, 0, -10), color(1, 1, 1)},
                     (Shape[2]){sphere1, sphere2}};
     Ray ray3 = ray(0, 0, 5, 0, 0, 1);
-    Intersection i3 = {sphere2, 4};
+    Intersection i3 = {&sphere2, 4};
     Computations comps3 = prepareComputations(i3, ray3);
     cr_expect_vec3_eq(shadeHit(world3, comps3), (color(0.1, 0.1, 0.1)));
 }
@@ -325,6 +927,28 @@ Test(world, render)
     image = NULL;
 }
 
+Test(world, render_parallel)
+{
+    World world = defaultWorld();
+    Camera camera = cameraInit(37, 21, M_PI_2, viewTransform(point(0, 0, -5), point(0, 0, 0), vector(0, 1, 0)));
+    Canvas *image = render(camera, world);
+    Canvas *parallelImage = renderParallel(camera, world, 4);
+    for (size_t y = 0; y < camera.vsize; y++)
+    {
+        for (size_t x = 0; x < camera.hsize; x++)
+        {
+            const Vec3 pixel = canvasPixel(image, x, y);
+            const Vec3 parallelPixel = canvasPixel(parallelImage, x, y);
+            cr_expect(all(eq(dbl, parallelPixel.x, pixel.x), eq(dbl, parallelPixel.y, pixel.y), eq(dbl, parallelPixel.z, pixel.z)));
+        }
+    }
+    worldDestroy(&world);
+    free(image);
+    free(parallelImage);
+    image = NULL;
+    parallelImage = NULL;
+}
+
 Test(world, is_shadowed)
 {
     World world = defaultWorld();
@@ -338,30 +962,32 @@ Test(world, is_shadowed)
 Test(plane_operations, normal)
 {
     Shape plane = plane(IDENTITY, MATERIAL);
-    cr_expect_vector_eq(normal(plane, point(0, 0, 0)), 0, 1, 0);
-    cr_expect_vector_eq(normal(plane, point(10, 0, -10)), 0, 1, 0);
-    cr_expect_vector_eq(normal(plane, point(-5, 0, 150)), 0, 1, 0);
+    cr_expect_vector_eq(normal(&plane, point(0, 0, 0)), 0, 1, 0);
+    cr_expect_vector_eq(normal(&plane, point(10, 0, -10)), 0, 1, 0);
+    cr_expect_vector_eq(normal(&plane, point(-5, 0, 150)), 0, 1, 0);
+    Shape plane2 = plane(mat4Mul(translation(0, 2, 0), rotationZ(M_PI_2)), MATERIAL);
+    cr_expect_vector_eq(normal(&plane2, point(0, 5, 3)), -1, 0, 0);
 }
 
 Test(plane_operations, intersect)
 {
     Shape plane = plane(IDENTITY, MATERIAL);
     Ray ray1 = ray(0, 10, 0, 0, 0, 1);
-    Intersections xs1 = intersect(plane, ray1);
+    Intersections xs1 = intersect(&plane, ray1);
     cr_assert(eq(sz, xs1.size, 0));
     intersectionsDestroy(&xs1);
     Ray ray2 = ray(0, 0, 0, 0, 0, 1);
-    Intersections xs2 = intersect(plane, ray2);
+    Intersections xs2 = intersect(&plane, ray2);
     cr_assert(eq(sz, xs2.size, 0));
     intersectionsDestroy(&xs2);
     Ray ray3 = ray(0, 1, 0, 0, -1, 0);
-    Intersection i1 = {plane, 1};
-    Intersections xs3 = intersect(plane, ray3);
+    Intersection i1 = {&plane, 1};
+    Intersections xs3 = intersect(&plane, ray3);
     cr_assert(eq(sz, xs3.size, 1));
     cr_expect_intersection_eq(xs3.elem[0], i1);
     intersectionsDestroy(&xs3);
     Ray ray4 = ray(0, -1, 0, 0, 1, 0);
-    Intersections xs4 = intersect(plane, ray4);
+    Intersections xs4 = intersect(&plane, ray4);
     cr_expect_intersection_eq(xs4.elem[0], i1);
     intersectionsDestroy(&xs4);
 }
@@ -396,8 +1022,8 @@ Test(materials, pattern)
     Vec4 eyev = vector(0, 0, -1);
     Vec4 normalv = vector(0, 0, -1);
     Light light = light(0, 0, -10, 1, 1, 1);
-    Vec3 c1 = lighting(m, sphere(IDENTITY, m), light, point(0.9, 0, 0), eyev, normalv, false);
-    Vec3 c2 = lighting(m, sphere(IDENTITY,m), light, point(1.1, 0, 0), eyev, normalv, false);
+    Vec3 c1 = lighting(m, &sphere(IDENTITY, m), light, point(0.9, 0, 0), eyev, normalv, false);
+    Vec3 c2 = lighting(m, &sphere(IDENTITY, m), light, point(1.1, 0, 0), eyev, normalv, false);
     cr_expect_vec3_eq(c1, (color(1, 1, 1)));
     cr_expect_vec3_eq(c2, (color(0, 0, 0)));
 }
@@ -409,16 +1035,16 @@ Test(patterns, transformations)
     Shape sphere1 = sphere(scaling(2, 2, 2), MATERIAL);
     sphere1.material.hasPattern = true;
     sphere1.material.pattern = stripePattern(white, black, IDENTITY);
-    const Vec3 c1 = stripeAtObject(sphere1, point(1.5, 0, 0));
+    const Vec3 c1 = stripeAtObject(&sphere1, point(1.5, 0, 0));
     cr_expect_vec3_eq(c1, white);
     Shape sphere2 = sphere(IDENTITY, MATERIAL);
     sphere2.material.hasPattern = true;
     sphere2.material.pattern = stripePattern(white, black, scaling(2, 2, 2));
-    const Vec3 c2 = stripeAtObject(sphere2, point(1.5, 0, 0));
+    const Vec3 c2 = stripeAtObject(&sphere2, point(1.5, 0, 0));
     cr_expect_vec3_eq(c2, white);
     Shape sphere3 = sphere(scaling(2, 2, 2), MATERIAL);
     sphere3.material.hasPattern = true;
     sphere3.material.pattern = stripePattern(white, black, translation(0.5, 0, 0));
-    const Vec3 c3 = stripeAtObject(sphere3, point(2.5, 0, 0));
+    const Vec3 c3 = stripeAtObject(&sphere3, point(2.5, 0, 0));
     cr_expect_vec3_eq(c3, white);
 }
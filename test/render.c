@@ -0,0 +1,114 @@
+/*
+ * render.c - Renders a scene description file or binary scene cache and outputs it in PPM format on stdout
+ *
+ * Copyright (c) 2023, Dimitrios Alexopoulos All rights reserved.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "src/canvas.h"
+#include "src/rays.h"
+#include "src/scene.h"
+
+// Worlds with more shapes and instances than this are rendered with a BVH (or a grid with `--grid`) instead of testing
+// every shape
+#define RENDER_BVH_THRESHOLD 64
+
+int main(int argc, char *argv[])
+{
+    const char *program = argv[0];
+    const bool grid = argc > 1 && strcmp(argv[1], "--grid") == 0;
+    if (grid)
+    {
+        argc--;
+        argv++;
+    }
+    if (argc != 2 && argc != 3)
+    {
+        fprintf(stderr, "Usage: %s [--grid] <scene file or cache> [<cache to write>]\n", program);
+        return EXIT_FAILURE;
+    }
+    FILE *file = fopen(argv[1], "rb");
+    if (file == NULL)
+    {
+        perror(argv[1]);
+        return EXIT_FAILURE;
+    }
+    SceneCache cache;
+    Scene parsed;
+    SceneError error;
+    // Only files which are not caches are parsed as text, so unusable caches report why
+    const bool cached = sceneIsCache(file);
+    const bool loaded = cached ? sceneCacheMap(&cache, file, &error) : sceneLoad(&parsed, file, &error);
+    fclose(file);
+    if (!loaded && error.line == 0)
+    {
+        fprintf(stderr, "%s: %s\n", argv[1], error.message);
+        return EXIT_FAILURE;
+    }
+    if (!loaded)
+    {
+        fprintf(stderr, "%s:%zu: %s\n", argv[1], error.line, error.message);
+        return EXIT_FAILURE;
+    }
+    Scene *scene = cached ? &cache.scene : &parsed;
+    if (!scene->hasCamera)
+    {
+        fprintf(stderr, "%s: no camera\n", argv[1]);
+        if (cached)
+        {
+            sceneCacheClose(&cache);
+        }
+        else
+        {
+            sceneDestroy(scene);
+        }
+        return EXIT_FAILURE;
+    }
+    if (!cached && scene->world.shapeCount + scene->world.instanceCount > RENDER_BVH_THRESHOLD)
+    {
+        if (grid)
+        {
+            worldBuildGrid(&scene->world);
+        }
+        else
+        {
+            worldBuildBvh(&scene->world);
+        }
+    }
+    if (argc == 3)
+    {
+        FILE *output = fopen(argv[2], "wb");
+        if (output == NULL)
+        {
+            perror(argv[2]);
+        }
+        else if (!sceneCacheWrite(scene, output))
+        {
+            fprintf(stderr, "%s: could not write the cache\n", argv[2]);
+        }
+        if (output != NULL)
+        {
+            fclose(output);
+        }
+    }
+    if (scene->world.bvh == NULL && scene->world.grid == NULL)
+    {
+        worldBuildArrays(&scene->world);
+    }
+    Canvas *image = renderParallel(scene->camera, scene->world, 0);
+    if (cached)
+    {
+        sceneCacheClose(&cache);
+    }
+    else
+    {
+        sceneDestroy(scene);
+    }
+    canvasWritePPM(image, stdout, PPM_P6);
+    free(image);
+    image = NULL;
+    return 0;
+}
@@ -0,0 +1,89 @@
+/*
+ * scene_bench.c - Benchmark of scene description parsing and binary scene caches
+ *
+ * Copyright (c) 2023, Dimitrios Alexopoulos All rights reserved.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include "src/rays.h"
+#include "src/scene.h"
+
+#define BENCH_SHAPES 1000000
+#define BENCH_LINE_LENGTH 128
+#define BENCH_RAYS 1000
+
+// Returns the current time in seconds
+static double benchTime(void)
+{
+    struct timespec now;
+    timespec_get(&now, TIME_UTC);
+    return (double)now.tv_sec + (double)now.tv_nsec / 1e9;
+}
+
+int main(void)
+{
+    char *text = malloc((size_t)BENCH_SHAPES * BENCH_LINE_LENGTH);
+    if (text == NULL)
+    {
+        return 1;
+    }
+    size_t length = (size_t)sprintf(text, "camera 1920 1080 1.0471975511965976 0 50 -200 0 0 0 0 1 0\n"
+                                          "light -100 100 -100 1 1 1\n"
+                                          "material red 1 0.2 0.2 0.1 0.9 0.3 200\n"
+                                          "material green 0.2 1 0.2 0.1 0.9 0.3 200 stripe 1 1 1 0 0 0 scale 0.1 0.1 0.1\n"
+                                          "plane green translate 0 -1 0\n");
+    for (size_t i = 0; i < BENCH_SHAPES; i++)
+    {
+        length += (size_t)sprintf(text + length, "sphere %s translate %.3f %.3f %.3f rotate-y %.4f scale %.2f %.2f %.2f\n",
+                                  i % 3 == 0 ? "green" : "red", (double)(i % 1000) * 0.25 - 125, (double)(i / 1000 % 100) * 0.5,
+                                  (double)(i / 100000) * 3.125, (double)(i % 628) / 100, 0.1 + (double)(i % 7) / 100,
+                                  0.1 + (double)(i % 5) / 100, 0.1 + (double)(i % 3) / 100);
+    }
+    const double start = benchTime();
+    Scene scene;
+    SceneError error;
+    if (!sceneParse(&scene, text, length, &error))
+    {
+        printf("Line %zu: %s\n", error.line, error.message);
+        return 1;
+    }
+    const double elapsed = benchTime() - start;
+    printf("Parsed %zu shapes (%.1f MiB) in %.3f s, %.1f ns/shape\n", scene.world.shapeCount, (double)length / (1 << 20),
+           elapsed, elapsed * 1e9 / (double)scene.world.shapeCount);
+    free(text);
+    BvhStats stats;
+    worldBuildBvhWith(&scene.world, BVH_BUILD_DEFAULT, &stats);
+    printf("Built the BVH in %.3f s, SAH cost %.1f, depth %zu, %zu leaves of %.2f shapes on average\n", stats.buildTime,
+           (double)stats.sahCost, stats.depth, stats.leafCount, (double)stats.averageLeafSize);
+
+    FILE *file = tmpfile();
+    if (file == NULL || !sceneCacheWrite(&scene, file))
+    {
+        return 1;
+    }
+    const double mapStart = benchTime();
+    SceneCache cache;
+    if (!sceneCacheMap(&cache, file, &error))
+    {
+        printf("%s\n", error.message);
+        return 1;
+    }
+    const double mapped = benchTime() - mapStart;
+    // Tracing a few rays only faults in the pages of the shapes and nodes they reach
+    size_t hits = 0;
+    for (size_t i = 0; i < BENCH_RAYS; i++)
+    {
+        const Ray ray = ray(0, 50, -200, (double)i / BENCH_RAYS - 0.5, -0.1, 1);
+        hits += intersectClosest(cache.scene.world, ray).shape != NULL;
+    }
+    const double traced = benchTime() - mapStart;
+    printf("Mapped the cache (%.1f MiB) in %.6f s, traced %d rays (%zu hits) after %.6f s\n",
+           (double)cache.size / (1 << 20), mapped, BENCH_RAYS, hits, traced);
+    sceneCacheClose(&cache);
+    fclose(file);
+    sceneDestroy(&scene);
+    return 0;
+}
@@ -0,0 +1,455 @@
+/*
+ * scene_test.c - Tests on scene description parsing
+ *
+ * Copyright (c) 2023, Dimitrios Alexopoulos All rights reserved.
+ */
+
+// TODO: Find a better solution than _XOPEN_SOURCE
+#ifdef _WIN32
+#define _USE_MATH_DEFINES
+#endif
+#ifdef __unix__
+#define _XOPEN_SOURCE
+#endif
+
+#include <criterion/criterion.h>
+#include <criterion/new/assert.h>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "src/rays.h"
+#include "src/scene.h"
+#include "src/vectors.h"
+
+#define EPSILON MAT_EPSILON
+
+#define cr_expect_affine_eq(actual, expected)                                                       \
+    for (size_t row = 0; row < 3; row++)                                                            \
+    {                                                                                               \
+        for (size_t col = 0; col < 4; col++)                                                        \
+        {                                                                                           \
+            cr_expect(epsilon_eq(dbl, actual.elem[row][col], expected.elem[row][col], EPSILON)); \
+        }                                                                                           \
+    }
+
+// Parses a scene which is expected to be invalid, returning the error
+SceneError parseInvalid(const char *text)
+{
+    Scene scene;
+    SceneError error = {0, NULL};
+    cr_expect(not(sceneParse(&scene, text, strlen(text), &error)));
+    cr_expect(eq(sz, scene.world.shapeCount, 0));
+    cr_expect(eq(ptr, scene.world.shapes, NULL));
+    cr_expect(not(eq(ptr, (void *)error.message, NULL)));
+    return error;
+}
+
+Test(scene_parsing, parse)
+{
+    const char *text = "# Two spheres on a plane\n"
+                       "camera 100 50 1.0471975511965976 0 1.5 -5  0 1 0  0 1 0\n"
+                       "light -10 10 -10 1 1 1\n"
+                       "\n"
+                       "material floor 1 0.9 0.9 0.1 0.9 0 200 stripe 1 1 1 0 0 0 scale 0.5 0.5 0.5\n"
+                       "material red 1 0 0 0.1 0.7 0.3 200 # no pattern\n"
+                       "plane floor\n"
+                       "sphere red translate -0.5 1 0.5 scale 0.5 2 0.5\r\n"
+                       "\tsphere red rotate-y 0.5 shear 1 0 0 0 0 0 rotate-x -1e-1 rotate-z 3.5e0";
+    Scene scene;
+    SceneError error = {0, NULL};
+    cr_assert(sceneParse(&scene, text, strlen(text), &error));
+    cr_expect(eq(ptr, (void *)error.message, NULL));
+    cr_assert(scene.hasCamera);
+    cr_expect(eq(sz, scene.camera.hsize, 100));
+    cr_expect(eq(sz, scene.camera.vsize, 50));
+    const Camera camera = cameraInit(100, 50, M_PI / 3, viewTransform(point(0, 1.5, -5), point(0, 1, 0), vector(0, 1, 0)));
+    cr_expect_affine_eq(scene.camera.transformInv, camera.transformInv);
+    cr_assert(eq(sz, scene.world.lightCount, 1));
+    cr_expect(epsilon_eq(dbl, scene.world.lights[0].position.x, -10, EPSILON));
+    cr_assert(eq(sz, scene.world.shapeCount, 3));
+    const Shape *plane = &scene.world.shapes[0];
+    cr_expect(eq(int, plane->type, PLANE));
+    cr_expect(plane->material.hasPattern);
+    cr_expect(epsilon_eq(dbl, plane->material.color.y, 0.9, EPSILON));
+    cr_expect(epsilon_eq(dbl, plane->material.pattern.transformInv.elem[0][0], 2, EPSILON));
+    const Shape *sphere = &scene.world.shapes[1];
+    const Shape expected = sphere(mat4Mul(translation(-0.5, 1, 0.5), scaling(0.5, 2, 0.5)), MATERIAL);
+    cr_expect(eq(int, sphere->type, SPHERE));
+    cr_expect(not(sphere->material.hasPattern));
+    cr_expect(epsilon_eq(dbl, sphere->material.diffuse, 0.7, EPSILON));
+    cr_expect_affine_eq(sphere->transform, expected.transform);
+    cr_expect_affine_eq(sphere->transformInv, expected.transformInv);
+    const Shape rotated = sphere(mat4Mul(mat4Mul(rotationY(0.5), shearing(1, 0, 0, 0, 0, 0)), mat4Mul(rotationX(-0.1), rotationZ(3.5))), MATERIAL);
+    cr_expect_affine_eq(scene.world.shapes[2].transform, rotated.transform);
+    cr_expect(eq(ptr, scene.world.bvh, NULL));
+    sceneDestroy(&scene);
+    cr_expect(eq(sz, scene.world.shapeCount, 0));
+}
+
+Test(scene_parsing, numbers)
+{
+    const char *numbers[] = {"0", "-0.5", "+2.", ".25", "1e3", "1.5E-3", "0.1", "123456789.123456789", "1e-30",
+                             "0.30000000000000004", "9007199254740993", "-7.25e+2"};
+    for (size_t i = 0; i < sizeof(numbers) / sizeof(numbers[0]); i++)
+    {
+        char text[128];
+        snprintf(text, sizeof(text), "light %s 0 0 1 1 1", numbers[i]);
+        Scene scene;
+        cr_assert(sceneParse(&scene, text, strlen(text), NULL));
+        cr_expect(eq(dbl, scene.world.lights[0].position.x, (Scalar)strtod(numbers[i], NULL)));
+        sceneDestroy(&scene);
+    }
+}
+
+Test(scene_parsing, errors)
+{
+    cr_expect(eq(sz, parseInvalid("sphere missing").line, 1));
+    cr_expect(eq(sz, parseInvalid("material a 1 1 1 0.1 0.9 0.9 200\n\nsphere a scale 1 0 1").line, 3));
+    cr_expect(eq(str, (char *)parseInvalid("material a 1 1 1 0.1 0.9 0.9 200\nsphere a scale 1 0 1").message, "singular transformation"));
+    cr_expect(eq(str, (char *)parseInvalid("cube").message, "unknown statement"));
+    cr_expect(eq(str, (char *)parseInvalid("light 1 2 3 1 1").message, "expected a number"));
+    cr_expect(eq(str, (char *)parseInvalid("light 1 2 3 1 1 1 1").message, "unexpected value"));
+    cr_expect(eq(str, (char *)parseInvalid("light 1 2 3 1 1 1x").message, "invalid number"));
+    cr_expect(eq(str, (char *)parseInvalid("light 1 2 3 1 1 e5").message, "invalid number"));
+    cr_expect(eq(str, (char *)parseInvalid("material a 1 1 1 0.1 0.9 0.9 200\nmaterial a 1 1 1 0.1 0.9 0.9 200").message, "duplicate material"));
+    cr_expect(eq(str, (char *)parseInvalid("material a 1 1 1 0.1 0.9 0.9 200 dots").message, "unknown pattern"));
+    cr_expect(eq(str, (char *)parseInvalid("material a 1 1 1 0.1 0.9 0.9 200\nplane a twist 1").message, "unknown transformation"));
+    cr_expect(eq(str, (char *)parseInvalid("camera 10.5 10 1 0 0 0 0 0 1 0 1 0").message, "invalid image size"));
+    cr_expect(eq(str, (char *)parseInvalid("camera 10 10 1 0 0 -5 0 0 0 0 1 0\ncamera 10 10 1 0 0 -5 0 0 0 0 1 0").message, "duplicate camera"));
+}
+
+Test(scene_parsing, load)
+{
+    FILE *file = tmpfile();
+    cr_assert(not(eq(ptr, file, NULL)));
+    fputs("light 0 10 0 1 1 1\nmaterial m 1 1 1 0.1 0.9 0.9 200\n", file);
+    for (size_t i = 0; i < 5000; i++)
+    {
+        fprintf(file, "sphere m translate %zu 0 0\n", i);
+    }
+    rewind(file);
+    Scene scene;
+    cr_assert(sceneLoad(&scene, file, NULL));
+    fclose(file);
+    cr_expect(not(scene.hasCamera));
+    cr_assert(eq(sz, scene.world.shapeCount, 5000));
+    cr_expect(epsilon_eq(dbl, scene.world.shapes[4999].transformInv.elem[0][3], -4999, EPSILON));
+    sceneDestroy(&scene);
+}
+
+Test(scene_parsing, cache)
+{
+    FILE *file = tmpfile();
+    cr_assert(not(eq(ptr, file, NULL)));
+    fputs("camera 40 30 1 0 1 -5 0 0 0 0 1 0\nlight 0 10 -10 1 1 1\nmaterial m 1 0.5 0.5 0.1 0.9 0.9 200 stripe 1 1 1 0 0 0\nplane m\n", file);
+    for (size_t i = 0; i < 100; i++)
+    {
+        fprintf(file, "sphere m translate %zu %zu 0 scale 0.4 0.4 0.4\n", i % 10, i / 10);
+    }
+    rewind(file);
+    Scene scene;
+    cr_assert(sceneLoad(&scene, file, NULL));
+    fclose(file);
+    worldBuildBvh(&scene.world);
+    file = tmpfile();
+    cr_assert(not(eq(ptr, file, NULL)));
+    cr_assert(sceneCacheWrite(&scene, file));
+    SceneCache cache;
+    cr_assert(sceneCacheMap(&cache, file, NULL));
+    fclose(file);
+    cr_expect(cache.scene.hasCamera);
+    cr_expect(eq(sz, cache.scene.camera.hsize, 40));
+    cr_expect_affine_eq(cache.scene.camera.transformInv, scene.camera.transformInv);
+    cr_assert(eq(sz, cache.scene.world.lightCount, 1));
+    cr_assert(eq(sz, cache.scene.world.shapeCount, 101));
+    cr_expect(eq(int, memcmp(cache.scene.world.shapes, scene.world.shapes, sizeof(Shape[101])), 0));
+    cr_assert(not(eq(ptr, cache.scene.world.bvh, NULL)));
+    cr_expect(eq(sz, cache.scene.world.bvh->nodeCount, scene.world.bvh->nodeCount));
+    cr_expect(eq(sz, cache.scene.world.bvh->unboundedCount, 1));
+    cr_expect(eq(int, (int)cache.scene.world.bvh->layout, (int)scene.world.bvh->layout));
+    cr_expect(eq(sz, cache.scene.world.bvh->wideNodeCount, scene.world.bvh->wideNodeCount));
+    for (size_t i = 0; i < 10; i++)
+    {
+        const Ray ray = ray(0, 1, -5, (double)i * 0.2, -0.1, 1);
+        const Intersection expected = intersectClosest(scene.world, ray);
+        const Intersection actual = intersectClosest(cache.scene.world, ray);
+        cr_assert(not(eq(ptr, (void *)expected.shape, NULL)));
+        cr_assert(not(eq(ptr, (void *)actual.shape, NULL)));
+        cr_expect(eq(dbl, actual.t, expected.t));
+        cr_expect(eq(sz, (size_t)(actual.shape - cache.scene.world.shapes), (size_t)(expected.shape - scene.world.shapes)));
+    }
+    sceneCacheClose(&cache);
+    cr_expect(eq(ptr, cache.mapping, NULL));
+    sceneDestroy(&scene);
+}
+
+Test(scene_parsing, cache_invalid)
+{
+    FILE *file = tmpfile();
+    cr_assert(not(eq(ptr, file, NULL)));
+    fputs("light 0 10 -10 1 1 1\n", file);
+    fflush(file);
+    SceneCache cache;
+    SceneError error = {0, NULL};
+    cr_expect(not(sceneIsCache(file)));
+    cr_expect(not(sceneCacheMap(&cache, file, &error)));
+    cr_expect(eq(str, (char *)error.message, "not a scene cache"));
+    cr_expect(eq(ptr, cache.mapping, NULL));
+    fclose(file);
+    Scene scene;
+    cr_assert(sceneParse(&scene, "light 0 10 -10 1 1 1", 20, NULL));
+    file = tmpfile();
+    cr_assert(not(eq(ptr, file, NULL)));
+    cr_assert(sceneCacheWrite(&scene, file));
+    sceneDestroy(&scene);
+    fseek(file, -1, SEEK_END);
+    long length = ftell(file);
+    rewind(file);
+    char *contents = malloc((size_t)length);
+    cr_assert(eq(sz, fread(contents, 1, (size_t)length, file), (size_t)length));
+    fclose(file);
+    file = tmpfile();
+    cr_assert(not(eq(ptr, file, NULL)));
+    fwrite(contents, 1, (size_t)length, file);
+    fflush(file);
+    free(contents);
+    cr_expect(sceneIsCache(file));
+    cr_expect(not(sceneCacheMap(&cache, file, &error)));
+    cr_expect(eq(str, (char *)error.message, "truncated scene cache"));
+    fclose(file);
+}
+
+// Returns the cache of the scene with the bytes of `value` written over those at `offset` in the first copy of `section`
+FILE *corruptCache(const Scene *scene, const void *section, const size_t sectionSize, const size_t offset, const void *value,
+                   const size_t valueSize)
+{
+    FILE *file = tmpfile();
+    cr_assert(not(eq(ptr, file, NULL)));
+    cr_assert(sceneCacheWrite(scene, file));
+    fseek(file, 0, SEEK_END);
+    const size_t length = (size_t)ftell(file);
+    rewind(file);
+    unsigned char *contents = malloc(length);
+    cr_assert(not(eq(ptr, contents, NULL)));
+    cr_assert(eq(sz, fread(contents, 1, length, file), length));
+    fclose(file);
+    size_t start = 0;
+    while (start + sectionSize <= length && memcmp(contents + start, section, sectionSize) != 0)
+    {
+        start++;
+    }
+    cr_assert(le(sz, start + sectionSize, length));
+    memcpy(contents + start + offset, value, valueSize);
+    file = tmpfile();
+    cr_assert(not(eq(ptr, file, NULL)));
+    fwrite(contents, 1, length, file);
+    fflush(file);
+    free(contents);
+    return file;
+}
+
+Test(scene_parsing, cache_corrupt)
+{
+    FILE *file = tmpfile();
+    cr_assert(not(eq(ptr, file, NULL)));
+    fputs("light 0 10 -10 1 1 1\nmaterial m 1 0.5 0.5 0.1 0.9 0.9 200\nplane m\n", file);
+    for (size_t i = 0; i < 20; i++)
+    {
+        fprintf(file, "sphere m translate %zu 0 0 scale 0.4 0.4 0.4\n", i);
+    }
+    rewind(file);
+    Scene scene;
+    cr_assert(sceneLoad(&scene, file, NULL));
+    fclose(file);
+    worldBuildBvh(&scene.world);
+    const Bvh *bvh = scene.world.bvh;
+    cr_assert(gt(sz, bvh->nodeCount, 1));
+    SceneCache cache;
+    SceneError error = {0, NULL};
+    // Shapes of unknown types, hierarchies pointing outside of themselves and primitives which are not shapes
+    const ShapeType type = (ShapeType)42;
+    const size_t outside = SIZE_MAX / 2;
+    FILE *files[] = {
+        corruptCache(&scene, &scene.world.shapes[1], sizeof(Shape), offsetof(Shape, type), &type, sizeof(type)),
+        corruptCache(&scene, &bvh->nodes[0], sizeof(BvhNode), offsetof(BvhNode, start), &outside, sizeof(outside)),
+        corruptCache(&scene, &bvh->nodes[bvh->nodeCount - 1], sizeof(BvhNode), offsetof(BvhNode, count), &outside, sizeof(outside)),
+        corruptCache(&scene, bvh->primitives, sizeof(size_t[bvh->primitiveCount]), 0, &scene.world.shapeCount, sizeof(size_t)),
+    };
+    for (size_t i = 0; i < sizeof(files) / sizeof(files[0]); i++)
+    {
+        cr_expect(not(sceneCacheMap(&cache, files[i], &error)));
+        cr_expect(eq(str, (char *)error.message, "corrupt scene cache"));
+        cr_expect(eq(ptr, cache.mapping, NULL));
+        fclose(files[i]);
+    }
+    sceneDestroy(&scene);
+}
+
+// Loads a Wavefront OBJ file from the text, which is expected to be valid
+void loadObj(Mesh *mesh, const char *text)
+{
+    FILE *file = tmpfile();
+    cr_assert(not(eq(ptr, file, NULL)));
+    fputs(text, file);
+    rewind(file);
+    SceneError error = {0, NULL};
+    cr_assert(sceneLoadObj(mesh, file, &error));
+    cr_expect(eq(ptr, (void *)error.message, NULL));
+    fclose(file);
+}
+
+// Loads a Wavefront OBJ file from the text, which is expected to be invalid, returning the error
+SceneError loadInvalidObj(const char *text)
+{
+    FILE *file = tmpfile();
+    cr_assert(not(eq(ptr, file, NULL)));
+    fputs(text, file);
+    rewind(file);
+    Mesh mesh;
+    SceneError error = {0, NULL};
+    cr_expect(not(sceneLoadObj(&mesh, file, &error)));
+    cr_expect(eq(sz, mesh.triangleCount, 0));
+    fclose(file);
+    return error;
+}
+
+Test(scene_parsing, obj)
+{
+    Mesh mesh;
+    loadObj(&mesh, "# A square\n"
+                   "mtllib square.mtl\n"
+                   "o square\n"
+                   "v 0 0 0\n"
+                   "v 1 0 0\n"
+                   "v 1 1 0\n"
+                   "v 0 1 0 1.0\n"
+                   "vt 0 0\n"
+                   "vn 0 0 -1\n"
+                   "g face\n"
+                   "usemtl white\n"
+                   "s 1\n"
+                   "f 1 2 3\n"
+                   "f 1//1 3//1 4//1\r\n"
+                   "f -4/1/1 -3/1/1 -2/1/1 -1/1/1");
+    cr_expect(eq(sz, mesh.vertexCount, 4));
+    cr_assert(eq(sz, mesh.triangleCount, 4));
+    cr_expect(eq(sz, mesh.normalCount, 5)); // one from the file and one computed for every vertex
+    const MeshTriangle fan = mesh.triangles[3];
+    cr_expect(all(eq(sz, fan.vertices[0], 0), eq(sz, fan.vertices[1], 2), eq(sz, fan.vertices[2], 3)));
+    cr_expect(all(eq(sz, fan.normals[0], 0), eq(sz, fan.normals[1], 0), eq(sz, fan.normals[2], 0)));
+    cr_expect(eq(sz, mesh.triangles[0].normals[0], 1));
+    cr_expect(epsilon_eq(dbl, mesh.vertices[2].y, 1, EPSILON));
+    cr_expect(eq(sz, mesh.bvh.primitiveCount, 4));
+    meshDestroy(&mesh);
+}
+
+Test(scene_parsing, obj_blocks)
+{
+    FILE *file = tmpfile();
+    cr_assert(not(eq(ptr, file, NULL)));
+    for (size_t i = 0; i < 10000; i++)
+    {
+        fprintf(file, "v %zu.125 %zu.5 -%zu.25\n", i, i % 7, i % 3);
+    }
+    for (size_t i = 2; i < 10000; i++)
+    {
+        fprintf(file, "f %zu %zu %zu\n", i - 1, i, i + 1);
+    }
+    rewind(file);
+    Mesh mesh;
+    cr_assert(sceneLoadObj(&mesh, file, NULL));
+    fclose(file);
+    cr_assert(eq(sz, mesh.vertexCount, 10000));
+    cr_expect(epsilon_eq(dbl, mesh.vertices[9999].x, 9999.125, EPSILON));
+    cr_expect(epsilon_eq(dbl, mesh.vertices[4321].z, -1.25, EPSILON));
+    cr_assert(eq(sz, mesh.triangleCount, 9998));
+    cr_expect(eq(sz, mesh.triangles[9997].vertices[2], 9999));
+    meshDestroy(&mesh);
+}
+
+Test(scene_parsing, obj_errors)
+{
+    cr_expect(eq(str, (char *)loadInvalidObj("v 0 0 0\nv 1 0 0\nv 1 1 0\nf 1 2 4").message, "invalid index"));
+    cr_expect(eq(sz, loadInvalidObj("v 0 0 0\nv 1 0 0\nv 1 1 0\nf 1 2 4").line, 4));
+    cr_expect(eq(str, (char *)loadInvalidObj("v 0 0 0\nv 1 0 0\nv 1 1 0\nf 0 1 2").message, "invalid index"));
+    cr_expect(eq(str, (char *)loadInvalidObj("v 0 0 0\nv 1 0 0\nv 1 1 0\nf 1 2 -4").message, "invalid index"));
+    cr_expect(eq(str, (char *)loadInvalidObj("v 0 0 0\nv 1 0 0\nv 1 1 0\nf 1//1 2//1 3//1").message, "invalid index"));
+    cr_expect(eq(str, (char *)loadInvalidObj("v 0 0 0\nv 1 0 0\nv 1 1 0\nf 1 2x 3").message, "invalid index"));
+    cr_expect(eq(str, (char *)loadInvalidObj("v 0 0 0\nv 1 0 0\nf 1 2").message, "a face needs at least three vertices"));
+    cr_expect(eq(str, (char *)loadInvalidObj("v 0 0\n").message, "expected a number"));
+}
+
+Test(scene_parsing, mesh)
+{
+    FILE *file = fopen("scene_test_mesh.obj", "w");
+    cr_assert(not(eq(ptr, file, NULL)));
+    fputs("v -1 0 0\nv 1 0 0\nv 0 1 0\nf 1 2 3\n", file);
+    fclose(file);
+    const char *text = "material m 1 1 1 0.1 0.9 0.9 200\n"
+                       "mesh m scene_test_mesh.obj translate 0 0 5\n"
+                       "mesh m scene_test_mesh.obj scale 2 2 2\n";
+    Scene scene;
+    cr_assert(sceneParse(&scene, text, strlen(text), NULL));
+    cr_assert(eq(sz, scene.meshCount, 1));
+    cr_assert(eq(sz, scene.world.shapeCount, 2));
+    cr_expect(eq(int, scene.world.shapes[0].type, MESH));
+    cr_expect(eq(ptr, (void *)scene.world.shapes[0].mesh, scene.meshes[0]));
+    cr_expect(eq(ptr, (void *)scene.world.shapes[1].mesh, scene.meshes[0]));
+    const Intersection hit = intersectClosest(scene.world, ray(0, 0.5, -5, 0, 0, 1));
+    cr_expect(eq(ptr, (void *)hit.shape, &scene.world.shapes[1]));
+    cr_expect(epsilon_eq(dbl, hit.t, 5, EPSILON));
+    FILE *cache = tmpfile();
+    cr_assert(not(eq(ptr, cache, NULL)));
+    cr_expect(not(sceneCacheWrite(&scene, cache)));
+    fclose(cache);
+    sceneDestroy(&scene);
+    cr_expect(eq(sz, scene.meshCount, 0));
+    remove("scene_test_mesh.obj");
+    cr_expect(eq(str, (char *)parseInvalid("material m 1 1 1 0.1 0.9 0.9 200\nmesh m missing.obj").message, "could not open the mesh file"));
+}
+
+Test(scene_parsing, groups)
+{
+    const char *text = "light -10 10 -10 1 1 1\n"
+                       "material a 1 0.2 0.2 0.1 0.9 0.9 200\n"
+                       "group tree # placed below\n"
+                       "  sphere a translate 0 2 0\n"
+                       "  sphere a scale 0.2 1 0.2\n"
+                       "end\n"
+                       "instance tree translate -3 0 0\n"
+                       "instance tree translate 3 0 0 scale 2 2 2\n"
+                       "plane a translate 0 -1 0\n";
+    Scene scene;
+    SceneError error;
+    cr_assert(sceneParse(&scene, text, strlen(text), &error));
+    cr_expect(eq(sz, scene.groupCount, 1));
+    cr_expect(eq(sz, scene.world.shapeCount, 1));
+    cr_expect(eq(sz, scene.world.instanceCount, 2));
+    const Group *tree = scene.groups[0];
+    cr_expect(eq(sz, tree->shapeCount, 2));
+    cr_expect(not(eq(ptr, tree->bvh, NULL)));
+    cr_expect(eq(ptr, (void *)scene.world.instances[0].group, (void *)tree));
+    cr_expect(eq(ptr, (void *)scene.world.instances[1].group, (void *)tree));
+    const Intersection hit = intersectClosest(scene.world, ray(3, 4, -10, 0, 0, 1));
+    cr_expect(eq(ptr, (void *)hit.shape, &tree->shapes[0]));
+    cr_expect(eq(ptr, (void *)hit.instance, &scene.world.instances[1]));
+    cr_expect(epsilon_eq(dbl, hit.t, 8, EPSILON));
+    FILE *file = tmpfile();
+    cr_assert(not(eq(ptr, file, NULL)));
+    cr_expect(not(sceneCacheWrite(&scene, file)));
+    fclose(file);
+    sceneDestroy(&scene);
+    cr_expect(eq(sz, scene.groupCount, 0));
+    cr_expect(eq(sz, scene.world.instanceCount, 0));
+
+    cr_expect(eq(str, (char *)parseInvalid("group a\ngroup b\nend\nend").message, "nested group"));
+    cr_expect(eq(str, (char *)parseInvalid("end").message, "end outside of a group"));
+    cr_expect(eq(str, (char *)parseInvalid("group a\nend\ngroup a\nend").message, "duplicate group"));
+    cr_expect(eq(str, (char *)parseInvalid("group a\ninstance a").message, "instance inside a group"));
+    cr_expect(eq(str, (char *)parseInvalid("instance a translate 1 0 0").message, "unknown group"));
+    cr_expect(eq(str, (char *)parseInvalid("group a\nend\ninstance a scale 0 1 1").message, "singular transformation"));
+    const SceneError unterminated = parseInvalid("group a\n\n");
+    cr_expect(eq(str, (char *)unterminated.message, "group without an end"));
+}
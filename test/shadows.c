@@ -44,14 +44,13 @@ int main(void)
     left.material.specular = 0.3;
     Light mainLight = light(-10, 10, -10, 0.5, 0.5, 0.5);
     Light sideLight = light(10, 10, -10, 0.5, 0.5, 0.5);
-    World world = {2, 6, (Light[]){mainLight, sideLight}, (Shape[]){floor, leftWall, rightWall, middle, right, left}};
+    World world = {.lightCount = 2, .shapeCount = 6, .lights = (Light[]){mainLight, sideLight}, .shapes = (Shape[]){floor, leftWall, rightWall, middle, right, left}};
+    worldBuildArrays(&world);
     Camera camera = cameraInit(2000, 1000, M_PI / 3, viewTransform(point(0, 1.5, -5), point(0, 1, 0), vector(0, 1, 0)));
-    Canvas *image = render(camera, world);
-    char *imagePPM = canvasPPM(image);
+    Canvas *image = renderParallel(camera, world, 0);
+    worldDestroyArrays(&world);
+    canvasWritePPM(image, stdout, PPM_P6);
     free(image);
     image = NULL;
-    fputs(imagePPM, stdout);
-    free(imagePPM);
-    imagePPM = NULL;
     return 0;
 }
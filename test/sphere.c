@@ -31,27 +31,24 @@ int main(void)
             canvasPoint.x = canvasX + ((double)i / canvasWidth(canvas)) * canvasSize;
             canvasPoint.y = canvasY - ((double)j / canvasHeight(canvas)) * canvasSize;
             cameraRay.direction = vec4Sub(canvasPoint, cameraOrigin);
-            Intersections cameraIntersections = intersect(sphere, cameraRay);
+            Intersections cameraIntersections = intersect(&sphere, cameraRay);
             Intersection cameraHit = hit(cameraIntersections);
-            if (cameraHit.shape.type == SPHERE)
+            if (cameraHit.shape != NULL)
             {
                 canvasPixelWrite(canvas, i, j, sphereColor);
             }
             intersectionsDestroy(&cameraIntersections);
-            cameraIntersections = intersect(sphere2, cameraRay);
+            cameraIntersections = intersect(&sphere2, cameraRay);
             cameraHit = hit(cameraIntersections);
-            if (cameraHit.shape.type == SPHERE)
+            if (cameraHit.shape != NULL)
             {
                 canvasPixelWrite(canvas, i, j, sphere2Color);
             }
             intersectionsDestroy(&cameraIntersections);
         }
     }
-    char *ppmOutput = canvasPPM(canvas);
-    fputs(ppmOutput, stdout);
+    canvasWritePPM(canvas, stdout, PPM_P6);
     free(canvas);
     canvas = NULL;
-    free(ppmOutput);
-    ppmOutput = NULL;
     return 0;
 }
@@ -0,0 +1,60 @@
+/*
+ * tasks_test.c - Tests on the parallel task scheduler
+ *
+ * Copyright (c) 2023, Dimitrios Alexopoulos All rights reserved.
+ */
+
+#include <criterion/criterion.h>
+#include <criterion/new/assert.h>
+#include <stdatomic.h>
+#include <stdlib.h>
+
+#include "src/tasks.h"
+
+typedef struct
+{
+    atomic_size_t *runs;
+    size_t threadCount;
+    atomic_bool badWorker;
+} TaskCounter;
+
+void countTask(void *context, const size_t task, const size_t worker)
+{
+    TaskCounter *counter = context;
+    atomic_fetch_add(&counter->runs[task], 1);
+    if (worker >= counter->threadCount)
+    {
+        atomic_store(&counter->badWorker, true);
+    }
+}
+
+void runCounted(const size_t taskCount, const size_t threadCount)
+{
+    TaskCounter counter = {calloc(taskCount + 1, sizeof(atomic_size_t)), tasksThreadCount(threadCount), false};
+    cr_assert(not(eq(ptr, counter.runs, NULL)));
+    const size_t workers = tasksRun(taskCount, threadCount, countTask, &counter);
+    cr_expect(le(sz, workers, counter.threadCount));
+    cr_expect(not(atomic_load(&counter.badWorker)));
+    for (size_t i = 0; i < taskCount; i++)
+    {
+        cr_expect(eq(sz, atomic_load(&counter.runs[i]), 1));
+    }
+    free(counter.runs);
+}
+
+Test(task_operations, thread_count)
+{
+    cr_expect(eq(sz, tasksThreadCount(3), 3));
+    cr_expect(ge(sz, tasksThreadCount(0), 1));
+}
+
+Test(task_operations, run_once)
+{
+    runCounted(0, 4);
+    runCounted(1, 4);
+    runCounted(1000, 1);
+    runCounted(1000, 2);
+    runCounted(1000, 8);
+    runCounted(7, 16);
+    runCounted(10000, 0);
+}
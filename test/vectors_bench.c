@@ -0,0 +1,126 @@
+/*
+ * vectors_bench.c - Benchmarks of the vector and matrix kernels
+ *
+ * Copyright (c) 2023, Dimitrios Alexopoulos All rights reserved.
+ */
+
+#include <stdio.h>
+#include <time.h>
+
+#include "src/vectors.h"
+
+#define BENCH_COUNT 1024
+#define BENCH_REPEATS 10000
+
+static Vec4 vectors[BENCH_COUNT];
+static Mat4 matrices[BENCH_COUNT];
+
+// Returns the current time in seconds
+static double benchTime(void)
+{
+    struct timespec now;
+    timespec_get(&now, TIME_UTC);
+    return (double)now.tv_sec + (double)now.tv_nsec / 1e9;
+}
+
+// Prints the average time of one kernel call.
+// Info: `sink` is printed so the compiler cannot drop the benchmarked calls
+static void benchReport(const char *name, const double start, const size_t calls, const double sink)
+{
+    const double elapsed = benchTime() - start;
+    printf("%-12s %8.3f ns/op (%g)\n", name, elapsed * 1e9 / (double)calls, sink);
+}
+
+int main(void)
+{
+#ifdef VECTORS_SIMD
+    printf("Vector kernels: %s\n", VECTORS_SIMD);
+#else
+    printf("Vector kernels: scalar\n");
+#endif
+    for (size_t i = 0; i < BENCH_COUNT; i++)
+    {
+        const double r = (double)i / BENCH_COUNT;
+        vectors[i] = vector(r, 1 - r, r * r);
+        vectors[i].w = 1;
+        matrices[i] = mat4Mul(rotationY(r), mat4Mul(scaling(1 + r, 2, 1 - r / 2), translation(r, -r, 2 * r)));
+    }
+
+    double start = benchTime();
+    Vec4 sum = vector(0, 0, 0);
+    for (size_t repeat = 0; repeat < BENCH_REPEATS; repeat++)
+    {
+        for (size_t i = 0; i < BENCH_COUNT; i++)
+        {
+            sum = vec4Add(sum, vectors[i]);
+        }
+    }
+    benchReport("vec4Add", start, BENCH_COUNT * BENCH_REPEATS, sum.x);
+
+    start = benchTime();
+    double dot = 0;
+    for (size_t repeat = 0; repeat < BENCH_REPEATS; repeat++)
+    {
+        for (size_t i = 0; i < BENCH_COUNT; i++)
+        {
+            dot += vec4Dot(vectors[i], vectors[BENCH_COUNT - 1 - i]);
+        }
+    }
+    benchReport("vec4Dot", start, BENCH_COUNT * BENCH_REPEATS, dot);
+
+    start = benchTime();
+    sum = vector(0, 0, 0);
+    for (size_t repeat = 0; repeat < BENCH_REPEATS; repeat++)
+    {
+        for (size_t i = 0; i < BENCH_COUNT; i++)
+        {
+            sum = vec4Add(sum, vec4Norm(vectors[i]));
+        }
+    }
+    benchReport("vec4Norm", start, BENCH_COUNT * BENCH_REPEATS, sum.x);
+
+    start = benchTime();
+    sum = vector(0, 0, 0);
+    for (size_t repeat = 0; repeat < BENCH_REPEATS; repeat++)
+    {
+        for (size_t i = 0; i < BENCH_COUNT; i++)
+        {
+            sum = vec4Add(sum, mat4VecMul(matrices[i], vectors[i]));
+        }
+    }
+    benchReport("mat4VecMul", start, BENCH_COUNT * BENCH_REPEATS, sum.x);
+
+    start = benchTime();
+    Mat4 product = IDENTITY;
+    for (size_t repeat = 0; repeat < BENCH_REPEATS / 10; repeat++)
+    {
+        for (size_t i = 0; i < BENCH_COUNT; i++)
+        {
+            product = mat4Mul(matrices[i], matrices[BENCH_COUNT - 1 - i]);
+        }
+    }
+    benchReport("mat4Mul", start, BENCH_COUNT * (BENCH_REPEATS / 10), product.elem[0][0]);
+
+    start = benchTime();
+    Mat4 transposed = IDENTITY;
+    for (size_t repeat = 0; repeat < BENCH_REPEATS / 10; repeat++)
+    {
+        for (size_t i = 0; i < BENCH_COUNT; i++)
+        {
+            transposed = mat4Trans(matrices[i]);
+        }
+    }
+    benchReport("mat4Trans", start, BENCH_COUNT * (BENCH_REPEATS / 10), transposed.elem[0][1]);
+
+    start = benchTime();
+    Mat4 inverted = IDENTITY;
+    for (size_t repeat = 0; repeat < BENCH_REPEATS / 10; repeat++)
+    {
+        for (size_t i = 0; i < BENCH_COUNT; i++)
+        {
+            inverted = mat4Inv(matrices[i]);
+        }
+    }
+    benchReport("mat4Inv", start, BENCH_COUNT * (BENCH_REPEATS / 10), inverted.elem[0][1]);
+    return 0;
+}
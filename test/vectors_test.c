@@ -18,7 +18,7 @@
 
 #include "src/vectors.h"
 
-#define EPSILON 0.00001
+#define EPSILON MAT_EPSILON
 
 #define cr_expect_dbl(actual, expected) cr_expect(epsilon_eq(dbl, actual, expected, EPSILON))
 
@@ -444,6 +444,23 @@ Test(matrix_operations, matrix_invert)
     mat4EqExpect(mat4Inv(matC), matD);
     mat4EqExpect(mat4Inv(matE), matF);
     mat4EqExpect(mat4Mul(mat4Mul(matG, matH), mat4Inv(matH)), matG);
+    Mat4 inverted = IDENTITY;
+    cr_expect(mat4TryInv(&inverted, matE));
+    mat4EqExpect(inverted, matF);
+    const Mat4 singular = {{{-4, 2, -2, -3},
+                            {9, 6, 2, 6},
+                            {0, -5, 1, -5},
+                            {0, 0, 0, 0}}};
+    cr_expect(not(mat4TryInv(&inverted, singular)));
+    mat4EqExpect(inverted, matF);
+    cr_expect(not(mat4TryInv(&inverted, scaling(0, 1, 1))));
+    for (size_t row = 0; row < 4; row++)
+    {
+        for (size_t col = 0; col < 4; col++)
+        {
+            cr_expect_dbl(mat4Cof(row, col, matG) / mat4Det(matG), mat4Inv(matG).elem[col][row]);
+        }
+    }
 }
 
 Test(matrix_transformations, translation)
@@ -514,3 +531,37 @@ Test(matrix_transformations, view_transform)
                      {0, 0, 0, 1}}};
     mat4EqExpect(viewTransform(point(1, 3, 2), point(4, -2, 8), vector(1, 1, 0)), matView);
 }
+
+Test(affine_transformations, conversion)
+{
+    const Mat4 transform = mat4Mul(translation(1, -2, 3), mat4Mul(rotationY(0.5), shearing(1, 0, 0, 2, 0.5, 0)));
+    mat4EqExpect(affineToMat4(affineFromMat4(transform)), transform);
+    const Mat4 other = mat4Mul(scaling(2, 3, -1), rotationX(1.2));
+    mat4EqExpect(affineToMat4(affineMul(affineFromMat4(transform), affineFromMat4(other))), mat4Mul(transform, other));
+}
+
+Test(affine_transformations, inverse)
+{
+    const Mat4 transform = mat4Mul(translation(1, -2, 3), mat4Mul(rotationZ(-0.7), scaling(0.5, 4, 2)));
+    mat4EqExpect(affineToMat4(affineInv(affineFromMat4(transform))), mat4Inv(transform));
+    Affine inverted = affineFromMat4(IDENTITY);
+    cr_expect(not(affineTryInv(&inverted, affineFromMat4(scaling(1, 0, 1)))));
+    mat4EqExpect(affineToMat4(inverted), IDENTITY);
+    cr_expect(affineTryInv(&inverted, affineFromMat4(translation(5, -3, 2))));
+    cr_expect_point_eq(affinePointMul(inverted, point(-3, 4, 5)), -8, 7, 3);
+}
+
+Test(affine_transformations, multiply)
+{
+    const Mat4 transform = mat4Mul(translation(10, 5, 7), mat4Mul(scaling(5, 2, 5), rotationX(M_PI_2)));
+    const Affine affine = affineFromMat4(transform);
+    const Vec4 expectedPoint = mat4VecMul(transform, point(1, -2, 1));
+    cr_expect_point_eq(affinePointMul(affine, point(1, -2, 1)), expectedPoint.x, expectedPoint.y, expectedPoint.z);
+    const Vec4 expectedVector = mat4VecMul(transform, vector(1, -2, 1));
+    cr_expect_vector_eq(affineVecMul(affine, vector(1, -2, 1)), expectedVector.x, expectedVector.y, expectedVector.z);
+    const Vec4 expectedNormal = mat4VecMul(mat4Trans(mat4Inv(transform)), vector(0, 1, 0));
+    cr_expect_vector_eq(affineNormalMul(affineInv(affine), vector(0, 1, 0)), expectedNormal.x, expectedNormal.y, expectedNormal.z);
+    Vec4 normal = vector(0, 0, 0);
+    normal.xyz = mat3VecMul(affineNormalMatrix(affine), color(0, 1, 0));
+    cr_expect_vector_eq(normal, expectedNormal.x, expectedNormal.y, expectedNormal.z);
+}